@@ -1,6 +1,8 @@
 #include "l2cap_client.h"
 #include "l2cap_server.h"
 #include "hci_controller.h"
+#include "hci_scan_tuner.h"
+#include "hci_watchdog.h"
 #include "hci_socket.h"
 #include "matrice.h"
 #include "simulation_data.h"
@@ -32,6 +34,8 @@ static pthread_mutex_t mutexMatrice;
 
 char * mesures[NUM_CAPTORS] = {0};
 
+static volatile char scanning = 1;
+
 struct routine_data_t {
 	int16_t timeout;
 	hci_controller_t *hci_controller;
@@ -94,22 +98,61 @@ static void *get_rssi_thread_routine_mesures(void *data) {
 			*status = 1;
 		}
 	} else {
-		char * rssi_values;
-		rssi_values = hci_LE_get_RSSI(NULL, hci_controller, NULL, NULL, NUM_MEASURES, 0x00, SCAN_INTERVAL, SCAN_WINDOW, 0x00, 0x01);
-		fprintf(stderr, "%s\n", rssi_values);
-		if (rssi_values) {
-			memset(mesures[num_captor], 0, strlen(mesures[num_captor]));
-			strcpy(mesures[num_captor], rssi_values);
+		// The scan thread keeps feeding the sensor's ring, we only read its latest samples :
+		bt_rssi_sample_t samples[NUM_MEASURES];
+		uint16_t num_samples = bt_device_get_RSSI_samples(sensor.mac, samples, NUM_MEASURES);
+		if (num_samples) {
+			char *cursor = mesures[num_captor];
+			for (uint16_t k = 0; k < num_samples; k++) {
+				cursor += sprintf(cursor, "%i;", samples[k].rssi);
+			}
+			fprintf(stderr, "%s\n", mesures[num_captor]);
 		} else {
 			*status = 1;
 		}
-		free(rssi_values);
 	}
 	
 	
 	pthread_exit((void *)status);
 }
 
+static void *scan_thread_routine(void *data) {
+	hci_controller_t *hci_controller = (hci_controller_t *)data;
+	hci_scan_session_t session;
+	hci_report_batch_t batch;
+
+	if (hci_report_batch_init(&batch, NUM_MEASURES) < 0) {
+		pthread_exit(NULL);
+	}
+	if (hci_LE_start_scan_session(&session, hci_controller, 0x00, SCAN_INTERVAL, SCAN_WINDOW, 0x00, 0x01) < 0) {
+		hci_report_batch_destroy(&batch);
+		pthread_exit(NULL);
+	}
+	// A large reception queue absorbs the report bursts of a crowded environment :
+	set_hci_socket_receive_buffer(&(session.hci_socket), SCAN_RCVBUF);
+	/* SCAN_INTERVAL is only the starting point : the tuner adapts the duty cycle to get
+	   SCAN_TARGET_RATE reports per second from each of the (white-listed) devices.
+	*/
+	hci_scan_tuner_t tuner;
+	hci_scan_tuner_init(&tuner, &session, SCAN_TARGET_RATE, SCAN_TUNER_SLOT);
+	tuner.auto_track = 1;
+	// Reading the reports is enough to feed the RSSI rings of the devices :
+	while (scanning) {
+		hci_LE_scan_session_drain(&session, &batch, SCAN_TUNER_SLOT);
+		hci_scan_tuner_feed(&tuner, &batch);
+	}
+	hci_socket_stats_t stats;
+	if (get_hci_socket_stats(&(session.hci_socket), &stats) == 0 && stats.dropped) {
+		print_trace(TRACE_WARNING, "Ancre saturée : %llu évènement(s) perdu(s) sur %llu.\n",
+			    (unsigned long long)stats.dropped,
+			    (unsigned long long)(stats.events + stats.dropped));
+	}
+	hci_LE_stop_scan_session(&session);
+	hci_report_batch_destroy(&batch);
+
+	pthread_exit(NULL);
+}
+
 
 int main(int arc, char**argv) {
 
@@ -137,7 +180,8 @@ int main(int arc, char**argv) {
 	str2ba(server3Add, &server3Mac); 
 	str2ba(sensorAdd, &sensorMac);
 
-	hci_controller_t hci_controller = hci_open_controller(&controllerAdd, "MAIN_SERVER");
+	hci_controller_t hci_controller;
+	hci_controller_init(&hci_controller, NULL, NULL, &controllerAdd, "MAIN_SERVER");
 	sensor = bt_device_create(sensorMac, PUBLIC_DEVICE_ADDRESS, NULL, "SENSOR_TAG");
 	server1 = bt_device_create(server1Mac, PUBLIC_DEVICE_ADDRESS, NULL, "SERVER_1");
 	server2 = bt_device_create(server2Mac, PUBLIC_DEVICE_ADDRESS, NULL, "SERVER_2");
@@ -145,6 +189,15 @@ int main(int arc, char**argv) {
 
 	hci_LE_clear_white_list(NULL, &hci_controller);
 	hci_LE_add_white_list(NULL, &hci_controller, sensor);
+
+	// Surveillance de l'adaptateur (arrêté à la fermeture du contrôleur) : le scan est
+	// relancé, voire l'adaptateur réinitialisé, s'il ne reçoit plus rien.
+	hci_watchdog_t watchdog;
+	hci_watchdog_config_t watchdog_config = hci_watchdog_default_config();
+	watchdog_config.stall_time = SCAN_STALL_TIME;
+	if (hci_watchdog_start(&watchdog, &hci_controller, &watchdog_config) < 0) {
+		print_trace(TRACE_WARNING, "Impossible de surveiller l'adaptateur.\n");
+	}
 	
 	// Création des trois clients :
 	l2cap_client_t clients[NUM_CAPTORS-1] = {0};
@@ -166,6 +219,9 @@ int main(int arc, char**argv) {
 		return EXIT_FAILURE;
 	}
 
+	pthread_t scan_thread;
+	pthread_create(&scan_thread, NULL, &(scan_thread_routine), (void *)&hci_controller);
+
 	pthread_t clients_threads[NUM_CAPTORS];
 	struct routine_data_t routine_data[NUM_CAPTORS];
 	for (uint8_t k = 0; k < NUM_CAPTORS; k++) {
@@ -181,7 +237,7 @@ int main(int arc, char**argv) {
 		routine_data[k].matrice = matrice;
 	}
 
-	timeReference = time(NULL);
+	clock_gettime(CLOCK_REALTIME, &timeReference);
 
 	fprintf(stderr,"\n------------------------\n");
 	fprintf(stderr,"----Prise de mesures----\n");
@@ -222,6 +278,11 @@ int main(int arc, char**argv) {
 	l2cap_client_close(&clients[1]);
 	l2cap_client_close(&clients[2]);
 
+	scanning = 0;
+	// Réveil immédiat du thread de scan, sans attendre la fin de sa lecture :
+	hci_controller_cancel(&hci_controller);
+	pthread_join(scan_thread, NULL);
+
 	pthread_mutex_destroy(&mutexMatrice);
 
 	hci_close_controller(&hci_controller);
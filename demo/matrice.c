@@ -327,11 +327,13 @@ static double add_point(struct listPoints** list, struct Point point, int size)
 
 /**
  * Retourne le temps écoulé en ms depuis le lancement du main.
- * N'a pas de précision meilleure que la seconde.
- * Ne pas oublier d'initialiser timeReference au début du main avec time(NULL)
+ * Ne pas oublier d'initialiser timeReference au début du main avec
+ * clock_gettime(CLOCK_REALTIME, ...), l'horloge des timestamps des rapports.
  */
 static int get_time_in_ms() {
-    return (time(NULL) - timeReference)*1000;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (now.tv_sec - timeReference.tv_sec)*1000 + (now.tv_nsec - timeReference.tv_nsec)/1000000;
 }
 
 /**
@@ -2,11 +2,12 @@
 #define	MATRICE_H
 
 #include <stdint.h>
+#include <time.h>
 
 #define NB_CAPTEURS 4
 #define NB_MESURES 8
 
-int timeReference;
+struct timespec timeReference;
 
 /**
  * Ce que contient chaque case de la matrice.
@@ -53,7 +53,7 @@ int main(int arc, char**argv) {
 	str2ba(btControllerAdd, &controllerAdd); 
 	str2ba(sensorAdd, &sensorMac);
 
-	hci_controller = hci_open_controller(&controllerAdd, "SERVER_1");
+	hci_controller_init(&hci_controller, NULL, NULL, &controllerAdd, "SERVER_1");
 	sensor = bt_device_create(sensorMac, PUBLIC_DEVICE_ADDRESS, NULL, "SENSOR_TAG");
 
 	bt_device_display(hci_controller.device);
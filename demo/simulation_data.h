@@ -9,6 +9,10 @@
 
 #define SCAN_INTERVAL 0x40
 #define SCAN_WINDOW 0x10
+#define SCAN_TARGET_RATE 4.0
+#define SCAN_TUNER_SLOT 500
+#define SCAN_RCVBUF (1 << 20)
+#define SCAN_STALL_TIME 10000
 
 #define MEASURE_STEP 3
 
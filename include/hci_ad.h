@@ -0,0 +1,239 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+/**
+ * @file hci_ad.h
+ * @brief Module bluez_tools.hci.hci_ad decoding and classifying the advertising data
+ * of the reports.
+ *
+ * An advertising data is a sequence of AD structures (length, type, value). The
+ * iterator of this module goes through them without copying anything : each structure
+ * points into the data of the report, which therefore has to outlive it.
+ * A matcher holds a set of patterns (iBeacon proximity UUIDs, Eddystone namespaces,
+ * manufacturer specific data...), each one being a masked prefix of the value of an
+ * AD structure of a given type. It classifies the reports by their payload : only
+ * the patterns of the type of a structure are tested, and each test compares 32
+ * bytes at once with vector operations.
+ * {@code
+ * hci_ad_matcher_t matcher;
+ * hci_ad_matcher_init(&matcher);
+ * int16_t beacons = hci_ad_matcher_add_ibeacon(&matcher, proximity_uuid);
+ * ...
+ * int16_t classes[HCI_REPORT_DEFAULT_CAPACITY];
+ * hci_ad_matcher_classify(&matcher, &batch, classes); // classes[i] == beacons for our beacons
+ * }
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_AD_H__
+#define __HCI_AD_H__
+
+#include <stdint.h>
+#include "hci_report.h"
+
+/**
+ * AD types (cf Bluetooth Core Specification Supplement, part A).
+ */
+#define HCI_AD_FLAGS 0x01
+#define HCI_AD_INCOMPLETE_UUID16 0x02
+#define HCI_AD_COMPLETE_UUID16 0x03
+#define HCI_AD_INCOMPLETE_UUID128 0x06
+#define HCI_AD_COMPLETE_UUID128 0x07
+#define HCI_AD_SHORT_NAME 0x08
+#define HCI_AD_COMPLETE_NAME 0x09
+#define HCI_AD_TX_POWER 0x0A
+#define HCI_AD_SERVICE_DATA_UUID16 0x16
+#define HCI_AD_MANUFACTURER_DATA 0xFF
+
+/**
+ * Maximum length of a pattern (compared with the beginning of the value of a structure).
+ */
+#define HCI_AD_PATTERN_SIZE 32
+
+/**
+ * Maximum number of patterns of a matcher.
+ */
+#define HCI_AD_MATCHER_MAX_PATTERNS 64
+
+/**
+ * Class of the reports matching none of the patterns (@see hci_ad_matcher_classify).
+ */
+#define HCI_AD_NO_MATCH -1
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * AD structure, pointing into the advertising data.
+ */
+typedef struct hci_ad_structure_t {
+	/** AD type. */
+	uint8_t type;
+	/** Length of the value. */
+	uint8_t length;
+	/** Value of the structure (NULL if its length is 0). */
+	const uint8_t *value;
+} hci_ad_structure_t;
+
+/**
+ * Iterator over the AD structures of an advertising data.
+ *
+ * @see hci_ad_iterator_init
+ */
+typedef struct hci_ad_iterator_t {
+	/** Next byte to decode. */
+	const uint8_t *cursor;
+	/** First byte after the data. */
+	const uint8_t *end;
+} hci_ad_iterator_t;
+
+/**
+ * Pattern of a matcher : the first {@code length} bytes of the value of a structure
+ * of type {@code type} match the pattern if they are equal to {@code bytes} on the
+ * bits set in {@code mask}. The bytes beyond {@code length} are null in both.
+ */
+typedef struct hci_ad_pattern_t {
+	uint8_t bytes[HCI_AD_PATTERN_SIZE] __attribute__((aligned(16)));
+	uint8_t mask[HCI_AD_PATTERN_SIZE] __attribute__((aligned(16)));
+	uint8_t type;
+	uint8_t length;
+	/** Next pattern of the same type (in the order of addition), -1 if none. */
+	int8_t next;
+} hci_ad_pattern_t;
+
+/**
+ * Set of patterns.
+ */
+typedef struct hci_ad_matcher_t {
+	hci_ad_pattern_t patterns[HCI_AD_MATCHER_MAX_PATTERNS];
+	uint8_t nb_patterns;
+	/** First pattern of each AD type, -1 if none. */
+	int8_t first[256];
+	/** Last pattern of each AD type, to chain the new ones. */
+	int8_t last[256];
+} hci_ad_matcher_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Initializes an iterator over an advertising data.
+ * @param it iterator to initialize.
+ * @param data the advertising data (as the {@code data} field of a report).
+ * @param length length of the data.
+ */
+extern void hci_ad_iterator_init(hci_ad_iterator_t *it, const uint8_t *data, uint16_t length);
+
+/**
+ * @brief Decodes the next AD structure. The iteration ends at the end of the data,
+ * at a null length (the rest of the data is padding) or at a structure exceeding the data.
+ * @param it an initialized iterator.
+ * @param ad structure to fill.
+ * @return 1 if a structure has been decoded, 0 at the end of the data.
+ */
+extern char hci_ad_iterator_next(hci_ad_iterator_t *it, hci_ad_structure_t *ad);
+
+/**
+ * @brief Looks for the first AD structure of the given type.
+ * @param data the advertising data.
+ * @param length length of the data.
+ * @param type the AD type.
+ * @param ad structure to fill.
+ * @return 1 if the structure has been found, 0 otherwise.
+ */
+extern char hci_ad_find(const uint8_t *data, uint16_t length, uint8_t type, hci_ad_structure_t *ad);
+
+/**
+ * @brief Initializes an empty matcher.
+ * @param matcher the matcher.
+ */
+extern void hci_ad_matcher_init(hci_ad_matcher_t *matcher);
+
+/**
+ * @brief Adds a pattern to a matcher.
+ * @param matcher an initialized matcher.
+ * @param type AD type of the structures to compare with the pattern.
+ * @param bytes the expected bytes.
+ * @param mask (optional) bits of {@code bytes} to compare, all of them if NULL.
+ * @param length length of the pattern (at most {@code HCI_AD_PATTERN_SIZE}) : the
+ * shorter values don't match.
+ * @return the index of the pattern, a value < 0 if an error occured.
+ */
+extern int16_t hci_ad_matcher_add(hci_ad_matcher_t *matcher, uint8_t type, const uint8_t *bytes,
+				  const uint8_t *mask, uint8_t length);
+
+/**
+ * @brief Adds a pattern matching the iBeacon frames (manufacturer data 0x004C, type 0x02).
+ * @param matcher an initialized matcher.
+ * @param uuid (optional) proximity UUID (16 bytes, in the order of the frame), any if NULL.
+ * @return the index of the pattern, a value < 0 if an error occured.
+ */
+extern int16_t hci_ad_matcher_add_ibeacon(hci_ad_matcher_t *matcher, const uint8_t *uuid);
+
+/**
+ * @brief Adds a pattern matching the Eddystone frames (service data of UUID 0xFEAA).
+ * @param matcher an initialized matcher.
+ * @param frame_type Eddystone frame type (0x00 : UID, 0x10 : URL, 0x20 : TLM...).
+ * @param namespace_id (optional) namespace of the UID frames (10 bytes), any if NULL.
+ * @return the index of the pattern, a value < 0 if an error occured.
+ */
+extern int16_t hci_ad_matcher_add_eddystone(hci_ad_matcher_t *matcher, uint8_t frame_type,
+					    const uint8_t *namespace_id);
+
+/**
+ * @brief Adds a pattern matching the manufacturer specific data of a company.
+ * @param matcher an initialized matcher.
+ * @param company_id identifier of the company.
+ * @param data (optional) data expected after the identifier.
+ * @param length length of {@code data}.
+ * @return the index of the pattern, a value < 0 if an error occured.
+ */
+extern int16_t hci_ad_matcher_add_manufacturer(hci_ad_matcher_t *matcher, uint16_t company_id,
+					       const uint8_t *data, uint8_t length);
+
+/**
+ * @brief Looks for the first pattern matched by an advertising data (in the order of
+ * its structures, then in the order of addition of the patterns).
+ * @param matcher an initialized matcher.
+ * @param data the advertising data.
+ * @param length length of the data.
+ * @return the index of the pattern, {@code HCI_AD_NO_MATCH} if none.
+ */
+extern int16_t hci_ad_matcher_match(const hci_ad_matcher_t *matcher, const uint8_t *data, uint16_t length);
+
+/**
+ * @brief Classifies the reports of a batch by their advertising data.
+ * @param matcher an initialized matcher.
+ * @param batch the batch.
+ * @param classes table of (at least) {@code batch->length} elements receiving the index
+ * of the pattern matched by each report, {@code HCI_AD_NO_MATCH} if none.
+ * @return the number of reports matching a pattern.
+ */
+extern uint16_t hci_ad_matcher_classify(const hci_ad_matcher_t *matcher, const hci_report_batch_t *batch,
+					int16_t *classes);
+
+#endif // __HCI_AD_H__
@@ -0,0 +1,399 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+/**
+ * @file hci_conn_manager.h
+ * @brief Module bluez_tools.hci.hci_conn_manager maintaining LE connections with several
+ * peripherals at once and measuring their RSSI.
+ *
+ * The RSSI of the advertising reports is noisy and only measured once per advertising
+ * interval. The RSSI of an established connection is measured by the adapter on each
+ * connection event, and read with the HCI "Read RSSI" command. A connection manager
+ * connects to the devices it is given (one "LE Create Connection" at a time, as the
+ * adapters can't create several), reconnects them when their links are lost, and reads
+ * the RSSI of all its links every {@code rssi_period} ms : the "Read RSSI" commands of a
+ * round are pipelined through a command queue (@see hci_cmd_queue.h). The measures are
+ * read as reports ({@code HCI_REPORT_CONNECTION_EVT_TYPE}), in the batches used by the
+ * scans (@see hci_report_batch_add), and feed the RSSI rings of the devices :
+ * {@code
+ * hci_conn_manager_t manager;
+ * hci_conn_manager_start(&manager, &hci_controller, NULL);
+ * for (...) {
+ *	hci_conn_manager_add(&manager, &devices[i]);
+ * }
+ * while (...) {
+ *	int16_t n = hci_conn_manager_read(&manager, &batch, 1000);
+ *	...
+ * }
+ * hci_conn_manager_stop(&manager);
+ * }
+ * The manager works on sockets of its own, from a background thread, without taking
+ * the controller : it runs along with the scans. As its socket receives all the "LE Meta"
+ * events, the advertising reports of a concurrent scan are also read (and ignored) by
+ * its thread. A controller can have only one manager, which is stopped when the
+ * controller is closed.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_CONN_MANAGER_H__
+#define __HCI_CONN_MANAGER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include "hci_controller.h"
+#include "hci_cmd_queue.h"
+#include "hci_report.h"
+#include "bt_device.h"
+
+/**
+ * Default scan interval and window (in units of 0.625 ms) used to find the devices
+ * to connect to.
+ */
+#define HCI_CONN_MANAGER_DEFAULT_SCAN_INTERVAL 0x0060
+#define HCI_CONN_MANAGER_DEFAULT_SCAN_WINDOW 0x0030
+
+/**
+ * Default connection parameters : 30 to 50 ms connection interval (in units of 1.25 ms),
+ * no slave latency and 5 s supervision timeout (in units of 10 ms).
+ */
+#define HCI_CONN_MANAGER_DEFAULT_MIN_INTERVAL 0x0018
+#define HCI_CONN_MANAGER_DEFAULT_MAX_INTERVAL 0x0028
+#define HCI_CONN_MANAGER_DEFAULT_LATENCY 0x0000
+#define HCI_CONN_MANAGER_DEFAULT_SUPERVISION_TIMEOUT 0x01F4
+
+/**
+ * Default time (in ms) given to a connection attempt before it is cancelled.
+ */
+#define HCI_CONN_MANAGER_DEFAULT_CONNECT_TIMEOUT 5000
+
+/**
+ * Default time (in ms) to wait before connecting again a lost or failed link.
+ */
+#define HCI_CONN_MANAGER_DEFAULT_RETRY_DELAY 1000
+
+/**
+ * Default time (in ms) between two RSSI rounds.
+ */
+#define HCI_CONN_MANAGER_DEFAULT_RSSI_PERIOD 100
+
+/**
+ * Default maximum number of links of a manager.
+ */
+#define HCI_CONN_MANAGER_DEFAULT_MAX_LINKS 8
+
+/**
+ * Default number of measures kept until they are read.
+ */
+#define HCI_CONN_MANAGER_DEFAULT_QUEUE_SIZE 1024
+
+/**
+ * Maximum time (in ms) the manager's thread sleeps before checking its links.
+ */
+#define HCI_CONN_MANAGER_POLL_PERIOD 100
+
+/**
+ * States of a link.
+ */
+typedef enum hci_conn_state_t {
+	HCI_CONN_STATE_FREE = 0, // Unused entry
+	HCI_CONN_STATE_IDLE = 1, // Not connected, waiting for its (next) connection attempt
+	HCI_CONN_STATE_CONNECTING = 2,
+	HCI_CONN_STATE_CONNECTED = 3,
+	HCI_CONN_STATE_DISCONNECTING = 4
+} hci_conn_state_t;
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Configuration of a connection manager.
+ */
+typedef struct hci_conn_manager_config_t {
+	/**
+	 * Scan used to find the devices to connect to (@see le_create_connection_cp).
+	 */
+	uint16_t scan_interval;
+	uint16_t scan_window;
+	uint8_t own_add_type;
+	/**
+	 * Connection parameters (@see hci_conn_manager_set_parameters).
+	 */
+	uint16_t min_interval;
+	uint16_t max_interval;
+	uint16_t latency;
+	uint16_t supervision_timeout;
+	/**
+	 * Time (in ms) given to a connection attempt before it is cancelled.
+	 */
+	uint32_t connect_timeout;
+	/**
+	 * Time (in ms) to wait before connecting again a lost or failed link.
+	 */
+	uint32_t retry_delay;
+	/**
+	 * Time (in ms) between two RSSI rounds.
+	 */
+	uint32_t rssi_period;
+	/**
+	 * Maximum number of links.
+	 */
+	uint16_t max_links;
+	/**
+	 * Number of measures kept until they are read : once full, the oldest ones are dropped.
+	 */
+	uint16_t queue_size;
+} hci_conn_manager_config_t;
+
+/**
+ * Link maintained with a device.
+ */
+typedef struct hci_conn_link_t {
+	/**
+	 * Connected device.
+	 */
+	bt_address_t mac;
+	uint8_t add_type;
+	/**
+	 * State of the link and handle of its connection (when connected).
+	 */
+	hci_conn_state_t state;
+	uint16_t handle;
+	/**
+	 * Current connection parameters, given by the adapter.
+	 */
+	uint16_t interval;
+	uint16_t latency;
+	uint16_t supervision_timeout;
+	/**
+	 * Last measured RSSI, {@code HCI_REPORT_RSSI_UNAVAILABLE} if none.
+	 */
+	int8_t rssi;
+	/**
+	 * Number of consecutive failed connection attempts.
+	 */
+	uint32_t failures;
+	/**
+	 * Time (CLOCK_MONOTONIC, in ms) of the next connection attempt, or at which the
+	 * current one is cancelled.
+	 */
+	uint64_t next_attempt;
+	/**
+	 * Indicates whether the current attempt has been cancelled, whether the link has
+	 * been removed (it is freed once disconnected), and whether its connection
+	 * parameters have to be updated.
+	 */
+	char cancelled;
+	char removed;
+	char update;
+} hci_conn_link_t;
+
+/**
+ * Statistics of a connection manager.
+ */
+typedef struct hci_conn_manager_stats_t {
+	/**
+	 * Number of connection attempts, established connections and failed attempts.
+	 */
+	uint64_t attempts;
+	uint64_t connections;
+	uint64_t failures;
+	/**
+	 * Number of terminated connections (lost or removed).
+	 */
+	uint64_t disconnections;
+	/**
+	 * Number of RSSI rounds, of read RSSI values and of failed "Read RSSI" commands.
+	 */
+	uint64_t rounds;
+	uint64_t rssi_reads;
+	uint64_t rssi_errors;
+	/**
+	 * Number of measures dropped because they weren't read in time.
+	 */
+	uint64_t dropped;
+	/**
+	 * Number of currently established connections.
+	 */
+	uint16_t connected;
+} hci_conn_manager_stats_t;
+
+/**
+ * Connection manager.
+ */
+typedef struct hci_conn_manager_t {
+	/**
+	 * Controller whose adapter holds the connections.
+	 */
+	hci_controller_t *hci_controller;
+	/**
+	 * Configuration of the manager.
+	 */
+	hci_conn_manager_config_t config;
+	/**
+	 * Queue through which the commands are sent.
+	 */
+	hci_cmd_queue_t queue;
+	/**
+	 * Socket receiving the connection events.
+	 */
+	hci_socket_t hci_socket;
+	/**
+	 * Event file descriptor waking the manager's thread up.
+	 */
+	int wakeup_fd;
+	/**
+	 * Thread maintaining the links.
+	 */
+	pthread_t thread;
+	volatile char running;
+	/**
+	 * Mutex protecting the links, the measures and the statistics, and condition
+	 * signaled when new measures are available.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/**
+	 * Links ({@code max_links} entries). The entries are only freed by the manager's thread.
+	 */
+	hci_conn_link_t *links;
+	/**
+	 * Link being connected, -1 if none, and next link to try (round robin).
+	 */
+	int32_t connecting;
+	uint16_t next_link;
+	/**
+	 * "Read RSSI" commands of a round (one per link) and time (CLOCK_MONOTONIC, in ms)
+	 * of the next round.
+	 */
+	hci_cmd_t *cmds;
+	uint64_t next_round;
+	/**
+	 * Measures not read yet (circular buffer of {@code queue_size} entries).
+	 */
+	hci_report_t *measures;
+	uint16_t measures_head;
+	uint16_t measures_length;
+	/**
+	 * Statistics.
+	 */
+	hci_conn_manager_stats_t stats;
+} hci_conn_manager_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Returns the default configuration of a connection manager (8 links, 30 to 50 ms
+ * connection interval, RSSI read every 100 ms, attempts cancelled after 5 s and retried
+ * after 1 s).
+ * @return the default configuration.
+ */
+extern hci_conn_manager_config_t hci_conn_manager_default_config(void);
+
+/**
+ * @brief Starts a connection manager on a controller, which can have only one.
+ * @param manager the manager to start.
+ * @param hci_controller an opened controller.
+ * @param config configuration of the manager, NULL for the default one.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_conn_manager_start(hci_conn_manager_t *manager, hci_controller_t *hci_controller,
+				     const hci_conn_manager_config_t *config);
+
+/**
+ * @brief Adds a device to the ones a manager connects to. The device is registered
+ * (@see bt_register_device) so that its RSSI ring is fed with the measures.
+ * @param manager a started manager.
+ * @param bt_device the device (its address type tells how to connect to it).
+ * @return 0 on success, a value < 0 if the device is already managed or if the manager
+ * has no free link.
+ */
+extern int8_t hci_conn_manager_add(hci_conn_manager_t *manager, const bt_device_t *bt_device);
+
+/**
+ * @brief Removes a device from a manager : its connection is terminated (or its attempt
+ * cancelled) and its link is freed afterwards.
+ * @param manager a started manager.
+ * @param mac address of the device.
+ * @return 0 on success, a value < 0 if the device isn't managed.
+ */
+extern int8_t hci_conn_manager_remove(hci_conn_manager_t *manager, const bt_address_t *mac);
+
+/**
+ * @brief Changes the connection parameters of a manager : they are used by the next
+ * connections, and the established ones are updated ("LE Connection Update").
+ * @param manager a started manager.
+ * @param min_interval minimum connection interval (in units of 1.25 ms, 0x0006 to 0x0C80).
+ * @param max_interval maximum connection interval (same unit, at least {@code min_interval}).
+ * @param latency slave latency (in connection events, at most 0x01F3).
+ * @param supervision_timeout supervision timeout (in units of 10 ms, 0x000A to 0x0C80).
+ * @return 0 on success, a value < 0 if the parameters are invalid.
+ */
+extern int8_t hci_conn_manager_set_parameters(hci_conn_manager_t *manager, uint16_t min_interval,
+					      uint16_t max_interval, uint16_t latency,
+					      uint16_t supervision_timeout);
+
+/**
+ * @brief Retrieves the state of the link of a device.
+ * @param manager a started manager.
+ * @param mac address of the device.
+ * @param link reference on the structure receiving the link.
+ * @return 0 on success, a value < 0 if the device isn't managed.
+ */
+extern int8_t hci_conn_manager_get_link(hci_conn_manager_t *manager, const bt_address_t *mac,
+					hci_conn_link_t *link);
+
+/**
+ * @brief Retrieves the RSSI measured on the links since the previous call, as reports
+ * ({@code HCI_REPORT_CONNECTION_EVT_TYPE}, no data). Waits up to {@code timeout} ms for
+ * a first measure, then stops when the batch is full or when no measure is left. The
+ * reports go through the white list and the deduplicator of the batch, and their RSSI
+ * are appended to the rings of the registered devices (@see bt_device_get_RSSI_samples).
+ * @param manager a started manager.
+ * @param batch initialized batch receiving the reports. Its previous content is discarded.
+ * @param timeout maximum time (in ms) to wait for a measure.
+ * @return the number of reports stored in the batch, a value < 0 if an error occured.
+ */
+extern int16_t hci_conn_manager_read(hci_conn_manager_t *manager, hci_report_batch_t *batch, int16_t timeout);
+
+/**
+ * @brief Retrieves the statistics of a manager.
+ * @param manager a started manager.
+ * @param stats reference on the structure receiving the statistics.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_conn_manager_get_stats(hci_conn_manager_t *manager, hci_conn_manager_stats_t *stats);
+
+/**
+ * @brief Stops a manager : its connections are terminated (the attempt in progress is
+ * cancelled) and its thread is stopped.
+ * @param manager a started manager.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_conn_manager_stop(hci_conn_manager_t *manager);
+
+#endif // __HCI_CONN_MANAGER_H__
@@ -41,16 +41,61 @@
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
+#include <pthread.h>
 #include "hci_socket.h"
+#include "hci_socket_pool.h"
+#include "hci_transport.h"
 #include "hci_utils.h"
+#include "hci_report.h"
 #include "bt_device.h"
 #include "list.h"
+#include "reactor.h"
+
+/**
+ * Number of sockets of the pool of a controller (@see hci_socket_pool.h).
+ */
+#define HCI_CONTROLLER_SOCKET_POOL_SIZE 4
 
 /**
  * Default timeout used to communicate with the adapter using HCI.
 */
 #define HCI_CONTROLLER_DEFAULT_TIMEOUT 3000
 
+/**
+ * Default time to wait for an advertising report while scanning.
+*/
+#define HCI_SCAN_SESSION_DEFAULT_TIMEOUT 5000
+
+/**
+ * Inquiry modes (@see hci_start_periodic_inquiry_session) : standard inquiry results,
+ * inquiry results with RSSI, and inquiry results with RSSI or extended inquiry results.
+ * The mode of a controller is {@code HCI_INQUIRY_MODE_UNKNOWN} until it is written.
+ */
+#define HCI_INQUIRY_MODE_STANDARD 0x00
+#define HCI_INQUIRY_MODE_RSSI 0x01
+#define HCI_INQUIRY_MODE_EXTENDED 0x02
+#define HCI_INQUIRY_MODE_UNKNOWN 0xFF
+
+/**
+ * Capabilities of the adapter held by the cache of a controller
+ * (@see hci_controller_caps_t) : a capability is only known once it has been read.
+ */
+#define HCI_CAPS_VERSION 0x01
+#define HCI_CAPS_COMMANDS 0x02
+#define HCI_CAPS_BUFFER_SIZE 0x04
+#define HCI_CAPS_LE_BUFFER_SIZE 0x08
+#define HCI_CAPS_LE_FEATURES 0x10
+#define HCI_CAPS_LE_STATES 0x20
+#define HCI_CAPS_WHITE_LIST_SIZE 0x40
+
+/**
+ * Bits of the LE features mask (@see hci_controller_has_LE_feature).
+ */
+#define HCI_LE_FEATURE_ENCRYPTION 0
+#define HCI_LE_FEATURE_2M_PHY 8
+#define HCI_LE_FEATURE_CODED_PHY 11
+#define HCI_LE_FEATURE_EXT_ADVERTISING 12
+
 /**
  * @brief Possible states of the hci_controller.
  * The hci_controller is a state machine.
@@ -68,10 +113,77 @@ typedef enum {
 	HCI_STATE_SCANNING = 2,
 	HCI_STATE_ADVERTISING = 3,
 	HCI_STATE_READING = 4,
-	HCI_STATE_WRITING = 5} hci_state_t;
+	HCI_STATE_WRITING = 5,
+	HCI_STATE_RECOVERING = 6 // The adapter is being recovered by a watchdog (@see hci_watchdog.h).
+} hci_state_t;
+
+/**
+ * @brief Capabilities of an adapter, read once when its controller is opened so that
+ * checking them doesn't cost any command round trip.
+ * The LE ones are not known for the adapters which don't support LE.
+ *
+ * @see hci_controller_refresh_caps
+ */
+typedef struct hci_controller_caps_t {
+	/**
+	 * Capabilities which could be read (combination of {@code HCI_CAPS_...}), the others
+	 * are left to 0.
+	 */
+	uint8_t known;
+	/**
+	 * Version information (@see read_local_version_rp).
+	 */
+	uint8_t hci_ver;
+	uint16_t hci_rev;
+	uint8_t lmp_ver;
+	uint16_t manufacturer;
+	uint16_t lmp_subver;
+	/**
+	 * Supported commands bitmap, as returned by the adapter
+	 * (@see hci_controller_supports_command).
+	 */
+	uint8_t commands[64];
+	/**
+	 * BR/EDR data buffers (@see read_buffer_size_rp).
+	 */
+	uint16_t acl_mtu;
+	uint8_t sco_mtu;
+	uint16_t acl_max_pkt;
+	uint16_t sco_max_pkt;
+	/**
+	 * LE data buffers (@see le_read_buffer_size_rp). A null length means that the
+	 * LE data share the BR/EDR buffers.
+	 */
+	uint16_t le_mtu;
+	uint8_t le_max_pkt;
+	/**
+	 * LE features mask, decoded from its little endian representation
+	 * (@see hci_controller_has_LE_feature).
+	 */
+	uint64_t le_features;
+	/**
+	 * Supported LE states mask (@see hci_display_LE_supported_states).
+	 */
+	uint64_t le_states;
+	/**
+	 * Number of entries of the white list of the adapter.
+	 */
+	uint8_t white_list_size;
+} hci_controller_caps_t;
+
+struct hci_name_resolver_t;
+struct hci_white_list_t;
+struct hci_watchdog_t;
+struct hci_conn_manager_t;
+struct hci_scan_session_t;
+struct hci_dedup_t;
+struct hci_cmd_t;
+struct hci_bpf_program_t;
 
 /**
  * hci_controller structure : 
+ * A controller embeds its own lock, so it must not be copied once it is used
+ * (always share it through pointers).
 */
 typedef struct hci_controller_t {
 	/**
@@ -84,8 +196,27 @@ typedef struct hci_controller_t {
 	list_t *sockets_list;
 	/**
 	 * Current state of the controller.
+	 * It is only modified with atomic compare-and-swap operations : a thread
+	 * "owns" the controller from the moment it moves it out of the
+	 * {@code HCI_STATE_OPEN} state until it moves it back into it.
 	 */
 	hci_state_t state;
+	/**
+	 * Number of state changes so far (atomically incremented) : a state which doesn't
+	 * change for a long time tells a stuck controller from a busy one.
+	 */
+	uint32_t state_changes;
+	/**
+	 * Lock protecting the sockets list and the reactor registration of the
+	 * controller, as well as the resolution of its interruptions and its
+	 * cancellations.
+	 */
+	pthread_mutex_t lock;
+	/**
+	 * Pre-opened sockets used by the functions of this module when they
+	 * are not given any socket.
+	 */
+	hci_socket_pool_t socket_pool;
 	/**
 	 * Error indicator : if an error occured during a request,
 	 * the adapter could be stuck in a bad state. By putting
@@ -98,24 +229,193 @@ typedef struct hci_controller_t {
 	 * @see hci_resolve_interruption
 	 */
 	char interrupted;  
+	/**
+	 * Transport used by all the sockets opened on this adapter.
+	 */
+	const hci_transport_t *transport;
+	/**
+	 * Private data given to the transport when a socket is opened.
+	 */
+	void *transport_data;
+	/**
+	 * Reactor in which the sockets of the controller are registered, NULL if none.
+	 *
+	 * @see hci_controller_add_to_reactor
+	 */
+	reactor_t *reactor;
+	/**
+	 * Callback the sockets are registered with in the reactor.
+	 */
+	reactor_callback_t reactor_callback;
+	/**
+	 * User data the sockets are registered with in the reactor.
+	 */
+	void *reactor_user_data;
+	/**
+	 * Resolver providing the names of the discovered devices, NULL if none
+	 * (the names are then asked synchronously).
+	 *
+	 * @see hci_name_resolver_start
+	 */
+	struct hci_name_resolver_t *name_resolver;
+	/**
+	 * Deduplicator used by {@code hci_get_RSSI} and {@code hci_LE_get_RSSI}, NULL if
+	 * none (every report is then returned). It is set by the user, who keeps its
+	 * ownership. As these functions reserve the controller, it is never used by two
+	 * threads at a time.
+	 *
+	 * @see hci_dedup_accept
+	 */
+	struct hci_dedup_t *dedup;
+	/**
+	 * Inquiry mode last written to the adapter. The mode is kept by the adapter : it is
+	 * only written again when an inquiry needs another one.
+	 */
+	uint8_t inquiry_mode;
+	/**
+	 * eventfd polled along with the socket while the reports are collected, written
+	 * to wake the collections up (@see hci_controller_cancel). -1 if it could not be
+	 * created, the collections then can't be cancelled.
+	 */
+	int cancel_fd;
+	/**
+	 * Number of cancellations requested so far : a collection is cancelled if it
+	 * changed since the collection began. Protected by {@code lock}.
+	 */
+	uint32_t cancel_generation;
+	/**
+	 * Number of collections currently polling {@code cancel_fd}. Protected by {@code lock}.
+	 */
+	uint16_t cancel_waiters;
+	/**
+	 * Absolute time (CLOCK_MONOTONIC, in ns) at which the collections of reports end,
+	 * zero for none (@see hci_controller_set_deadline). Accessed atomically.
+	 */
+	volatile uint64_t deadline;
+	/**
+	 * Scan session currently scanning with the controller, NULL if none. Protected by
+	 * {@code lock}.
+	 */
+	struct hci_scan_session_t *scan_session;
+	/**
+	 * White list manager of the controller, NULL if none (@see hci_white_list_init).
+	 * Protected by {@code lock}.
+	 */
+	struct hci_white_list_t *white_list;
+	/**
+	 * Watchdog recovering the adapter, NULL if none (@see hci_watchdog_start).
+	 */
+	struct hci_watchdog_t *watchdog;
+	/**
+	 * Indicates whether the watchdog is restoring the scan session and the white list
+	 * of the controller without holding {@code lock} : they are only unregistered once
+	 * it is done, which {@code restored} signals. Protected by {@code lock}.
+	 */
+	char restoring;
+	pthread_cond_t restored;
+	/**
+	 * Connection manager of the controller, NULL if none (@see hci_conn_manager_start).
+	 * Protected by {@code lock}.
+	 */
+	struct hci_conn_manager_t *conn_manager;
+	/**
+	 * Capabilities of the adapter, read when the controller is opened. They are only
+	 * written again by {@code hci_controller_refresh_caps}.
+	 */
+	hci_controller_caps_t caps;
 } hci_controller_t;
+
+/**
+ * @brief Long-lived LE scan session.
+ * A scan session keeps the controller in the {@code HCI_STATE_SCANNING} state
+ * between its start and its explicit stop. The reports are read from a
+ * socket dedicated to the session, so that the ones arriving between two
+ * reads are queued by the kernel instead of being lost.
+ *
+ * @see hci_LE_start_scan_session
+ */
+typedef struct hci_scan_session_t {
+	/**
+	 * Controller performing the scan, NULL if the session is not active.
+	 */
+	hci_controller_t *hci_controller;
+	/**
+	 * Socket on which the advertising reports are received.
+	 */
+	hci_socket_t hci_socket;
+	/**
+	 * Indicates whether the session is currently scanning (1) or not (0).
+	 */
+	char active;
+	/**
+	 * Indicates whether the session scans with the extended commands (1) or not (0).
+	 */
+	char extended;
+	/**
+	 * Indicates whether the session is a periodic classic inquiry (1) or an LE scan (0).
+	 */
+	char classic;
+	/**
+	 * Indicates whether a BPF program is attached to the socket of the session (1) or not
+	 * (0) (@see hci_LE_start_filtered_scan_session).
+	 */
+	char filtered;
+	/**
+	 * Current scan parameters (@see hci_le_set_scan_parameters). The scanning PHYs
+	 * are 0 for the sessions using the legacy commands.
+	 */
+	uint8_t scan_phys;
+	uint8_t scan_type;
+	uint16_t scan_interval;
+	uint16_t scan_window;
+	uint8_t own_add_type;
+	uint8_t scan_filter_policy;
+	/**
+	 * Parameters of the periodic inquiry of the classic sessions
+	 * (@see hci_start_periodic_inquiry_session).
+	 */
+	uint16_t min_period;
+	uint16_t max_period;
+	uint8_t duration;
+	uint8_t max_rsp;
+} hci_scan_session_t;
 	
-/** 
- * @brief Creates a new hci_controller instance using  the adapter 
- * given by the {@code mac} reference.
- * If this reference is NULL, we take the first available adapter in
- * the system.
- * The field {@code name} is used to describe in an user-friendly way the adapter.
- * If NULL then the name of the adapter will be "UNKNOWN".
- * @param mac address of the adapter to use.
- * @param name user-friendly name used to describe the adapter.
- * @return the newly created instance of the adapter's hci_controller.
-*/
-extern hci_controller_t hci_open_controller(bt_address_t *mac, char *name);
+/**
+ * @brief Opens a controller in place, using the adapter given by the {@code mac}
+ * reference (the first available adapter in the system if NULL), whose sockets are
+ * opened through the given transport (for instance the simulated controller of the
+ * {@code hci_sim} module).
+ * The capabilities of the adapter are read once at that time (@see hci_controller_caps_t).
+ * The controller embeds its lock and the list of its sockets : it must not be copied
+ * nor moved once opened, but only used through its reference.
+ * {@code
+ * hci_controller_t hci_controller;
+ * if (hci_controller_init(&hci_controller, NULL, NULL, NULL, "MAIN") < 0) {
+ *	...
+ * }
+ * }
+ * @param hci_controller reference on the controller to open.
+ * @param transport transport to use, NULL for the default (BlueZ) one.
+ * @param transport_data private data of the transport.
+ * @param mac address of the adapter to use, NULL for the first available one.
+ * @param name user-friendly name used to describe the adapter, "UNKNOWN" if NULL.
+ * @return 0 upon success, < 0 if the adapter couldn't be opened (the controller is then
+ * in the {@code HCI_STATE_CLOSED} state).
+ */
+extern int8_t hci_controller_init(hci_controller_t *hci_controller, const hci_transport_t *transport,
+				  void *transport_data, bt_address_t *mac, char *name);
 
 /**
  * @brief Tries to resolve a past interruption of a controller in order to put it
  * in the default state to be able to use it properly again.
+ * A scanning controller has its scan disabled, unless a scan session is registered on
+ * it : the scan of the session is then restored (@see hci_LE_scan_session_restore) and
+ * the controller stays in the {@code HCI_STATE_SCANNING} state. An advertising one has
+ * its advertising disabled, and a controller interrupted while reading or writing is
+ * simply put back in the default state.
+ * The lock of the controller isn't held while the commands are sent : the result is
+ * committed from the state found when the function was called, and a concurrent call
+ * waits for the first one to finish.
  * The field {@code hci_socket} must refers to either NULL, so a new socket is opened
  * on the given controller, or a valid opened socket on the given controller.
  * The field {@code hci_controller} has to be a valid reference on an opened 
@@ -127,6 +427,47 @@ extern hci_controller_t hci_open_controller(bt_address_t *mac, char *name);
 */
 extern int8_t hci_resolve_interruption(hci_socket_t *hci_socket, hci_controller_t *hci_controller);
 
+/**
+ * @brief Atomically moves the controller from the {@code from} state to the {@code to}
+ * state. Moving a controller out of {@code HCI_STATE_OPEN} thus both checks that it is
+ * idle and reserves it. This is meant for the modules driving the controller (the
+ * watchdog for instance), the other functions change its state by themselves.
+ * @param hci_controller the controller.
+ * @param from expected current state.
+ * @param to new state.
+ * @return 0 on success, -1 (leaving the state untouched) if the controller wasn't
+ * in the {@code from} state.
+ */
+extern int8_t hci_change_state(hci_controller_t *hci_controller, hci_state_t from, hci_state_t to);
+
+/**
+ * @brief Disables whatever the adapter may be scanning with : LE scan (legacy or
+ * extended) and periodic inquiry. The commands refused by the adapter (for instance
+ * because it wasn't doing this kind of scan) are ignored. The state of the controller is
+ * left untouched : this function is meant to recover an adapter whose state is unknown.
+ * @param hci_socket a reference on either a valid opened socket on the controller
+ * or NULL. In the later case, a new one is opened.
+ * @param hci_controller a valid reference on a hci_controller.
+ * @param timeout maximum time (in ms) to wait for each answer.
+ * @return 0 if the adapter answered all the commands, a value < 0 otherwise.
+ */
+extern int8_t hci_force_scan_disable(hci_socket_t *hci_socket, hci_controller_t *hci_controller, int timeout);
+
+/**
+ * @brief Resets the adapter (HCI "Reset" command) and sets its event masks back, so
+ * that the LE advertising reports and the extended inquiry results are reported again.
+ * The whole configuration of the adapter is lost : the white list managers and the
+ * scan sessions have to be restored afterwards (@see hci_white_list_restore and
+ * {@code hci_LE_scan_session_restore}). The state of the controller is left untouched,
+ * the caller has to own the controller.
+ * @param hci_socket a reference on either a valid opened socket on the controller
+ * or NULL. In the later case, a new one is opened.
+ * @param hci_controller a valid reference on a hci_controller.
+ * @param timeout maximum time (in ms) to wait for each answer.
+ * @return 0 upon success, a value < 0 otherwise.
+ */
+extern int8_t hci_reset_adapter(hci_socket_t *hci_socket, hci_controller_t *hci_controller, int timeout);
+
 /**
  * @brief Closes and destroys an hci_controller instance. 
  * More precisely, it closes all the opened sockets on 
@@ -160,7 +501,9 @@ extern hci_socket_t hci_open_socket_controller(hci_controller_t *hci_controller)
  * @brief Closes one of the opened sockets of an hci_controller.
  * The {@code hci_controller} reference has to be valid (the referenced controller
  * should be opened and initialized).
- * The {@code hci_socket} field has to refer to an opened socket on the given controller.
+ * The {@code hci_socket} field has to refer to an opened socket on the given controller,
+ * which is identified by its descriptor (the copy returned by {@code hci_open_socket_controller}
+ * can be given, even once used).
  * WARNING : only this function should be used to close a socket on an hci_controller
  * for the socket to properly be removed from the sockets list of the controller.
  * Using the classic {@code close_hci_socket} function will result in the socket still
@@ -175,11 +518,81 @@ extern hci_socket_t hci_open_socket_controller(hci_controller_t *hci_controller)
 */
 extern int8_t hci_close_socket_controller(hci_controller_t *hci_controller, hci_socket_t *hci_socket);
 
+/**
+ * @brief Registers all the sockets opened on a controller in a reactor.
+ * The sockets are watched for incoming data (EPOLLIN) and the given callback is
+ * called with the listed {@code hci_socket_t} as {@code data} argument. From then on,
+ * the sockets opened (resp. closed) with {@code hci_open_socket_controller} (resp.
+ * {@code hci_close_socket_controller}) are automatically registered (resp. unregistered),
+ * until {@code hci_controller_remove_from_reactor} or {@code hci_close_controller} is called.
+ * A controller can only be registered in one reactor at a time.
+ * WARNING : the events of a registered socket are consumed by the reactor's callback,
+ * so the blocking functions of this module should not be given a listed socket.
+ * The default (NULL) socket is taken from the pool of the controller, which is
+ * never registered.
+ * @param hci_controller the controller whose sockets are to be registered.
+ * @param reactor the reactor.
+ * @param callback function called when data is available on one of the sockets.
+ * @param user_data user data given to the callback.
+ * @return 0 on success, < 0 otherwise (in which case no socket is registered).
+ */
+extern int8_t hci_controller_add_to_reactor(hci_controller_t *hci_controller, reactor_t *reactor,
+					    reactor_callback_t callback, void *user_data);
+
+/**
+ * @brief Unregisters all the sockets of a controller from the reactor they
+ * were registered in with {@code hci_controller_add_to_reactor}.
+ * @param hci_controller the controller.
+ * @return 0 on success, < 0 otherwise.
+ */
+extern int8_t hci_controller_remove_from_reactor(hci_controller_t *hci_controller);
+
+/**
+ * @brief Cancels the collections of reports in progress on the controller
+ * ({@code hci_get_reports}, {@code hci_LE_get_reports}, the reads of a scan session and
+ * the functions built on them). They poll an eventfd of the controller along with
+ * their socket, so that they return as soon as it is written, with the reports
+ * received so far : the scan is then stopped as usual. Only the collections in
+ * progress are cancelled, the following ones aren't affected, and the commands sent
+ * to the adapter are not interrupted (they are bounded by their own timeout).
+ * This function can be called from any thread, for instance along with a flag
+ * ending a loop of reads :
+ * {@code
+ * scanning = 0;
+ * hci_controller_cancel(&hci_controller);
+ * }
+ * @param hci_controller the controller.
+ */
+extern void hci_controller_cancel(hci_controller_t *hci_controller);
+
+/**
+ * @brief Sets the absolute time at which the collections of reports of the
+ * controller end, whether the reports keep arriving or not. The functions waiting
+ * for reports otherwise only end once nothing arrived during their timeout, so that
+ * a measurement cycle can last much longer than expected :
+ * {@code
+ * struct timespec deadline;
+ * clock_gettime(CLOCK_MONOTONIC, &deadline);
+ * deadline.tv_sec += 1;
+ * hci_controller_set_deadline(&hci_controller, &deadline);
+ * hci_LE_get_RSSI(NULL, &hci_controller, NULL, NULL, 0, 0x00, 0x0010, 0x0010, 0x00, 0x00);
+ * }
+ * The deadline is cleared by the collection which reaches it : it doesn't empty the
+ * following ones. It can be set from any thread (a collection in progress takes it
+ * into account at its next event), but as the functions using it reserve the controller
+ * (or are bound to its only scan session), it is usually set by the thread calling them.
+ * @param hci_controller the controller.
+ * @param deadline the deadline (CLOCK_MONOTONIC), NULL for none.
+ */
+extern void hci_controller_set_deadline(hci_controller_t *hci_controller, const struct timespec *deadline);
+
 /**
  * @brief Performs a basic Bluetooth scan to recognize nearby devices.
  * The {@code hci_socket} field can either be a valid opened socket on a valid Bluetooth adapter
  * or NULL, in which case a new socket is opened on the given {@code hci_controller}.
  * The {@hci_controller} field has to refer to a valid opened hci_controller.
+ * If a name resolver is started on the controller, the names which are not cached
+ * yet are "[UNKNOWN]" in the returned table and set later in the registered devices.
  * @param hci_socket socket to be used to perform the scan.
  * @param hci_controller controller emitting the scan.
  * @param duration the scan will last at most {@code duration}*1,28s.
@@ -208,7 +621,9 @@ extern int8_t hci_compute_device_name(hci_socket_t *hci_socket, hci_controller_t
  * @brief Performs a RSSI measurement on a remote device.
  * This function is in charge of sending RSSI inquiries and
  * retrieving them to/from the remote device. The computed results
- * can be stored inside a file if needed. Even though the filters
+ * can be stored inside a file if needed, and the measured devices are displayed on
+ * the standard output if the trace level is at least {@code TRACE_INFO} (@see
+ * set_trace_lvl), which is the case by default. Even though the filters
  * apply to the socket are changed during the process, they are 
  * reset to their initial values in the end.
  * The {@code hci_socket} field can either be a valid opened socket on a valid Bluetooth adapter
@@ -221,16 +636,43 @@ extern int8_t hci_compute_device_name(hci_socket_t *hci_socket, hci_controller_t
  * @param mac address of the device from which we want the RSSI values.
  * @param duration duration of the RSSI scan.
  * @param max_rsp maximum RSSI values to receive.
- * @return the computed RSSI values stored in a string.
+ * @return the computed RSSI values stored in a string of the form "rssi1;rssi2;...".
+ * The duplicate reports are left out if the controller has a deduplicator.
  */
 extern char *hci_get_RSSI(hci_socket_t *hci_socket, hci_controller_t *hci_controller, int8_t *file_descriptor,
 			 bt_address_t *mac, uint8_t duration, uint16_t max_rsp);	
 
+/**
+ * @brief Performs a RSSI measurement on remote devices and stores the results as
+ * typed reports.
+ * This function behaves like {@code hci_get_RSSI} but, instead of formatting the RSSI
+ * values into a string, it fills the given batch with one record per inquiry
+ * result (address, RSSI, timestamp...). Filling the batch doesn't allocate any memory.
+ * The duplicate reports are left out if the batch has a deduplicator. The inquiry mode
+ * is only written if the adapter doesn't already report the RSSI. If the collection
+ * stops before the end of the inquiry (full batch, deadline or cancellation), the
+ * inquiry is cancelled.
+ * For a continuous stream of results, @see hci_start_periodic_inquiry_session.
+ * The {@code hci_socket} field can either be a valid opened socket on a valid Bluetooth adapter
+ * or NULL, in which case a new socket is opened on the given {@code hci_controller}.
+ * The {@hci_controller} field has to refer to a valid opened hci_controller.
+ * @param hci_socket socket to be used to send and retrieve RSSI inquiries.
+ * @param hci_controller local controller.
+ * @param batch initialized batch receiving the reports. Its previous content is discarded.
+ * @param mac (optional) address of the device from which we want the RSSI values.
+ * @param duration duration of the RSSI scan.
+ * @param max_rsp maximum RSSI values to receive.
+ * @return the number of reports stored in the batch, a value < 0 if an error occured.
+ */
+extern int16_t hci_get_reports(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+			       hci_report_batch_t *batch, bt_address_t *mac, uint8_t duration, uint16_t max_rsp);
+
 /**
  * @brief Performs a RSSI measurement on a remote device (LE version).
  * This function is in charge of sending RSSI inquiries and
  * retrieving them to/from the remote device. The computed results
- * can be stored inside a file if needed. Even though the filters
+ * can be stored inside a file if needed (and displayed as by {@code hci_get_RSSI}).
+ * Even though the filters
  * apply to the socket are changed during the process, they are 
  * reset to their initial values in the end.
  * The {@code hci_socket} field can either be a valid opened socket on a valid Bluetooth adapter
@@ -250,12 +692,227 @@ extern char *hci_get_RSSI(hci_socket_t *hci_socket, hci_controller_t *hci_contro
  * @param scan_window @see hci_le_set_scan_parameters
  * @param own_add_type @see hci_le_set_scan_parameters
  * @param scan_filter_policy @see hci_le_set_scan_parameters
- * @return the computed RSSI values stored in a string.
+ * @return the computed RSSI values stored in a string of the form "rssi1;rssi2;...".
+ * The scan is run without the controller's duplicate filtering : the duplicate reports
+ * are left out by the controller's deduplicator, if any.
  */
 extern char *hci_LE_get_RSSI(hci_socket_t *hci_socket, hci_controller_t *hci_controller, int8_t *file_descriptor,
 			    bt_address_t *mac, uint16_t max_rsp, uint8_t scan_type, uint16_t scan_interval,
 			    uint16_t scan_window, uint8_t own_add_type, uint8_t scan_filter_policy);
 
+/**
+ * @brief Performs a RSSI measurement on remote devices (LE version) and stores the
+ * results as typed reports.
+ * This function behaves like {@code hci_LE_get_RSSI} but fills the given batch with one
+ * record per advertising report (address, address type, event type, RSSI, timestamp
+ * and advertising data). The scan ends when the batch is full or when no report
+ * arrived during {@code HCI_SCAN_SESSION_DEFAULT_TIMEOUT} ms.
+ * Filling the batch doesn't allocate any memory. The duplicate reports are left out
+ * if the batch has a deduplicator.
+ * @param hci_socket socket to be used to send and retrieve RSSI inquiries.
+ * @param hci_controller local controller.
+ * @param batch initialized batch receiving the reports. Its previous content is discarded.
+ * @param mac (optional) address of the device from which we want the RSSI values.
+ * @param scan_type @see hci_le_set_scan_parameters
+ * @param scan_interval @see hci_le_set_scan_parameters
+ * @param scan_window @see hci_le_set_scan_parameters
+ * @param own_add_type @see hci_le_set_scan_parameters
+ * @param scan_filter_policy @see hci_le_set_scan_parameters
+ * @return the number of reports stored in the batch, a value < 0 if an error occured.
+ */
+extern int16_t hci_LE_get_reports(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+				  hci_report_batch_t *batch, bt_address_t *mac, uint8_t scan_type,
+				  uint16_t scan_interval, uint16_t scan_window, uint8_t own_add_type,
+				  uint8_t scan_filter_policy);
+
+
+/**
+ * @brief Starts a long-lived LE scan session on a controller.
+ * Unlike {@code hci_LE_get_RSSI}, which enables and disables the scan at each call,
+ * the scan is enabled once and stays enabled until {@code hci_LE_stop_scan_session}
+ * is called. Meanwhile, the controller remains in the {@code HCI_STATE_SCANNING}
+ * state and can't be used for other operations.
+ * The {@code hci_controller} field has to refer to a valid opened hci_controller.
+ * For a detailed description of the last five parameters, please refer to
+ * {@code hci_LE_get_RSSI}.
+ * @param session reference on the session to initialize.
+ * @param hci_controller controller performing the scan.
+ * @param scan_type @see hci_le_set_scan_parameters
+ * @param scan_interval @see hci_le_set_scan_parameters
+ * @param scan_window @see hci_le_set_scan_parameters
+ * @param own_add_type @see hci_le_set_scan_parameters
+ * @param scan_filter_policy @see hci_le_set_scan_parameters
+ * @return 0 upon success, <0 otherwise.
+ */
+extern int8_t hci_LE_start_scan_session(hci_scan_session_t *session, hci_controller_t *hci_controller,
+					uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window,
+					uint8_t own_add_type, uint8_t scan_filter_policy);
+
+/**
+ * @brief Starts a long-lived LE scan session with the Bluetooth 5 extended scan
+ * commands. The controller then reports the legacy advertisements as well as the
+ * extended ones, in LE extended advertising report events, whose fragmented data
+ * are reassembled by the batches (@see hci_report_batch_commit).
+ * Scanning on the Coded PHY gives a longer range with a lower throughput. The given
+ * parameters are used on each of the scanning PHYs. Apart from its start, the session
+ * is used as the one of {@code hci_LE_start_scan_session}.
+ * @param session reference on the session to initialize.
+ * The session is refused when the capabilities of the controller tell that it doesn't
+ * support the extended scan, or the Coded PHY if it is asked.
+ * @param hci_controller controller performing the scan (supporting Bluetooth 5).
+ * @param scan_phys scanning PHYs, a combination of {@code HCI_LE_SCAN_PHY_1M} and
+ * {@code HCI_LE_SCAN_PHY_CODED}.
+ * @param scan_type @see hci_le_set_scan_parameters
+ * @param scan_interval @see hci_le_set_scan_parameters
+ * @param scan_window @see hci_le_set_scan_parameters
+ * @param own_add_type @see hci_le_set_scan_parameters
+ * @param scan_filter_policy @see hci_le_set_scan_parameters
+ * @return 0 upon success, <0 otherwise.
+ */
+extern int8_t hci_LE_start_ext_scan_session(hci_scan_session_t *session, hci_controller_t *hci_controller,
+					    uint8_t scan_phys, uint8_t scan_type, uint16_t scan_interval,
+					    uint16_t scan_window, uint8_t own_add_type, uint8_t scan_filter_policy);
+
+/**
+ * @brief Starts a long-lived LE scan session whose socket drops, in the kernel, the
+ * reports which don't pass the given BPF program (@see hci_bpf.h). The program is
+ * attached before the scan is enabled, so that every report of the session went through
+ * it, and is detached when the session is stopped. Apart from its start, the session is
+ * used as the one of {@code hci_LE_start_scan_session} (or of
+ * {@code hci_LE_start_ext_scan_session} if scanning PHYs are given).
+ * @param session reference on the session to initialize.
+ * @param hci_controller controller performing the scan.
+ * @param program a compiled program (the kernel keeps its own copy of it).
+ * @param scan_phys scanning PHYs of an extended scan, 0 for a scan using the legacy commands.
+ * @param scan_type @see hci_le_set_scan_parameters
+ * @param scan_interval @see hci_le_set_scan_parameters
+ * @param scan_window @see hci_le_set_scan_parameters
+ * @param own_add_type @see hci_le_set_scan_parameters
+ * @param scan_filter_policy @see hci_le_set_scan_parameters
+ * @return 0 upon success, <0 otherwise.
+ */
+extern int8_t hci_LE_start_filtered_scan_session(hci_scan_session_t *session, hci_controller_t *hci_controller,
+						 const struct hci_bpf_program_t *program, uint8_t scan_phys,
+						 uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window,
+						 uint8_t own_add_type, uint8_t scan_filter_policy);
+
+/**
+ * @brief Starts a scan session performing a periodic classic (BR/EDR) inquiry. The
+ * adapter starts a new inquiry every {@code min_period} to {@code max_period} units of
+ * 1.28 s, on its own, and the inquiry results are delivered continuously through the
+ * session as typed reports, like the advertising reports of an LE scan session. The
+ * adapter is put in the extended inquiry mode (if it isn't already), so that the reports
+ * carry the RSSI and, for the devices which send one, their extended inquiry response
+ * (as the report data, @see hci_ad.h). The session is read and stopped as an LE scan
+ * session (@see hci_LE_scan_session_read) ; its parameters can't be changed.
+ * As the controller stays busy during the session, the names of the new devices are
+ * only asked if the controller has a name resolver (@see hci_name_resolver_start) :
+ * they are registered as "[UNKNOWN]" otherwise.
+ * @param session reference on the session to initialize.
+ * @param hci_controller controller performing the inquiries.
+ * @param min_period minimum time between two inquiries (in 1.28 s units, >= 2).
+ * @param max_period maximum time between two inquiries (in 1.28 s units, > min_period).
+ * @param duration duration of each inquiry (in 1.28 s units, 1 to 0x30, < min_period).
+ * @param max_rsp maximum number of results per inquiry (0 for no limit).
+ * @return 0 upon success, <0 otherwise.
+ */
+extern int8_t hci_start_periodic_inquiry_session(hci_scan_session_t *session, hci_controller_t *hci_controller,
+						 uint16_t min_period, uint16_t max_period,
+						 uint8_t duration, uint8_t max_rsp);
+
+/**
+ * @brief Retrieves the next batch of reports from an active scan session.
+ * The reports received since the previous call are consumed first, so that
+ * consecutive batches don't have any gap between them. The reading stops
+ * when the batch is full, when no report arrived during {@code timeout} ms, at the
+ * deadline of the controller (@see hci_controller_set_deadline) or once cancelled
+ * (@see hci_controller_cancel).
+ * Filling the batch doesn't allocate any memory. The RSSI values are also appended
+ * to the rings of the corresponding registered devices (@see bt_device_get_RSSI_samples).
+ * The duplicate reports are left out if the batch has a deduplicator (@see hci_dedup.h).
+ * @param session an active scan session.
+ * @param batch initialized batch receiving the reports. Its previous content is discarded.
+ * @param mac (optional) address of the device from which we want the reports.
+ * @param timeout maximum time (in ms) to wait for a report.
+ * @return the number of reports stored in the batch, a value < 0 if an error occured.
+ */
+extern int16_t hci_LE_scan_session_read(hci_scan_session_t *session, hci_report_batch_t *batch,
+					bt_address_t *mac, int16_t timeout);
+
+/**
+ * @brief Retrieves the reports already received by an active scan session.
+ * Waits up to {@code timeout} ms for a first event, then only reads the events
+ * already queued on the session's socket (until the batch is full) instead of
+ * waiting for the batch to be filled. Once it returns, every report received by the
+ * session before the call has been either stored in the batch or left queued
+ * because the batch was full, unless the deadline of the controller passed or the
+ * reading was cancelled meanwhile. The RSSI rings are fed as in
+ * {@code hci_LE_scan_session_read}.
+ * @param session an active scan session.
+ * @param batch initialized batch receiving the reports. Its previous content is discarded.
+ * @param timeout maximum time (in ms) to wait for the first report.
+ * @return the number of reports stored in the batch, a value < 0 if an error occured.
+ */
+extern int16_t hci_LE_scan_session_drain(hci_scan_session_t *session, hci_report_batch_t *batch,
+					 int16_t timeout);
+
+/**
+ * @brief Retrieves the next batch of RSSI values from an active scan session.
+ * The reports received since the previous call are consumed first, so that
+ * consecutive batches don't have any gap between them. The measured devices are
+ * displayed as by {@code hci_get_RSSI}.
+ * @param session an active scan session.
+ * @param file_descriptor (optional) if set, the RSSI values will be written in the
+ * corresponding file.
+ * @param mac (optional) address of the device from which we want the RSSI values.
+ * @param max_rsp number of RSSI values to receive, has to be > 0.
+ * @param timeout maximum time (in ms) to wait for a report before returning
+ * an incomplete batch.
+ * @return the computed RSSI values stored in a string of the form "rssi1;rssi2;...",
+ * NULL if an error occured.
+ */
+extern char *hci_LE_scan_session_get_RSSI(hci_scan_session_t *session, int8_t *file_descriptor,
+					  bt_address_t *mac, uint16_t max_rsp, int16_t timeout);
+
+/**
+ * @brief Changes the scan type, interval and window of an active scan session. The scan
+ * is disabled, re-programmed and enabled again without the controller leaving the
+ * {@code HCI_STATE_SCANNING} state. The commands aren't sent on the session's socket :
+ * the reports already queued on it are kept, none being received while the scan is
+ * disabled. If the new parameters are refused, the scan is resumed with the previous ones.
+ * If the scan can't be enabled again, the controller is marked as interrupted. The
+ * periodic inquiry sessions can't be re-programmed.
+ * @param session an active scan session.
+ * @param scan_type @see hci_le_set_scan_parameters
+ * @param scan_interval @see hci_le_set_scan_parameters
+ * @param scan_window @see hci_le_set_scan_parameters
+ * @return 0 upon success, <0 otherwise.
+ */
+extern int8_t hci_LE_scan_session_set_parameters(hci_scan_session_t *session, uint8_t scan_type,
+						 uint16_t scan_interval, uint16_t scan_window);
+
+/**
+ * @brief Stops a scan session (or a periodic inquiry session) and puts its controller
+ * back in the default state. The BPF program of a filtered session is detached.
+ * If the scan can't be disabled, the controller is marked as interrupted.
+ * @param session the session to stop.
+ * @return 0 upon success, <0 otherwise.
+ */
+extern int8_t hci_LE_stop_scan_session(hci_scan_session_t *session);
+
+/**
+ * @brief Programs the scan of a session into the adapter again, with the parameters
+ * of the session : the scan (or the periodic inquiry) is disabled, its parameters are
+ * written and it is enabled. It is used to resume a session after the adapter lost its
+ * configuration (@see hci_reset_adapter) or stopped scanning on its own. The reports
+ * already queued on the session's socket are kept.
+ * @param session an active scan session.
+ * @param hci_socket a reference on either a valid opened socket on the controller
+ * of the session or NULL. In the later case, a new one is opened.
+ * @return 0 upon success, <0 otherwise.
+ */
+extern int8_t hci_LE_scan_session_restore(hci_scan_session_t *session, hci_socket_t *hci_socket);
+
 
 /**
  * @brief Clears the white list of a Bluetooth adapter. 
@@ -294,6 +951,34 @@ extern int8_t hci_LE_add_white_list(hci_socket_t *hci_socket, hci_controller_t *
  */
 extern int8_t hci_LE_rm_white_list(hci_socket_t *hci_socket, hci_controller_t *hci_controller, const bt_device_t bt_device);
 
+/**
+ * @brief Sends several commands to a controller, pipelined through a command queue
+ * (@see hci_cmd_queue.h). The controller is reserved (in the {@code HCI_STATE_WRITING}
+ * state) until all of them are answered. The commands are sent in the given order.
+ * The {@hci_controller} field has to refer to a valid opened hci_controller.
+ * @param hci_controller controller to send the commands to.
+ * @param cmds table of commands initialized with {@code hci_cmd_init}, receiving their
+ * results (@see hci_cmd_t).
+ * @param nb_cmds number of commands.
+ * @return 0 if all the commands were submitted (each of them may have failed on its
+ * own), < 0 otherwise (the commands which couldn't be submitted failed as well).
+ */
+extern int8_t hci_run_cmds(hci_controller_t *hci_controller, struct hci_cmd_t *cmds, uint16_t nb_cmds);
+
+/**
+ * @brief Replaces the content of the white list of the controller with the given
+ * devices. The commands (clear, then one addition per device) are pipelined through
+ * a command queue (@see hci_cmd_queue.h) instead of being sent one after the other,
+ * which is much faster for large lists.
+ * The {@hci_controller} field has to refer to a valid opened hci_controller.
+ * @param hci_controller controller whose white list is to be set.
+ * @param devices table of the devices to put in the white list.
+ * @param length number of devices.
+ * @return the number of devices added to the white list (some may be refused by the
+ * controller, for instance if its white list is full), < 0 if an error occured.
+*/
+extern int16_t hci_LE_set_white_list(hci_controller_t *hci_controller, const bt_device_t *devices, uint16_t length);
+
 /**
  * @brief Reads the size of the white list of a Bluetooth adapter. 
  * The {@code hci_socket} field can either be a valid opened socket on a valid Bluetooth adapter
@@ -304,6 +989,8 @@ extern int8_t hci_LE_rm_white_list(hci_socket_t *hci_socket, hci_controller_t *h
  * @param size reference on the size of the list.
  * @return 0 upon success, ensuring that the {@code size} size parameter now
  * contains the size of the white list, <0 otherwise.
+ * The size is answered from the capabilities of the controller when it is known
+ * (@see hci_controller_caps_t), even if the controller is busy or interrupted.
  */
 extern int8_t hci_LE_get_white_list_size(hci_socket_t *hci_socket, hci_controller_t *hci_controller, uint8_t *size);
 
@@ -320,6 +1007,8 @@ extern int8_t hci_LE_get_white_list_size(hci_socket_t *hci_socket, hci_controlle
   * @param features binary mask used to store the list of supported features.
   * @return 0 upon success, ensuring that the {@code features} parameter now
   * contains the list of all supported LE features, <0 otherwise.
+  * The features are answered from the capabilities of the controller when they are
+  * known (@see hci_controller_caps_t), even if the controller is busy or interrupted.
 */
 extern int8_t hci_LE_read_local_supported_features(hci_socket_t *hci_socket, hci_controller_t *hci_controller, uint8_t *features);
 
@@ -339,7 +1028,42 @@ extern int8_t hci_LE_read_local_supported_features(hci_socket_t *hci_socket, hci
  * @param states binary mask used to store the list of supported states.
  * @return 0 upon success, ensuring that the {@code states} parameter now
  * contains the list of all supported LE states, <0 otherwise.
+ * The states are answered from the capabilities of the controller when they are
+ * known (@see hci_controller_caps_t), even if the controller is busy or interrupted.
 */
 extern int8_t hci_LE_read_supported_states(hci_socket_t *hci_socket, hci_controller_t *hci_controller, uint64_t *states);
 
+/**
+ * @brief Reads again the capabilities of the adapter of a controller, for instance
+ * after its firmware has been changed. They are otherwise read once, when the
+ * controller is opened.
+ * The {@code hci_socket} field can either be a valid opened socket on a valid Bluetooth adapter
+ * or NULL, in which case a socket of the given {@code hci_controller} is used.
+ * @param hci_socket socket used to access the adapter.
+ * @param hci_controller controller whose capabilities are to be read.
+ * @return 0 upon success (at least the version of the adapter could be read), <0 otherwise.
+ */
+extern int8_t hci_controller_refresh_caps(hci_socket_t *hci_socket, hci_controller_t *hci_controller);
+
+/**
+ * @brief Tells, without any command, whether the adapter of a controller supports
+ * an LE feature.
+ * @param hci_controller controller to check.
+ * @param bit bit of the feature in the LE features mask ({@code HCI_LE_FEATURE_...}).
+ * @return 1 if the feature is supported, 0 if it isn't, <0 if the LE features are not known.
+ */
+extern int8_t hci_controller_has_LE_feature(const hci_controller_t *hci_controller, uint8_t bit);
+
+/**
+ * @brief Tells, without any command, whether the adapter of a controller supports
+ * an HCI command, given by its position in the supported commands bitmap of the
+ * Bluetooth core specification (Vol 2, Part E, 6.27).
+ * @param hci_controller controller to check.
+ * @param octet octet of the command in the bitmap (0 to 63).
+ * @param bit bit of the command in its octet (0 to 7).
+ * @return 1 if the command is supported, 0 if it isn't, <0 if the supported commands are
+ * not known.
+ */
+extern int8_t hci_controller_supports_command(const hci_controller_t *hci_controller, uint8_t octet, uint8_t bit);
+
 #endif // __HCI_CONTROLLER_H__
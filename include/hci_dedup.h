@@ -0,0 +1,174 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+/**
+ * @file hci_dedup.h
+ * @brief Module bluez_tools.hci.hci_dedup suppressing the duplicate reports on the host side.
+ *
+ * The scans are started with the controller's duplicate filtering disabled, as it would
+ * also drop the RSSI updates of the devices. A deduplicator filters the reports instead :
+ * a report is a duplicate of the previous one of the same device carrying the same
+ * advertising data (same address and data hash), and it is only kept if at least
+ * {@code min_interval} ms elapsed since the last kept one, or if its RSSI moved by at
+ * least {@code rssi_threshold} dBm. The devices are tracked in a fixed size hash set,
+ * so that filtering a report never allocates anything.
+ * A deduplicator is used through a batch (@see hci_report_batch_t) :
+ * {@code
+ * hci_dedup_t dedup;
+ * hci_dedup_init(&dedup, HCI_DEDUP_DEFAULT_CAPACITY, 1000, 5);
+ * batch.dedup = &dedup;
+ * hci_LE_scan_session_read(&session, &batch, NULL, 100); // Duplicates are left out
+ * ...
+ * hci_dedup_destroy(&dedup);
+ * }
+ * A deduplicator isn't thread-safe : it must only be used by one reader at a time.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_DEDUP_H__
+#define __HCI_DEDUP_H__
+
+#include <stdint.h>
+#include "hci_report.h"
+
+/**
+ * Default number of entries of a deduplicator.
+ */
+#define HCI_DEDUP_DEFAULT_CAPACITY 1024
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Entry of the hash set of a deduplicator : last kept report of a device for
+ * a given advertising data.
+ */
+typedef struct hci_dedup_entry_t {
+	/**
+	 * Hash of the address, address type, event type and advertising data of the report.
+	 */
+	uint32_t hash;
+	/**
+	 * Address of the device (compared along with the hash).
+	 */
+	bt_address_t mac;
+	/**
+	 * RSSI of the last kept report.
+	 */
+	int8_t rssi;
+	/**
+	 * Indicates whether or not the entry is in use.
+	 */
+	char used;
+	/**
+	 * Time (in ms) of the last kept report.
+	 */
+	uint64_t last;
+} hci_dedup_entry_t;
+
+/**
+ * Statistics of a deduplicator.
+ */
+typedef struct hci_dedup_stats_t {
+	/**
+	 * Number of reports kept.
+	 */
+	uint64_t kept;
+	/**
+	 * Number of reports suppressed as duplicates.
+	 */
+	uint64_t suppressed;
+	/**
+	 * Number of entries replaced while still in their time window (the hash set was
+	 * too small for the number of devices).
+	 */
+	uint64_t evictions;
+} hci_dedup_stats_t;
+
+/**
+ * Host-side duplicate filter.
+ */
+typedef struct hci_dedup_t {
+	/**
+	 * Hash set of the tracked devices (open addressing).
+	 */
+	hci_dedup_entry_t *entries;
+	/**
+	 * Number of entries (a power of 2).
+	 */
+	uint32_t capacity;
+	/**
+	 * Minimum time (in ms) between two kept reports of a device with the same data.
+	 */
+	uint32_t min_interval;
+	/**
+	 * Minimum RSSI change (in dBm) for a duplicate to be kept anyway, 0 to ignore the RSSI.
+	 */
+	uint8_t rssi_threshold;
+	/**
+	 * Statistics.
+	 */
+	hci_dedup_stats_t stats;
+} hci_dedup_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Initializes a deduplicator.
+ * @param dedup the deduplicator to initialize.
+ * @param capacity number of entries of the hash set, rounded up to a power of 2. It should
+ * be larger than the number of devices in range, or some duplicates will go through.
+ * @param min_interval minimum time (in ms) between two kept reports of a device with the same data.
+ * @param rssi_threshold minimum RSSI change (in dBm) for a duplicate to be kept anyway,
+ * 0 to ignore the RSSI.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_dedup_init(hci_dedup_t *dedup, uint32_t capacity, uint32_t min_interval, uint8_t rssi_threshold);
+
+/**
+ * @brief Tells whether a report has to be kept and, if so, records it as the last
+ * kept report of its device.
+ * @param dedup an initialized deduplicator.
+ * @param report the report.
+ * @return 1 if the report has to be kept, 0 if it is a duplicate.
+ */
+extern char hci_dedup_accept(hci_dedup_t *dedup, const hci_report_t *report);
+
+/**
+ * @brief Forgets all the tracked devices (the next report of each device is kept).
+ * @param dedup an initialized deduplicator.
+ */
+extern void hci_dedup_clear(hci_dedup_t *dedup);
+
+/**
+ * @brief Frees the hash set of a deduplicator.
+ * @param dedup the deduplicator.
+ */
+extern void hci_dedup_destroy(hci_dedup_t *dedup);
+
+#endif // __HCI_DEDUP_H__
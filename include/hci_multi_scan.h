@@ -0,0 +1,265 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file hci_multi_scan.h
+ * @brief Module bluez_tools.hci.hci_multi_scan scanning with several adapters at once.
+ *
+ * A multi-controller scan runs a LE scan session (@see hci_LE_start_scan_session) on
+ * each of the given controllers, with one capture thread per controller, and merges
+ * the reports of all the adapters into a single stream ordered by reception time.
+ * Each report is tagged with the index of the adapter which received it, so that the
+ * report capacity grows with the number of dongles while the consumer still sees one
+ * time-ordered stream.
+ * {@code
+ * hci_controller_t *adapters[3] = {&hci0, &hci1, &hci2};
+ * hci_multi_report_t reports[64];
+ * hci_multi_scan_start(&scan, adapters, 3, 0x00, 0x0010, 0x0010, 0x00, 0x00,
+ *			HCI_MULTI_SCAN_DEFAULT_MAX_DELAY);
+ * while (...) {
+ *	int16_t n = hci_multi_scan_read(&scan, reports, 64, 1000);
+ *	for (int16_t i = 0; i < n; i++) {
+ *		treat(reports[i].adapter, &(reports[i].report));
+ *	}
+ * }
+ * hci_multi_scan_stop(&scan);
+ * }
+ * A report is only delivered once every other adapter has been read up to its
+ * timestamp, or once it has been held back for {@code max_delay} ms (an adapter
+ * whose thread lags behind can then deliver older reports afterwards).
+ * A multi-controller scan must be read by a single thread.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_MULTI_SCAN_H__
+#define __HCI_MULTI_SCAN_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include "hci_controller.h"
+#include "hci_report.h"
+
+/**
+ * Maximum number of controllers of a multi-controller scan.
+ */
+#define HCI_MULTI_SCAN_MAX_CONTROLLERS 8
+
+/**
+ * Number of reports buffered per controller (has to be a power of 2). The reports
+ * received while the buffer of their controller is full are dropped.
+ */
+#define HCI_MULTI_SCAN_RING_SIZE 1024
+
+/**
+ * Maximum length of the advertising data kept in a report.
+ */
+#define HCI_MULTI_SCAN_MAX_DATA 31
+
+/**
+ * Default maximum time (in ms) a report is held back waiting for the other adapters.
+ */
+#define HCI_MULTI_SCAN_DEFAULT_MAX_DELAY 50
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Report of a multi-controller scan.
+ */
+typedef struct hci_multi_report_t {
+	/**
+	 * Index (in the array given to {@code hci_multi_scan_start}) of the
+	 * controller which received the report.
+	 */
+	uint8_t adapter;
+	/**
+	 * Decoded report. Its {@code data} field points on the {@code data} field of
+	 * this structure (NULL if the report doesn't have any data).
+	 */
+	hci_report_t report;
+	/**
+	 * Copy of the advertising data (truncated to {@code HCI_MULTI_SCAN_MAX_DATA} bytes).
+	 */
+	uint8_t data[HCI_MULTI_SCAN_MAX_DATA];
+} hci_multi_report_t;
+
+struct hci_multi_scan_t;
+
+/**
+ * Capture of a single controller.
+ */
+typedef struct hci_multi_scan_adapter_t {
+	/**
+	 * Multi-controller scan the capture belongs to.
+	 */
+	struct hci_multi_scan_t *scan;
+	/**
+	 * Index of the controller.
+	 */
+	uint8_t index;
+	/**
+	 * Scan session of the controller.
+	 */
+	hci_scan_session_t session;
+	/**
+	 * Capture thread.
+	 */
+	pthread_t thread;
+	/**
+	 * Reports captured and not yet read.
+	 */
+	hci_multi_report_t *ring;
+	/**
+	 * Number of reports ever written in the ring (only written by the capture thread).
+	 */
+	uint64_t head;
+	/**
+	 * Number of reports ever read from the ring (only written by the reader).
+	 */
+	uint64_t tail;
+	/**
+	 * Time (CLOCK_REALTIME, in ns) up to which all the reports of the
+	 * controller are in the ring.
+	 */
+	uint64_t watermark;
+	/**
+	 * Indicates that the capture thread stopped (because of an error).
+	 */
+	char stopped;
+	/**
+	 * Number of reports captured.
+	 */
+	uint64_t reports;
+	/**
+	 * Number of reports dropped because the ring was full.
+	 */
+	uint64_t drops;
+} hci_multi_scan_adapter_t;
+
+/**
+ * Multi-controller scan.
+ */
+typedef struct hci_multi_scan_t {
+	/**
+	 * Captures of the controllers.
+	 */
+	hci_multi_scan_adapter_t adapters[HCI_MULTI_SCAN_MAX_CONTROLLERS];
+	/**
+	 * Number of controllers.
+	 */
+	uint8_t count;
+	/**
+	 * Maximum time (in ms) a report is held back waiting for the other adapters.
+	 */
+	uint16_t max_delay;
+	/**
+	 * Indicates whether or not the capture threads should keep running.
+	 */
+	volatile char running;
+	/**
+	 * Mutex and condition used to wake the reader up.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} hci_multi_scan_t;
+
+/**
+ * Statistics of a controller of a multi-controller scan.
+ */
+typedef struct hci_multi_scan_stats_t {
+	/**
+	 * Number of reports captured by the controller.
+	 */
+	uint64_t reports;
+	/**
+	 * Number of reports dropped because the reader was too slow.
+	 */
+	uint64_t drops;
+	/**
+	 * Number of reports waiting to be read.
+	 */
+	uint32_t pending;
+	/**
+	 * Indicates that the capture of the controller stopped because of an error.
+	 */
+	char stopped;
+} hci_multi_scan_stats_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Starts a LE scan on several controllers.
+ * The scan parameters are the same for all the controllers (@see hci_LE_start_scan_session).
+ * The controllers have to be opened and idle, and stay in the {@code HCI_STATE_SCANNING}
+ * state until {@code hci_multi_scan_stop} is called.
+ * @param scan the multi-controller scan to initialize.
+ * @param controllers the controllers to scan with.
+ * @param count number of controllers (at most {@code HCI_MULTI_SCAN_MAX_CONTROLLERS}).
+ * @param scan_type @see hci_le_set_scan_parameters
+ * @param scan_interval @see hci_le_set_scan_parameters
+ * @param scan_window @see hci_le_set_scan_parameters
+ * @param own_add_type @see hci_le_set_scan_parameters
+ * @param scan_filter_policy @see hci_le_set_scan_parameters
+ * @param max_delay maximum time (in ms) a report is held back waiting for the other
+ * adapters (for instance {@code HCI_MULTI_SCAN_DEFAULT_MAX_DELAY}).
+ * @return 0 on success, a value < 0 otherwise (in which case no scan is running).
+ */
+extern int8_t hci_multi_scan_start(hci_multi_scan_t *scan, hci_controller_t **controllers, uint8_t count,
+				   uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window,
+				   uint8_t own_add_type, uint8_t scan_filter_policy, uint16_t max_delay);
+
+/**
+ * @brief Reads the next reports of a multi-controller scan, in reception order.
+ * @param scan a running multi-controller scan.
+ * @param reports array receiving the reports.
+ * @param max_reports size of the {@code reports} array.
+ * @param timeout maximum time (in ms) to wait for a first report (-1 to wait indefinitely).
+ * @return the number of reports stored in the array (0 on timeout), a value < 0 on error.
+ */
+extern int16_t hci_multi_scan_read(hci_multi_scan_t *scan, hci_multi_report_t *reports,
+				   uint16_t max_reports, int16_t timeout);
+
+/**
+ * @brief Retrieves the statistics of a controller of a multi-controller scan.
+ * @param scan the multi-controller scan.
+ * @param index index of the controller.
+ * @param stats structure receiving the statistics.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_multi_scan_get_stats(hci_multi_scan_t *scan, uint8_t index, hci_multi_scan_stats_t *stats);
+
+/**
+ * @brief Stops a multi-controller scan : the capture threads are joined and
+ * the scan sessions of the controllers are stopped.
+ * @param scan the multi-controller scan.
+ * @return 0 on success, a value < 0 if at least one session couldn't be stopped.
+ */
+extern int8_t hci_multi_scan_stop(hci_multi_scan_t *scan);
+
+#endif // __HCI_MULTI_SCAN_H__
@@ -0,0 +1,219 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file hci_replay.h
+ * @brief Module bluez_tools.hci.hci_replay feeding a btsnoop capture back to the 
+ * library, through the {@code hci_replay_transport} transport.
+ *
+ * The events of the capture are delivered to the sockets opened through the
+ * transport (with respect to their filters) at their original pace, N times faster
+ * or as fast as the sockets can take them. The commands of the capture are used as
+ * synchronisation points : when a command is sent by the user, the replay jumps to 
+ * the next occurrence of this command in the capture (going back to its beginning if
+ * needed) and goes on with the events following it. A command missing from the capture
+ * is answered by a successful "Command Complete" event.
+ *
+ * Such a replay is deterministic and can be used as a throughput benchmark of the
+ * upper functions (hci_LE_get_RSSI, hci_get_RSSI, scan sessions...) :
+ * {@code
+ * hci_replay_t *replay = hci_replay_open("capture.log", HCI_REPLAY_AS_FAST_AS_POSSIBLE);
+ * hci_controller_t controller;
+ * hci_controller_init(&controller, &hci_replay_transport, replay, NULL, "REPLAY");
+ * ...
+ * hci_close_controller(&controller);
+ * hci_replay_close(replay);
+ * }
+ * The captures written by the {@code hci_snoop} module (H4 datalink) and by btmon
+ * (monitor datalink, only the first adapter of the capture is replayed) are supported.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_REPLAY_H__
+#define __HCI_REPLAY_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "hci_transport.h"
+
+/**
+ * Maximum number of sockets simultaneously opened on a replay.
+ */
+#define HCI_REPLAY_MAX_SOCKETS 32
+
+/**
+ * Speed value replaying the capture as fast as possible.
+ */
+#define HCI_REPLAY_AS_FAST_AS_POSSIBLE 0.0
+
+/**
+ * Maximum time (in ms) to wait for a socket whose reception queue is full before
+ * dropping the event for this socket.
+ */
+#define HCI_REPLAY_BLOCK_TIMEOUT 1000
+
+/**
+ * Maximum time (in ms) waited after the answer to a command, for the requesting
+ * socket to restore its filter (@see hci_transport_generic_send_req) before going on.
+ */
+#define HCI_REPLAY_SETTLE_TIME 10
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Record of a capture.
+ */
+typedef struct hci_replay_record_t {
+	/**
+	 * Timestamp of the record (µs).
+	 */
+	uint64_t timestamp;
+	/**
+	 * The packet, packet type indicator included (HCI_COMMAND_PKT or HCI_EVENT_PKT).
+	 */
+	const uint8_t *packet;
+	uint16_t length;
+} hci_replay_record_t;
+
+/**
+ * Counters of a replay.
+ */
+typedef struct hci_replay_stats_t {
+	/**
+	 * Number of commands sent by the user.
+	 */
+	uint64_t commands;
+	/**
+	 * Number of commands sent by the user and missing from the capture.
+	 */
+	uint64_t unmatched_commands;
+	/**
+	 * Number of events delivered to the sockets.
+	 */
+	uint64_t events;
+	/**
+	 * Number of events dropped because a socket didn't read them.
+	 */
+	uint64_t dropped_events;
+	/**
+	 * Number of times the replay went back to the beginning of the capture.
+	 */
+	uint64_t loops;
+} hci_replay_stats_t;
+
+/**
+ * Replay of a capture.
+ */
+typedef struct hci_replay_t {
+	/**
+	 * Records of the capture and buffer containing their packets.
+	 */
+	hci_replay_record_t *records;
+	uint32_t length;
+	uint8_t *data;
+	/**
+	 * Speed factor (1.0 for the original pace), or HCI_REPLAY_AS_FAST_AS_POSSIBLE.
+	 */
+	double speed;
+	/**
+	 * Mutex protecting the state of the replay and condition used to wake
+	 * the replaying thread up.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/**
+	 * Replaying thread.
+	 */
+	pthread_t thread;
+	volatile char running;
+	/**
+	 * Sockets opened on the replay.
+	 */
+	hci_transport_pair_t sockets[HCI_REPLAY_MAX_SOCKETS];
+	/**
+	 * Next record to replay.
+	 */
+	uint32_t position;
+	/**
+	 * Opcode of the last command sent by the user and indicator telling that the
+	 * replay is waiting for the filter of the requesting socket to be restored.
+	 * Without this, when replaying as fast as possible, the events following the
+	 * answer would be filtered out by the request's temporary filter.
+	 */
+	uint16_t pending_opcode;
+	char settling;
+	/**
+	 * Time reference : the record with the timestamp {@code base_timestamp} was
+	 * replayed at the time {@code base}.
+	 */
+	char synchronized;
+	struct timespec base;
+	uint64_t base_timestamp;
+	/**
+	 * Counters of the replay.
+	 */
+	hci_replay_stats_t stats;
+} hci_replay_t;
+
+//------------------------------------------------------------------------------------
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * Transport replaying a capture. The private data of the sockets opened through it
+ * has to be a reference on a {@code hci_replay_t}.
+ */
+extern const hci_transport_t hci_replay_transport;
+
+/**
+ * @brief Loads a btsnoop capture and starts its replaying thread.
+ * @param path path of the capture.
+ * @param speed speed factor (1.0 for the original pace, 10.0 for a replay 10 times faster...)
+ * or HCI_REPLAY_AS_FAST_AS_POSSIBLE.
+ * @return a reference on the replay, NULL if an error occured.
+ */
+extern hci_replay_t *hci_replay_open(const char *path, double speed);
+
+/**
+ * @brief Stops and destroys a replay.
+ * All the sockets opened on it have to be closed beforehand.
+ * @param replay reference on the replay.
+ */
+extern void hci_replay_close(hci_replay_t *replay);
+
+/**
+ * @brief Retrieves the counters of a replay.
+ * @param replay reference on the replay.
+ * @param stats reference on the structure receiving the counters.
+ */
+extern void hci_replay_get_stats(hci_replay_t *replay, hci_replay_stats_t *stats);
+
+#endif // __HCI_REPLAY_H__
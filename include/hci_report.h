@@ -0,0 +1,394 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file hci_report.h
+ * @brief Module bluez_tools.hci.hci_report decoding the reports (advertising reports,
+ * inquiry results) contained in HCI events into typed records.
+ *
+ * The records are decoded straight out of the buffer in which the HCI event has
+ * been read : no copy of the advertising data is made, each record only points
+ * into the event buffer. The buffer therefore has to outlive the records.
+ * Bluetooth 5 extended advertising reports are also decoded. Their data may be
+ * split over several reports, which a reassembler puts back together
+ * (@see hci_report_reassemble).
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_REPORT_H__
+#define __HCI_REPORT_H__
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <stdint.h>
+#include <time.h>
+#include "bt_device.h"
+
+/**
+ * Value of the {@code evt_type} field for reports coming from a classic
+ * (BR/EDR) inquiry.
+ */
+#define HCI_REPORT_CLASSIC_EVT_TYPE 0xFF
+
+/**
+ * Value of the {@code evt_type} field for the RSSI measured on an LE connection
+ * (@see hci_conn_manager.h).
+ */
+#define HCI_REPORT_CONNECTION_EVT_TYPE 0xFE
+
+/**
+ * RSSI value used when the controller could not measure it (or when the
+ * event doesn't carry it).
+ */
+#define HCI_REPORT_RSSI_UNAVAILABLE 127
+
+/**
+ * Tx power value used when the event doesn't carry it.
+ */
+#define HCI_REPORT_TX_POWER_UNAVAILABLE 127
+
+/**
+ * LE Extended Advertising Report subevent (cf Core v5.0, vol 2 part E, 7.7.65.13),
+ * which older BlueZ headers don't define.
+ */
+#ifndef EVT_LE_EXT_ADVERTISING_REPORT
+#define EVT_LE_EXT_ADVERTISING_REPORT 0x0D
+#endif
+
+/**
+ * Status of the advertising data of a report (@see hci_report_t).
+ */
+#define HCI_REPORT_DATA_COMPLETE 0x00
+#define HCI_REPORT_DATA_INCOMPLETE 0x01
+#define HCI_REPORT_DATA_TRUNCATED 0x02
+
+/**
+ * Maximum length of the advertising data of an extended advertising set.
+ */
+#define HCI_REPORT_EXT_MAX_DATA 1650
+
+/**
+ * Number of advertising data being reassembled at the same time by a reassembler.
+ */
+#define HCI_REPORT_REASSEMBLY_SLOTS 8
+
+/**
+ * Capacity of the batches used when the caller doesn't bound the number of reports.
+ */
+#define HCI_REPORT_DEFAULT_CAPACITY 255
+
+/**
+ * Maximum length of the string produced by {@code hci_report_batch_to_string}
+ * for one report ("-127;").
+ */
+#define HCI_REPORT_RSSI_STRING_LENGTH 5
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Report record : one sighting of a remote device.
+ */
+typedef struct hci_report_t {
+	/** Address of the remote device. */
+	bt_address_t mac;
+	/** Address type of the remote device (@see bt_address_type_t). */
+	uint8_t add_type;
+	/** 
+	 * Advertising event type (ADV_IND, ADV_NONCONN_IND...), or
+	 * {@code HCI_REPORT_CLASSIC_EVT_TYPE} for an inquiry result. For an extended
+	 * report, bits 0 to 4 of its event type (connectable, scannable, directed,
+	 * scan response, legacy).
+	 */
+	uint8_t evt_type;
+	/** 1 if the report comes from an extended advertising report, 0 otherwise. */
+	uint8_t extended;
+	/** Status of the advertising data ({@code HCI_REPORT_DATA_COMPLETE} for legacy reports). */
+	uint8_t data_status;
+	/** Primary and secondary PHYs of an extended report (1 : 1M, 2 : 2M, 3 : Coded, 0 : none). */
+	uint8_t primary_phy;
+	uint8_t secondary_phy;
+	/** Advertising set identifier of an extended report (0xFF if none). */
+	uint8_t sid;
+	/** Tx power in dBm, {@code HCI_REPORT_TX_POWER_UNAVAILABLE} if unknown. */
+	int8_t tx_power;
+	/** Measured RSSI in dBm, {@code HCI_REPORT_RSSI_UNAVAILABLE} if unknown. */
+	int8_t rssi;
+	/** Time at which the event carrying the report was received. */
+	struct timespec timestamp;
+	/**
+	 * Advertising data, pointing inside the event buffer. NULL if none. For an extended
+	 * inquiry result, significant part of the extended inquiry response (same format).
+	 */
+	const uint8_t *data;
+	/** Length of the advertising data. */
+	uint16_t data_length;
+} hci_report_t;
+
+/**
+ * Iterator over the reports contained in one HCI event packet.
+ *
+ * @see hci_report_iterator_init
+ */
+typedef struct hci_report_iterator_t {
+	/** Next byte to decode. */
+	const uint8_t *cursor;
+	/** First byte after the event. */
+	const uint8_t *end;
+	/** Event code of the iterated packet. */
+	uint8_t evt;
+	/** Subevent code of the iterated packet (LE meta events only). */
+	uint8_t subevent;
+	/** Number of reports not yet decoded. */
+	uint8_t remaining;
+	/** Timestamp given to the decoded reports. */
+	struct timespec timestamp;
+} hci_report_iterator_t;
+
+/**
+ * Advertising data of an extended advertising set being reassembled.
+ */
+typedef struct hci_report_fragments_t {
+	/** Advertiser of the data. */
+	bt_address_t mac;
+	uint8_t add_type;
+	uint8_t sid;
+	/** Scan response bit of the event type (the scan response is reassembled apart). */
+	uint8_t scan_rsp;
+	/** Indicates whether the slot is in use. */
+	char used;
+	/** Time of the last fragment (in calls to the reassembler), to evict the oldest slot. */
+	uint32_t age;
+	/** Data received so far. */
+	uint16_t length;
+	uint8_t data[HCI_REPORT_EXT_MAX_DATA];
+} hci_report_fragments_t;
+
+/**
+ * Reassembler of the advertising data split over several extended reports.
+ */
+typedef struct hci_report_reassembler_t {
+	hci_report_fragments_t slots[HCI_REPORT_REASSEMBLY_SLOTS];
+	uint32_t clock;
+} hci_report_reassembler_t;
+
+struct hci_dedup_t;
+struct hci_white_list_t;
+
+/**
+ * Batch of reports along with the storage of the events they point into.
+ * All the memory is allocated once by {@code hci_report_batch_init}, filling a
+ * batch doesn't allocate anything. The reassembled advertising data of extended
+ * reports are copied in the storage of the batch, after their last event.
+ */
+typedef struct hci_report_batch_t {
+	/** Storage of the raw events. */
+	uint8_t *buffer;
+	/** Size of {@code buffer}. */
+	uint32_t buffer_size;
+	/** Number of bytes of {@code buffer} currently in use. */
+	uint32_t buffer_used;
+	/** Decoded reports. */
+	hci_report_t *reports;
+	/** Maximum number of reports. */
+	uint16_t capacity;
+	/** Current number of reports. */
+	uint16_t length;
+	/**
+	 * Number of reports left out by the filters of the batch (address, white list,
+	 * deduplicator) since it was last cleared.
+	 */
+	uint32_t filtered;
+	/**
+	 * End of the last event whose reports didn't all fit in the batch, and the
+	 * iterator over its reports not yet decoded. They are added first to the batch
+	 * by the next collection (@see hci_report_batch_resume), so that no report is
+	 * lost. They aren't emptied by {@code hci_report_batch_clear}.
+	 */
+	uint8_t *pending;
+	uint16_t pending_length;
+	hci_report_iterator_t pending_it;
+	/**
+	 * Number of reports lost because the batch was full while reports were still
+	 * pending (@see hci_report_batch_commit) since it was last cleared.
+	 */
+	uint32_t overflowed;
+	/**
+	 * Number of reports whose reassembled data was truncated because the batch was full
+	 * (@see HCI_REPORT_DATA_TRUNCATED) since it was last cleared.
+	 */
+	uint32_t truncated;
+	/**
+	 * Reassembler of the fragmented extended reports. It isn't emptied by
+	 * {@code hci_report_batch_clear}, as a data may be split over two reads.
+	 */
+	hci_report_reassembler_t *reassembler;
+	/**
+	 * Deduplicator leaving the duplicate reports out of the batch, NULL if none
+	 * (set by the user, who keeps its ownership).
+	 *
+	 * @see hci_dedup_accept
+	 */
+	struct hci_dedup_t *dedup;
+	/**
+	 * White list whose devices are the only ones kept in the batch, NULL if none
+	 * (set by the user, who keeps its ownership).
+	 *
+	 * @see hci_white_list_accept
+	 */
+	struct hci_white_list_t *white_list;
+} hci_report_batch_t;
+
+//------------------------------------------------------------------------------------
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Initializes an iterator over the reports of an HCI event packet.
+ * The packet has to start with its packet type indicator (as read from an
+ * HCI socket). Supported events are LE advertising reports, LE extended advertising
+ * reports, inquiry results, inquiry results with RSSI and extended inquiry results.
+ * @param it iterator to initialize.
+ * @param packet packet as read from an HCI socket.
+ * @param length length of the packet.
+ * @param timestamp (optional) reception time of the packet. If NULL, the current
+ * time is used.
+ * @return the number of reports contained in the packet, a value < 0 if the packet
+ * doesn't contain any report or is malformed.
+ */
+extern int16_t hci_report_iterator_init(hci_report_iterator_t *it, const uint8_t *packet, uint16_t length,
+					const struct timespec *timestamp);
+
+/**
+ * @brief Decodes the next report of an event.
+ * The fields of the report are checked against the length of the event : a
+ * truncated report ends the iteration.
+ * @param it an initialized iterator.
+ * @param report record to fill.
+ * @return 1 if a report has been decoded, 0 at the end of the event.
+ */
+extern char hci_report_iterator_next(hci_report_iterator_t *it, hci_report_t *report);
+
+/**
+ * @brief Feeds a reassembler with an extended report. The fragments of a data
+ * ({@code HCI_REPORT_DATA_INCOMPLETE} status) are kept until its last fragment arrives,
+ * which completes the report : its {@code data} then points on the whole data, stored
+ * in the reassembler until its next call. A report which isn't fragmented is left untouched.
+ * @param reassembler the reassembler.
+ * @param report an extended report.
+ * @return 1 if the report is complete (or truncated), 0 if it is a fragment kept
+ * by the reassembler.
+ */
+extern char hci_report_reassemble(hci_report_reassembler_t *reassembler, hci_report_t *report);
+
+/**
+ * @brief Allocates the storage of a batch able to hold {@code capacity} reports.
+ * @param batch batch to initialize.
+ * @param capacity maximum number of reports of the batch.
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int8_t hci_report_batch_init(hci_report_batch_t *batch, uint16_t capacity);
+
+/**
+ * @brief Empties a batch, making it ready to be filled again.
+ * The previously decoded records become invalid.
+ * @param batch batch to empty.
+ */
+extern void hci_report_batch_clear(hci_report_batch_t *batch);
+
+/**
+ * @brief Frees the storage of a batch.
+ * @param batch batch to destroy.
+ */
+extern void hci_report_batch_destroy(hci_report_batch_t *batch);
+
+/**
+ * @brief Returns the location where the next event of a batch should be read.
+ * At least {@code HCI_MAX_EVENT_SIZE} bytes are available at this location
+ * as long as the batch isn't full. The batch is also full when the data held by its
+ * reassembler would no longer fit once completed, so that they aren't truncated.
+ * @param batch batch to fill.
+ * @return where to read the next event, NULL if the batch is full.
+ */
+extern uint8_t *hci_report_batch_next_buffer(hci_report_batch_t *batch);
+
+/**
+ * @brief Decodes the reports of an event previously read at the location given by
+ * {@code hci_report_batch_next_buffer} and adds them to the batch.
+ * If {@code mac} is not NULL, only the reports coming from this device are kept, and
+ * if the batch has a white list, only the ones of its devices.
+ * The fragments of the extended reports are reassembled : a fragmented data gives
+ * one report, added along with its last fragment. The duplicates are then left out
+ * if the batch has a deduplicator.
+ * The event's storage is only kept if at least one report has been added, and the
+ * reports left out are counted in the {@code filtered} field of the batch.
+ * If the batch fills up before the end of the event, the reports not yet decoded
+ * are kept pending in the batch until {@code hci_report_batch_resume} is called.
+ * Reports still pending from a previous event are lost then (and counted in the
+ * {@code overflowed} field).
+ * @param batch batch to fill.
+ * @param length length of the event.
+ * @param timestamp (optional) reception time of the event.
+ * @param mac (optional) address of the only device to keep the reports from.
+ * @return the number of reports added to the batch.
+ */
+extern uint16_t hci_report_batch_commit(hci_report_batch_t *batch, uint16_t length,
+					const struct timespec *timestamp, const bt_address_t *mac);
+
+/**
+ * @brief Adds to the batch the reports left pending by the last call to
+ * {@code hci_report_batch_commit} which filled it, before any new event is read.
+ * They keep the reception time of their event, and go through the same filters.
+ * @param batch batch to fill.
+ * @param mac (optional) address of the only device to keep the reports from.
+ * @return the number of reports added to the batch.
+ */
+extern uint16_t hci_report_batch_resume(hci_report_batch_t *batch, const bt_address_t *mac);
+
+/**
+ * @brief Adds an already decoded report to a batch, for the reports which don't come
+ * from an advertising or inquiry event (for instance the RSSI of a connection).
+ * The report goes through the white list and the deduplicator of the batch, as the
+ * ones of {@code hci_report_batch_commit}. Its data, if any, is copied in the storage
+ * of the batch (and truncated to {@code HCI_MAX_EVENT_SIZE} bytes).
+ * @param batch batch to fill.
+ * @param report report to add.
+ * @return 1 if the report has been added, 0 if it was left out or if the batch is full.
+ */
+extern uint16_t hci_report_batch_add(hci_report_batch_t *batch, const hci_report_t *report);
+
+/**
+ * @brief Formats the RSSI values of a batch into a string of the form "rssi1;rssi2;...".
+ * The string is built in a single pass.
+ * @param batch batch to format.
+ * @return the newly allocated string, to be freed by the caller.
+ */
+extern char *hci_report_batch_to_string(const hci_report_batch_t *batch);
+
+#endif // __HCI_REPORT_H__
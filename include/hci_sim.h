@@ -0,0 +1,406 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file hci_sim.h
+ * @brief Module bluez_tools.hci.hci_sim implementing an in-process simulated 
+ * bt adapter, usable through the {@code hci_sim_transport} transport.
+ *
+ * The simulator answers the HCI commands used by the library (LE scan parameters
+ * and enable, legacy or extended, LE white list, inquiry, periodic inquiry, remote name request, LE local supported
+ * features and supported states, local version, reset and event masks...) and, while an LE scan is enabled, generates
+ * advertising reports at a configurable rate from a configurable population of
+ * devices. It allows the upper modules to be tested and benchmarked without any
+ * physical adapter : 
+ * {@code
+ * hci_sim_t *sim = hci_sim_create(NULL);
+ * hci_controller_t controller;
+ * hci_controller_init(&controller, &hci_sim_transport, sim, NULL, "SIM");
+ * ...
+ * hci_close_controller(&controller);
+ * hci_sim_destroy(sim);
+ * }
+ * 
+ * Each socket opened on the simulator is one end of an AF_UNIX socket pair, the other
+ * end being kept by the simulator. As with the kernel, the events are delivered to 
+ * every socket whose filter accepts them and an event is dropped (and counted) when
+ * the reception queue of a socket is full.
+ *
+ * The simulated devices accept the LE connections (@see hci_sim_disconnect to lose one of
+ * them), whose RSSI is read with the HCI "Read RSSI" command.
+ *
+ * Faults can be injected to test the recovery of the upper modules (@see hci_sim_set_fault) :
+ * {@code
+ * hci_sim_set_fault(sim, HCI_SIM_FAULT_UNRESPONSIVE); // Only an HCI reset brings it back
+ * }
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_SIM_H__
+#define __HCI_SIM_H__
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "hci_transport.h"
+#include "hci_report.h"
+#include "hci_utils.h"
+#include "bt_device.h"
+
+/**
+ * Maximum number of sockets simultaneously opened on a simulated adapter.
+ */
+#define HCI_SIM_MAX_SOCKETS 32
+
+/**
+ * Maximum size of the white list of a simulated adapter.
+ */
+#define HCI_SIM_MAX_WHITE_LIST_SIZE 128
+
+/**
+ * Maximum number of LE connections simultaneously established by a simulated adapter.
+ */
+#define HCI_SIM_MAX_CONNECTIONS 16
+
+/**
+ * Period (in µs) of the thread generating the advertising reports.
+ */
+#define HCI_SIM_TICK 1000
+
+/**
+ * Faults of a simulated adapter (@see hci_sim_set_fault).
+ */
+typedef enum hci_sim_fault_t {
+	/**
+	 * The adapter works normally.
+	 */
+	HCI_SIM_FAULT_NONE = 0,
+	/**
+	 * The adapter stops generating reports while its scan stays enabled. Disabling
+	 * the scan (or resetting the adapter) clears the fault.
+	 */
+	HCI_SIM_FAULT_SCAN_STALLED = 1,
+	/**
+	 * The adapter neither answers the commands nor generates reports, until it is
+	 * reset (HCI "Reset" command).
+	 */
+	HCI_SIM_FAULT_UNRESPONSIVE = 2,
+	/**
+	 * The adapter ignores everything, resets included, until it is restarted
+	 * (@see hci_transport_t).
+	 */
+	HCI_SIM_FAULT_HUNG = 3
+} hci_sim_fault_t;
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Configuration of a simulated adapter.
+ */
+typedef struct hci_sim_config_t {
+	/**
+	 * Address of the simulated adapter.
+	 */
+	bt_address_t address;
+	/**
+	 * Number of simulated remote devices (advertising and answering inquiries).
+	 */
+	uint32_t num_devices;
+	/**
+	 * Number of advertising reports generated per second while scanning.
+	 */
+	uint32_t reports_per_second;
+	/**
+	 * Number of reports packed into a single LE advertising report event.
+	 */
+	uint8_t reports_per_event;
+	/**
+	 * Length of the advertising data of each report (at most 31).
+	 */
+	uint8_t data_length;
+	/**
+	 * Length of the advertising data of the extended reports (at most
+	 * {@code HCI_REPORT_EXT_MAX_DATA}), 0 to use {@code data_length}. Longer data
+	 * than an event can carry are split over several reports.
+	 */
+	uint16_t extended_data_length;
+	/**
+	 * Bounds of the generated RSSI values.
+	 */
+	int8_t rssi_min;
+	int8_t rssi_max;
+	/**
+	 * Size of the LE white list (at most {@code HCI_SIM_MAX_WHITE_LIST_SIZE}).
+	 */
+	uint8_t white_list_size;
+	/**
+	 * Seed of the pseudo-random generator (for reproducible runs).
+	 */
+	uint32_t seed;
+	/**
+	 * Time (in µs) taken by the adapter to answer a command (0 to answer immediately).
+	 * The answers being delivered by the generating thread, the actual latency is
+	 * rounded up to a multiple of HCI_SIM_TICK.
+	 */
+	uint32_t command_latency;
+	/**
+	 * Number of command credits (Num_HCI_Command_Packets) advertised in the answers.
+	 */
+	uint8_t command_credits;
+	/**
+	 * If set, {@code reports_per_second} is the rate of a continuous scan and the actual
+	 * rate follows the duty cycle (scan window / scan interval) of the scan parameters.
+	 * The active scans then get half as many reports again, as if half of the devices
+	 * answered the scan requests.
+	 */
+	char duty_cycle;
+} hci_sim_config_t;
+
+/**
+ * Counters of a simulated adapter.
+ */
+typedef struct hci_sim_stats_t {
+	/**
+	 * Number of received commands.
+	 */
+	uint64_t commands;
+	/**
+	 * Number of generated advertising reports.
+	 */
+	uint64_t reports;
+	/**
+	 * Number of events delivered to the sockets.
+	 */
+	uint64_t events;
+	/**
+	 * Number of events which could not be delivered because the reception
+	 * queue of a socket was full.
+	 */
+	uint64_t dropped_events;
+	/**
+	 * Number of HCI resets and of restarts of the adapter.
+	 */
+	uint64_t resets;
+	uint64_t restarts;
+	/**
+	 * Number of established and terminated LE connections.
+	 */
+	uint64_t connections;
+	uint64_t disconnections;
+} hci_sim_stats_t;
+
+/**
+ * Event waiting to be delivered (answer to a command when a command latency is set).
+ */
+typedef struct hci_sim_delayed_event_t {
+	struct timespec due;
+	uint8_t evt;
+	uint8_t plen;
+	uint8_t param[255];
+	struct hci_sim_delayed_event_t *next;
+} hci_sim_delayed_event_t;
+
+/**
+ * Entry of the white list of a simulated adapter.
+ */
+typedef struct hci_sim_white_list_entry_t {
+	bt_address_t mac;
+	uint8_t add_type;
+} hci_sim_white_list_entry_t;
+
+/**
+ * LE connection of a simulated adapter.
+ */
+typedef struct hci_sim_connection_t {
+	/**
+	 * Indicates whether the connection is established (1) or the entry is free (0).
+	 */
+	char used;
+	/**
+	 * Handle of the connection and index of the connected device.
+	 */
+	uint16_t handle;
+	uint32_t index;
+	/**
+	 * Connection parameters (@see le_connection_update_cp).
+	 */
+	uint16_t interval;
+	uint16_t latency;
+	uint16_t supervision_timeout;
+} hci_sim_connection_t;
+
+/**
+ * Simulated adapter.
+ */
+typedef struct hci_sim_t {
+	/**
+	 * Configuration of the adapter.
+	 */
+	hci_sim_config_t config;
+	/**
+	 * Mutex protecting the whole state of the simulator.
+	 */
+	pthread_mutex_t mutex;
+	/**
+	 * Thread generating the advertising reports.
+	 */
+	pthread_t thread;
+	/**
+	 * Indicates whether the generating thread has to keep running.
+	 */
+	volatile char running;
+	/**
+	 * Sockets opened on the adapter.
+	 */
+	hci_transport_pair_t sockets[HCI_SIM_MAX_SOCKETS];
+	/**
+	 * LE scan state.
+	 */
+	char scan_enabled;
+	char scan_extended;
+	uint8_t scan_phys;
+	uint8_t scan_type;
+	uint16_t scan_interval;
+	uint16_t scan_window;
+	uint8_t scan_filter_policy;
+	struct timespec scan_start;
+	uint64_t scan_reports;
+	/**
+	 * LE white list.
+	 */
+	hci_sim_white_list_entry_t white_list[HCI_SIM_MAX_WHITE_LIST_SIZE];
+	uint8_t white_list_length;
+	/**
+	 * Inquiry mode (standard, with RSSI or extended).
+	 */
+	uint8_t inquiry_mode;
+	/**
+	 * Periodic inquiry : number of results per inquiry, period (in ms, the minimum
+	 * period requested) and time of the next inquiry.
+	 */
+	char periodic_inquiry;
+	uint8_t periodic_num_rsp;
+	uint32_t periodic_period;
+	struct timespec periodic_next;
+	/**
+	 * LE connections, connection being created (waiting for a device which doesn't
+	 * exist, until it is cancelled) and next connection handle.
+	 */
+	hci_sim_connection_t connections[HCI_SIM_MAX_CONNECTIONS];
+	char connecting;
+	bt_address_t connecting_mac;
+	uint16_t next_handle;
+	/**
+	 * Answers waiting for their delivery (FIFO).
+	 */
+	hci_sim_delayed_event_t *delayed_head;
+	hci_sim_delayed_event_t *delayed_tail;
+	/**
+	 * Fault currently injected.
+	 */
+	hci_sim_fault_t fault;
+	/**
+	 * Next device to advertise and state of the pseudo-random generator.
+	 */
+	uint32_t next_device;
+	uint32_t random;
+	/**
+	 * Counters of the adapter.
+	 */
+	hci_sim_stats_t stats;
+} hci_sim_t;
+
+//------------------------------------------------------------------------------------
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * Transport giving access to a simulated adapter. The private data of the sockets
+ * opened through it has to be a reference on a {@code hci_sim_t}.
+ */
+extern const hci_transport_t hci_sim_transport;
+
+/**
+ * @brief Returns the default configuration of a simulated adapter 
+ * (100 devices, 1000 reports/s, one report per event, commands answered
+ * immediately with one credit).
+ * @return the default configuration.
+ */
+extern hci_sim_config_t hci_sim_default_config(void);
+
+/**
+ * @brief Creates a simulated adapter and starts its generating thread.
+ * @param config configuration of the adapter, NULL for the default one.
+ * @return a reference on the new adapter, NULL if an error occured.
+ */
+extern hci_sim_t *hci_sim_create(const hci_sim_config_t *config);
+
+/**
+ * @brief Stops and destroys a simulated adapter. 
+ * All the sockets opened on it have to be closed beforehand.
+ * @param sim reference on the adapter to destroy.
+ */
+extern void hci_sim_destroy(hci_sim_t *sim);
+
+/**
+ * @brief Returns the address of one of the simulated remote devices.
+ * @param sim reference on the adapter.
+ * @param index index of the device (lower than {@code config.num_devices}).
+ * @return the address of the device.
+ */
+extern bt_address_t hci_sim_device_address(hci_sim_t *sim, uint32_t index);
+
+/**
+ * @brief Retrieves the counters of a simulated adapter.
+ * @param sim reference on the adapter.
+ * @param stats reference on the structure receiving the counters.
+ */
+extern void hci_sim_get_stats(hci_sim_t *sim, hci_sim_stats_t *stats);
+
+/**
+ * @brief Injects a fault into a simulated adapter. The commands ignored because of the
+ * fault are still counted, but never answered.
+ * @param sim reference on the adapter.
+ * @param fault the fault, {@code HCI_SIM_FAULT_NONE} to clear the current one.
+ */
+extern void hci_sim_set_fault(hci_sim_t *sim, hci_sim_fault_t fault);
+
+/**
+ * @brief Terminates the LE connection established with a simulated device, as if the device
+ * went out of range ("Disconnection Complete" event with the "Connection Timeout" reason).
+ * @param sim reference on the adapter.
+ * @param mac address of the connected device.
+ * @return 0 on success, a value < 0 if the device isn't connected.
+ */
+extern int8_t hci_sim_disconnect(hci_sim_t *sim, const bt_address_t *mac);
+
+#endif // __HCI_SIM_H__
@@ -0,0 +1,182 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file hci_snoop.h
+ * @brief Module bluez_tools.hci.hci_snoop recording the HCI traffic of a controller
+ * into a btsnoop capture (readable by Wireshark, btmon, or the {@code hci_replay} 
+ * module).
+ *
+ * The recorder is a transport wrapping another one : every command sent and every
+ * event read through the sockets opened with it is written to the capture.
+ * {@code
+ * hci_snoop_t *snoop = hci_snoop_open("capture.log", &hci_bluez_transport, NULL);
+ * hci_controller_t controller;
+ * hci_controller_init(&controller, &hci_snoop_transport, snoop, NULL, "REC");
+ * ...
+ * hci_close_controller(&controller);
+ * hci_snoop_close(snoop);
+ * }
+ * The records are gathered in an in-memory buffer, which is only written to the file
+ * when full (or flushed), so that the recording doesn't slow the event path down.
+ * Since each socket records what it reads, an event delivered to several sockets of
+ * the controller appears once per socket. The inquiries performed by
+ * {@code hci_scan_devices} are not recorded, the BlueZ transport delegating them 
+ * to the kernel.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_SNOOP_H__
+#define __HCI_SNOOP_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "hci_transport.h"
+
+/**
+ * Size of the in-memory buffer of a recorder.
+ */
+#define HCI_SNOOP_BUFFER_SIZE 65536
+
+/**
+ * Identification pattern and version of the btsnoop format.
+ */
+#define HCI_SNOOP_ID "btsnoop"
+#define HCI_SNOOP_VERSION 1
+
+/**
+ * Supported btsnoop datalink types : unencapsulated HCI, HCI UART (H4, 
+ * written by the recorder) and BlueZ monitor (written by btmon).
+ */
+#define HCI_SNOOP_DATALINK_HCI 1001
+#define HCI_SNOOP_DATALINK_H4 1002
+#define HCI_SNOOP_DATALINK_MONITOR 2001
+
+/**
+ * Flags of a btsnoop record (H4 and unencapsulated HCI datalinks).
+ */
+#define HCI_SNOOP_FLAG_RECEIVED 0x01
+#define HCI_SNOOP_FLAG_COMMAND_EVENT 0x02
+
+/**
+ * Difference (in µs) between the btsnoop epoch (midnight, January 1st, 0 AD) 
+ * and the Unix one.
+ */
+#define HCI_SNOOP_EPOCH_DELTA 0x00DCDDB30F2F8000ULL
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Header of a btsnoop record (all the fields are big-endian).
+ */
+typedef struct hci_snoop_record_hdr_t {
+	uint32_t original_length;
+	uint32_t included_length;
+	uint32_t flags;
+	uint32_t drops;
+	uint64_t timestamp;
+} __attribute__ ((packed)) hci_snoop_record_hdr_t;
+
+/**
+ * Recorder of the HCI traffic.
+ */
+typedef struct hci_snoop_t {
+	/**
+	 * Recorded transport and its private data.
+	 */
+	const hci_transport_t *transport;
+	void *transport_data;
+	/**
+	 * Descriptor of the capture file.
+	 */
+	int fd;
+	/**
+	 * Mutex protecting the buffer (the sockets can be used by several threads).
+	 */
+	pthread_mutex_t mutex;
+	/**
+	 * In-memory buffer of records.
+	 */
+	uint8_t buffer[HCI_SNOOP_BUFFER_SIZE];
+	uint32_t buffer_used;
+	uint32_t buffer_records;
+	/**
+	 * Number of written records and of records lost due to write errors.
+	 */
+	uint64_t records;
+	uint64_t drops;
+} hci_snoop_t;
+
+//------------------------------------------------------------------------------------
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * Transport recording the traffic of the sockets opened through it. The private
+ * data of those sockets has to be a reference on a {@code hci_snoop_t}.
+ */
+extern const hci_transport_t hci_snoop_transport;
+
+/**
+ * @brief Creates a recorder writing into a new btsnoop capture.
+ * @param path path of the capture file (truncated if it already exists).
+ * @param transport recorded transport, NULL for the default (BlueZ) one.
+ * @param transport_data private data of the recorded transport.
+ * @return a reference on the recorder, NULL if an error occured.
+ */
+extern hci_snoop_t *hci_snoop_open(const char *path, const hci_transport_t *transport, void *transport_data);
+
+/**
+ * @brief Adds a packet to the capture.
+ * @param snoop reference on the recorder.
+ * @param packet the packet (packet type indicator included).
+ * @param length length of the packet.
+ * @param received 1 if the packet comes from the adapter, 0 if it was sent to it.
+ * @param timestamp time of the packet, NULL for the current time.
+ */
+extern void hci_snoop_record(hci_snoop_t *snoop, const uint8_t *packet, uint16_t length, char received,
+			     const struct timespec *timestamp);
+
+/**
+ * @brief Writes the buffered records into the capture file.
+ * @param snoop reference on the recorder.
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int8_t hci_snoop_flush(hci_snoop_t *snoop);
+
+/**
+ * @brief Flushes and closes the capture, then destroys the recorder.
+ * All the sockets opened through it have to be closed beforehand.
+ * @param snoop reference on the recorder.
+ */
+extern void hci_snoop_close(hci_snoop_t *snoop);
+
+#endif // __HCI_SNOOP_H__
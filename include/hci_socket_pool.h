@@ -0,0 +1,133 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file hci_socket_pool.h
+ * @brief Module bluez_tools.hci.hci_socket_pool managing pools of pre-opened HCI sockets.
+ *
+ * A pool opens its sockets once, at its creation. Acquiring and releasing a socket
+ * then neither allocates memory nor performs any system call : the free sockets are
+ * kept in a lock-free stack (Treiber stack) of indexes, whose head is tagged with
+ * a counter to avoid the ABA problem.
+ * Each hci_controller_t owns a pool, used by the functions of the hci_controller
+ * module when no socket is given to them.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_SOCKET_POOL_H__
+#define __HCI_SOCKET_POOL_H__
+
+#include <stdint.h>
+#include "hci_socket.h"
+
+/**
+ * Maximum number of sockets of a pool.
+ */
+#define HCI_SOCKET_POOL_MAX_SIZE 16
+
+/**
+ * Index marking the end of the free list.
+ */
+#define HCI_SOCKET_POOL_END 0xFF
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Pool of HCI sockets.
+ */
+typedef struct hci_socket_pool_t {
+	/**
+	 * Sockets of the pool.
+	 */
+	hci_socket_t sockets[HCI_SOCKET_POOL_MAX_SIZE];
+	/**
+	 * For each free socket, index of the next free socket ({@code HCI_SOCKET_POOL_END}
+	 * for the last one).
+	 */
+	uint8_t next[HCI_SOCKET_POOL_MAX_SIZE];
+	/**
+	 * Head of the free list : index of the first free socket in the lowest byte,
+	 * modification counter in the other ones.
+	 */
+	uint64_t head;
+	/**
+	 * Number of sockets of the pool.
+	 */
+	uint8_t size;
+} hci_socket_pool_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Creates a pool and opens its sockets.
+ * The sockets are opened with an empty filter : nothing is queued on them while
+ * they are not used.
+ * @param pool the pool to initialize.
+ * @param transport transport of the sockets (NULL for BlueZ, @see open_hci_socket_transport).
+ * @param transport_data private data of the transport.
+ * @param controller address of the adapter on which the sockets are opened.
+ * @param size number of sockets (at most {@code HCI_SOCKET_POOL_MAX_SIZE}).
+ * @return the number of opened sockets (which can be lower than {@code size}),
+ * a value < 0 if none could be opened.
+ */
+extern int8_t hci_socket_pool_init(hci_socket_pool_t *pool, const struct hci_transport_t *transport,
+				   void *transport_data, bt_address_t *controller, uint8_t size);
+
+/**
+ * @brief Takes a free socket from a pool. Lock-free, can be called from any thread.
+ * @param pool the pool.
+ * @return a socket for the exclusive use of the caller until it is released,
+ * NULL if all the sockets of the pool are in use.
+ */
+extern hci_socket_t *hci_socket_pool_acquire(hci_socket_pool_t *pool);
+
+/**
+ * @brief Gives a socket back to its pool. Lock-free, can be called from any thread.
+ * The caller should restore the filter it found on the socket before releasing it.
+ * @param pool the pool.
+ * @param hci_socket a socket acquired from this pool.
+ */
+extern void hci_socket_pool_release(hci_socket_pool_t *pool, hci_socket_t *hci_socket);
+
+/**
+ * @brief Indicates whether or not a socket belongs to a pool.
+ * @param pool the pool.
+ * @param hci_socket the socket.
+ * @return 1 if the socket belongs to the pool, 0 otherwise.
+ */
+extern char hci_socket_pool_owns(const hci_socket_pool_t *pool, const hci_socket_t *hci_socket);
+
+/**
+ * @brief Closes all the sockets of a pool. No socket of the pool may be in use.
+ * @param pool the pool.
+ */
+extern void hci_socket_pool_close(hci_socket_pool_t *pool);
+
+#endif // __HCI_SOCKET_POOL_H__
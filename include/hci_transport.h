@@ -0,0 +1,275 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file hci_transport.h
+ * @brief Module bluez_tools.hci.hci_transport defining the interface through which
+ * the HCI I/O of a socket is performed.
+ *
+ * Every hci_socket is bound to a transport. The default one, {@code hci_bluez_transport},
+ * talks to a real adapter through the BlueZ library. Other transports (such as the
+ * simulated controller of the {@code hci_sim} module) allow the upper modules to be
+ * used, tested and benchmarked without any physical adapter.
+ *
+ * Whatever the transport, the {@code sock} field of an opened hci_socket has to be a
+ * file descriptor that can be polled : the events sent by the controller are
+ * made available on it.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_TRANSPORT_H__
+#define __HCI_TRANSPORT_H__
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "hci_socket.h"
+#include "bt_device.h"
+
+struct sock_fprog;
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * HCI transport : set of functions performing the I/O of the sockets bound to it.
+ * Unless stated otherwise, each function returns a value >= 0 upon success and a
+ * value < 0 (with errno set) otherwise.
+ */
+typedef struct hci_transport_t {
+	/**
+	 * Name of the transport (used for display purposes).
+	 */
+	const char *name;
+	/**
+	 * @brief Opens a socket on an adapter. 
+	 * Has to fill the {@code sock} and {@code dev_id} fields of the socket.
+	 * @param hci_socket socket to open, its {@code transport} and {@code transport_data}
+	 * fields are already set.
+	 * @param adapter address of the adapter, NULL for the first available one.
+	 */
+	int8_t (*open)(hci_socket_t *hci_socket, bt_address_t *adapter);
+	/**
+	 * @brief Closes a socket.
+	 */
+	void (*close)(hci_socket_t *hci_socket);
+	/**
+	 * @brief Sends a command without waiting for its completion.
+	 */
+	int (*send_cmd)(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf, uint8_t plen, void *param);
+	/**
+	 * @brief Sends a command and waits for its completion (@see hci_send_req).
+	 */
+	int (*send_req)(hci_socket_t *hci_socket, struct hci_request *rq, int timeout);
+	/**
+	 * @brief Reads one packet (packet type indicator included) from the socket, and
+	 * stores its reception time in the {@code timestamp} field of the socket.
+	 * @return the length of the packet.
+	 */
+	ssize_t (*read)(hci_socket_t *hci_socket, void *buf, size_t length);
+	/**
+	 * @brief Retrieves the filter currently applied to the socket.
+	 */
+	int (*get_filter)(hci_socket_t *hci_socket, struct hci_filter *flt);
+	/**
+	 * @brief Applies a filter to the socket.
+	 */
+	int (*set_filter)(hci_socket_t *hci_socket, const struct hci_filter *flt);
+	/**
+	 * @brief Performs a complete inquiry (@see hci_inquiry).
+	 * @return the number of responses stored inside the table {@code *ii}.
+	 */
+	int (*inquiry)(hci_socket_t *hci_socket, uint8_t duration, uint16_t max_rsp,
+		       inquiry_info **ii, long flags);
+	/**
+	 * @brief Retrieves the information of the adapter (@see hci_devinfo).
+	 */
+	int (*dev_info)(hci_socket_t *hci_socket, struct hci_dev_info *info);
+	/**
+	 * @brief Retrieves the number of events dropped since the socket was opened
+	 * because its reception queue was full.
+	 */
+	int (*get_drops)(hci_socket_t *hci_socket, uint32_t *drops);
+	/**
+	 * @brief Sizes the reception queue of the socket (0 to keep the current size) and
+	 * enables the reporting of its drops, if supported.
+	 * @return the resulting size (in bytes) of the reception queue, < 0 on error.
+	 */
+	int (*set_receive_buffer)(hci_socket_t *hci_socket, int size);
+	/**
+	 * @brief Attaches a BPF program (SO_ATTACH_FILTER) filtering the events received by
+	 * the socket, or detaches the attached one if {@code program} is NULL.
+	 */
+	int (*attach_filter)(hci_socket_t *hci_socket, const struct sock_fprog *program);
+	/**
+	 * @brief Restarts the adapter (powers it off and on again) : its whole configuration
+	 * is lost, but the sockets opened on it stay usable.
+	 */
+	int (*restart)(hci_socket_t *hci_socket);
+} hci_transport_t;
+
+/**
+ * Socket pair used by the transports delivering the events themselves (simulated
+ * controller, replay...) : the user gets one end as the {@code sock} field of its
+ * hci_socket, the transport writes the events into the other one.
+ */
+typedef struct hci_transport_pair_t {
+	/**
+	 * End of the pair kept by the transport, -1 if the slot is free.
+	 */
+	int fd;
+	/**
+	 * End of the pair given to the user.
+	 */
+	int peer;
+	/**
+	 * Filter applied to the socket.
+	 */
+	struct hci_filter filter;
+	/**
+	 * Number of events which could not be written because the reception queue of
+	 * the user end was full.
+	 */
+	uint32_t dropped;
+} hci_transport_pair_t;
+
+//------------------------------------------------------------------------------------
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * Transport using the BlueZ library to communicate with a real adapter.
+ * It is the default transport of the hci_sockets.
+ */
+extern const hci_transport_t hci_bluez_transport;
+
+/**
+ * @brief Generic implementation of the {@code send_req} function of a transport,
+ * relying only on its {@code send_cmd}, {@code read} and filter functions.
+ * It behaves like the BlueZ {@code hci_send_req} function : the command is sent and
+ * the events received on the socket are read until the matching "Command Complete",
+ * "Command Status" or {@code rq->event} event arrives. The filter of the socket is
+ * restored before returning. Unrelated events (such as queued advertising reports)
+ * are skipped until the deadline, instead of after 10 events as BlueZ does.
+ * @param hci_socket socket on which to send the request.
+ * @param rq the request.
+ * @param timeout maximum time (in ms) to wait for the answer, 0 for no limit.
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int hci_transport_generic_send_req(hci_socket_t *hci_socket, struct hci_request *rq, int timeout);
+
+/**
+ * @brief Reads one packet from the descriptor of a socket with {@code recvmsg}, storing
+ * the kernel's reception timestamp in the {@code timestamp} field of the socket. Both the
+ * HCI timestamps ({@code HCI_TIME_STAMP}, raw HCI sockets, microsecond resolution) and
+ * the socket ones ({@code SO_TIMESTAMPNS}, socket pairs) are handled. Without any, the
+ * current time is used. The drop counter reported with the packet ({@code SO_RXQ_OVFL})
+ * is accounted as well (@see hci_transport_account_drops).
+ * @param hci_socket socket to read from.
+ * @param buf reception buffer.
+ * @param length size of the reception buffer.
+ * @return the length of the packet, < 0 if an error occured.
+ */
+extern ssize_t hci_transport_recv(hci_socket_t *hci_socket, void *buf, size_t length);
+
+/**
+ * @brief Updates the {@code dropped} counter of a socket with the drop counter of its
+ * transport (@see hci_transport_t), which only grows while the socket is open.
+ * @param hci_socket the socket.
+ * @param drops current value of the drop counter of the transport.
+ */
+extern void hci_transport_account_drops(hci_socket_t *hci_socket, uint32_t drops);
+
+/**
+ * @brief Marks all the slots of a table of socket pairs as free.
+ * @param pairs table of socket pairs.
+ * @param count size of the table.
+ */
+extern void hci_transport_pairs_init(hci_transport_pair_t *pairs, uint8_t count);
+
+/**
+ * @brief Opens a socket pair in a free slot of the table and fills the {@code sock} 
+ * and {@code dev_id} fields of the given socket. The end kept by the transport is
+ * non-blocking, and the user end timestamps the packets it receives
+ * (@see hci_transport_recv). The table has to be protected by the caller.
+ * @param pairs table of socket pairs.
+ * @param count size of the table.
+ * @param hci_socket socket to open.
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int8_t hci_transport_pair_open(hci_transport_pair_t *pairs, uint8_t count, hci_socket_t *hci_socket);
+
+/**
+ * @brief Retrieves the socket pair whose user end is the given descriptor.
+ * @param pairs table of socket pairs.
+ * @param count size of the table.
+ * @param peer descriptor of the user end.
+ * @return a reference on the pair, NULL if not found.
+ */
+extern hci_transport_pair_t *hci_transport_pair_get(hci_transport_pair_t *pairs, uint8_t count, int peer);
+
+/**
+ * @brief Closes the end of a socket pair kept by the transport and frees its slot.
+ * @param pair the socket pair.
+ */
+extern void hci_transport_pair_close(hci_transport_pair_t *pair);
+
+/**
+ * @brief Sizes the queue of the events written to the user end of a socket pair. With
+ * a pair, the events waiting to be read are accounted to the end kept by the transport :
+ * its send buffer is sized. The table has to be protected by the caller.
+ * @param pair the socket pair.
+ * @param size size (in bytes) of the queue, 0 to keep the current one.
+ * @return the resulting size of the queue, < 0 on error.
+ */
+extern int hci_transport_pair_set_receive_buffer(hci_transport_pair_t *pair, int size);
+
+/**
+ * @brief Attaches a BPF program to the user end of a socket pair, where the kernel
+ * filters the events written by the transport, or detaches the attached one if
+ * {@code program} is NULL. The events dropped by the program aren't counted as dropped.
+ * @param pair the socket pair.
+ * @param program the program, NULL to detach the attached one.
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int hci_transport_pair_attach_filter(hci_transport_pair_t *pair, const struct sock_fprog *program);
+
+/**
+ * @brief Tells whether an event packet passes a socket filter, mimicking the
+ * filtering done by the kernel on raw HCI sockets. Used by the transports
+ * delivering events themselves (simulated controller, replay...).
+ * @param flt filter of the socket.
+ * @param packet event packet (packet type indicator included).
+ * @return 1 if the event has to be delivered to the socket, 0 otherwise.
+ */
+extern char hci_transport_filter_event(struct hci_filter *flt, const uint8_t *packet);
+
+#endif // __HCI_TRANSPORT_H__
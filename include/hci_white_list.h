@@ -0,0 +1,183 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+/**
+ * @file hci_white_list.h
+ * @brief Module bluez_tools.hci.hci_white_list keeping the LE white list of a controller
+ * in sync with a set of devices.
+ *
+ * A white list manager keeps a shadow copy of the controller's white list : setting a
+ * new set of devices only sends the removals and additions needed to go from one list
+ * to the other, pipelined through a command queue (@see hci_cmd_queue.h). When the set
+ * doesn't fit in the controller's white list (whose size is read once, at the
+ * initialization), the manager falls back to host-side filtering : the scan has to
+ * accept every advertiser and the reports are filtered by the batches instead.
+ * {@code
+ * hci_white_list_t white_list;
+ * hci_white_list_init(&white_list, &hci_controller);
+ * hci_white_list_sync(&white_list, tags, nb_tags);
+ * batch.white_list = &white_list;
+ * hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00,
+ *			     hci_white_list_scan_filter_policy(&white_list));
+ * hci_LE_scan_session_read(&session, &batch, NULL, 100); // Only the tags' reports
+ * ...
+ * hci_white_list_destroy(&white_list);
+ * }
+ * Synchronizing a manager needs an idle controller (it is refused while the controller
+ * scans), but it may still be done while batches using it are being filled with the
+ * reports of other controllers : the devices are swapped under the manager's lock,
+ * which the batches take to look a device up.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_WHITE_LIST_H__
+#define __HCI_WHITE_LIST_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include "hci_controller.h"
+
+/**
+ * Maximum size of the white list of a controller (its size is read on 8 bits).
+ */
+#define HCI_WHITE_LIST_MAX_SIZE 255
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Device of a white list.
+ */
+typedef struct hci_white_list_entry_t {
+	bt_address_t mac;
+	uint8_t add_type;
+} hci_white_list_entry_t;
+
+/**
+ * White list manager.
+ */
+typedef struct hci_white_list_t {
+	/**
+	 * Controller whose white list is managed.
+	 */
+	hci_controller_t *hci_controller;
+	/**
+	 * Size of the controller's white list.
+	 */
+	uint8_t capacity;
+	/**
+	 * Shadow copy of the controller's white list (sorted).
+	 */
+	hci_white_list_entry_t shadow[HCI_WHITE_LIST_MAX_SIZE];
+	uint8_t shadow_length;
+	/**
+	 * Devices to accept (sorted, without duplicates). Protected by {@code lock}.
+	 */
+	hci_white_list_entry_t *devices;
+	uint16_t length;
+	uint16_t allocated;
+	/**
+	 * Indicates whether the devices are filtered by the host (1) or by the controller (0).
+	 * Protected by {@code lock}.
+	 */
+	char host_filtering;
+	/**
+	 * Lock taken for reading by the lookups of the batches, and for writing when the
+	 * devices or the shadow copy are replaced.
+	 */
+	pthread_rwlock_t lock;
+} hci_white_list_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Initializes a white list manager : the size of the controller's white list
+ * is read, and the list is cleared so that its content is known. The manager is
+ * registered on the controller, so that its watchdog restores the list after a reset.
+ * @param white_list the manager to initialize.
+ * @param hci_controller an opened controller.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_white_list_init(hci_white_list_t *white_list, hci_controller_t *hci_controller);
+
+/**
+ * @brief Sets the devices to accept. If they fit in the controller's white list, only
+ * the differences with its current content are sent to the controller. Otherwise,
+ * the controller's white list is left as it is and the host filtering is enabled
+ * (it is also enabled if the controller refused some of the devices).
+ * The devices of unknown address type are considered as public ones, and the new
+ * devices are registered (@see bt_register_device).
+ * The controller has to be idle (not scanning) : otherwise, the function fails and
+ * the manager is left untouched. The devices are only replaced once the controller's
+ * white list has been updated, so that both never filter on different lists.
+ * @param white_list an initialized manager.
+ * @param devices table of the devices to accept.
+ * @param length number of devices (if 0, every device is accepted).
+ * @return the number of commands sent to the controller, a value < 0 if an error occured.
+ */
+extern int16_t hci_white_list_sync(hci_white_list_t *white_list, const bt_device_t *devices, uint16_t length);
+
+/**
+ * @brief Writes the shadow copy back into the controller's white list, once the adapter
+ * lost it (@see hci_reset_adapter) : the controller's list is cleared and the devices
+ * of the shadow copy are added again. The devices refused by the controller are then
+ * filtered by the host. Unlike {@code hci_white_list_sync}, the controller isn't
+ * reserved : the caller has to own it (this is used by the watchdog, @see hci_watchdog.h)
+ * and its scan has to be disabled.
+ * @param white_list an initialized manager.
+ * @return the number of devices restored, a value < 0 if an error occured.
+ */
+extern int16_t hci_white_list_restore(hci_white_list_t *white_list);
+
+/**
+ * @brief Gives the scan filter policy to scan with (@see hci_le_set_scan_parameters) :
+ * 0x01 (white list only) if the controller filters the devices, 0x00 (accept all)
+ * otherwise.
+ * @param white_list an initialized manager.
+ * @return the scan filter policy.
+ */
+extern uint8_t hci_white_list_scan_filter_policy(hci_white_list_t *white_list);
+
+/**
+ * @brief Tells whether the reports of a device are to be kept. This is the host-side
+ * filtering, used by the batches (@see hci_report_batch_t). It may be called while
+ * the manager is being synchronized.
+ * @param white_list an initialized manager.
+ * @param mac address of the device.
+ * @return 1 if the device is one of the accepted ones (or if no device was set), 0 otherwise.
+ */
+extern char hci_white_list_accept(hci_white_list_t *white_list, const bt_address_t *mac);
+
+/**
+ * @brief Frees the memory of a white list manager and unregisters it from its controller.
+ * The controller's white list is left as it is.
+ * @param white_list the manager.
+ */
+extern void hci_white_list_destroy(hci_white_list_t *white_list);
+
+#endif // __HCI_WHITE_LIST_H__
@@ -0,0 +1,215 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file reactor.h
+ * @brief Module bluez_tools.misc.reactor implementing an epoll based event loop.
+ *
+ * A reactor watches any number of file descriptors (HCI sockets of several
+ * controllers, L2CAP sockets, timers, ...) in a single epoll set and dispatches
+ * their events to the callbacks they were registered with. One thread can thus
+ * serve several adapters and clients instead of having one thread blocked in a
+ * poll() loop per socket.
+ * {@code
+ * reactor_t reactor;
+ * reactor_init(&reactor);
+ * hci_controller_add_to_reactor(&controller, &reactor, on_hci_event, &ctx);
+ * l2cap_socket_add_to_reactor(&server.socket, &reactor, on_connection, &server);
+ * reactor_run(&reactor); // until reactor_stop(&reactor) is called.
+ * reactor_close(&reactor);
+ * }
+ * The sources are level-triggered : a callback which doesn't consume all the
+ * available data will be called again on the next iteration.
+ * Sources can be added, modified or removed from any thread, including from a
+ * callback (a removed source is never called again, even if it had pending events
+ * in the current iteration).
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/**
+ * Maximum number of events handled by a single iteration of the loop.
+ */
+#define REACTOR_MAX_EVENTS 64
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+struct reactor_t;
+
+/**
+ * @brief Function called when events occur on a registered file descriptor.
+ * @param reactor reactor dispatching the events.
+ * @param fd file descriptor on which the events occured.
+ * @param events epoll events which occured (EPOLLIN, EPOLLOUT, EPOLLHUP, EPOLLERR...).
+ * @param data object owning the file descriptor (hci_socket_t, l2cap_socket_t...),
+ * as given at the registration.
+ * @param user_data user data given at the registration.
+ */
+typedef void (*reactor_callback_t)(struct reactor_t *reactor, int fd, uint32_t events,
+				   void *data, void *user_data);
+
+/**
+ * File descriptor registered in a reactor.
+ */
+typedef struct reactor_source_t {
+	/**
+	 * Watched file descriptor.
+	 */
+	int fd;
+	/**
+	 * Watched epoll events.
+	 */
+	uint32_t events;
+	/**
+	 * Object owning the file descriptor.
+	 */
+	void *data;
+	/**
+	 * Function called upon events.
+	 */
+	reactor_callback_t callback;
+	/**
+	 * User data given to the callback.
+	 */
+	void *user_data;
+	/**
+	 * Indicates that the source was removed and must no longer be dispatched.
+	 */
+	char removed;
+	/**
+	 * Next source (of the registered list or of the removed list).
+	 */
+	struct reactor_source_t *next;
+} reactor_source_t;
+
+/**
+ * Reactor structure.
+ */
+typedef struct reactor_t {
+	/**
+	 * epoll instance.
+	 */
+	int epoll_fd;
+	/**
+	 * eventfd used to wake the loop up (@see reactor_stop).
+	 */
+	int wakeup_fd;
+	/**
+	 * Protects the lists of sources.
+	 */
+	pthread_mutex_t mutex;
+	/**
+	 * Registered sources.
+	 */
+	reactor_source_t *sources;
+	/**
+	 * Removed sources, released at the end of the current iteration.
+	 */
+	reactor_source_t *removed;
+	/**
+	 * Number of registered sources.
+	 */
+	uint16_t nb_sources;
+	/**
+	 * Indicates whether or not {@code reactor_run} should keep looping.
+	 */
+	volatile char running;
+} reactor_t;
+
+/**
+ * @brief Initializes a reactor.
+ * @param reactor the reactor to initialize.
+ * @return 0 on success, -1 otherwise.
+ */
+extern int8_t reactor_init(reactor_t *reactor);
+
+/**
+ * @brief Registers a file descriptor in a reactor.
+ * @param reactor the reactor.
+ * @param fd the file descriptor to watch. It can only be registered once.
+ * @param events the epoll events to watch (typically EPOLLIN).
+ * @param data object owning the file descriptor, given back to the callback.
+ * @param callback function to call upon events.
+ * @param user_data user data given back to the callback.
+ * @return 0 on success, -1 otherwise.
+ */
+extern int8_t reactor_add(reactor_t *reactor, int fd, uint32_t events, void *data,
+			  reactor_callback_t callback, void *user_data);
+
+/**
+ * @brief Changes the events watched on a registered file descriptor.
+ * @param reactor the reactor.
+ * @param fd the registered file descriptor.
+ * @param events the new epoll events to watch.
+ * @return 0 on success, -1 otherwise.
+ */
+extern int8_t reactor_modify(reactor_t *reactor, int fd, uint32_t events);
+
+/**
+ * @brief Unregisters a file descriptor from a reactor. This function must be
+ * called BEFORE closing the file descriptor.
+ * @param reactor the reactor.
+ * @param fd the registered file descriptor.
+ * @return 0 on success, -1 otherwise.
+ */
+extern int8_t reactor_remove(reactor_t *reactor, int fd);
+
+/**
+ * @brief Performs a single iteration of the loop : waits for events and dispatches them.
+ * @param reactor the reactor.
+ * @param timeout maximum time to wait for events in ms (-1 to wait indefinitely).
+ * @return the number of dispatched events (0 on timeout or wake up), -1 on error.
+ */
+extern int16_t reactor_dispatch(reactor_t *reactor, int timeout);
+
+/**
+ * @brief Dispatches the events until {@code reactor_stop} is called.
+ * @param reactor the reactor.
+ * @return 0 if the reactor was stopped, -1 on error.
+ */
+extern int8_t reactor_run(reactor_t *reactor);
+
+/**
+ * @brief Stops a running reactor. Can be called from any thread or from a callback.
+ * @param reactor the reactor.
+ */
+extern void reactor_stop(reactor_t *reactor);
+
+/**
+ * @brief Releases a reactor. The registered file descriptors are NOT closed.
+ * Must not be called while the reactor is running.
+ * @param reactor the reactor.
+ */
+extern void reactor_close(reactor_t *reactor);
+
+#endif // __REACTOR_H__
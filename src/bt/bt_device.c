@@ -24,6 +24,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "cfuhash.h"
 
 /**
@@ -31,6 +32,18 @@
  */
 static cfuhash_table_t *bt_devices_table = NULL;
 
+/**
+ * Mutex making the registration of a device (and of its RSSI ring) atomic.
+ */
+static pthread_mutex_t bt_devices_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//------------------------------------------------------------------------------------
+
+static void bt_device_free(void *device) {
+	bt_rssi_ring_destroy(((bt_device_t *)device)->rssi_ring);
+	free(device);
+}
+
 //------------------------------------------------------------------------------------
 
 char bt_compare_addresses(const bt_address_t *a1, const bt_address_t *a2) {
@@ -63,7 +76,14 @@ bt_device_t *bt_register_device(bt_device_t bt_device) {
 	bt_device_t *tmp = malloc(sizeof(bt_device_t));
 	memcpy(tmp, &bt_device, sizeof(bt_device_t));
 
-	return (bt_device_t *)cfuhash_put(bt_devices_table, string_add, (void *)tmp);
+	// The RSSI samples of a device survive its re-registration :
+	pthread_mutex_lock(&bt_devices_mutex);
+	bt_device_t *old = (bt_device_t *)cfuhash_get(bt_devices_table, string_add);
+	tmp->rssi_ring = (old ? old->rssi_ring : bt_rssi_ring_create());
+	old = (bt_device_t *)cfuhash_put(bt_devices_table, string_add, (void *)tmp);
+	pthread_mutex_unlock(&bt_devices_mutex);
+
+	return old;
 } 
 
 //------------------------------------------------------------------------------------
@@ -86,9 +106,58 @@ bt_device_t bt_get_device(bt_address_t add) {
 
 //------------------------------------------------------------------------------------
 
+bt_device_t *bt_get_device_ref(bt_address_t add) {
+	if (!bt_devices_table) {
+		bt_devices_table = cfuhash_new_with_initial_size(200);
+	}
+
+	char string_add[18]; 
+	memset(string_add, 0, 18);
+	ba2str((const bt_address_t *)&(add), string_add);
+
+	return (bt_device_t *)cfuhash_get(bt_devices_table, string_add);
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t bt_device_push_RSSI(bt_address_t add, const bt_rssi_sample_t *sample) {
+	bt_device_t *device = bt_get_device_ref(add);
+	if (!device || !device->rssi_ring) {
+		return -1;
+	}
+	bt_rssi_ring_push(device->rssi_ring, sample);
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+uint16_t bt_device_get_RSSI_samples(bt_address_t add, bt_rssi_sample_t *samples, uint16_t max) {
+	bt_device_t *device = bt_get_device_ref(add);
+	if (!device || !device->rssi_ring) {
+		return 0;
+	}
+	return bt_rssi_ring_read_latest(device->rssi_ring, samples, max);
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t bt_device_set_real_name(bt_address_t add, const char *name) {
+	pthread_mutex_lock(&bt_devices_mutex);
+	bt_device_t *device = bt_get_device_ref(add);
+	if (device) {
+		strncpy(device->real_name, name, BT_NAME_LENGTH - 1);
+		device->real_name[BT_NAME_LENGTH - 1] = '\0';
+	}
+	pthread_mutex_unlock(&bt_devices_mutex);
+
+	return (device ? 0 : -1);
+}
+
+//------------------------------------------------------------------------------------
+
 void bt_destroy_device_table(void) {
 	if (bt_devices_table) {
-		cfuhash_destroy_with_free_fn(bt_devices_table, free);
+		cfuhash_destroy_with_free_fn(bt_devices_table, bt_device_free);
 	}
 	bt_devices_table = NULL;
 }
@@ -112,6 +181,7 @@ bt_device_t bt_device_create(bt_address_t mac, bt_address_type_t add_type,
 	}
 
 	bt_register_device(res);
+	res.rssi_ring = bt_get_device_ref(mac)->rssi_ring;
 
 	return res;
 }		
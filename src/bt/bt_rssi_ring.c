@@ -0,0 +1,116 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+#include "bt_rssi_ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BT_RSSI_RING_MASK (BT_RSSI_RING_SIZE - 1)
+
+//------------------------------------------------------------------------------------
+
+/* Static function reading the n-th sample of a ring. 
+   Returns 1 if the sample has been read, 0 if it has already been overwritten
+   and -1 if it is still being written.
+*/
+static inline int8_t bt_rssi_ring_read_slot(const bt_rssi_ring_t *ring, uint64_t n, bt_rssi_sample_t *sample) {
+	const bt_rssi_slot_t *slot = &(ring->slots[n & BT_RSSI_RING_MASK]);
+	uint64_t expected = 2*(n+1);
+
+	uint64_t seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+	if (seq != expected) {
+		return (seq < expected ? -1 : 0);
+	}
+	memcpy(sample, &(slot->sample), sizeof(bt_rssi_sample_t));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	// The writer may have started overwriting the slot during the copy :
+	return (__atomic_load_n(&(slot->seq), __ATOMIC_RELAXED) == expected);
+}
+
+//------------------------------------------------------------------------------------
+
+bt_rssi_ring_t *bt_rssi_ring_create(void) {
+	return calloc(1, sizeof(bt_rssi_ring_t));
+}
+
+//------------------------------------------------------------------------------------
+
+void bt_rssi_ring_destroy(bt_rssi_ring_t *ring) {
+	free(ring);
+}
+
+//------------------------------------------------------------------------------------
+
+void bt_rssi_ring_push(bt_rssi_ring_t *ring, const bt_rssi_sample_t *sample) {
+	uint64_t n = __atomic_fetch_add(&(ring->head), 1, __ATOMIC_RELAXED);
+	bt_rssi_slot_t *slot = &(ring->slots[n & BT_RSSI_RING_MASK]);
+
+	__atomic_store_n(&(slot->seq), 2*n+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&(slot->sample), sample, sizeof(bt_rssi_sample_t));
+	__atomic_store_n(&(slot->seq), 2*(n+1), __ATOMIC_RELEASE);
+}
+
+//------------------------------------------------------------------------------------
+
+uint16_t bt_rssi_ring_read_latest(const bt_rssi_ring_t *ring, bt_rssi_sample_t *samples, uint16_t max) {
+	uint64_t position = bt_rssi_ring_position(ring);
+	
+	if (max > BT_RSSI_RING_SIZE) {
+		max = BT_RSSI_RING_SIZE;
+	}
+	position = (position > max ? position - max : 0);
+
+	return bt_rssi_ring_read_since(ring, &position, samples, max);
+}
+
+//------------------------------------------------------------------------------------
+
+uint16_t bt_rssi_ring_read_since(const bt_rssi_ring_t *ring, uint64_t *position,
+				 bt_rssi_sample_t *samples, uint16_t max) {
+	uint64_t head = bt_rssi_ring_position(ring);
+	uint64_t n = *position;
+	uint16_t count = 0;
+
+	// Samples older than the ring's capacity have been overwritten :
+	if (head > BT_RSSI_RING_SIZE && n < head - BT_RSSI_RING_SIZE) {
+		n = head - BT_RSSI_RING_SIZE;
+	}
+
+	for (; n < head && count < max; n++) {
+		int8_t status = bt_rssi_ring_read_slot(ring, n, &(samples[count]));
+		if (status < 0) { // We'll read it next time.
+			break;
+		}
+		count += status;
+	}
+	*position = n;
+
+	return count;
+}
+
+//------------------------------------------------------------------------------------
+
+uint64_t bt_rssi_ring_position(const bt_rssi_ring_t *ring) {
+	return __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+}
@@ -38,6 +38,7 @@
 
 #include <stdint.h>
 #include <bluetooth/bluetooth.h>
+#include "bt_rssi_ring.h"
 
 /** Max length of a stroed name */
 #define BT_NAME_LENGTH 50 
@@ -75,6 +76,13 @@ typedef struct {
 	char real_name[BT_NAME_LENGTH]; 
 	/** User-friendly name of the device.*/
 	char custom_name[BT_NAME_LENGTH]; 
+	/** 
+	 * Latest RSSI samples received from the device. The ring is owned by
+	 * the registered device : it is allocated by {@code bt_register_device},
+	 * kept when the device is registered again and freed by
+	 * {@code bt_destroy_device_table}. NULL for a non-registered device.
+	 */
+	bt_rssi_ring_t *rssi_ring;
 } bt_device_t;
 
 /** 
@@ -131,6 +139,44 @@ extern bt_device_t *bt_register_device(bt_device_t bt_device);
  */
 extern bt_device_t bt_get_device(bt_address_t add);
 
+/**
+ * @brief Returns a reference on the stored device corresponding to the given address.
+ * Unlike {@code bt_get_device}, no copy is made : the reference stays valid until
+ * the device table is destroyed or the device registered again.
+ * @param add address of the device to retrieve.
+ * @return a reference on the device corresponding to the given address if any. Returns
+ * NULL otherwise.
+ */
+extern bt_device_t *bt_get_device_ref(bt_address_t add);
+
+/**
+ * @brief Appends an RSSI sample to the ring of a registered device.
+ * @param add address of the device.
+ * @param sample sample to append.
+ * @return 0 on success, < 0 if the device isn't registered.
+ */
+extern int8_t bt_device_push_RSSI(bt_address_t add, const bt_rssi_sample_t *sample);
+
+/**
+ * @brief Copies the latest RSSI samples of a registered device, from the oldest to the newest.
+ * This function doesn't take any lock on the samples : it can be called by any number
+ * of threads while the scanning code keeps feeding the device's ring.
+ * @param add address of the device.
+ * @param samples table receiving the samples.
+ * @param max maximum number of samples to read.
+ * @return the number of samples copied inside {@code samples}.
+ */
+extern uint16_t bt_device_get_RSSI_samples(bt_address_t add, bt_rssi_sample_t *samples, uint16_t max);
+
+/**
+ * @brief Sets the real name of a registered device (used to fill in the names
+ * resolved in the background, @see hci_name_resolver.h).
+ * @param add address of the device.
+ * @param name the name.
+ * @return 0 on success, < 0 if the device isn't registered.
+ */
+extern int8_t bt_device_set_real_name(bt_address_t add, const char *name);
+
 /**
  * @brief Function used to destroy and free the structure containing the
  * (@, bt_device) couples.
@@ -0,0 +1,139 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file bt_rssi_ring.h
+ * @brief Module bluez_tools.bt.bt_rssi_ring providing fixed-size rings of
+ * RSSI samples.
+ *
+ * Each registered device owns such a ring : the scanning code appends the RSSI
+ * values it receives to it while any number of threads read it concurrently.
+ * Neither the writer nor the readers take any lock : each slot carries a sequence
+ * number allowing the readers to detect (and skip) a slot being overwritten.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __BT_RSSI_RING_H__
+#define __BT_RSSI_RING_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/** Number of samples kept in a ring (has to be a power of 2). */
+#define BT_RSSI_RING_SIZE 64
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/** RSSI sample. */
+typedef struct bt_rssi_sample_t {
+	/** Time at which the sample has been received. */
+	struct timespec timestamp;
+	/** RSSI value in dBm. */
+	int8_t rssi;
+} bt_rssi_sample_t;
+
+/** Slot of a ring : a sample and its sequence number. */
+typedef struct bt_rssi_slot_t {
+	/** 
+	 * 2*(n+1) once the n-th sample of the ring has been written in this slot,
+	 * odd while a sample is being written.
+	 */
+	uint64_t seq;
+	/** Stored sample. */
+	bt_rssi_sample_t sample;
+} bt_rssi_slot_t;
+
+/** Ring of RSSI samples. */
+typedef struct bt_rssi_ring_t {
+	/** Number of samples ever appended to the ring. */
+	uint64_t head;
+	/** Storage of the samples. */
+	bt_rssi_slot_t slots[BT_RSSI_RING_SIZE];
+} bt_rssi_ring_t;
+
+//------------------------------------------------------------------------------------
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Creates a new empty ring.
+ * @return the newly allocated ring, NULL if the allocation failed.
+ */
+extern bt_rssi_ring_t *bt_rssi_ring_create(void);
+
+/**
+ * @brief Destroys a ring. No thread should use it anymore.
+ * @param ring ring to destroy.
+ */
+extern void bt_rssi_ring_destroy(bt_rssi_ring_t *ring);
+
+/**
+ * @brief Appends a sample to a ring, overwriting the oldest one if the ring is full.
+ * Rings are meant to be fed by a single thread, although concurrent writers
+ * only result in one of the samples being dropped.
+ * @param ring ring to feed.
+ * @param sample sample to append.
+ */
+extern void bt_rssi_ring_push(bt_rssi_ring_t *ring, const bt_rssi_sample_t *sample);
+
+/**
+ * @brief Copies the latest samples of a ring, from the oldest to the newest.
+ * A slot being written while it is read is skipped.
+ * @param ring ring to read.
+ * @param samples table receiving the samples.
+ * @param max maximum number of samples to read.
+ * @return the number of samples copied inside {@code samples}.
+ */
+extern uint16_t bt_rssi_ring_read_latest(const bt_rssi_ring_t *ring, bt_rssi_sample_t *samples, uint16_t max);
+
+/**
+ * @brief Copies the samples appended to a ring since a given position, from the oldest to
+ * the newest, allowing a reader to consume each sample once.
+ * The position has to be initialized to 0 (or to the value returned by
+ * {@code bt_rssi_ring_position}) and is updated by the function. If the reader is too
+ * slow and the ring has been overwritten, the lost samples are skipped.
+ * @param ring ring to read.
+ * @param position position of the next sample to read, updated by the function.
+ * @param samples table receiving the samples.
+ * @param max maximum number of samples to read.
+ * @return the number of samples copied inside {@code samples}.
+ */
+extern uint16_t bt_rssi_ring_read_since(const bt_rssi_ring_t *ring, uint64_t *position,
+					bt_rssi_sample_t *samples, uint16_t max);
+
+/**
+ * @brief Returns the current position of a ring, i.e the number of samples
+ * ever appended to it.
+ * @param ring ring to check.
+ * @return the position of the next sample to be written.
+ */
+extern uint64_t bt_rssi_ring_position(const bt_rssi_ring_t *ring);
+
+#endif // __BT_RSSI_RING_H__
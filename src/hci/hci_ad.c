@@ -0,0 +1,239 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_ad.h"
+#include "trace.h"
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * 16 bytes vector (GCC vector extension) : the patterns are compared by halves of
+ * {@code HCI_AD_PATTERN_SIZE} bytes.
+ */
+typedef uint64_t hci_ad_vector_t __attribute__((vector_size(16)));
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline hci_ad_vector_t hci_ad_load(const uint8_t *bytes) {
+	hci_ad_vector_t res;
+	memcpy(&res, bytes, sizeof(res));
+	return res;
+}
+
+//---------------------------------
+
+/* Static function testing the value of a structure (copied at the beginning of a null
+   padded buffer of HCI_AD_PATTERN_SIZE bytes) against the patterns of its type.
+*/
+static int16_t hci_ad_match_structure(const hci_ad_matcher_t *matcher, uint8_t type, uint8_t length,
+				      const uint8_t *value) {
+	hci_ad_vector_t low = hci_ad_load(value);
+	hci_ad_vector_t high = hci_ad_load(value + sizeof(hci_ad_vector_t));
+
+	for (int8_t i = matcher->first[type]; i >= 0; i = matcher->patterns[i].next) {
+		const hci_ad_pattern_t *pattern = &(matcher->patterns[i]);
+		if (pattern->length > length) {
+			continue;
+		}
+		hci_ad_vector_t diff = ((low & hci_ad_load(pattern->mask)) ^ hci_ad_load(pattern->bytes)) |
+			((high & hci_ad_load(pattern->mask + sizeof(hci_ad_vector_t))) ^
+			 hci_ad_load(pattern->bytes + sizeof(hci_ad_vector_t)));
+		if (!(diff[0] | diff[1])) {
+			return i;
+		}
+	}
+
+	return HCI_AD_NO_MATCH;
+}
+
+/*----------------------
+  - ITERATOR FUNCTIONS -
+  ----------------------*/
+
+void hci_ad_iterator_init(hci_ad_iterator_t *it, const uint8_t *data, uint16_t length) {
+	it->cursor = data;
+	it->end = (data ? data + length : NULL);
+}
+
+//------------------------------------------------------------------------------------
+
+char hci_ad_iterator_next(hci_ad_iterator_t *it, hci_ad_structure_t *ad) {
+	if (!it->cursor || it->cursor >= it->end) {
+		return 0;
+	}
+
+	uint8_t length = it->cursor[0];
+	// A null length ends the significant part of the data :
+	if (!length || it->end - it->cursor < 1 + (ptrdiff_t)length) {
+		it->cursor = it->end;
+		return 0;
+	}
+
+	ad->type = it->cursor[1];
+	ad->length = length - 1;
+	ad->value = (ad->length ? it->cursor + 2 : NULL);
+	it->cursor += 1 + length;
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------------
+
+char hci_ad_find(const uint8_t *data, uint16_t length, uint8_t type, hci_ad_structure_t *ad) {
+	hci_ad_iterator_t it;
+	hci_ad_iterator_init(&it, data, length);
+	while (hci_ad_iterator_next(&it, ad)) {
+		if (ad->type == type) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*---------------------
+  - MATCHER FUNCTIONS -
+  ---------------------*/
+
+void hci_ad_matcher_init(hci_ad_matcher_t *matcher) {
+	memset(matcher, 0, sizeof(hci_ad_matcher_t));
+	memset(matcher->first, -1, sizeof(matcher->first));
+	memset(matcher->last, -1, sizeof(matcher->last));
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_ad_matcher_add(hci_ad_matcher_t *matcher, uint8_t type, const uint8_t *bytes,
+			   const uint8_t *mask, uint8_t length) {
+	if (!matcher || (length && !bytes) || length > HCI_AD_PATTERN_SIZE) {
+		print_trace(TRACE_ERROR, "hci_ad_matcher_add : invalid pattern.\n");
+		return -1;
+	}
+	if (matcher->nb_patterns >= HCI_AD_MATCHER_MAX_PATTERNS) {
+		print_trace(TRACE_ERROR, "hci_ad_matcher_add : too many patterns.\n");
+		return -1;
+	}
+
+	int8_t index = matcher->nb_patterns++;
+	hci_ad_pattern_t *pattern = &(matcher->patterns[index]);
+	memset(pattern, 0, sizeof(hci_ad_pattern_t));
+	for (uint8_t i = 0; i < length; i++) {
+		pattern->mask[i] = (mask ? mask[i] : 0xFF);
+		pattern->bytes[i] = bytes[i] & pattern->mask[i];
+	}
+	pattern->type = type;
+	pattern->length = length;
+	pattern->next = -1;
+
+	if (matcher->last[type] >= 0) {
+		matcher->patterns[matcher->last[type]].next = index;
+	} else {
+		matcher->first[type] = index;
+	}
+	matcher->last[type] = index;
+
+	return index;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_ad_matcher_add_ibeacon(hci_ad_matcher_t *matcher, const uint8_t *uuid) {
+	uint8_t bytes[20] = {0x4C, 0x00, 0x02, 0x15};
+	uint8_t mask[20] = {0xFF, 0xFF, 0xFF, 0xFF};
+	if (uuid) {
+		memcpy(bytes + 4, uuid, 16);
+		memset(mask + 4, 0xFF, 16);
+	}
+	return hci_ad_matcher_add(matcher, HCI_AD_MANUFACTURER_DATA, bytes, mask, (uuid ? 20 : 4));
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_ad_matcher_add_eddystone(hci_ad_matcher_t *matcher, uint8_t frame_type,
+				     const uint8_t *namespace_id) {
+	// UUID 0xFEAA, frame type, Tx power (ignored), namespace :
+	uint8_t bytes[14] = {0xAA, 0xFE, frame_type};
+	uint8_t mask[14] = {0xFF, 0xFF, 0xFF};
+	if (namespace_id) {
+		memcpy(bytes + 4, namespace_id, 10);
+		memset(mask + 4, 0xFF, 10);
+	}
+	return hci_ad_matcher_add(matcher, HCI_AD_SERVICE_DATA_UUID16, bytes, mask, (namespace_id ? 14 : 3));
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_ad_matcher_add_manufacturer(hci_ad_matcher_t *matcher, uint16_t company_id,
+					const uint8_t *data, uint8_t length) {
+	if (length > HCI_AD_PATTERN_SIZE - 2 || (length && !data)) {
+		print_trace(TRACE_ERROR, "hci_ad_matcher_add_manufacturer : invalid data.\n");
+		return -1;
+	}
+	uint8_t bytes[HCI_AD_PATTERN_SIZE];
+	bytes[0] = company_id & 0xFF; // Little endian
+	bytes[1] = company_id >> 8;
+	if (length) {
+		memcpy(bytes + 2, data, length);
+	}
+	return hci_ad_matcher_add(matcher, HCI_AD_MANUFACTURER_DATA, bytes, NULL, length + 2);
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_ad_matcher_match(const hci_ad_matcher_t *matcher, const uint8_t *data, uint16_t length) {
+	uint8_t value[HCI_AD_PATTERN_SIZE] __attribute__((aligned(16)));
+	hci_ad_iterator_t it;
+	hci_ad_structure_t ad;
+
+	hci_ad_iterator_init(&it, data, length);
+	while (hci_ad_iterator_next(&it, &ad)) {
+		if (matcher->first[ad.type] < 0) {
+			continue;
+		}
+		uint8_t size = (ad.length < HCI_AD_PATTERN_SIZE ? ad.length : HCI_AD_PATTERN_SIZE);
+		memset(value, 0, sizeof(value));
+		if (size) {
+			memcpy(value, ad.value, size);
+		}
+		int16_t res = hci_ad_match_structure(matcher, ad.type, ad.length, value);
+		if (res != HCI_AD_NO_MATCH) {
+			return res;
+		}
+	}
+
+	return HCI_AD_NO_MATCH;
+}
+
+//------------------------------------------------------------------------------------
+
+uint16_t hci_ad_matcher_classify(const hci_ad_matcher_t *matcher, const hci_report_batch_t *batch,
+				 int16_t *classes) {
+	uint16_t matched = 0;
+	for (uint16_t i = 0; i < batch->length; i++) {
+		classes[i] = hci_ad_matcher_match(matcher, batch->reports[i].data, batch->reports[i].data_length);
+		if (classes[i] != HCI_AD_NO_MATCH) {
+			matched++;
+		}
+	}
+	return matched;
+}
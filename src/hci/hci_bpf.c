@@ -0,0 +1,272 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_bpf.h"
+#include "hci_report.h"
+#include "hci_transport.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Return values of the programs : the whole packet is kept, or dropped.
+ */
+#define HCI_BPF_ACCEPT 0xFFFFFFFF
+#define HCI_BPF_REJECT 0
+
+/**
+ * Offsets (packet type indicator included) of the address and of the advertising
+ * data of the first report of the events, when it is the only one.
+ */
+#define HCI_BPF_LE_ADDRESS 7
+#define HCI_BPF_LE_DATA 14
+#define HCI_BPF_LE_EXT_ADDRESS 8
+#define HCI_BPF_LE_EXT_DATA 29
+#define HCI_BPF_INQUIRY_ADDRESS 4
+
+/**
+ * Number of UUIDs of a list compared with the searched one.
+ */
+#define HCI_BPF_UUIDS 3
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline void hci_bpf_emit(hci_bpf_program_t *program, struct sock_filter instruction) {
+	program->instructions[program->length++] = instruction;
+}
+
+//---------------------------------
+
+/* Static function emitting a jump to an instruction not emitted yet. Returns the
+   index of the jump, to be given to "hci_bpf_land" once the target is reached.
+*/
+static inline uint16_t hci_bpf_jump(hci_bpf_program_t *program) {
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA, 0, 0, 0));
+	return program->length - 1;
+}
+
+//---------------------------------
+
+static inline void hci_bpf_land(hci_bpf_program_t *program, uint16_t jump) {
+	program->instructions[jump].k = program->length - jump - 1;
+}
+
+//---------------------------------
+
+/* Static function emitting the dispatch of a report event : the events carrying several
+   reports are accepted, otherwise the offset of the advertising data is stored in M[0]
+   (0 for a classic inquiry) and the one of the address in X. Returns the index of the
+   jump to the address matching.
+*/
+static uint16_t hci_bpf_emit_report(hci_bpf_program_t *program, uint32_t num_offset, uint32_t address_offset,
+				    uint32_t data_offset) {
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, num_offset));
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 1, 0));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_ACCEPT));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_IMM, data_offset));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_ST, 0));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LDX | BPF_IMM, address_offset));
+	return hci_bpf_jump(program);
+}
+
+//---------------------------------
+
+/* Static function emitting the matching of one AD structure, starting at offset X, with
+   the "Manufacturer Specific Data" and 16-bit UUID lists criteria. X then goes to the
+   next structure. The reading beyond the packet ends the program (rejecting it).
+*/
+static void hci_bpf_emit_ad_structure(hci_bpf_program_t *program, const hci_bpf_match_t *match) {
+	if (match->match_company) {
+		// The identifier is little endian, the loads are big endian :
+		uint16_t company = (uint16_t)((match->company_id << 8) | (match->company_id >> 8));
+		hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_IND, 1));
+		hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xFF, 0, 3));
+		hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2));
+		hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, company, 0, 1));
+		hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_ACCEPT));
+	}
+
+	if (match->match_uuid16) {
+		uint16_t uuid = (uint16_t)((match->uuid16 << 8) | (match->uuid16 >> 8));
+		hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_IND, 1));
+		hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x02, 1, 0));
+		hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x03, 0,
+								   5 * HCI_BPF_UUIDS));
+		for (uint8_t i = 0; i < HCI_BPF_UUIDS; i++) {
+			// The list has to be long enough (its length byte counts the type) :
+			hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0));
+			hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 2 * i + 3, 0,
+									   3 + 5 * (HCI_BPF_UUIDS - i - 1)));
+			hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2 + 2 * i));
+			hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, uuid, 0, 1));
+			hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_ACCEPT));
+		}
+	}
+
+	// Next structure (a null length ends the data) :
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0));
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_REJECT));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 1));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0));
+}
+
+/*-----------------
+  - BPF FUNCTIONS -
+  -----------------*/
+
+int8_t hci_bpf_compile(hci_bpf_program_t *program, const hci_bpf_match_t *match) {
+	if (!program || !match || (match->nb_addresses && !match->addresses)) {
+		print_trace(TRACE_ERROR, "hci_bpf_compile : invalid arguments.\n");
+		return -1;
+	}
+	memset(program, 0, sizeof(hci_bpf_program_t));
+
+	char match_data = match->match_company || match->match_uuid16;
+	if (!match->nb_addresses && !match_data) {
+		print_trace(TRACE_ERROR, "hci_bpf_compile : no criterion.\n");
+		return -1;
+	}
+	if (match->nb_addresses > HCI_BPF_MAX_ADDRESSES) {
+		print_trace(TRACE_ERROR, "hci_bpf_compile : too many addresses (%u, at most %u).\n",
+			    match->nb_addresses, HCI_BPF_MAX_ADDRESSES);
+		return -1;
+	}
+
+	// Upper bound of the number of instructions :
+	uint32_t size = 64 + 5 * match->nb_addresses + HCI_BPF_AD_STRUCTURES * (5 + 3 + 5 * HCI_BPF_UUIDS + 6);
+	program->instructions = calloc(size, sizeof(struct sock_filter));
+	if (!program->instructions) {
+		perror("hci_bpf_compile");
+		return -1;
+	}
+
+	// Dispatch on the event code (the other events pass) :
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1));
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, EVT_LE_META_EVENT, 0, 1));
+	uint16_t to_le = hci_bpf_jump(program);
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, EVT_INQUIRY_RESULT, 2, 0));
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+							   EVT_INQUIRY_RESULT_WITH_RSSI, 1, 0));
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+							   EVT_EXTENDED_INQUIRY_RESULT, 0, 1));
+	uint16_t to_inquiry = hci_bpf_jump(program);
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_ACCEPT));
+
+	hci_bpf_land(program, to_le);
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 3));
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, EVT_LE_ADVERTISING_REPORT, 0, 1));
+	uint16_t to_legacy = hci_bpf_jump(program);
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, EVT_LE_EXT_ADVERTISING_REPORT, 0, 1));
+	uint16_t to_extended = hci_bpf_jump(program);
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_ACCEPT));
+
+	hci_bpf_land(program, to_legacy);
+	uint16_t legacy_to_addresses = hci_bpf_emit_report(program, 4, HCI_BPF_LE_ADDRESS, HCI_BPF_LE_DATA);
+	hci_bpf_land(program, to_extended);
+	uint16_t extended_to_addresses = hci_bpf_emit_report(program, 4, HCI_BPF_LE_EXT_ADDRESS, HCI_BPF_LE_EXT_DATA);
+	hci_bpf_land(program, to_inquiry);
+	uint16_t inquiry_to_addresses = hci_bpf_emit_report(program, 3, HCI_BPF_INQUIRY_ADDRESS, 0);
+
+	/* Addresses (at offset X) : the address is stored little endian in the event, and
+	   loaded big endian, as a word followed by a half word.
+	*/
+	hci_bpf_land(program, legacy_to_addresses);
+	hci_bpf_land(program, extended_to_addresses);
+	hci_bpf_land(program, inquiry_to_addresses);
+	for (uint16_t i = 0; i < match->nb_addresses; i++) {
+		const uint8_t *b = match->addresses[i].b;
+		uint32_t word = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+		uint32_t half = ((uint32_t)b[4] << 8) | b[5];
+		hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_IND, 0));
+		hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, word, 0, 3));
+		hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4));
+		hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, half, 0, 1));
+		hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_ACCEPT));
+	}
+
+	if (!match_data) {
+		hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_REJECT));
+		return 0;
+	}
+
+	// Advertising data (at offset M[0]), which a classic inquiry result doesn't have :
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_LD | BPF_MEM, 0));
+	hci_bpf_emit(program, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_ACCEPT));
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0));
+	for (uint8_t i = 0; i < HCI_BPF_AD_STRUCTURES; i++) {
+		hci_bpf_emit_ad_structure(program, match);
+	}
+	hci_bpf_emit(program, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, HCI_BPF_REJECT));
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_bpf_free(hci_bpf_program_t *program) {
+	if (!program) {
+		return;
+	}
+	free(program->instructions);
+	memset(program, 0, sizeof(hci_bpf_program_t));
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_bpf_attach(hci_socket_t *hci_socket, const hci_bpf_program_t *program) {
+	if (!hci_socket || hci_socket->sock < 0 || !program || !program->length) {
+		print_trace(TRACE_ERROR, "hci_bpf_attach : invalid arguments.\n");
+		return -1;
+	}
+
+	struct sock_fprog fprog;
+	fprog.len = program->length;
+	fprog.filter = program->instructions;
+	if (hci_socket->transport->attach_filter(hci_socket, &fprog) < 0) {
+		perror("hci_bpf_attach");
+		return -1;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_bpf_detach(hci_socket_t *hci_socket) {
+	if (!hci_socket || hci_socket->sock < 0) {
+		print_trace(TRACE_ERROR, "hci_bpf_detach : invalid socket reference.\n");
+		return -1;
+	}
+
+	if (hci_socket->transport->attach_filter(hci_socket, NULL) < 0) {
+		perror("hci_bpf_detach");
+		return -1;
+	}
+
+	return 0;
+}
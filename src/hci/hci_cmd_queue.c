@@ -0,0 +1,450 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_cmd_queue.h"
+#include "trace.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline void hci_cmd_append(hci_cmd_t **head, hci_cmd_t **tail, hci_cmd_t *cmd) {
+	cmd->next = NULL;
+	if (*tail) {
+		(*tail)->next = cmd;
+	} else {
+		*head = cmd;
+	}
+	*tail = cmd;
+}
+
+//---------------------------------
+
+static inline void hci_cmd_fail(hci_cmd_t *cmd, int error) {
+	cmd->result = -1;
+	cmd->error = error;
+}
+
+//---------------------------------
+
+/* Completes a list of commands : their callbacks are called, then they are marked as done
+   (after which their memory can be released by the caller). The mutex must not be held,
+   since a callback can submit new commands.
+*/
+static void hci_cmd_complete_list(hci_cmd_queue_t *queue, hci_cmd_t *list) {
+	while (list) {
+		hci_cmd_t *cmd = list;
+		list = list->next;
+		cmd->next = NULL;
+		if (cmd->callback) {
+			cmd->callback(cmd, cmd->user_data);
+		}
+		pthread_mutex_lock(&(queue->mutex));
+		cmd->done = 1;
+		queue->in_flight--;
+		pthread_cond_broadcast(&(queue->cond));
+		pthread_mutex_unlock(&(queue->mutex));
+	}
+}
+
+//---------------------------------
+
+/* Sends the pending commands as long as the controller has credits. The commands which
+   couldn't be sent are returned as a list to be completed. The mutex has to be held.
+*/
+static hci_cmd_t *hci_cmd_send_pending(hci_cmd_queue_t *queue) {
+	hci_cmd_t *failed_head = NULL, *failed_tail = NULL;
+
+	while (queue->credits > 0 && queue->pending_head) {
+		hci_cmd_t *cmd = queue->pending_head;
+		queue->pending_head = cmd->next;
+		if (!queue->pending_head) {
+			queue->pending_tail = NULL;
+		}
+
+		if (send_hci_socket_cmd(&(queue->hci_socket), cmd_opcode_ogf(cmd->opcode), cmd_opcode_ocf(cmd->opcode),
+					cmd->clen, cmd->cparam) < 0) {
+			hci_cmd_fail(cmd, errno);
+			hci_cmd_append(&failed_head, &failed_tail, cmd);
+			continue;
+		}
+		queue->credits--;
+
+		clock_gettime(CLOCK_MONOTONIC, &(cmd->deadline));
+		cmd->deadline.tv_sec += queue->timeout / 1000;
+		cmd->deadline.tv_nsec += (queue->timeout % 1000) * 1000000L;
+		if (cmd->deadline.tv_nsec >= 1000000000L) {
+			cmd->deadline.tv_sec++;
+			cmd->deadline.tv_nsec -= 1000000000L;
+		}
+		hci_cmd_append(&(queue->sent_head), &(queue->sent_tail), cmd);
+	}
+
+	return failed_head;
+}
+
+//---------------------------------
+
+/* Removes from the sent list the oldest command having the given opcode. */
+static hci_cmd_t *hci_cmd_take_sent(hci_cmd_queue_t *queue, uint16_t opcode) {
+	hci_cmd_t *prev = NULL;
+	for (hci_cmd_t *cmd = queue->sent_head; cmd; prev = cmd, cmd = cmd->next) {
+		if (cmd->opcode != opcode) {
+			continue;
+		}
+		if (prev) {
+			prev->next = cmd->next;
+		} else {
+			queue->sent_head = cmd->next;
+		}
+		if (queue->sent_tail == cmd) {
+			queue->sent_tail = prev;
+		}
+		cmd->next = NULL;
+		return cmd;
+	}
+	return NULL;
+}
+
+//---------------------------------
+
+/* Handles a "Command Complete" or "Command Status" event and returns the list of
+   commands to complete.
+*/
+static hci_cmd_t *hci_cmd_handle_event(hci_cmd_queue_t *queue, const uint8_t *buf, ssize_t len) {
+	hci_cmd_t *completed_head = NULL, *completed_tail = NULL;
+	hci_event_hdr *hdr = (void *)(buf + 1);
+	const uint8_t *ptr = buf + 1 + HCI_EVENT_HDR_SIZE;
+	hci_cmd_t *cmd = NULL;
+
+	if (len < 1 + HCI_EVENT_HDR_SIZE || buf[0] != HCI_EVENT_PKT) {
+		return NULL;
+	}
+	len -= 1 + HCI_EVENT_HDR_SIZE;
+
+	pthread_mutex_lock(&(queue->mutex));
+	if (hdr->evt == EVT_CMD_COMPLETE && len >= EVT_CMD_COMPLETE_SIZE) {
+		const evt_cmd_complete *cc = (const void *)ptr;
+		queue->credits = cc->ncmd;
+		cmd = hci_cmd_take_sent(queue, btohs(cc->opcode));
+		if (cmd) {
+			cmd->rlen = len - EVT_CMD_COMPLETE_SIZE;
+			memcpy(cmd->rparam, ptr + EVT_CMD_COMPLETE_SIZE, cmd->rlen);
+			cmd->status = cmd->rlen ? cmd->rparam[0] : 0;
+		}
+	} else if (hdr->evt == EVT_CMD_STATUS && len >= EVT_CMD_STATUS_SIZE) {
+		const evt_cmd_status *cs = (const void *)ptr;
+		queue->credits = cs->ncmd;
+		cmd = hci_cmd_take_sent(queue, btohs(cs->opcode));
+		if (cmd) {
+			cmd->rlen = 1;
+			cmd->rparam[0] = cs->status;
+			cmd->status = cs->status;
+		}
+	}
+	if (cmd) {
+		cmd->result = 0;
+		hci_cmd_append(&completed_head, &completed_tail, cmd);
+	}
+
+	hci_cmd_t *failed = hci_cmd_send_pending(queue);
+	pthread_mutex_unlock(&(queue->mutex));
+
+	if (completed_tail) {
+		completed_tail->next = failed;
+		return completed_head;
+	}
+	return failed;
+}
+
+//---------------------------------
+
+/* Fails the sent commands whose deadline has passed and returns them as a list. Since
+   their answers are lost, the controller is assumed to be able to accept a new command.
+*/
+static hci_cmd_t *hci_cmd_check_timeouts(hci_cmd_queue_t *queue) {
+	hci_cmd_t *expired_head = NULL, *expired_tail = NULL;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&(queue->mutex));
+	while (queue->sent_head && (queue->sent_head->deadline.tv_sec < now.tv_sec ||
+				    (queue->sent_head->deadline.tv_sec == now.tv_sec &&
+				     queue->sent_head->deadline.tv_nsec <= now.tv_nsec))) {
+		hci_cmd_t *cmd = queue->sent_head;
+		queue->sent_head = cmd->next;
+		if (!queue->sent_head) {
+			queue->sent_tail = NULL;
+		}
+		print_trace(TRACE_WARNING, "hci_cmd_queue : no answer to the command 0x%04X.\n", cmd->opcode);
+		hci_cmd_fail(cmd, ETIMEDOUT);
+		hci_cmd_append(&expired_head, &expired_tail, cmd);
+	}
+	if (expired_head && !queue->credits) {
+		queue->credits = 1;
+	}
+	hci_cmd_t *failed = expired_head ? hci_cmd_send_pending(queue) : NULL;
+	pthread_mutex_unlock(&(queue->mutex));
+
+	if (expired_tail) {
+		expired_tail->next = failed;
+	}
+	return expired_head;
+}
+
+//---------------------------------
+
+/* Stops a queue : no command can be submitted anymore and the commands not completed
+   yet fail with the given error. The mutex must not be held.
+*/
+static void hci_cmd_queue_stop(hci_cmd_queue_t *queue, int error) {
+	pthread_mutex_lock(&(queue->mutex));
+	queue->running = 0;
+	if (!queue->error) {
+		queue->error = error;
+	}
+	hci_cmd_t *cancelled = queue->sent_head;
+	if (queue->sent_tail) {
+		queue->sent_tail->next = queue->pending_head;
+	} else {
+		cancelled = queue->pending_head;
+	}
+	queue->sent_head = queue->sent_tail = NULL;
+	queue->pending_head = queue->pending_tail = NULL;
+	for (hci_cmd_t *cmd = cancelled; cmd; cmd = cmd->next) {
+		hci_cmd_fail(cmd, error);
+	}
+	pthread_cond_broadcast(&(queue->cond));
+	pthread_mutex_unlock(&(queue->mutex));
+	hci_cmd_complete_list(queue, cancelled);
+}
+
+//---------------------------------
+
+static void *hci_cmd_queue_thread_routine(void *arg) {
+	hci_cmd_queue_t *queue = (hci_cmd_queue_t *)arg;
+	uint8_t buf[HCI_MAX_EVENT_SIZE];
+	struct pollfd p[2];
+
+	while (queue->running) {
+		p[0].fd = queue->hci_socket.sock;
+		p[0].events = POLLIN;
+		p[1].fd = queue->wakeup_fd;
+		p[1].events = POLLIN;
+		int n = poll(p, 2, HCI_CMD_QUEUE_POLL_PERIOD);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			int error = errno;
+			perror("hci_cmd_queue : error while polling socket");
+			hci_cmd_queue_stop(queue, error);
+			break;
+		}
+
+		// An error on the socket is reported by the read :
+		if (n > 0 && (p[0].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL))) {
+			ssize_t len = read_hci_socket(&(queue->hci_socket), buf, sizeof(buf));
+			if (len < 0) {
+				if (errno == EAGAIN || errno == EINTR) {
+					continue;
+				}
+				int error = errno;
+				perror("hci_cmd_queue : error while reading socket");
+				hci_cmd_queue_stop(queue, error);
+				break;
+			}
+			if (len == 0) {
+				print_trace(TRACE_ERROR, "hci_cmd_queue : socket shut down.\n");
+				hci_cmd_queue_stop(queue, ENODEV);
+				break;
+			}
+			hci_cmd_complete_list(queue, hci_cmd_handle_event(queue, buf, len));
+		}
+
+		hci_cmd_complete_list(queue, hci_cmd_check_timeouts(queue));
+	}
+
+	return NULL;
+}
+
+//------------------------------------------------------------------------------------
+
+/*-------------------
+  - QUEUE FUNCTIONS -
+  -------------------*/
+
+void hci_cmd_init(hci_cmd_t *cmd, uint16_t ogf, uint16_t ocf, const void *cparam, uint8_t clen,
+		  hci_cmd_callback_t callback, void *user_data) {
+	memset(cmd, 0, sizeof(hci_cmd_t));
+	cmd->opcode = cmd_opcode_pack(ogf, ocf);
+	if (cparam && clen) {
+		memcpy(cmd->cparam, cparam, clen);
+		cmd->clen = clen;
+	}
+	cmd->callback = callback;
+	cmd->user_data = user_data;
+}
+
+//---------------------------------
+
+int8_t hci_cmd_queue_open(hci_cmd_queue_t *queue, hci_controller_t *hci_controller, uint32_t timeout) {
+	if (!queue || !hci_controller) {
+		print_trace(TRACE_ERROR, "hci_cmd_queue_open : invalid reference.\n");
+		return -1;
+	}
+
+	memset(queue, 0, sizeof(hci_cmd_queue_t));
+	queue->hci_controller = hci_controller;
+	queue->timeout = timeout;
+	queue->credits = 1; // Until the controller tells otherwise (cf spec vol 2 part E 4.4)
+
+	queue->hci_socket = open_hci_socket_transport(hci_controller->transport, hci_controller->transport_data,
+						      &(hci_controller->device.mac));
+	if (queue->hci_socket.sock < 0) {
+		queue->hci_controller = NULL;
+		return -1;
+	}
+
+	if (apply_hci_socket_filter_profile(&(queue->hci_socket), HCI_FILTER_PROFILE_CMD_COMPLETE) < 0) {
+		close_hci_socket(&(queue->hci_socket));
+		queue->hci_controller = NULL;
+		return -1;
+	}
+
+	queue->wakeup_fd = eventfd(0, EFD_CLOEXEC);
+	if (queue->wakeup_fd < 0) {
+		perror("hci_cmd_queue_open : eventfd");
+		close_hci_socket(&(queue->hci_socket));
+		queue->hci_controller = NULL;
+		return -1;
+	}
+
+	pthread_mutex_init(&(queue->mutex), NULL);
+	pthread_cond_init(&(queue->cond), NULL);
+	queue->running = 1;
+	if (pthread_create(&(queue->thread), NULL, hci_cmd_queue_thread_routine, queue) != 0) {
+		perror("hci_cmd_queue_open : unable to start the queue's thread");
+		queue->running = 0;
+		pthread_cond_destroy(&(queue->cond));
+		pthread_mutex_destroy(&(queue->mutex));
+		close(queue->wakeup_fd);
+		close_hci_socket(&(queue->hci_socket));
+		queue->hci_controller = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+//---------------------------------
+
+int8_t hci_cmd_queue_submit(hci_cmd_queue_t *queue, hci_cmd_t *cmd) {
+	if (!queue || !cmd) {
+		print_trace(TRACE_ERROR, "hci_cmd_queue_submit : invalid reference.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(queue->mutex));
+	if (!queue->running) {
+		hci_cmd_fail(cmd, queue->error);
+		cmd->done = 1;
+		pthread_mutex_unlock(&(queue->mutex));
+		errno = cmd->error;
+		print_trace(TRACE_ERROR, "hci_cmd_queue_submit : closed or stopped queue.\n");
+		return -1;
+	}
+	cmd->done = 0;
+	cmd->result = 0;
+	cmd->error = 0;
+	queue->in_flight++;
+	hci_cmd_append(&(queue->pending_head), &(queue->pending_tail), cmd);
+	hci_cmd_t *failed = hci_cmd_send_pending(queue);
+	pthread_mutex_unlock(&(queue->mutex));
+
+	hci_cmd_complete_list(queue, failed);
+
+	return 0;
+}
+
+//---------------------------------
+
+int8_t hci_cmd_wait(hci_cmd_queue_t *queue, hci_cmd_t *cmd) {
+	pthread_mutex_lock(&(queue->mutex));
+	while (!cmd->done) {
+		pthread_cond_wait(&(queue->cond), &(queue->mutex));
+	}
+	pthread_mutex_unlock(&(queue->mutex));
+
+	if (cmd->result < 0) {
+		errno = cmd->error;
+	}
+	return cmd->result;
+}
+
+//---------------------------------
+
+int8_t hci_cmd_queue_flush(hci_cmd_queue_t *queue) {
+	pthread_mutex_lock(&(queue->mutex));
+	while (queue->in_flight) {
+		pthread_cond_wait(&(queue->cond), &(queue->mutex));
+	}
+	pthread_mutex_unlock(&(queue->mutex));
+
+	return 0;
+}
+
+//---------------------------------
+
+void hci_cmd_queue_close(hci_cmd_queue_t *queue) {
+	// The queue's thread may have stopped on its own (e.g. the adapter was unplugged) :
+	if (!queue || !queue->hci_controller) {
+		print_trace(TRACE_WARNING, "hci_cmd_queue_close : already closed queue.\n");
+		return;
+	}
+
+	pthread_mutex_lock(&(queue->mutex));
+	queue->running = 0;
+	if (!queue->error) {
+		queue->error = ECANCELED;
+	}
+	pthread_mutex_unlock(&(queue->mutex));
+	uint64_t one = 1;
+	if (write(queue->wakeup_fd, &one, sizeof(one)) < 0) {
+		perror("hci_cmd_queue_close : unable to wake the queue's thread up");
+	}
+	pthread_join(queue->thread, NULL);
+	close(queue->wakeup_fd);
+	hci_cmd_queue_stop(queue, ECANCELED);
+
+	close_hci_socket(&(queue->hci_socket));
+	pthread_cond_destroy(&(queue->cond));
+	pthread_mutex_destroy(&(queue->mutex));
+	queue->hci_controller = NULL;
+}
@@ -0,0 +1,840 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_conn_manager.h"
+#include "trace.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Status of the commands and events concerning an unknown connection handle, and reason
+   given to the devices whose connection is terminated (cf spec vol 2 part D).
+*/
+#define HCI_CONN_UNKNOWN_CONNECTION 0x02
+#define HCI_CONN_REMOTE_USER_TERMINATED 0x13
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline uint64_t hci_conn_manager_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000ULL + (uint64_t)now.tv_nsec / 1000000ULL;
+}
+
+//---------------------------------
+
+/* Checks the connection parameters against the ranges of the specification (vol 2 part E 7.8.12). */
+static char hci_conn_parameters_valid(uint16_t min_interval, uint16_t max_interval, uint16_t latency,
+				      uint16_t supervision_timeout) {
+	return (min_interval >= 0x0006 && min_interval <= max_interval && max_interval <= 0x0C80 &&
+		latency <= 0x01F3 && supervision_timeout >= 0x000A && supervision_timeout <= 0x0C80 &&
+		// The supervision timeout has to exceed (1 + latency) * max_interval * 2 :
+		(uint32_t)supervision_timeout * 4 > (1 + (uint32_t)latency) * max_interval);
+}
+
+//---------------------------------
+
+/* Wakes the manager's thread up, so that a change of its links is handled at once. */
+static void hci_conn_manager_wakeup(hci_conn_manager_t *manager) {
+	uint64_t one = 1;
+	if (write(manager->wakeup_fd, &one, sizeof(one)) < 0) {
+		perror("hci_conn_manager : unable to wake the manager's thread up");
+	}
+}
+
+//---------------------------------
+
+/* Returns the (not free) link of the given device, NULL if none. The mutex has to be held. */
+static hci_conn_link_t *hci_conn_manager_find(hci_conn_manager_t *manager, const bt_address_t *mac) {
+	for (uint16_t i = 0; i < manager->config.max_links; i++) {
+		hci_conn_link_t *link = &(manager->links[i]);
+		if (link->state != HCI_CONN_STATE_FREE && bt_compare_addresses(&(link->mac), mac)) {
+			return link;
+		}
+	}
+	return NULL;
+}
+
+//---------------------------------
+
+/* Returns the link whose connection has the given handle, NULL if none. The mutex has
+   to be held.
+*/
+static hci_conn_link_t *hci_conn_manager_find_handle(hci_conn_manager_t *manager, uint16_t handle) {
+	for (uint16_t i = 0; i < manager->config.max_links; i++) {
+		hci_conn_link_t *link = &(manager->links[i]);
+		if ((link->state == HCI_CONN_STATE_CONNECTED || link->state == HCI_CONN_STATE_DISCONNECTING) &&
+		    link->handle == handle) {
+			return link;
+		}
+	}
+	return NULL;
+}
+
+//---------------------------------
+
+/* Brings a link back to the idle state once its connection is lost or its attempt failed
+   (a removed link is freed). The mutex has to be held.
+*/
+static void hci_conn_link_reset(hci_conn_manager_t *manager, hci_conn_link_t *link, uint64_t now) {
+	if (link->state == HCI_CONN_STATE_CONNECTED || link->state == HCI_CONN_STATE_DISCONNECTING) {
+		manager->stats.connected--;
+		manager->stats.disconnections++;
+	}
+	link->state = (link->removed ? HCI_CONN_STATE_FREE : HCI_CONN_STATE_IDLE);
+	link->next_attempt = now + manager->config.retry_delay;
+	link->cancelled = 0;
+	link->update = 0;
+}
+
+//---------------------------------
+
+/* Ends the connection attempt in progress, which failed. The mutex has to be held. */
+static void hci_conn_manager_attempt_failed(hci_conn_manager_t *manager, uint64_t now) {
+	hci_conn_link_t *link = &(manager->links[manager->connecting]);
+	manager->connecting = -1;
+	link->failures++;
+	manager->stats.failures++;
+	hci_conn_link_reset(manager, link, now);
+}
+
+//---------------------------------
+
+/* Sends a command through the queue and waits for its answer. Returns its status, -1 if
+   it wasn't answered. The mutex must not be held.
+*/
+static int16_t hci_conn_manager_cmd(hci_conn_manager_t *manager, uint16_t ogf, uint16_t ocf,
+				    const void *cparam, uint8_t clen) {
+	hci_cmd_t cmd;
+	hci_cmd_init(&cmd, ogf, ocf, cparam, clen, NULL, NULL);
+	if (hci_cmd_queue_submit(&(manager->queue), &cmd) < 0 || hci_cmd_wait(&(manager->queue), &cmd) < 0) {
+		return -1;
+	}
+	return cmd.status;
+}
+
+//---------------------------------
+
+/* Appends a measure to the circular buffer, dropping the oldest one if it is full. The
+   mutex has to be held.
+*/
+static void hci_conn_manager_push(hci_conn_manager_t *manager, const hci_conn_link_t *link,
+				  const struct timespec *timestamp) {
+	if (manager->measures_length == manager->config.queue_size) {
+		manager->measures_head = (manager->measures_head + 1) % manager->config.queue_size;
+		manager->measures_length--;
+		manager->stats.dropped++;
+	}
+
+	hci_report_t *measure = &(manager->measures[(manager->measures_head + manager->measures_length) %
+						    manager->config.queue_size]);
+	memset(measure, 0, sizeof(hci_report_t));
+	measure->mac = link->mac;
+	measure->add_type = link->add_type;
+	measure->evt_type = HCI_REPORT_CONNECTION_EVT_TYPE;
+	measure->data_status = HCI_REPORT_DATA_COMPLETE;
+	measure->sid = 0xFF;
+	measure->tx_power = HCI_REPORT_TX_POWER_UNAVAILABLE;
+	measure->rssi = link->rssi;
+	measure->timestamp = *timestamp;
+	manager->measures_length++;
+}
+
+//---------------------------------
+
+/* Handles a connection event : the completion of the attempt in progress, the update
+   of the parameters of a connection or its termination.
+*/
+static void hci_conn_manager_handle_event(hci_conn_manager_t *manager, const uint8_t *buf, ssize_t len) {
+	const hci_event_hdr *hdr = (const void *)(buf + 1);
+	const uint8_t *ptr = buf + 1 + HCI_EVENT_HDR_SIZE;
+	uint64_t now = hci_conn_manager_now();
+
+	if (len < 1 + HCI_EVENT_HDR_SIZE || buf[0] != HCI_EVENT_PKT) {
+		return;
+	}
+	len -= 1 + HCI_EVENT_HDR_SIZE;
+
+	pthread_mutex_lock(&(manager->mutex));
+	if (hdr->evt == EVT_DISCONN_COMPLETE && len >= EVT_DISCONN_COMPLETE_SIZE) {
+		const evt_disconn_complete *dc = (const void *)ptr;
+		hci_conn_link_t *link = hci_conn_manager_find_handle(manager, btohs(dc->handle) & 0x0FFF);
+		if (link && !dc->status) {
+			print_trace(TRACE_INFO, "hci_conn_manager : link 0x%04X terminated (reason 0x%02X).\n",
+				    link->handle, dc->reason);
+			hci_conn_link_reset(manager, link, now);
+		}
+	} else if (hdr->evt == EVT_LE_META_EVENT && len >= EVT_LE_META_EVENT_SIZE + EVT_LE_CONN_COMPLETE_SIZE &&
+		   ptr[0] == EVT_LE_CONN_COMPLETE && manager->connecting >= 0) {
+		/* Only one connection can be created at a time : a failure concerns the attempt in
+		   progress (the address isn't significant for a cancelled attempt).
+		*/
+		const evt_le_connection_complete *cc = (const void *)(ptr + EVT_LE_META_EVENT_SIZE);
+		hci_conn_link_t *link = &(manager->links[manager->connecting]);
+		if (cc->status) {
+			hci_conn_manager_attempt_failed(manager, now);
+		} else if (bt_compare_addresses(&(cc->peer_bdaddr), &(link->mac))) {
+			manager->connecting = -1;
+			link->state = HCI_CONN_STATE_CONNECTED;
+			link->handle = btohs(cc->handle) & 0x0FFF;
+			link->interval = btohs(cc->interval);
+			link->latency = btohs(cc->latency);
+			link->supervision_timeout = btohs(cc->supervision_timeout);
+			link->failures = 0;
+			link->cancelled = 0;
+			// The parameters may have been changed during the attempt :
+			link->update = (link->interval < manager->config.min_interval ||
+					link->interval > manager->config.max_interval ||
+					link->latency != manager->config.latency ||
+					link->supervision_timeout != manager->config.supervision_timeout);
+			manager->stats.connections++;
+			manager->stats.connected++;
+		}
+	} else if (hdr->evt == EVT_LE_META_EVENT &&
+		   len >= EVT_LE_META_EVENT_SIZE + EVT_LE_CONN_UPDATE_COMPLETE_SIZE &&
+		   ptr[0] == EVT_LE_CONN_UPDATE_COMPLETE) {
+		const evt_le_connection_update_complete *uc = (const void *)(ptr + EVT_LE_META_EVENT_SIZE);
+		hci_conn_link_t *link = hci_conn_manager_find_handle(manager, btohs(uc->handle) & 0x0FFF);
+		if (link && !uc->status) {
+			link->interval = btohs(uc->interval);
+			link->latency = btohs(uc->latency);
+			link->supervision_timeout = btohs(uc->supervision_timeout);
+		}
+	}
+	pthread_mutex_unlock(&(manager->mutex));
+}
+
+//---------------------------------
+
+/* Cancels the attempt in progress once it timed out (or its link was removed). An attempt
+   whose cancellation isn't answered either (the adapter was reset meanwhile) is considered
+   as failed. The mutex has to be held, it is released while the command is sent.
+*/
+static void hci_conn_manager_check_attempt(hci_conn_manager_t *manager, uint64_t now) {
+	hci_conn_link_t *link = &(manager->links[manager->connecting]);
+	if (now < link->next_attempt && (!link->removed || link->cancelled)) {
+		return;
+	}
+	if (link->cancelled) {
+		print_trace(TRACE_WARNING, "hci_conn_manager : connection attempt lost.\n");
+		hci_conn_manager_attempt_failed(manager, now);
+		return;
+	}
+
+	link->cancelled = 1;
+	link->next_attempt = now + manager->config.connect_timeout;
+	pthread_mutex_unlock(&(manager->mutex));
+	// The "LE Connection Complete" event ends the attempt, even if it just succeeded :
+	hci_conn_manager_cmd(manager, OGF_LE_CTL, OCF_LE_CREATE_CONN_CANCEL, NULL, 0);
+	pthread_mutex_lock(&(manager->mutex));
+}
+
+//---------------------------------
+
+/* Terminates the connection of a removed link, or updates its parameters. The mutex has
+   to be held, it is released while the command is sent.
+*/
+static void hci_conn_manager_update_link(hci_conn_manager_t *manager, hci_conn_link_t *link) {
+	char removed = link->removed;
+	int16_t status;
+
+	if (removed) {
+		disconnect_cp cp;
+		cp.handle = htobs(link->handle);
+		cp.reason = HCI_CONN_REMOTE_USER_TERMINATED;
+		link->state = HCI_CONN_STATE_DISCONNECTING;
+		pthread_mutex_unlock(&(manager->mutex));
+		status = hci_conn_manager_cmd(manager, OGF_LINK_CTL, OCF_DISCONNECT, &cp, DISCONNECT_CP_SIZE);
+	} else {
+		le_connection_update_cp cp;
+		memset(&cp, 0, sizeof(cp));
+		cp.handle = htobs(link->handle);
+		cp.min_interval = htobs(manager->config.min_interval);
+		cp.max_interval = htobs(manager->config.max_interval);
+		cp.latency = htobs(manager->config.latency);
+		cp.supervision_timeout = htobs(manager->config.supervision_timeout);
+		link->update = 0;
+		pthread_mutex_unlock(&(manager->mutex));
+		status = hci_conn_manager_cmd(manager, OGF_LE_CTL, OCF_LE_CONN_UPDATE, &cp, LE_CONN_UPDATE_CP_SIZE);
+	}
+	pthread_mutex_lock(&(manager->mutex));
+
+	if (status == HCI_CONN_UNKNOWN_CONNECTION) { // Lost without any event (reset of the adapter)
+		hci_conn_link_reset(manager, link, hci_conn_manager_now());
+	} else if (status != 0 && removed && link->state == HCI_CONN_STATE_DISCONNECTING) {
+		link->state = HCI_CONN_STATE_CONNECTED; // Tried again at the next check
+	}
+}
+
+//---------------------------------
+
+/* Starts the connection attempt of the next idle link, if any. The mutex has to be held,
+   it is released while the command is sent.
+*/
+static void hci_conn_manager_next_attempt(hci_conn_manager_t *manager, uint64_t now) {
+	hci_conn_link_t *link = NULL;
+	uint16_t index = 0;
+	for (uint16_t i = 0; i < manager->config.max_links && !link; i++) {
+		index = (manager->next_link + i) % manager->config.max_links;
+		hci_conn_link_t *candidate = &(manager->links[index]);
+		if (candidate->state == HCI_CONN_STATE_IDLE && !candidate->removed && candidate->next_attempt <= now) {
+			link = candidate;
+		}
+	}
+	if (!link) {
+		return;
+	}
+	manager->next_link = (index + 1) % manager->config.max_links;
+
+	le_create_connection_cp cp;
+	memset(&cp, 0, sizeof(cp));
+	cp.interval = htobs(manager->config.scan_interval);
+	cp.window = htobs(manager->config.scan_window);
+	cp.initiator_filter = 0x00; // The peer address is used
+	cp.peer_bdaddr_type = link->add_type;
+	bacpy(&(cp.peer_bdaddr), &(link->mac));
+	cp.own_bdaddr_type = manager->config.own_add_type;
+	cp.min_interval = htobs(manager->config.min_interval);
+	cp.max_interval = htobs(manager->config.max_interval);
+	cp.latency = htobs(manager->config.latency);
+	cp.supervision_timeout = htobs(manager->config.supervision_timeout);
+
+	link->state = HCI_CONN_STATE_CONNECTING;
+	link->cancelled = 0;
+	link->next_attempt = now + manager->config.connect_timeout;
+	manager->connecting = index;
+	manager->stats.attempts++;
+	pthread_mutex_unlock(&(manager->mutex));
+	int16_t status = hci_conn_manager_cmd(manager, OGF_LE_CTL, OCF_LE_CREATE_CONN, &cp, LE_CREATE_CONN_CP_SIZE);
+	pthread_mutex_lock(&(manager->mutex));
+
+	if (status != 0 && manager->connecting == index) {
+		print_trace(TRACE_DEBUG, "hci_conn_manager : connection attempt refused (%i).\n", status);
+		hci_conn_manager_attempt_failed(manager, hci_conn_manager_now());
+	}
+}
+
+//---------------------------------
+
+/* Maintains the links : the attempt in progress, the links to terminate or update, and
+   the next attempt.
+*/
+static void hci_conn_manager_maintain(hci_conn_manager_t *manager) {
+	uint64_t now = hci_conn_manager_now();
+
+	pthread_mutex_lock(&(manager->mutex));
+	if (manager->connecting >= 0) {
+		hci_conn_manager_check_attempt(manager, now);
+	}
+	for (uint16_t i = 0; i < manager->config.max_links; i++) {
+		hci_conn_link_t *link = &(manager->links[i]);
+		if (link->state == HCI_CONN_STATE_IDLE && link->removed) {
+			link->state = HCI_CONN_STATE_FREE;
+		} else if (link->state == HCI_CONN_STATE_CONNECTED && (link->removed || link->update)) {
+			hci_conn_manager_update_link(manager, link);
+		}
+	}
+	if (manager->connecting < 0) {
+		hci_conn_manager_next_attempt(manager, now);
+	}
+	pthread_mutex_unlock(&(manager->mutex));
+}
+
+//---------------------------------
+
+/* Reads the RSSI of all the established connections : the commands are pipelined, up to
+   the number of commands the adapter accepts at a time.
+*/
+static void hci_conn_manager_rssi_round(hci_conn_manager_t *manager) {
+	uint16_t nb_cmds = 0;
+
+	pthread_mutex_lock(&(manager->mutex));
+	for (uint16_t i = 0; i < manager->config.max_links; i++) {
+		hci_conn_link_t *link = &(manager->links[i]);
+		if (link->state == HCI_CONN_STATE_CONNECTED && !link->removed) {
+			uint16_t handle = htobs(link->handle);
+			hci_cmd_init(&(manager->cmds[nb_cmds++]), OGF_STATUS_PARAM, OCF_READ_RSSI, &handle, sizeof(handle),
+				     NULL, link);
+		}
+	}
+	pthread_mutex_unlock(&(manager->mutex));
+	if (!nb_cmds) {
+		return;
+	}
+
+	uint16_t submitted = 0;
+	while (submitted < nb_cmds && hci_cmd_queue_submit(&(manager->queue), &(manager->cmds[submitted])) == 0) {
+		submitted++;
+	}
+	for (uint16_t i = 0; i < submitted; i++) {
+		hci_cmd_wait(&(manager->queue), &(manager->cmds[i]));
+	}
+	struct timespec timestamp;
+	clock_gettime(CLOCK_REALTIME, &timestamp); // As the reception time of the events
+
+	char measured = 0;
+	pthread_mutex_lock(&(manager->mutex));
+	manager->stats.rounds++;
+	manager->stats.rssi_errors += nb_cmds - submitted;
+	for (uint16_t i = 0; i < submitted; i++) {
+		hci_cmd_t *cmd = &(manager->cmds[i]);
+		hci_conn_link_t *link = (hci_conn_link_t *)cmd->user_data;
+		uint16_t handle = (cmd->cparam[0] | (cmd->cparam[1] << 8));
+		if (link->state != HCI_CONN_STATE_CONNECTED || link->handle != handle) {
+			continue; // Terminated meanwhile
+		}
+		if (cmd->result < 0 || cmd->status || cmd->rlen < READ_RSSI_RP_SIZE) {
+			manager->stats.rssi_errors++;
+			if (cmd->result == 0 && cmd->status == HCI_CONN_UNKNOWN_CONNECTION) {
+				hci_conn_link_reset(manager, link, hci_conn_manager_now());
+			}
+			continue;
+		}
+		link->rssi = (int8_t)cmd->rparam[3];
+		manager->stats.rssi_reads++;
+		hci_conn_manager_push(manager, link, &timestamp);
+		measured = 1;
+	}
+	if (measured) {
+		pthread_cond_broadcast(&(manager->cond));
+	}
+	pthread_mutex_unlock(&(manager->mutex));
+}
+
+//---------------------------------
+
+static void *hci_conn_manager_routine(void *data) {
+	hci_conn_manager_t *manager = (hci_conn_manager_t *)data;
+	uint8_t buf[HCI_MAX_EVENT_SIZE];
+	struct pollfd p[2];
+
+	while (manager->running) {
+		uint64_t now = hci_conn_manager_now();
+		int timeout = HCI_CONN_MANAGER_POLL_PERIOD;
+		if (manager->next_round <= now) {
+			timeout = 0;
+		} else if (manager->next_round - now < (uint64_t)timeout) {
+			timeout = manager->next_round - now;
+		}
+
+		p[0].fd = manager->hci_socket.sock;
+		p[0].events = POLLIN;
+		p[1].fd = manager->wakeup_fd;
+		p[1].events = POLLIN;
+		int n = poll(p, 2, timeout);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("hci_conn_manager : error while polling socket");
+			break;
+		}
+		if (n > 0 && (p[1].revents & POLLIN)) {
+			uint64_t value;
+			if (read(manager->wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+				perror("hci_conn_manager : error while reading the wake-up counter");
+			}
+		}
+
+		// The events already received are all handled before the links are maintained :
+		char readable = (n > 0 && (p[0].revents & POLLIN));
+		while (readable) {
+			ssize_t len = read_hci_socket(&(manager->hci_socket), buf, sizeof(buf));
+			if (len < 0) {
+				if (errno != EAGAIN && errno != EINTR) {
+					perror("hci_conn_manager : error while reading socket");
+				}
+				break;
+			}
+			hci_conn_manager_handle_event(manager, buf, len);
+			struct pollfd pfd = {manager->hci_socket.sock, POLLIN, 0};
+			readable = (poll(&pfd, 1, 0) > 0);
+		}
+		if (!manager->running) {
+			break;
+		}
+
+		hci_conn_manager_maintain(manager);
+		now = hci_conn_manager_now();
+		if (now >= manager->next_round) {
+			hci_conn_manager_rssi_round(manager);
+			manager->next_round += manager->config.rssi_period;
+			if (manager->next_round <= now) { // Late rounds are skipped
+				manager->next_round = now + manager->config.rssi_period;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+//------------------------------------------------------------------------------------
+
+/*--------------------------------
+  - CONNECTION MANAGER FUNCTIONS -
+  --------------------------------*/
+
+hci_conn_manager_config_t hci_conn_manager_default_config(void) {
+	hci_conn_manager_config_t config;
+	memset(&config, 0, sizeof(config));
+	config.scan_interval = HCI_CONN_MANAGER_DEFAULT_SCAN_INTERVAL;
+	config.scan_window = HCI_CONN_MANAGER_DEFAULT_SCAN_WINDOW;
+	config.own_add_type = PUBLIC_DEVICE_ADDRESS;
+	config.min_interval = HCI_CONN_MANAGER_DEFAULT_MIN_INTERVAL;
+	config.max_interval = HCI_CONN_MANAGER_DEFAULT_MAX_INTERVAL;
+	config.latency = HCI_CONN_MANAGER_DEFAULT_LATENCY;
+	config.supervision_timeout = HCI_CONN_MANAGER_DEFAULT_SUPERVISION_TIMEOUT;
+	config.connect_timeout = HCI_CONN_MANAGER_DEFAULT_CONNECT_TIMEOUT;
+	config.retry_delay = HCI_CONN_MANAGER_DEFAULT_RETRY_DELAY;
+	config.rssi_period = HCI_CONN_MANAGER_DEFAULT_RSSI_PERIOD;
+	config.max_links = HCI_CONN_MANAGER_DEFAULT_MAX_LINKS;
+	config.queue_size = HCI_CONN_MANAGER_DEFAULT_QUEUE_SIZE;
+	return config;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_conn_manager_start(hci_conn_manager_t *manager, hci_controller_t *hci_controller,
+			      const hci_conn_manager_config_t *config) {
+	if (!manager || !hci_controller) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_start : invalid arguments.\n");
+		return -1;
+	}
+
+	if (__atomic_load_n(&(hci_controller->state), __ATOMIC_ACQUIRE) == HCI_STATE_CLOSED) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_start : closed controller.\n");
+		return -1;
+	}
+
+	memset(manager, 0, sizeof(hci_conn_manager_t));
+	manager->config = config ? *config : hci_conn_manager_default_config();
+	if (!manager->config.max_links || !manager->config.queue_size || !manager->config.rssi_period ||
+	    !manager->config.connect_timeout || !manager->config.scan_window ||
+	    manager->config.scan_window > manager->config.scan_interval ||
+	    !hci_conn_parameters_valid(manager->config.min_interval, manager->config.max_interval,
+				       manager->config.latency, manager->config.supervision_timeout)) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_start : invalid configuration.\n");
+		return -1;
+	}
+	if (hci_controller_supports_command(hci_controller, 26, 4) == 0) { // LE Create Connection
+		print_trace(TRACE_ERROR, "hci_conn_manager_start : LE connections not supported by the adapter.\n");
+		return -1;
+	}
+	manager->connecting = -1;
+	manager->wakeup_fd = -1;
+
+	manager->links = calloc(manager->config.max_links, sizeof(hci_conn_link_t));
+	manager->cmds = calloc(manager->config.max_links, sizeof(hci_cmd_t));
+	manager->measures = calloc(manager->config.queue_size, sizeof(hci_report_t));
+	if (!manager->links || !manager->cmds || !manager->measures) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_start : unable to allocate the manager.\n");
+		goto fail;
+	}
+
+	manager->hci_socket = open_hci_socket_transport(hci_controller->transport, hci_controller->transport_data,
+							 &(hci_controller->device.mac));
+	if (manager->hci_socket.sock < 0) {
+		goto fail;
+	}
+	if (apply_hci_socket_filter_profile(&(manager->hci_socket), HCI_FILTER_PROFILE_LE_CONNECTIONS) < 0) {
+		goto fail_socket;
+	}
+	manager->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (manager->wakeup_fd < 0) {
+		perror("hci_conn_manager_start : eventfd");
+		goto fail_socket;
+	}
+	if (hci_cmd_queue_open(&(manager->queue), hci_controller, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+		goto fail_fd;
+	}
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&(manager->mutex), NULL);
+	pthread_cond_init(&(manager->cond), &attr);
+	pthread_condattr_destroy(&attr);
+
+	pthread_mutex_lock(&(hci_controller->lock));
+	if (hci_controller->conn_manager) {
+		pthread_mutex_unlock(&(hci_controller->lock));
+		print_trace(TRACE_ERROR, "hci_conn_manager_start : the controller already has a connection manager.\n");
+		goto fail_thread;
+	}
+	manager->hci_controller = hci_controller;
+	manager->next_round = hci_conn_manager_now() + manager->config.rssi_period;
+	manager->running = 1;
+	if (pthread_create(&(manager->thread), NULL, &hci_conn_manager_routine, manager) != 0) {
+		pthread_mutex_unlock(&(hci_controller->lock));
+		perror("hci_conn_manager_start");
+		goto fail_thread;
+	}
+	hci_controller->conn_manager = manager;
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	return 0;
+
+ fail_thread:
+	manager->running = 0;
+	manager->hci_controller = NULL;
+	pthread_cond_destroy(&(manager->cond));
+	pthread_mutex_destroy(&(manager->mutex));
+	hci_cmd_queue_close(&(manager->queue));
+ fail_fd:
+	close(manager->wakeup_fd);
+ fail_socket:
+	close_hci_socket(&(manager->hci_socket));
+ fail:
+	free(manager->links);
+	free(manager->cmds);
+	free(manager->measures);
+	manager->links = NULL;
+	manager->cmds = NULL;
+	manager->measures = NULL;
+	return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_conn_manager_add(hci_conn_manager_t *manager, const bt_device_t *bt_device) {
+	if (!manager || !manager->hci_controller || !bt_device) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_add : invalid arguments.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(manager->mutex));
+	hci_conn_link_t *link = hci_conn_manager_find(manager, &(bt_device->mac));
+	if (link && link->removed) { // Removed, but not freed yet
+		link->removed = 0;
+	} else if (link) {
+		pthread_mutex_unlock(&(manager->mutex));
+		print_trace(TRACE_ERROR, "hci_conn_manager_add : device already managed.\n");
+		return -1;
+	} else {
+		for (uint16_t i = 0; i < manager->config.max_links && !link; i++) {
+			if (manager->links[i].state == HCI_CONN_STATE_FREE) {
+				link = &(manager->links[i]);
+			}
+		}
+		if (!link) {
+			pthread_mutex_unlock(&(manager->mutex));
+			print_trace(TRACE_ERROR, "hci_conn_manager_add : no free link.\n");
+			return -1;
+		}
+		memset(link, 0, sizeof(hci_conn_link_t));
+		link->mac = bt_device->mac;
+		link->add_type = (bt_device->add_type == RANDOM_DEVICE_ADDRESS ? RANDOM_DEVICE_ADDRESS :
+				  PUBLIC_DEVICE_ADDRESS);
+		link->rssi = HCI_REPORT_RSSI_UNAVAILABLE;
+		link->state = HCI_CONN_STATE_IDLE;
+	}
+	pthread_mutex_unlock(&(manager->mutex));
+
+	if (!bt_already_registered_device(bt_device->mac)) {
+		bt_register_device(*bt_device);
+	}
+	hci_conn_manager_wakeup(manager);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_conn_manager_remove(hci_conn_manager_t *manager, const bt_address_t *mac) {
+	if (!manager || !manager->hci_controller || !mac) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_remove : invalid arguments.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(manager->mutex));
+	hci_conn_link_t *link = hci_conn_manager_find(manager, mac);
+	if (!link || link->removed) {
+		pthread_mutex_unlock(&(manager->mutex));
+		print_trace(TRACE_ERROR, "hci_conn_manager_remove : device not managed.\n");
+		return -1;
+	}
+	link->removed = 1;
+	pthread_mutex_unlock(&(manager->mutex));
+	hci_conn_manager_wakeup(manager);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_conn_manager_set_parameters(hci_conn_manager_t *manager, uint16_t min_interval,
+				       uint16_t max_interval, uint16_t latency,
+				       uint16_t supervision_timeout) {
+	if (!manager || !manager->hci_controller) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_set_parameters : inactive manager.\n");
+		return -1;
+	}
+	if (!hci_conn_parameters_valid(min_interval, max_interval, latency, supervision_timeout)) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_set_parameters : invalid parameters.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(manager->mutex));
+	manager->config.min_interval = min_interval;
+	manager->config.max_interval = max_interval;
+	manager->config.latency = latency;
+	manager->config.supervision_timeout = supervision_timeout;
+	for (uint16_t i = 0; i < manager->config.max_links; i++) {
+		if (manager->links[i].state == HCI_CONN_STATE_CONNECTED) {
+			manager->links[i].update = 1;
+		}
+	}
+	pthread_mutex_unlock(&(manager->mutex));
+	hci_conn_manager_wakeup(manager);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_conn_manager_get_link(hci_conn_manager_t *manager, const bt_address_t *mac,
+				 hci_conn_link_t *link) {
+	if (!manager || !manager->hci_controller || !mac || !link) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_get_link : invalid arguments.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(manager->mutex));
+	hci_conn_link_t *found = hci_conn_manager_find(manager, mac);
+	if (found) {
+		*link = *found;
+	}
+	pthread_mutex_unlock(&(manager->mutex));
+
+	return found ? 0 : -1;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_conn_manager_read(hci_conn_manager_t *manager, hci_report_batch_t *batch, int16_t timeout) {
+	if (!manager || !manager->hci_controller || !batch) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_read : invalid arguments.\n");
+		return -1;
+	}
+
+	hci_report_batch_clear(batch);
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&(manager->mutex));
+	while (!manager->measures_length && manager->running && timeout > 0 &&
+	       pthread_cond_timedwait(&(manager->cond), &(manager->mutex), &deadline) != ETIMEDOUT);
+	while (manager->measures_length && batch->length < batch->capacity) {
+		hci_report_batch_add(batch, &(manager->measures[manager->measures_head]));
+		manager->measures_head = (manager->measures_head + 1) % manager->config.queue_size;
+		manager->measures_length--;
+	}
+	pthread_mutex_unlock(&(manager->mutex));
+
+	for (uint16_t i = 0; i < batch->length; i++) {
+		bt_rssi_sample_t sample;
+		sample.timestamp = batch->reports[i].timestamp;
+		sample.rssi = batch->reports[i].rssi;
+		bt_device_push_RSSI(batch->reports[i].mac, &sample);
+	}
+
+	return batch->length;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_conn_manager_get_stats(hci_conn_manager_t *manager, hci_conn_manager_stats_t *stats) {
+	if (!manager || !manager->hci_controller || !stats) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_get_stats : invalid arguments.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(manager->mutex));
+	*stats = manager->stats;
+	pthread_mutex_unlock(&(manager->mutex));
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_conn_manager_stop(hci_conn_manager_t *manager) {
+	if (!manager || !manager->hci_controller) {
+		print_trace(TRACE_ERROR, "hci_conn_manager_stop : inactive manager.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(manager->hci_controller->lock));
+	if (manager->hci_controller->conn_manager == manager) {
+		manager->hci_controller->conn_manager = NULL;
+	}
+	pthread_mutex_unlock(&(manager->hci_controller->lock));
+
+	pthread_mutex_lock(&(manager->mutex));
+	manager->running = 0;
+	pthread_cond_broadcast(&(manager->cond));
+	pthread_mutex_unlock(&(manager->mutex));
+	hci_conn_manager_wakeup(manager);
+	pthread_join(manager->thread, NULL);
+
+	// The connections are terminated through the queue, still opened :
+	if (manager->connecting >= 0) {
+		hci_conn_manager_cmd(manager, OGF_LE_CTL, OCF_LE_CREATE_CONN_CANCEL, NULL, 0);
+	}
+	for (uint16_t i = 0; i < manager->config.max_links; i++) {
+		hci_conn_link_t *link = &(manager->links[i]);
+		if (link->state == HCI_CONN_STATE_CONNECTED) {
+			disconnect_cp cp;
+			cp.handle = htobs(link->handle);
+			cp.reason = HCI_CONN_REMOTE_USER_TERMINATED;
+			hci_conn_manager_cmd(manager, OGF_LINK_CTL, OCF_DISCONNECT, &cp, DISCONNECT_CP_SIZE);
+		}
+	}
+
+	hci_cmd_queue_close(&(manager->queue));
+	close_hci_socket(&(manager->hci_socket));
+	close(manager->wakeup_fd);
+	pthread_cond_destroy(&(manager->cond));
+	pthread_mutex_destroy(&(manager->mutex));
+	free(manager->links);
+	free(manager->cmds);
+	free(manager->measures);
+	manager->links = NULL;
+	manager->cmds = NULL;
+	manager->measures = NULL;
+	manager->hci_controller = NULL;
+
+	return 0;
+}
@@ -23,7 +23,13 @@
 #include "hci_controller.h"
 #include "trace.h"
 #include "hci_utils.h"
+#include "hci_name_resolver.h"
+#include "hci_watchdog.h"
+#include "hci_conn_manager.h"
 #include "bt_device.h"
+#include "hci_report.h"
+#include "hci_cmd_queue.h"
+#include "hci_bpf.h"
 #include <bluetooth/hci_lib.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,7 +37,10 @@
 #include <sys/poll.h>
 #include <sys/errno.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #define RSSI_STRING_LENGTH 10
 
@@ -67,7 +76,7 @@ do {\
 
 #define CHECK_HCI_CONTROLLER_OPEN(__hci_controller, __function_name)\
 do {\
-	if (__hci_controller->state != HCI_STATE_OPEN) {\
+	if (hci_get_state(__hci_controller) != HCI_STATE_OPEN) {\
 		print_trace(TRACE_ERROR, "%s : busy or closed controller.\n", __function_name);\
 		return -1;\
 	}\
@@ -77,125 +86,321 @@ do {\
 //------------------------------------------------------------------------------------
 
 /*--------------------
-  - GLOBAL VARIABLES -
+  - STATIC FUNCTIONS -
   --------------------*/
 
-static pthread_mutex_t hci_controller_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t hci_state_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-//------------------------------------------------------------------------------------
+/* Origin of the socket used by a function (@see check_hci_socket_ptr) :
+   given by the caller, opened for the call or taken from the pool of the controller.
+*/
+#define HCI_SOCKET_GIVEN 0
+#define HCI_SOCKET_NEW 1
+#define HCI_SOCKET_POOLED 2
 
-/*--------------------
-  - STATIC FUNCTIONS -
-  --------------------*/
+//---------------------------------
 
 /* Static function verifying if the given socket is a valid one or not.
-   If not, we try to open a new one using the given hci_controller.
+   If not, we take one from the pool of the controller or, if they are all
+   in use, we try to open a new one using the given hci_controller.
 */
 static inline void check_hci_socket_ptr(hci_socket_t **hci_socket, hci_controller_t *controller,
 					char *new_socket, char *err) {
 	*err = 0;
 	if (*hci_socket == NULL) { // We take the first socket we can :
-		if (controller->sockets_list) {
-			*new_socket = 0;
-			*hci_socket = ((hci_socket_t *)controller->sockets_list->val);
+		*hci_socket = hci_socket_pool_acquire(&(controller->socket_pool));
+		if (*hci_socket) {
+			*new_socket = HCI_SOCKET_POOLED;
 		} else {
-			*new_socket = 1;
+			*new_socket = HCI_SOCKET_NEW;
 			*hci_socket = malloc(sizeof(hci_socket_t));
-			*(*hci_socket) = open_hci_socket(&(controller->device.mac));
+			*(*hci_socket) = open_hci_socket_transport(controller->transport, controller->transport_data,
+									    &(controller->device.mac));
 		}}
 	if ((*hci_socket)->sock < 0) {
-		if (*new_socket) {
+		if (*new_socket == HCI_SOCKET_NEW) {
 			free(*hci_socket);
 			*err = 1;
-			*new_socket = 0;
+			*new_socket = HCI_SOCKET_GIVEN;
 		}
 	}
 }
 
 //---------------------------------
 
-/* Static function trying to catch if a CMD_COMPLETE event has occured or not. Please note
-   that, due to BlueZ implementation, the huge majority of functions don't need to catch
-   such an event. In fact, each BlueZ function using "hci_send_req" already does this verification.
-   Nevertheless, if we use a function calling "hci_send_cmd" we have to do the verification by ourselves.
-   To know wether or not a function needs to be verified, please refer to the BlueZ file "hci.c".
+/* Static function releasing a socket obtained with check_hci_socket_ptr.
 */
-static char check_cmd_complete(hci_socket_t *hci_socket, hci_controller_t *hci_controller) {
-	//http://forum.hardware.fr/hfr/Programmation/C/poll-sockets-sujet_86846_1.htm
-	//http://code.metager.de/source/xref/linux/bluetooth/bluez/lib/hci.c
-	struct pollfd p;
-	int n;
-	unsigned char buf[HCI_MAX_EVENT_SIZE];
-	hci_event_hdr *hdr;
-
-	char new_socket = 0;
-	char socket_err = 0;
-	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
-	if (socket_err) {
-		goto fail;
+static inline void release_hci_socket_ptr(hci_socket_t *hci_socket, hci_controller_t *controller,
+					  char new_socket) {
+	switch (new_socket) {
+	case HCI_SOCKET_NEW:
+		close_hci_socket(hci_socket);
+		free(hci_socket);
+		break;
+	case HCI_SOCKET_POOLED:
+		hci_socket_pool_release(&(controller->socket_pool), hci_socket);
+		break;
+	default:
+		break;
 	}
+}
 
-	uint8_t try = 10;
-	while (try--) {
-		p.fd = hci_socket->sock; p.events = POLLIN;
-		while ((n = poll(&p, 1, HCI_CONTROLLER_DEFAULT_TIMEOUT)) < 0) {
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
-			perror("check_cmd_complete : error while polling socket");
-			goto fail;
-		}
-	
-		if (!n) {
-			errno = ETIMEDOUT;
-			perror("check_cmd_complete : error while polling socket");
-			goto fail;
-		}
+//---------------------------------
 
-		int8_t len;
-		while ((len = read(hci_socket->sock, buf, sizeof(buf))) < 0) {
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
-			perror("check_cmd_complete : error while reading socket");
-			goto fail;
-		}
+/* Static functions sending the LE scan commands through the transport of the socket
+   (they replace the BlueZ "hci_le_set_scan_*" functions, which only work on real
+   adapters).
+*/
+static int8_t hci_LE_set_scan_parameters_req(hci_socket_t *hci_socket, uint8_t scan_type,
+					     uint16_t scan_interval, uint16_t scan_window,
+					     uint8_t own_add_type, uint8_t scan_filter_policy,
+					     int timeout) {
+	le_set_scan_parameters_cp cp;
+	uint8_t status;
+	memset(&cp, 0, sizeof(cp));
+	cp.type = scan_type;
+	cp.interval = htobs(scan_interval);
+	cp.window = htobs(scan_window);
+	cp.own_bdaddr_type = own_add_type;
+	cp.filter = scan_filter_policy;
+
+	return send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_SET_SCAN_PARAMETERS,
+					  &cp, LE_SET_SCAN_PARAMETERS_CP_SIZE, &status, 1, timeout);
+}
 
-		hdr = (void *) (buf + 1);
-		switch (hdr->evt) {
-		case EVT_CMD_COMPLETE:
-			return 1;
-			break;
-		default:
-			print_trace(TRACE_WARNING, "check_cmd_complete warning : an unknown event occured.\n");
-			break;
+static int8_t hci_LE_set_scan_enable_req(hci_socket_t *hci_socket, uint8_t enable,
+					 uint8_t filter_dup, int timeout) {
+	le_set_scan_enable_cp cp;
+	uint8_t status;
+	memset(&cp, 0, sizeof(cp));
+	cp.enable = enable;
+	cp.filter_dup = filter_dup;
+
+	return send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE,
+					  &cp, LE_SET_SCAN_ENABLE_CP_SIZE, &status, 1, timeout);
+}
+
+/* Same as above with the Bluetooth 5 extended scan commands. The same parameters are
+   used on each of the scanning PHYs.
+*/
+static int8_t hci_LE_set_ext_scan_parameters_req(hci_socket_t *hci_socket, uint8_t scan_phys,
+						 uint8_t scan_type, uint16_t scan_interval,
+						 uint16_t scan_window, uint8_t own_add_type,
+						 uint8_t scan_filter_policy, int timeout) {
+	uint8_t cp[HCI_LE_EXT_SCAN_PARAMETERS_CP_SIZE + 2*HCI_LE_EXT_SCAN_PHY_CP_SIZE];
+	hci_le_ext_scan_parameters_cp *fixed = (hci_le_ext_scan_parameters_cp *)cp;
+	uint8_t length = HCI_LE_EXT_SCAN_PARAMETERS_CP_SIZE;
+	uint8_t status;
+	fixed->own_bdaddr_type = own_add_type;
+	fixed->filter = scan_filter_policy;
+	fixed->phys = scan_phys;
+
+	for (uint8_t phy = HCI_LE_SCAN_PHY_1M; phy <= HCI_LE_SCAN_PHY_CODED; phy <<= 1) {
+		if (scan_phys & phy) {
+			hci_le_ext_scan_phy_cp *phy_cp = (hci_le_ext_scan_phy_cp *)(cp + length);
+			phy_cp->type = scan_type;
+			phy_cp->interval = htobs(scan_interval);
+			phy_cp->window = htobs(scan_window);
+			length += HCI_LE_EXT_SCAN_PHY_CP_SIZE;
 		}
 	}
-	errno = ETIMEDOUT;
 
- fail:	
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} 
-	
-	return 0;
+	return send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_SET_EXT_SCAN_PARAMETERS,
+					  cp, length, &status, 1, timeout);
+}
 
+static int8_t hci_LE_set_ext_scan_enable_req(hci_socket_t *hci_socket, uint8_t enable,
+					     uint8_t filter_dup, int timeout) {
+	hci_le_ext_scan_enable_cp cp;
+	uint8_t status;
+	memset(&cp, 0, sizeof(cp)); // Scanning until disabled
+	cp.enable = enable;
+	cp.filter_dup = filter_dup;
+
+	return send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_SET_EXT_SCAN_ENABLE,
+					  &cp, HCI_LE_EXT_SCAN_ENABLE_CP_SIZE, &status, 1, timeout);
+}
+
+static int8_t hci_LE_set_session_scan_enable_req(hci_scan_session_t *session, uint8_t enable,
+						 int timeout) {
+	if (session->extended) {
+		return hci_LE_set_ext_scan_enable_req(&(session->hci_socket), enable, 0x00, timeout);
+	}
+	return hci_LE_set_scan_enable_req(&(session->hci_socket), enable, 0x00, timeout);
 }
 
 //---------------------------------
 
-static inline int8_t hci_change_state(hci_controller_t *hci_controller, hci_state_t state) {
+/* Static function writing the inquiry mode of the adapter, unless it is already the one
+   last written. The command is sent as a request, which installs its own filter : the
+   "Command Complete" event is caught whatever the filter of the socket (the one of a scan
+   session or of a watchdog drops it). If it isn't answered, the mode is considered as
+   unknown, so that it is written again by the next inquiry.
+*/
+static int8_t hci_write_inquiry_mode(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+				     uint8_t mode) {
+	if (hci_controller->inquiry_mode == mode) {
+		return 0;
+	}
+
+	write_inquiry_mode_cp write_cp;
+	uint8_t status;
+	memset(&write_cp, 0, sizeof(write_cp));
+	write_cp.mode = mode;
+
+	print_trace(TRACE_DEBUG, "Configuring the inquiry mode...");
+	if (send_hci_socket_simple_req(hci_socket, OGF_HOST_CTL, OCF_WRITE_INQUIRY_MODE, &write_cp,
+				       WRITE_INQUIRY_MODE_CP_SIZE, &status, 1, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+		print_trace(TRACE_ERROR, " [ERROR]\n");
+		perror("Can't set inquiry mode");
+		hci_controller->inquiry_mode = HCI_INQUIRY_MODE_UNKNOWN;
+		return -1;
+	}
+	print_trace(TRACE_DEBUG, " [DONE]\n");
+	hci_controller->inquiry_mode = mode;
 
-	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_change_state");
-	
-	pthread_mutex_lock(&hci_state_mutex);
-	print_trace(TRACE_DEBUG, "Controller %s state changing from %i to %i\n", hci_controller->device.custom_name,
-		    hci_controller->state, state);
-	hci_controller->state = state;
-	pthread_mutex_unlock(&hci_state_mutex);
-	
 	return 0;
 }
+
+//---------------------------------
+
+/* Static functions starting and exiting the periodic inquiry mode (the general inquiry
+   access code is used).
+*/
+static int8_t hci_periodic_inquiry_req(hci_socket_t *hci_socket, uint16_t min_period, uint16_t max_period,
+				       uint8_t duration, uint8_t max_rsp, int timeout) {
+	periodic_inquiry_cp cp;
+	uint8_t status;
+	memset(&cp, 0, sizeof(cp));
+	cp.max_period = htobs(max_period);
+	cp.min_period = htobs(min_period);
+	cp.lap[2] = 0x9e;
+	cp.lap[1] = 0x8b;
+	cp.lap[0] = 0x33;
+	cp.length = duration;
+	cp.num_rsp = max_rsp;
+
+	return send_hci_socket_simple_req(hci_socket, OGF_LINK_CTL, OCF_PERIODIC_INQUIRY,
+					  &cp, PERIODIC_INQUIRY_CP_SIZE, &status, 1, timeout);
+}
+
+static int8_t hci_exit_periodic_inquiry_req(hci_socket_t *hci_socket, int timeout) {
+	uint8_t status;
+	return send_hci_socket_simple_req(hci_socket, OGF_LINK_CTL, OCF_EXIT_PERIODIC_INQUIRY,
+					  NULL, 0, &status, 1, timeout);
+}
+
+// Same as above to stop an inquiry started by a "OCF_INQUIRY" command.
+static int8_t hci_inquiry_cancel_req(hci_socket_t *hci_socket, int timeout) {
+	uint8_t status;
+	return send_hci_socket_simple_req(hci_socket, OGF_LINK_CTL, OCF_INQUIRY_CANCEL,
+					  NULL, 0, &status, 1, timeout);
+}
+
+//---------------------------------
+
+/* Static function installing the filter of the socket of a scan session : the one of the
+   given profile, without the "Command Complete" events. The commands of a session are sent
+   as requests, which install their own filter : the answers to the commands of the other
+   sockets (the probes of a watchdog for instance) would only pile up on the session's one.
+*/
+static int8_t hci_scan_session_filter(hci_scan_session_t *session, hci_filter_profile_t profile) {
+	struct hci_filter flt = *hci_filter_profile(profile);
+	hci_filter_clear_event(EVT_CMD_COMPLETE, &flt);
+	return apply_hci_socket_filter(&(session->hci_socket), &flt);
+}
+
+//---------------------------------
+
+static inline hci_state_t hci_get_state(hci_controller_t *hci_controller) {
+	return __atomic_load_n(&(hci_controller->state), __ATOMIC_ACQUIRE);
+}
+
+//---------------------------------
+
+/* Reads one capability of the adapter : it is only kept if the answer is complete and
+   successful (the adapters which don't support a command answer it with an error status).
+*/
+static char hci_read_cap(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf, void *rparam, uint8_t rlen) {
+	struct hci_request rq;
+	memset(&rq, 0, sizeof(rq));
+	memset(rparam, 0, rlen);
+	rq.ogf = ogf;
+	rq.ocf = ocf;
+	rq.rparam = rparam;
+	rq.rlen = rlen;
+
+	if (send_hci_socket_req(hci_socket, &rq, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+		return 0;
+	}
+	return (rq.rlen == rlen && ((uint8_t *)rparam)[0] == 0);
+}
+
+//---------------------------------
+
+/* Reads all the capabilities of the adapter into "caps". Nothing else is asked to an
+   adapter which doesn't even give its version.
+*/
+static void hci_read_caps(hci_socket_t *hci_socket, hci_controller_caps_t *caps) {
+	memset(caps, 0, sizeof(hci_controller_caps_t));
+
+	read_local_version_rp version;
+	if (!hci_read_cap(hci_socket, OGF_INFO_PARAM, OCF_READ_LOCAL_VERSION, &version,
+			  READ_LOCAL_VERSION_RP_SIZE)) {
+		return;
+	}
+	caps->known |= HCI_CAPS_VERSION;
+	caps->hci_ver = version.hci_ver;
+	caps->hci_rev = btohs(version.hci_rev);
+	caps->lmp_ver = version.lmp_ver;
+	caps->manufacturer = btohs(version.manufacturer);
+	caps->lmp_subver = btohs(version.lmp_subver);
+
+	read_local_commands_rp commands;
+	if (hci_read_cap(hci_socket, OGF_INFO_PARAM, OCF_READ_LOCAL_COMMANDS, &commands,
+			 READ_LOCAL_COMMANDS_RP_SIZE)) {
+		caps->known |= HCI_CAPS_COMMANDS;
+		memcpy(caps->commands, commands.commands, sizeof(caps->commands));
+	}
+
+	read_buffer_size_rp buffers;
+	if (hci_read_cap(hci_socket, OGF_INFO_PARAM, OCF_READ_BUFFER_SIZE, &buffers, READ_BUFFER_SIZE_RP_SIZE)) {
+		caps->known |= HCI_CAPS_BUFFER_SIZE;
+		caps->acl_mtu = btohs(buffers.acl_mtu);
+		caps->sco_mtu = buffers.sco_mtu;
+		caps->acl_max_pkt = btohs(buffers.acl_max_pkt);
+		caps->sco_max_pkt = btohs(buffers.sco_max_pkt);
+	}
+
+	le_read_buffer_size_rp le_buffers;
+	if (hci_read_cap(hci_socket, OGF_LE_CTL, OCF_LE_READ_BUFFER_SIZE, &le_buffers,
+			 LE_READ_BUFFER_SIZE_RP_SIZE)) {
+		caps->known |= HCI_CAPS_LE_BUFFER_SIZE;
+		caps->le_mtu = btohs(le_buffers.pkt_len);
+		caps->le_max_pkt = le_buffers.max_pkt;
+	}
+
+	le_read_local_supported_features_rp features;
+	if (hci_read_cap(hci_socket, OGF_LE_CTL, OCF_LE_READ_LOCAL_SUPPORTED_FEATURES, &features,
+			 LE_READ_LOCAL_SUPPORTED_FEATURES_RP_SIZE)) {
+		caps->known |= HCI_CAPS_LE_FEATURES;
+		for (uint8_t i = 0; i < 8; i++) { // Little endian
+			caps->le_features |= (uint64_t)features.features[i] << (8 * i);
+		}
+	}
+
+	le_read_supported_states_rp states;
+	if (hci_read_cap(hci_socket, OGF_LE_CTL, OCF_LE_READ_SUPPORTED_STATES, &states,
+			 LE_READ_SUPPORTED_STATES_RP_SIZE)) {
+		caps->known |= HCI_CAPS_LE_STATES;
+		caps->le_states = states.states;
+	}
+
+	le_read_white_list_size_rp white_list;
+	if (hci_read_cap(hci_socket, OGF_LE_CTL, OCF_LE_READ_WHITE_LIST_SIZE, &white_list,
+			 LE_READ_WHITE_LIST_SIZE_RP_SIZE)) {
+		caps->known |= HCI_CAPS_WHITE_LIST_SIZE;
+		caps->white_list_size = white_list.size;
+	}
+}
 	
 
 //------------------------------------------------------------------------------------
@@ -204,29 +409,64 @@ static inline int8_t hci_change_state(hci_controller_t *hci_controller, hci_stat
   - CONTROLLER TYPE FUNCTIONS -
   -----------------------------*/
 
-hci_controller_t hci_open_controller(bt_address_t *mac, char *name) {
-	hci_controller_t res = {0};
-	res.state = HCI_STATE_CLOSED;
+int8_t hci_controller_init(hci_controller_t *hci_controller, const hci_transport_t *transport,
+			   void *transport_data, bt_address_t *mac, char *name) {
+	if (!hci_controller) {
+		print_trace(TRACE_ERROR, "hci_controller_init : invalid controller reference.\n");
+		return -1;
+	}
+
+	memset(hci_controller, 0, sizeof(hci_controller_t));
+	hci_controller->state = HCI_STATE_CLOSED;
+	hci_controller->transport = transport ? transport : &hci_bluez_transport;
+	hci_controller->transport_data = transport_data;
+	hci_controller->cancel_fd = -1;
 	struct hci_dev_info info;
-	hci_socket_t hci_socket = open_hci_socket(mac);
+	hci_socket_t hci_socket = open_hci_socket_transport(hci_controller->transport, transport_data, mac);
 	char real_name[8] = "UNKNOWN";
+	bt_address_t address;
+	memset(&address, 0, sizeof(address));
+	if (mac) {
+		address = *mac;
+	}
 
 	if (hci_socket.sock < 0) {
-		return res;
+		return -1;
 	}
-	list_push(&(res.sockets_list), &hci_socket, sizeof(hci_socket_t));
+	pthread_mutex_init(&(hci_controller->lock), NULL);
+	pthread_cond_init(&(hci_controller->restored), NULL);
+	list_push(&(hci_controller->sockets_list), &hci_socket, sizeof(hci_socket_t));
 
-	if (hci_devinfo(hci_socket.dev_id, &info) >= 0) {
+	if (hci_controller->transport->dev_info(&hci_socket, &info) >= 0) {
 		strncpy(real_name, info.name, 8);
 		if (!mac) {
-			*mac = info.bdaddr;
+			address = info.bdaddr;
 		}
 	}
-	res.device = bt_device_create(*mac, PUBLIC_DEVICE_ADDRESS, real_name, name);
-	res.state = HCI_STATE_OPEN;
-	res.interrupted = 0;
+	hci_controller->device = bt_device_create(address, PUBLIC_DEVICE_ADDRESS, real_name, name);
+	hci_read_caps(&hci_socket, &(hci_controller->caps));
+	if (!(hci_controller->caps.known & HCI_CAPS_VERSION)) {
+		print_trace(TRACE_WARNING, "hci_controller_init : unable to read the "
+			    "capabilities of the adapter.\n");
+	}
 
-	return res;
+	// Sockets used by the functions called without an explicit socket :
+	if (hci_socket_pool_init(&(hci_controller->socket_pool), hci_controller->transport, transport_data,
+				 &(hci_controller->device.mac), HCI_CONTROLLER_SOCKET_POOL_SIZE) < 0) {
+		print_trace(TRACE_WARNING, "hci_controller_init : no socket pool, "
+			    "sockets will be opened on each call.\n");
+	}
+	hci_controller->cancel_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (hci_controller->cancel_fd < 0) {
+		perror("hci_controller_init : eventfd");
+		print_trace(TRACE_WARNING, "hci_controller_init : the collections of reports "
+			    "won't be cancellable.\n");
+	}
+	hci_controller->state = HCI_STATE_OPEN;
+	hci_controller->interrupted = 0;
+	hci_controller->inquiry_mode = HCI_INQUIRY_MODE_UNKNOWN;
+
+	return 0;
 }
 
 //---------------------------------
@@ -234,10 +474,34 @@ hci_controller_t hci_open_controller(bt_address_t *mac, char *name) {
 int8_t hci_close_controller(hci_controller_t *hci_controller) {
 
 	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_close_controller");
-	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_close_controller");
 
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_CLOSED) < 0) {
+		print_trace(TRACE_ERROR, "hci_close_controller : busy or closed controller.\n");
+		return -1;
+	}
+
+	if (hci_controller->reactor) {
+		hci_controller_remove_from_reactor(hci_controller);
+	}
+	if (hci_controller->name_resolver) {
+		hci_name_resolver_stop(hci_controller->name_resolver);
+	}
+	if (hci_controller->conn_manager) {
+		hci_conn_manager_stop(hci_controller->conn_manager);
+	}
+	if (hci_controller->watchdog) {
+		hci_watchdog_stop(hci_controller->watchdog);
+	}
+	pthread_mutex_lock(&(hci_controller->lock));
 	close_all_hci_sockets(&(hci_controller->sockets_list));
-	hci_change_state(hci_controller, HCI_STATE_CLOSED);
+	pthread_mutex_unlock(&(hci_controller->lock));
+	hci_socket_pool_close(&(hci_controller->socket_pool));
+	if (hci_controller->cancel_fd >= 0) {
+		close(hci_controller->cancel_fd);
+		hci_controller->cancel_fd = -1;
+	}
+	pthread_cond_destroy(&(hci_controller->restored));
+	pthread_mutex_destroy(&(hci_controller->lock));
 	
 	return 0;
 }
@@ -249,48 +513,232 @@ hci_socket_t hci_open_socket_controller(hci_controller_t *hci_controller) {
 	hci_socket_t tmp;
 
 	if (!hci_controller) {
-		print_trace(TRACE_ERROR, "hci_close_socket_controller : invalid controller reference.\n");
+		print_trace(TRACE_ERROR, "hci_open_socket_controller : invalid controller reference.\n");
+		tmp.sock = -1;
+		return tmp;
+	}
+
+	if (hci_get_state(hci_controller) == HCI_STATE_CLOSED) {
+		print_trace(TRACE_ERROR, "hci_open_socket_controller : closed controller.\n");
 		tmp.sock = -1;
 		return tmp;
 	}
 
-	tmp = open_hci_socket(&(hci_controller->device.mac));
+	tmp = open_hci_socket_transport(hci_controller->transport, hci_controller->transport_data,
+					&(hci_controller->device.mac));
 	int8_t status = tmp.sock;
 	if (status < 0) {
 		tmp.sock = -1;
 		return tmp;
 	}
+	pthread_mutex_lock(&(hci_controller->lock));
 	list_push(&(hci_controller->sockets_list), &tmp, sizeof(hci_socket_t));
+
+	if (hci_controller->reactor) {
+		if (reactor_add(hci_controller->reactor, tmp.sock, EPOLLIN,
+				hci_controller->sockets_list->val, hci_controller->reactor_callback,
+				hci_controller->reactor_user_data) < 0) {
+			print_trace(TRACE_WARNING, "hci_open_socket_controller : unable to register the socket in the reactor.\n");
+		}
+	}
+	pthread_mutex_unlock(&(hci_controller->lock));
 	
 	return tmp;
 }
 
 //---------------------------------
 
+/* Removes the socket opened on the given descriptor from a sockets list, and returns it
+   (NULL if not listed). The sockets are looked up by descriptor : the filter, timestamp
+   and statistics of the caller's copy change as soon as it is used.
+*/
+static hci_socket_t *hci_unlist_socket(list_t **sockets_list, int8_t sock) {
+	list_t **link = sockets_list;
+	while (*link != NULL) {
+		list_t *node = *link;
+		hci_socket_t *listed_socket = (hci_socket_t *)node->val;
+		if (listed_socket->sock == sock) {
+			*link = node->next;
+			free(node);
+			return listed_socket;
+		}
+		link = &(node->next);
+	}
+	return NULL;
+}
+
+//---------------------------------
+
 int8_t hci_close_socket_controller(hci_controller_t *hci_controller, hci_socket_t *hci_socket) {
 	
 	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_close_socket_controller");
 	CHECK_HCI_SOCKET_PTR(hci_socket, "hci_close_socket_controller");
 
-	hci_socket_t *listed_socket = list_search(&(hci_controller->sockets_list),
-						  (const void *)hci_socket,
-						  sizeof(hci_socket_t));
+	pthread_mutex_lock(&(hci_controller->lock));
+	hci_socket_t *listed_socket = NULL;
+	if (hci_socket->sock >= 0) {
+		listed_socket = hci_unlist_socket(&(hci_controller->sockets_list), hci_socket->sock);
+	}
 	if (!listed_socket) {
+		pthread_mutex_unlock(&(hci_controller->lock));
 		print_trace(TRACE_WARNING, "hci_close_socket_controller : unexisting socket.\n");
 		return -1;
 	}
+	if (hci_controller->reactor && listed_socket->sock >= 0) {
+		reactor_remove(hci_controller->reactor, listed_socket->sock);
+	}
+	pthread_mutex_unlock(&(hci_controller->lock));
 	close_hci_socket(listed_socket);
 	free(listed_socket);
 	
 	return 0;
 }
 
+//---------------------------------
+
+int8_t hci_controller_add_to_reactor(hci_controller_t *hci_controller, reactor_t *reactor,
+				     reactor_callback_t callback, void *user_data) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_controller_add_to_reactor");
+
+	if (hci_get_state(hci_controller) == HCI_STATE_CLOSED) {
+		print_trace(TRACE_ERROR, "hci_controller_add_to_reactor : closed controller.\n");
+		return -1;
+	}
+
+	if (!reactor || !callback) {
+		print_trace(TRACE_ERROR, "hci_controller_add_to_reactor : invalid arguments.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(hci_controller->lock));
+	if (hci_controller->reactor) {
+		pthread_mutex_unlock(&(hci_controller->lock));
+		print_trace(TRACE_ERROR, "hci_controller_add_to_reactor : controller already registered in a reactor.\n");
+		return -1;
+	}
+
+	list_t *tmp = hci_controller->sockets_list;
+	while (tmp != NULL) {
+		hci_socket_t *hci_socket = (hci_socket_t *)tmp->val;
+		if (hci_socket->sock >= 0 &&
+		    reactor_add(reactor, hci_socket->sock, EPOLLIN, hci_socket, callback, user_data) < 0) {
+			goto fail;
+		}
+		tmp = tmp->next;
+	}
+
+	hci_controller->reactor = reactor;
+	hci_controller->reactor_callback = callback;
+	hci_controller->reactor_user_data = user_data;
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	return 0;
+
+ fail:
+	// Unregisters the sockets registered before the failing one.
+	for (list_t *added = hci_controller->sockets_list; added != tmp; added = added->next) {
+		hci_socket_t *hci_socket = (hci_socket_t *)added->val;
+		if (hci_socket->sock >= 0) {
+			reactor_remove(reactor, hci_socket->sock);
+		}
+	}
+	pthread_mutex_unlock(&(hci_controller->lock));
+	return -1;
+}
+
+//---------------------------------
+
+int8_t hci_controller_remove_from_reactor(hci_controller_t *hci_controller) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_controller_remove_from_reactor");
+
+	pthread_mutex_lock(&(hci_controller->lock));
+	if (!hci_controller->reactor) {
+		pthread_mutex_unlock(&(hci_controller->lock));
+		print_trace(TRACE_WARNING, "hci_controller_remove_from_reactor : controller not registered in a reactor.\n");
+		return -1;
+	}
+
+	for (list_t *tmp = hci_controller->sockets_list; tmp != NULL; tmp = tmp->next) {
+		hci_socket_t *hci_socket = (hci_socket_t *)tmp->val;
+		if (hci_socket->sock >= 0) {
+			reactor_remove(hci_controller->reactor, hci_socket->sock);
+		}
+	}
+
+	hci_controller->reactor = NULL;
+	hci_controller->reactor_callback = NULL;
+	hci_controller->reactor_user_data = NULL;
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	return 0;
+}
+
+//---------------------------------
+
+void hci_controller_cancel(hci_controller_t *hci_controller) {
+	if (!hci_controller) {
+		print_trace(TRACE_ERROR, "hci_controller_cancel : invalid controller reference.\n");
+		return;
+	}
+
+	pthread_mutex_lock(&(hci_controller->lock));
+	hci_controller->cancel_generation++;
+	// Without any collection in progress, there is nobody to wake up :
+	if (hci_controller->cancel_waiters && hci_controller->cancel_fd >= 0) {
+		uint64_t one = 1;
+		if (write(hci_controller->cancel_fd, &one, sizeof(one)) < 0) {
+			perror("hci_controller_cancel : unable to wake the collections up");
+		}
+	}
+	pthread_mutex_unlock(&(hci_controller->lock));
+}
+
+//---------------------------------
+
+void hci_controller_set_deadline(hci_controller_t *hci_controller, const struct timespec *deadline) {
+	if (!hci_controller) {
+		print_trace(TRACE_ERROR, "hci_controller_set_deadline : invalid controller reference.\n");
+		return;
+	}
+
+	uint64_t ns = 0;
+	if (deadline) {
+		ns = (uint64_t)deadline->tv_sec * 1000000000ULL + deadline->tv_nsec;
+		if (!ns) {
+			ns = 1; // Zero means no deadline : the epoch of the clock has passed anyway.
+		}
+	}
+	__atomic_store_n(&(hci_controller->deadline), ns, __ATOMIC_RELEASE);
+}
+
 //------------------------------------------------------------------------------------
 
 /*------------------------------------
   - CONTROLLER INTERACTION FUNCTIONS -
   ------------------------------------*/
 
+int8_t hci_change_state(hci_controller_t *hci_controller, hci_state_t from, hci_state_t to) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_change_state");
+
+	hci_state_t expected = from;
+	if (!__atomic_compare_exchange_n(&(hci_controller->state), &expected, to, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		print_trace(TRACE_DEBUG, "Controller %s state not changing from %i to %i (current state : %i)\n",
+			    hci_controller->device.custom_name, from, to, expected);
+		return -1;
+	}
+	__atomic_add_fetch(&(hci_controller->state_changes), 1, __ATOMIC_RELAXED);
+	print_trace(TRACE_DEBUG, "Controller %s state changing from %i to %i\n", hci_controller->device.custom_name,
+		    from, to);
+	
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
 int8_t hci_resolve_interruption(hci_socket_t *hci_socket, hci_controller_t *hci_controller) {
 
 	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_resolve_interruption");
@@ -307,22 +755,92 @@ int8_t hci_resolve_interruption(hci_socket_t *hci_socket, hci_controller_t *hci_
 		return -1;
 	}
 
-	pthread_mutex_lock(&hci_controller_mutex);
-	switch (hci_controller->state) {
+	/* The lock is only held to take a snapshot of the controller : the commands below may
+	   block for their whole timeout. The "restoring" flag keeps the scan session registered
+	   meanwhile, and keeps the other resolvers (and the watchdog) out.
+	*/
+	pthread_mutex_lock(&(hci_controller->lock));
+	while (hci_controller->restoring) {
+		pthread_cond_wait(&(hci_controller->restored), &(hci_controller->lock));
+	}
+	if (!hci_controller->interrupted) { // Resolved by another thread meanwhile.
+		pthread_mutex_unlock(&(hci_controller->lock));
+		goto end;
+	}
+	hci_state_t state = hci_get_state(hci_controller);
+	hci_scan_session_t *session = hci_controller->scan_session;
+	hci_controller->restoring = 1;
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	char resolved = 0;
+	char reopen = 0;
+	switch (state) {
 	case HCI_STATE_SCANNING :
 		print_trace(TRACE_INFO, "The controller was previsouly blocking on the scanning state\n");
-		if (hci_le_set_scan_enable(hci_socket->sock, htobs(0x00), htobs(0x00), 0) < 0) {
+		// A session still scanning keeps the controller, its scan is programmed again :
+		if (session) {
+			if (hci_LE_scan_session_restore(session, hci_socket) < 0) {
+				perror("scan_session_restore");
+			} else {
+				resolved = 1;
+			}
+			break;
+		}
+		/* A controller which was scanning with the extended commands rejects the legacy
+		   ones ("Command Disallowed"), and the scan may also have been a periodic inquiry.
+		*/
+		if (hci_LE_set_scan_enable_req(hci_socket, 0x00, 0x00, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0 &&
+		    hci_LE_set_ext_scan_enable_req(hci_socket, 0x00, 0x00, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0 &&
+		    hci_exit_periodic_inquiry_req(hci_socket, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
 			perror("set_scan_disable");
 		} else {
-			hci_controller->interrupted = 0;
-			hci_change_state(hci_controller, HCI_STATE_OPEN);
+			resolved = reopen = 1;
+		}
+		break;
+	case HCI_STATE_ADVERTISING : {
+		print_trace(TRACE_INFO, "The controller was previsouly blocking on the advertising state\n");
+		le_set_advertise_enable_cp cp;
+		uint8_t status;
+		cp.enable = 0x00;
+		if (send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_SET_ADVERTISE_ENABLE, &cp,
+					       LE_SET_ADVERTISE_ENABLE_CP_SIZE, &status, 1,
+					       HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+			perror("set_advertise_disable");
+		} else {
+			resolved = reopen = 1;
 		}
 		break;
+	}
+	case HCI_STATE_OPEN : // Put back in the default state by its owner meanwhile.
+		resolved = 1;
+		break;
+	case HCI_STATE_READING :
+	case HCI_STATE_WRITING :
+		// Nothing is left running on the adapter by a single command :
+		print_trace(TRACE_INFO, "The controller was previsouly blocking on a command\n");
+		resolved = reopen = 1;
+		break;
 	default:
 		print_trace(TRACE_ERROR, "hci_resolve_interruption : unrecognized state.\n");
 		break;
 	}
-	pthread_mutex_unlock(&hci_controller_mutex);
+
+	/* The controller is given back from the state of the snapshot only : its owner may have
+	   left it meanwhile, the transition then fails without harm.
+	*/
+	if (reopen) {
+		hci_change_state(hci_controller, state, HCI_STATE_OPEN);
+	}
+	pthread_mutex_lock(&(hci_controller->lock));
+	if (resolved) {
+		hci_controller->interrupted = 0;
+	}
+	hci_controller->restoring = 0;
+	pthread_cond_broadcast(&(hci_controller->restored));
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+ end:
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	if (!hci_controller->interrupted) {
 		print_trace(TRACE_INFO, "hci_resolve_interruption : interruption resolved.\n");
@@ -335,43 +853,129 @@ int8_t hci_resolve_interruption(hci_socket_t *hci_socket, hci_controller_t *hci_
 
 //------------------------------------------------------------------------------------
 
-// RFU (Reserved for Future Use) : the only information available yet is the LE_Encryption...
-int8_t hci_LE_read_local_supported_features(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
-					    uint8_t *features) { //p1056
-
-	char new_socket = 0;
-
-	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_LE_read_local_supported_features");
-	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, hci_socket);
-	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_LE_read_local_supported_features");
+int8_t hci_force_scan_disable(hci_socket_t *hci_socket, hci_controller_t *hci_controller, int timeout) {
 
-	if (!features) {
-		print_trace(TRACE_ERROR, "hci_LE_read_local_supported_features : invalid reference.\n");
-		goto fail;
-	}
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_force_scan_disable");
 
-	struct hci_request rq;
-	memset(&rq, 0, sizeof(rq));
-	le_read_local_supported_features_rp rp;
-	memset(&rp, 0, sizeof(rp));
-	
-	rq.ogf = OGF_LE_CTL;
-	rq.ocf = OCF_LE_READ_LOCAL_SUPPORTED_FEATURES;
-	rq.rparam = &rp;
-	rq.rlen = LE_READ_LOCAL_SUPPORTED_FEATURES_RP_SIZE;
-	
+	char new_socket = 0;
+	char socket_err = 0;
+	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
+	if (socket_err) {
+		return -1;
+	}
+
+	/* An adapter which isn't scanning answers with an error status ("Command Disallowed"),
+	   only the commands left unanswered tell that it doesn't respond.
+	*/
+	int8_t res = 0;
+	if (hci_LE_set_scan_enable_req(hci_socket, 0x00, 0x00, timeout) < 0 && errno != EIO) {
+		res = -1;
+	}
+	if (hci_LE_set_ext_scan_enable_req(hci_socket, 0x00, 0x00, timeout) < 0 && errno != EIO) {
+		res = -1;
+	}
+	if (hci_exit_periodic_inquiry_req(hci_socket, timeout) < 0 && errno != EIO) {
+		res = -1;
+	}
+
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_reset_adapter(hci_socket_t *hci_socket, hci_controller_t *hci_controller, int timeout) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_reset_adapter");
+
+	char new_socket = 0;
+	char socket_err = 0;
+	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
+	if (socket_err) {
+		return -1;
+	}
+
+	int8_t res = -1;
+	uint8_t status;
+	if (send_hci_socket_simple_req(hci_socket, OGF_HOST_CTL, OCF_RESET, NULL, 0, &status, 1, timeout) < 0) {
+		perror("hci_reset_adapter : reset");
+		goto end;
+	}
+	hci_controller->inquiry_mode = HCI_INQUIRY_MODE_UNKNOWN;
+
+	/* Events masks of the kernel : the default events, the "Extended Inquiry Result" and
+	   "LE Meta" events, and the legacy and extended LE advertising reports.
+	*/
+	set_event_mask_cp mask_cp;
+	le_set_event_mask_cp le_mask_cp;
+	for (uint8_t i = 0; i < 8; i++) { // Little endian
+		mask_cp.mask[i] = (0x20005FFFFFFFFFFFULL >> (8 * i)) & 0xFF;
+		le_mask_cp.mask[i] = (0x000000000000101FULL >> (8 * i)) & 0xFF;
+	}
+	if (send_hci_socket_simple_req(hci_socket, OGF_HOST_CTL, OCF_SET_EVENT_MASK, &mask_cp,
+				       SET_EVENT_MASK_CP_SIZE, &status, 1, timeout) < 0 ||
+	    send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_SET_EVENT_MASK, &le_mask_cp,
+				       LE_SET_EVENT_MASK_CP_SIZE, &status, 1, timeout) < 0) {
+		perror("hci_reset_adapter : set_event_mask");
+		goto end;
+	}
+	print_trace(TRACE_INFO, "hci_reset_adapter : %s reset.\n", hci_controller->device.custom_name);
+	res = 0;
+
+ end:
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+// RFU (Reserved for Future Use) : the only information available yet is the LE_Encryption...
+int8_t hci_LE_read_local_supported_features(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+					    uint8_t *features) { //p1056
+
+	char new_socket = 0;
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_LE_read_local_supported_features");
+
+	if (!features) {
+		print_trace(TRACE_ERROR, "hci_LE_read_local_supported_features : invalid reference.\n");
+		goto fail;
+	}
+	if (hci_controller->caps.known & HCI_CAPS_LE_FEATURES) {
+		for (uint8_t i = 0; i < 8; i++) { // Little endian
+			features[i] = (hci_controller->caps.le_features >> (8 * i)) & 0xFF;
+		}
+		return 0;
+	}
+	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, hci_socket);
+	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_LE_read_local_supported_features");
+
+	struct hci_request rq;
+	memset(&rq, 0, sizeof(rq));
+	le_read_local_supported_features_rp rp;
+	memset(&rp, 0, sizeof(rp));
+	
+	rq.ogf = OGF_LE_CTL;
+	rq.ocf = OCF_LE_READ_LOCAL_SUPPORTED_FEATURES;
+	rq.rparam = &rp;
+	rq.rlen = LE_READ_LOCAL_SUPPORTED_FEATURES_RP_SIZE;
+	
 	char socket_err = 0;
 	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
 	if (socket_err) {
 		goto fail;
 	}
 
-	hci_change_state(hci_controller, HCI_STATE_READING);
-	if (hci_send_req(hci_socket->sock, &rq, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_READING) < 0) {
+		print_trace(TRACE_ERROR, "hci_LE_read_local_supported_features : busy or closed controller.\n");
+		goto fail;
+	}
+	if (send_hci_socket_req(hci_socket, &rq, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
 		perror("hci_LE_read_local_supported_features");
+		hci_change_state(hci_controller, HCI_STATE_READING, HCI_STATE_OPEN);
 		goto fail;
 	}
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
+	hci_change_state(hci_controller, HCI_STATE_READING, HCI_STATE_OPEN);
 
 	if (rp.status) {
 		print_trace(TRACE_ERROR, "hci_LE_read_supported_features : 0x%X\n", rp.status);
@@ -380,19 +984,13 @@ int8_t hci_LE_read_local_supported_features(hci_socket_t *hci_socket, hci_contro
 
 	memcpy(features, rp.features, 8);
 
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} 
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	return 0;
 
  fail:
 
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
-	if (new_socket) {
-		hci_close_socket_controller(hci_controller, hci_socket);
-	} 
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 	return -1;
 
 }
@@ -405,14 +1003,17 @@ int8_t hci_LE_read_supported_states(hci_socket_t *hci_socket, hci_controller_t *
 	char new_socket = 0;
 	
 	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_LE_read_local_supported_states");
-	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, hci_socket);
-	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_LE_read_local_supported_states");
-    
+
 	if (!states) {
 		print_trace(TRACE_ERROR, "hci_LE_read_local_supported_features : states invalid reference.\n");
 		goto fail;
 	}
-
+	if (hci_controller->caps.known & HCI_CAPS_LE_STATES) {
+		*states = hci_controller->caps.le_states;
+		return 0;
+	}
+	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, hci_socket);
+	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_LE_read_local_supported_states");
 
 	struct hci_request rq;
 	memset(&rq, 0, sizeof(rq));
@@ -430,12 +1031,16 @@ int8_t hci_LE_read_supported_states(hci_socket_t *hci_socket, hci_controller_t *
 		goto fail;
 	}
 
-	hci_change_state(hci_controller, HCI_STATE_READING);
-	if (hci_send_req(hci_socket->sock, &rq, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_READING) < 0) {
+		print_trace(TRACE_ERROR, "hci_LE_read_supported_states : busy or closed controller.\n");
+		goto fail;
+	}
+	if (send_hci_socket_req(hci_socket, &rq, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
 		perror("hci_LE_read_supported_states");
+		hci_change_state(hci_controller, HCI_STATE_READING, HCI_STATE_OPEN);
 		goto fail;
 	}
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
+	hci_change_state(hci_controller, HCI_STATE_READING, HCI_STATE_OPEN);
 
 	if (rp.status) {
 		print_trace(TRACE_ERROR, "hci_LE_read_supported_states : 0x%X\n", rp.status);
@@ -444,25 +1049,75 @@ int8_t hci_LE_read_supported_states(hci_socket_t *hci_socket, hci_controller_t *
 
 	*states = rp.states;
 
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} 
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	return 0;
 
  fail:
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} 
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 	return -1;
 
 }
 
 //------------------------------------------------------------------------------------
 
+int8_t hci_controller_refresh_caps(hci_socket_t *hci_socket, hci_controller_t *hci_controller) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_controller_refresh_caps");
+	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, hci_socket);
+
+	char new_socket = 0;
+	char socket_err = 0;
+	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
+	if (socket_err) {
+		return -1;
+	}
+
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_READING) < 0) {
+		print_trace(TRACE_ERROR, "hci_controller_refresh_caps : busy or closed controller.\n");
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+		return -1;
+	}
+	hci_controller_caps_t caps;
+	hci_read_caps(hci_socket, &caps);
+	hci_controller->caps = caps;
+	hci_change_state(hci_controller, HCI_STATE_READING, HCI_STATE_OPEN);
+
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+
+	if (!(caps.known & HCI_CAPS_VERSION)) {
+		print_trace(TRACE_ERROR, "hci_controller_refresh_caps : unable to read the capabilities.\n");
+		return -1;
+	}
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_controller_has_LE_feature(const hci_controller_t *hci_controller, uint8_t bit) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_controller_has_LE_feature");
+
+	if (!(hci_controller->caps.known & HCI_CAPS_LE_FEATURES) || bit > 63) {
+		return -1;
+	}
+	return (hci_controller->caps.le_features >> bit) & 0x01;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_controller_supports_command(const hci_controller_t *hci_controller, uint8_t octet, uint8_t bit) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_controller_supports_command");
+
+	if (!(hci_controller->caps.known & HCI_CAPS_COMMANDS) || octet > 63 || bit > 7) {
+		return -1;
+	}
+	return (hci_controller->caps.commands[octet] >> bit) & 0x01;
+}
+
+//------------------------------------------------------------------------------------
+
 int8_t hci_LE_clear_white_list(hci_socket_t *hci_socket, hci_controller_t *hci_controller) {
 
 	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_LE_clear_white_list");
@@ -476,22 +1131,22 @@ int8_t hci_LE_clear_white_list(hci_socket_t *hci_socket, hci_controller_t *hci_c
 		return -1;
 	}
 
-	hci_change_state(hci_controller, HCI_STATE_WRITING);
-	if (hci_le_clear_white_list(hci_socket->sock, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_WRITING) < 0) {
+		print_trace(TRACE_ERROR, "hci_LE_clear_white_list : busy or closed controller.\n");
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+		return -1;
+	}
+	uint8_t status;
+	if (send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_CLEAR_WHITE_LIST, NULL, 0,
+				       &status, 1, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
 		perror("hci_LE_clear_white_list");
-		hci_change_state(hci_controller, HCI_STATE_OPEN);
-		if (new_socket) {
-			close_hci_socket(hci_socket);
-			free(hci_socket);
-		}
+		hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 		return -1;
 	}
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
+	hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
 
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} 
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	return 0;
 }
@@ -518,26 +1173,29 @@ int8_t hci_LE_add_white_list(hci_socket_t *hci_socket, hci_controller_t *hci_con
 		add_type = PUBLIC_DEVICE_ADDRESS;
 	}
 
-	hci_change_state(hci_controller, HCI_STATE_WRITING);
-	if (hci_le_add_white_list(hci_socket->sock, &(bt_device.mac), add_type, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_WRITING) < 0) {
+		print_trace(TRACE_ERROR, "hci_LE_add_white_list : busy or closed controller.\n");
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+		return -1;
+	}
+	le_add_device_to_white_list_cp cp;
+	uint8_t status;
+	cp.bdaddr_type = add_type;
+	bacpy(&(cp.bdaddr), &(bt_device.mac));
+	if (send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_ADD_DEVICE_TO_WHITE_LIST, &cp, sizeof(cp),
+				       &status, 1, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
 		perror("hci_LE_add_white_list");
-		hci_change_state(hci_controller, HCI_STATE_OPEN);
-		if (new_socket) {
-			close_hci_socket(hci_socket);
-			free(hci_socket);
-		}
+		hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 		return -1;
 	}
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
+	hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
 
 	if (!bt_already_registered_device(bt_device.mac)) {
 		bt_register_device(bt_device);
 	}
 
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} 
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	return 0;
 }
@@ -564,36 +1222,140 @@ int8_t hci_LE_rm_white_list(hci_socket_t *hci_socket, hci_controller_t *hci_cont
 		add_type = PUBLIC_DEVICE_ADDRESS;
 	}
 
-	hci_change_state(hci_controller, HCI_STATE_WRITING);
-	if (hci_le_rm_white_list(hci_socket->sock, &(bt_device.mac), add_type, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_WRITING) < 0) {
+		print_trace(TRACE_ERROR, "hci_LE_rm_white_list : busy or closed controller.\n");
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+		return -1;
+	}
+	le_add_device_to_white_list_cp cp;
+	uint8_t status;
+	cp.bdaddr_type = add_type;
+	bacpy(&(cp.bdaddr), &(bt_device.mac));
+	if (send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_REMOVE_DEVICE_FROM_WHITE_LIST, &cp, sizeof(cp),
+				       &status, 1, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
 		perror("hci_LE_rm_white_list");	
-		hci_change_state(hci_controller, HCI_STATE_OPEN);
-		if (new_socket) {
-			close_hci_socket(hci_socket);
-			free(hci_socket);
-		}
+		hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 		return -1;
 	}
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
+	hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
 
 	if (!bt_already_registered_device(bt_device.mac)) {
 		bt_register_device(bt_device);
 	}
 
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} 
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	return 0;
 }
 
 //------------------------------------------------------------------------------------
 
+int8_t hci_run_cmds(hci_controller_t *hci_controller, hci_cmd_t *cmds, uint16_t nb_cmds) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_run_cmds");
+	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, NULL);
+	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_run_cmds");
+
+	if (nb_cmds && !cmds) {
+		print_trace(TRACE_ERROR, "hci_run_cmds : invalid commands reference.\n");
+		return -1;
+	}
+
+	hci_cmd_queue_t queue;
+	if (hci_cmd_queue_open(&queue, hci_controller, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+		return -1;
+	}
+
+	/* All the commands are submitted at once : they are pipelined by the queue
+	   instead of waiting for each round trip.
+	*/
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_WRITING) < 0) {
+		print_trace(TRACE_ERROR, "hci_run_cmds : busy or closed controller.\n");
+		hci_cmd_queue_close(&queue);
+		return -1;
+	}
+	int8_t res = 0;
+	for (uint16_t i = 0; i < nb_cmds; i++) {
+		if (hci_cmd_queue_submit(&queue, &(cmds[i])) < 0) {
+			res = -1; // The queue stopped : the remaining commands failed at once.
+		}
+	}
+	hci_cmd_queue_flush(&queue);
+	hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
+
+	hci_cmd_queue_close(&queue);
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_LE_set_white_list(hci_controller_t *hci_controller, const bt_device_t *devices, uint16_t length) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_LE_set_white_list");
+
+	if (length && !devices) {
+		print_trace(TRACE_ERROR, "hci_LE_set_white_list : invalid devices reference.\n");
+		return -1;
+	}
+
+	int16_t added = -1;
+	hci_cmd_t *cmds = calloc(length + 1, sizeof(hci_cmd_t));
+	if (!cmds) {
+		perror("hci_LE_set_white_list");
+		return -1;
+	}
+
+	hci_cmd_init(&(cmds[0]), OGF_LE_CTL, OCF_LE_CLEAR_WHITE_LIST, NULL, 0, NULL, NULL);
+	for (uint16_t i = 0; i < length; i++) {
+		le_add_device_to_white_list_cp cp;
+		cp.bdaddr_type = (devices[i].add_type == UNKNOWN_ADDRESS_TYPE) ? 
+			PUBLIC_DEVICE_ADDRESS : devices[i].add_type;
+		bacpy(&(cp.bdaddr), &(devices[i].mac));
+		hci_cmd_init(&(cmds[i + 1]), OGF_LE_CTL, OCF_LE_ADD_DEVICE_TO_WHITE_LIST, &cp, sizeof(cp), NULL, NULL);
+	}
+	if (hci_run_cmds(hci_controller, cmds, length + 1) < 0) {
+		goto end;
+	}
+
+	if (cmds[0].result < 0 || cmds[0].status) {
+		print_trace(TRACE_ERROR, "hci_LE_set_white_list : unable to clear the white list.\n");
+		goto end;
+	}
+
+	added = 0;
+	for (uint16_t i = 0; i < length; i++) {
+		if (cmds[i + 1].result < 0 || cmds[i + 1].status) {
+			print_trace(TRACE_WARNING, "hci_LE_set_white_list : device %u not added (status 0x%02X).\n",
+				    i, cmds[i + 1].status);
+			continue;
+		}
+		added++;
+		if (!bt_already_registered_device(devices[i].mac)) {
+			bt_register_device(devices[i]);
+		}
+	}
+
+ end:
+	free(cmds);
+	return added;
+}
+
+//------------------------------------------------------------------------------------
+
 int8_t hci_LE_get_white_list_size(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
 				  uint8_t *size) {
 
 	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_LE_get_white_list_size");
+
+	if (!size) {
+		print_trace(TRACE_ERROR, "hci_LE_get_white_list_size : invalid reference.\n");
+		return -1;
+	}
+	if (hci_controller->caps.known & HCI_CAPS_WHITE_LIST_SIZE) {
+		*size = hci_controller->caps.white_list_size;
+		return 0;
+	}
 	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, hci_socket);
 	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_LE_get_white_list_size");
 
@@ -604,22 +1366,23 @@ int8_t hci_LE_get_white_list_size(hci_socket_t *hci_socket, hci_controller_t *hc
 		return -1;
 	}
 
-	hci_change_state(hci_controller, HCI_STATE_READING);
-	if (hci_le_read_white_list_size(hci_socket->sock, size, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_READING) < 0) {
+		print_trace(TRACE_ERROR, "hci_LE_get_white_list_size : busy or closed controller.\n");
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+		return -1;
+	}
+	le_read_white_list_size_rp rp;
+	if (send_hci_socket_simple_req(hci_socket, OGF_LE_CTL, OCF_LE_READ_WHITE_LIST_SIZE, NULL, 0,
+				       &rp, LE_READ_WHITE_LIST_SIZE_RP_SIZE, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
 		perror("hci_LE_get_white_list_size");
-		hci_change_state(hci_controller, HCI_STATE_OPEN);
-		if (new_socket) {
-			close_hci_socket(hci_socket);
-			free(hci_socket);
-		}
+		hci_change_state(hci_controller, HCI_STATE_READING, HCI_STATE_OPEN);
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 		return -1;
 	}
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
+	*size = rp.size;
+	hci_change_state(hci_controller, HCI_STATE_READING, HCI_STATE_OPEN);
 
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} 
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	return 0;
 }
@@ -645,18 +1408,19 @@ int8_t hci_compute_device_name(hci_socket_t *hci_socket, hci_controller_t *hci_c
 		strcpy(bt_device->real_name, "[UNKNOWN]");
 	}
 
-	hci_change_state(hci_controller, HCI_STATE_SCANNING);
-	if (hci_read_remote_name(hci_socket->sock, &(bt_device->mac), BT_NAME_LENGTH, 
-				 bt_device->real_name, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_SCANNING) < 0) {
+		print_trace(TRACE_ERROR, "hci_compute_device_name : busy or closed controller.\n");
+		release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+		return -1;
+	}
+	if (read_hci_socket_remote_name(hci_socket, &(bt_device->mac), bt_device->real_name,
+					BT_NAME_LENGTH, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
 		perror("hci_read_remote_name");
 		strcpy(bt_device->real_name, "[UNKNOWN]");
 	}
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
+	hci_change_state(hci_controller, HCI_STATE_SCANNING, HCI_STATE_OPEN);
 
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} 
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	
 	return 0;
@@ -664,6 +1428,36 @@ int8_t hci_compute_device_name(hci_socket_t *hci_socket, hci_controller_t *hci_c
 
 //------------------------------------------------------------------------------------
 
+/* Static function filling the name of a newly discovered device : through the name
+   resolver of the controller if any (the name is "[UNKNOWN]" until it is resolved),
+   by asking the device otherwise. Without a resolver, the name is "[UNKNOWN]" while a
+   scan session holds the controller (the device can't be asked meanwhile).
+*/
+static void hci_fill_device_name(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+				 bt_device_t *bt_device) {
+	pthread_mutex_lock(&(hci_controller->lock));
+	if (hci_controller->name_resolver) {
+		if (hci_name_resolver_lookup(hci_controller->name_resolver, &(bt_device->mac),
+					     bt_device->real_name) != HCI_NAME_RESOLVED) {
+			strcpy(bt_device->real_name, "[UNKNOWN]");
+		}
+		pthread_mutex_unlock(&(hci_controller->lock));
+		return;
+	}
+	if (hci_controller->scan_session) {
+		strcpy(bt_device->real_name, "[UNKNOWN]");
+		pthread_mutex_unlock(&(hci_controller->lock));
+		return;
+	}
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	if (hci_compute_device_name(hci_socket, hci_controller, bt_device) < 0) {
+		strcpy(bt_device->real_name, "[UNKNOWN]"); // Busy controller
+	}
+}
+
+//------------------------------------------------------------------------------------
+
 bt_device_table_t hci_scan_devices(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
 				    uint8_t duration, uint16_t max_rsp, long flags) {
 	
@@ -676,7 +1470,7 @@ bt_device_table_t hci_scan_devices(hci_socket_t *hci_socket, hci_controller_t *h
 		return res;
 	}
 
-	if (hci_controller->state != HCI_STATE_OPEN) {
+	if (hci_get_state(hci_controller) != HCI_STATE_OPEN) {
 		print_trace(TRACE_ERROR, "hci_scan_devices : busy or closed controller.\n");
 		return res;
 	}
@@ -693,21 +1487,24 @@ bt_device_table_t hci_scan_devices(hci_socket_t *hci_socket, hci_controller_t *h
 	
 	// Starting the inquiry :
 	print_trace(TRACE_INFO, "Starting the scanning inquiry...");
-	hci_change_state(hci_controller, HCI_STATE_SCANNING);
-	int16_t num_rsp = hci_inquiry(hci_socket->dev_id, duration, max_rsp, NULL, &ii, flags);
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_SCANNING) < 0) {
+		print_trace(TRACE_ERROR, "hci_scan_devices : busy or closed controller.\n");
+		goto end;
+	}
+	int16_t num_rsp = hci_socket->transport->inquiry(hci_socket, duration, max_rsp, &ii, flags);
+	hci_change_state(hci_controller, HCI_STATE_SCANNING, HCI_STATE_OPEN);
 	if(num_rsp <= 0) {
 		print_trace(TRACE_STDOUT, " No device found.\n");
 		goto end;
 	}
 	
 	print_trace(TRACE_INFO, " [DONE]\n"); 
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
 	bt_device_t *device_table = calloc(num_rsp, sizeof(bt_device_t));
 
 	for (uint16_t i = 0; i < num_rsp; i++) {
 		memset(&(device_table[i]), 0, sizeof(bt_device_t));
 		device_table[i].mac = ii[i].bdaddr;
-		hci_compute_device_name(hci_socket, hci_controller, &(device_table[i]));
+		hci_fill_device_name(hci_socket, hci_controller, &(device_table[i]));
 		device_table[i].add_type = UNKNOWN_ADDRESS_TYPE;
 		strcpy(device_table[i].custom_name, "UNKNOWN");
 		if (!bt_already_registered_device(device_table[i].mac)) {
@@ -720,110 +1517,395 @@ bt_device_table_t hci_scan_devices(hci_socket_t *hci_socket, hci_controller_t *h
 	res.length = num_rsp;
 
  end :	
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
 	free(ii);
 
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	}
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	return res;
 }
 
 //------------------------------------------------------------------------------------
 
-// TODO : add the duplicate packets support
-char *hci_get_RSSI(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
-		   int8_t *file_descriptor,
-		   bt_address_t *mac, uint8_t duration, uint16_t max_rsp) {
-
-	if (!hci_controller) {
-		print_trace(TRACE_ERROR, "hci_get_RSSI : invalid controller reference.\n");
-		return NULL;
-	}
+/* Static function registering a collection of reports as waiting on the cancellation
+   eventfd of the controller. Returns the cancellation generation the collection has to
+   compare with (@see hci_cancelled).
+*/
+static uint32_t hci_cancel_point_enter(hci_controller_t *hci_controller) {
+	pthread_mutex_lock(&(hci_controller->lock));
+	hci_controller->cancel_waiters++;
+	uint32_t generation = hci_controller->cancel_generation;
+	pthread_mutex_unlock(&(hci_controller->lock));
+	return generation;
+}
 
-	if (hci_controller->interrupted) {
-		hci_resolve_interruption(hci_socket, hci_controller);
-	}
+//---------------------------------
 
-	if (hci_controller->state != HCI_STATE_OPEN) {
-		print_trace(TRACE_ERROR, "hci_get_RSSI : busy or closed controller.\n");
-		return NULL;
+/* Static function unregistering a collection of reports. The last one leaving resets
+   the eventfd : as nobody waits on it anymore, the past cancellations don't concern
+   the following collections.
+*/
+static void hci_cancel_point_leave(hci_controller_t *hci_controller) {
+	pthread_mutex_lock(&(hci_controller->lock));
+	if (!--hci_controller->cancel_waiters && hci_controller->cancel_fd >= 0) {
+		uint64_t count;
+		if (read(hci_controller->cancel_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+			perror("hci_cancel_point_leave : unable to reset the cancellation");
+		}
 	}
+	pthread_mutex_unlock(&(hci_controller->lock));
+}
 
-	// Resulting string :
-	char *res = NULL;
+//---------------------------------
 
-	// HCI_Filter structure :
-	struct hci_filter flt;	
-	struct hci_filter old_flt;
+/* Static function telling whether a cancellation was requested since the collection
+   which got the given generation began. If not, the eventfd was written for a previous
+   collection which hasn't left yet.
+*/
+static char hci_cancelled(hci_controller_t *hci_controller, uint32_t generation) {
+	pthread_mutex_lock(&(hci_controller->lock));
+	char cancelled = (hci_controller->cancel_generation != generation);
+	pthread_mutex_unlock(&(hci_controller->lock));
+	return cancelled;
+}
 
-	// Command parameter for an "OCF_WRITE_INQUIRY_MODE" :
-	write_inquiry_mode_cp write_cp;
-	memset(&write_cp, 0, sizeof(write_cp));
+//---------------------------------
 
-	// Command parameter for a standard inquiry : "OCF_INQUIRY" :
-	inquiry_cp cp;
-	memset (&cp, 0, sizeof(cp));
+/* Static function returning the time left (in ms) before the deadline of the controller,
+   or -1 if it has no deadline. The result is 0 once the deadline has passed, in which
+   case the deadline is cleared (unless it was changed meanwhile) : it only stops the
+   collection which reached it.
+*/
+static int64_t hci_deadline_remaining(hci_controller_t *hci_controller) {
+	uint64_t deadline = __atomic_load_n(&(hci_controller->deadline), __ATOMIC_ACQUIRE);
+	if (!deadline) {
+		return -1;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	if (deadline <= now_ns) {
+		__atomic_compare_exchange_n(&(hci_controller->deadline), &deadline, 0, 0,
+					    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		return 0;
+	}
+	return (int64_t)((deadline - now_ns + 999999) / 1000000);
+}
 
-	/* Events buffer : table of unsigned char (range 0-255) allowing us
-	   to catch an HCI-event packet coming in response to one of our
-	   commands packet (thanks to the "read()" function).
-	*/
-	unsigned char buf[HCI_MAX_EVENT_SIZE];
-	unsigned char *event_parameter;
- 
-	hci_event_hdr event_header;
+//---------------------------------
 
-	char new_socket = 0;
-	char socket_err = 0;
-	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
-	if (socket_err) {
-		return NULL;
+/* Static function reading the events of an already configured socket and decoding
+   the reports they contain into the given batch. The reading stops when the batch
+   is full, when max_rsp reports have been received (if max_rsp > 0), when an
+   "Inquiry Complete" event is received or when no event arrived during timeout ms
+   (next_timeout ms once a first event has been read). It also stops at the deadline
+   of the controller and when the collection is cancelled (@see hci_controller_cancel).
+   The reports of an event which didn't fit in the previous batch are added first.
+   If given, "completed" tells whether the reading stopped on an "Inquiry Complete" event.
+   Returns the number of collected reports or -1 if the socket could not be read.
+*/
+static int16_t hci_collect_reports(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+				   bt_address_t *mac, uint16_t max_rsp, int16_t timeout,
+				   int16_t next_timeout, hci_report_batch_t *batch, char *completed) {
+
+	struct pollfd p[2];
+	// Initializing the connection poll on our HCI socket and the cancellation eventfd :
+	p[0].fd = hci_socket->sock;
+	p[0].events = POLLIN;
+	p[1].fd = hci_controller->cancel_fd; // Ignored by poll if negative
+	p[1].events = POLLIN;
+
+	uint8_t *buf = NULL;
+	int n = 0;
+	int16_t len = 0;
+	int16_t wait = timeout;
+	int16_t res = -1;
+	if (completed) {
+		*completed = 0;
 	}
 
-	// Creating our filter :
-	hci_compute_filter(&flt, EVT_CMD_COMPLETE,
-			   EVT_INQUIRY_RESULT_WITH_RSSI,
-			   EVT_INQUIRY_COMPLETE,
-			   0);
-
-	/* Saving the old filter.
-	   This can be helpful in a case where we want to use a same socket for different purposes
-	   (even with multiple threads), we can replace the old filter and re-use it later.
+	/* With a deduplicator, the reports may keep arriving without any of them being kept :
+	   the collection then also stops "timeout" ms after the last kept report.
 	*/
-	char saved_flt = 1;
-	if (!new_socket) {
-		if (get_hci_socket_filter(*hci_socket, &old_flt) < 0) {
-			saved_flt = 0;
+	struct timespec last_kept;
+	if (batch->dedup) {
+		clock_gettime(CLOCK_MONOTONIC, &last_kept);
+	}
+
+	uint32_t generation = hci_cancel_point_enter(hci_controller);
+	uint32_t overflowed = batch->overflowed;
+	uint32_t truncated = batch->truncated;
+
+	// The reports of the last event which didn't fit in the previous batch come first :
+	if (batch->pending_length) {
+		uint32_t filtered = batch->filtered;
+		hci_socket->stats.delivered += hci_report_batch_resume(batch, mac);
+		hci_socket->stats.filtered += batch->filtered - filtered;
+	}
+
+	while ((!(max_rsp > 0) || (batch->length < max_rsp)) &&
+	       (buf = hci_report_batch_next_buffer(batch))) {
+		p[0].revents = 0;
+		p[1].revents = 0;
+
+		int64_t poll_wait = wait;
+		if (batch->dedup && timeout >= 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			int64_t elapsed = (now.tv_sec - last_kept.tv_sec) * 1000 +
+				(now.tv_nsec - last_kept.tv_nsec) / 1000000;
+			if (elapsed >= timeout) {
+				break;
+			}
+			if (wait < 0 || timeout - elapsed < wait) {
+				poll_wait = timeout - elapsed;
+			}
+		}
+
+		// The deadline bounds the whole collection, not only the wait for the next event :
+		char bounded = 0;
+		int64_t remaining = hci_deadline_remaining(hci_controller);
+		if (remaining == 0) {
+			break;
+		}
+		if (remaining > 0 && (poll_wait < 0 || remaining < poll_wait)) {
+			poll_wait = remaining;
+			bounded = 1;
+		}
+
+		// Polling the BT device for an event :
+		while ((n = poll(p, 2, (int)poll_wait)) < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			perror("hci_collect_reports : error while polling the socket");
+			goto end;
+		}
+
+		if (!n) {
+			/* Woken up at the deadline : it is cleared now that it has passed, so that it
+			   doesn't stop the following collection too.
+			*/
+			if (bounded && hci_deadline_remaining(hci_controller) > 0) {
+				continue;
+			}
+			// When draining (next_timeout < timeout), running out of events is expected.
+			if (next_timeout >= timeout && !bounded) {
+				errno = ETIMEDOUT;
+				perror("hci_collect_reports : error while polling the socket");
+			}
+			break;
+		}
+
+		if (p[1].revents) {
+			if (hci_cancelled(hci_controller, generation)) {
+				print_trace(TRACE_INFO, "hci_collect_reports : collection cancelled.\n");
+				break;
+			}
+			if (!p[0].revents) {
+				/* Written for a previous collection which hasn't left yet : it is reset
+				   as soon as it leaves.
+				*/
+				sched_yield();
+				continue;
+			}
+		}
+
+		while ((len = read_hci_socket(hci_socket, buf, HCI_MAX_EVENT_SIZE)) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			perror("hci_collect_reports : error while reading the socket");
+			goto end;
+		}
+
+		if (len == 0) {
+			print_trace(TRACE_WARNING, "hci_collect_reports : nothing to read on the socket.\n");
+			break;
+		}
+		wait = next_timeout;
+
+		// buf[0] is the packet type indicator (HCI_EVENT_PKT) :
+		switch (buf[1]) {
+		case EVT_LE_META_EVENT: // Code 0x3E
+		case EVT_INQUIRY_RESULT:
+		case EVT_INQUIRY_RESULT_WITH_RSSI: // Code 0x22
+		case EVT_EXTENDED_INQUIRY_RESULT: { // Code 0x2F
+			uint32_t filtered = batch->filtered;
+			uint16_t added = hci_report_batch_commit(batch, len, &(hci_socket->timestamp), mac);
+			hci_socket->stats.delivered += added;
+			hci_socket->stats.filtered += batch->filtered - filtered;
+			if (added && batch->dedup) {
+				clock_gettime(CLOCK_MONOTONIC, &last_kept);
+			}
+			break;
+		}
+
+		case EVT_INQUIRY_COMPLETE:
+			print_trace(TRACE_INFO, "Inquiry complete !\n");
+			if (completed) {
+				*completed = 1;
+			}
+			res = batch->length;
+			goto end;
+
+		case EVT_CMD_COMPLETE: // Corresponding to the last "hci_send_cmd"
+			print_trace(TRACE_WARNING, "hci_collect_reports : untreated \"Command Complete\" event.\n");
+			break;
+				
+		default:
+			print_trace(TRACE_WARNING, "hci_collect_reports : an unknown event occurred : 0x%X\n", buf[1]);
+			break;
+		}
+	}
+	res = batch->length;
+
+ end:
+	hci_socket->stats.overflowed += batch->overflowed - overflowed;
+	hci_socket->stats.truncated += batch->truncated - truncated;
+	hci_cancel_point_leave(hci_controller);
+	return res;
+}
+
+//---------------------------------
+
+/* Static function registering the devices seen in the reports of a batch starting
+   at the given index and feeding their RSSI rings. The name of the classic devices
+   is asked to the devices (@see hci_fill_device_name).
+*/
+static void hci_register_reports(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+				 hci_report_batch_t *batch, uint16_t from) {
+
+	for (uint16_t i = from; i < batch->length; i++) {
+		hci_report_t *report = &(batch->reports[i]);
+		bt_device_t *registered = bt_get_device_ref(report->mac);
+		if (!registered) {
+			bt_device_t bt_device;
+			memset(&bt_device, 0, sizeof(bt_device_t));
+			bt_device.mac = report->mac;
+			strcpy(bt_device.custom_name, "UNKNOWN");
+			if (report->evt_type == HCI_REPORT_CLASSIC_EVT_TYPE) {
+				hci_fill_device_name(hci_socket, hci_controller, &bt_device);
+				bt_device.add_type = UNKNOWN_ADDRESS_TYPE;
+			} else {
+				bt_device.add_type = report->add_type;
+			}
+			bt_register_device(bt_device);
+			registered = bt_get_device_ref(report->mac);
+		}
+
+		if (registered && registered->rssi_ring && report->rssi != HCI_REPORT_RSSI_UNAVAILABLE) {
+			bt_rssi_sample_t sample;
+			sample.timestamp = report->timestamp;
+			sample.rssi = report->rssi;
+			bt_rssi_ring_push(registered->rssi_ring, &sample);
+		}
+	}
+}
+
+//---------------------------------
+
+/* Static function displaying the reports of a batch (only from the TRACE_INFO trace
+   level : each one costs a lookup of its device and a write on the standard output)
+   and, if a file descriptor is given, writing their RSSI values inside the
+   corresponding file.
+*/
+static void hci_output_reports(hci_report_batch_t *batch, int8_t *file_descriptor) {
+
+	char verbose = (get_trace_lvl() >= TRACE_INFO);
+	for (uint16_t i = 0; i < batch->length; i++) {
+		int8_t rssi = batch->reports[i].rssi;
+		if (verbose) {
+			if (rssi == HCI_REPORT_RSSI_UNAVAILABLE) {
+				print_trace(TRACE_WARNING, "hci_output_reports : RSSI measure unavailable.\n");
+			} else if (rssi >= 21) {
+				print_trace(TRACE_ERROR, "hci_output_reports : error while reading RSSI measure.\n");
+			}
+			bt_device_display(bt_get_device(batch->reports[i].mac));
+		}
+
+		if (file_descriptor && (*file_descriptor >= 0)) {
+			char rssi_string[RSSI_STRING_LENGTH] = {0};
+			snprintf(rssi_string, RSSI_STRING_LENGTH, "%i \n", rssi);
+			if (write(*file_descriptor, rssi_string, RSSI_STRING_LENGTH) < RSSI_STRING_LENGTH) {
+				print_trace(TRACE_WARNING, "Unable to write rssi value into given fd\n");
+			}
+		}
+	}
+}
+
+//---------------------------------
+
+/* Static function turning a filled batch into the RSSI string returned by the
+   "get_RSSI" functions. The batch is destroyed.
+*/
+static char *hci_batch_to_RSSI_string(hci_report_batch_t *batch, int8_t *file_descriptor) {
+	hci_output_reports(batch, file_descriptor);
+	char *res = hci_report_batch_to_string(batch);
+	hci_report_batch_destroy(batch);
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_get_reports(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+			hci_report_batch_t *batch, bt_address_t *mac, uint8_t duration, uint16_t max_rsp) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_get_reports");
+
+	if (!batch || !batch->capacity) {
+		print_trace(TRACE_ERROR, "hci_get_reports : invalid batch reference.\n");
+		return -1;
+	}
+	hci_report_batch_clear(batch);
+
+	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, hci_socket);
+	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_get_reports");
+
+	int16_t res = -1;
+
+	// HCI_Filter structure :
+	struct hci_filter old_flt;
+
+	// Command parameter for a standard inquiry : "OCF_INQUIRY" :
+	inquiry_cp cp;
+	memset (&cp, 0, sizeof(cp));
+
+	char new_socket = 0;
+	char socket_err = 0;
+	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
+	if (socket_err) {
+		return -1;
+	}
+
+	/* Saving the old filter.
+	   This can be helpful in a case where we want to use a same socket for different purposes
+	   (even with multiple threads), we can replace the old filter and re-use it later.
+	   The filter recorded in the socket is used when known, and nothing is installed
+	   if the socket already has the inquiry filter.
+	*/
+	char saved_flt = 1;
+	if (new_socket != HCI_SOCKET_NEW) {
+		if (get_hci_socket_cached_filter(hci_socket, &old_flt) < 0) {
+			saved_flt = 0;
 		}
 	}
 
 	// Applying the new filter :
-	if (set_hci_socket_filter(*hci_socket, &flt) < 0) {
+	if (apply_hci_socket_filter_profile(hci_socket, HCI_FILTER_PROFILE_INQUIRY) < 0) {
 		goto end;
 	}
 
-	// Configuring the inquiry mode on the open HCI socket :
-	print_trace(TRACE_DEBUG, "Configuring the inquiry mode...");
-	write_cp.mode = htobs(0x01); // Inquiry Result format with RSSI (cf p878 spec').
-	
-	pthread_mutex_lock(&hci_controller_mutex);
-	hci_change_state(hci_controller, HCI_STATE_WRITING);
-	if (hci_send_cmd(hci_socket->sock, OGF_HOST_CTL, OCF_WRITE_INQUIRY_MODE, 
-			 WRITE_INQUIRY_MODE_CP_SIZE, &write_cp) < 0) {
-		print_trace(TRACE_ERROR, " [ERROR]\n");
-		perror("Can't set inquiry mode");
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_WRITING) < 0) {
+		print_trace(TRACE_ERROR, "hci_get_reports : busy or closed controller.\n");
 		goto end;
 	}
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
-	pthread_mutex_unlock(&hci_controller_mutex);
-	
-	if (check_cmd_complete(hci_socket, hci_controller)) {
-		print_trace(TRACE_DEBUG, " [DONE]\n"); 
-	} else {
-		print_trace(TRACE_DEBUG, " [ERROR]\n");
+	/* Configuring the inquiry mode on the open HCI socket : Inquiry Result format with
+	   RSSI (cf p878 spec'), unless the adapter already sends the RSSI in extended results.
+	*/
+	if (hci_write_inquiry_mode(hci_socket, hci_controller,
+				   (hci_controller->inquiry_mode == HCI_INQUIRY_MODE_EXTENDED ?
+				    HCI_INQUIRY_MODE_EXTENDED : HCI_INQUIRY_MODE_RSSI)) < 0) {
+		hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
+		goto end;
 	}
 
 	// Setting the command parameters for our rssi inquiry :
@@ -840,219 +1922,120 @@ char *hci_get_RSSI(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
 	   event will be sent to the host by using this command. 
 	   This will only generate an Inquiry Complete event.
 	*/
-	pthread_mutex_lock(&hci_controller_mutex);
-	hci_change_state(hci_controller, HCI_STATE_SCANNING);
-	if (hci_send_cmd(hci_socket->sock, OGF_LINK_CTL, OCF_INQUIRY, INQUIRY_CP_SIZE, &cp) < 0) {
+	// The controller stays reserved from the inquiry mode configuration to the end of the inquiry.
+	hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_SCANNING);
+	if (send_hci_socket_cmd(hci_socket, OGF_LINK_CTL, OCF_INQUIRY, INQUIRY_CP_SIZE, &cp) < 0) {
 		print_trace(TRACE_ERROR, " [ERROR]\n");
 		perror("Can't start inquiry");
+		hci_change_state(hci_controller, HCI_STATE_SCANNING, HCI_STATE_OPEN);
 		goto end;
 	}
 	print_trace(TRACE_INFO, " [DONE]\n"); 
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
-	pthread_mutex_unlock(&hci_controller_mutex);
-
-	// Connection poll structure, not initialized yet :
-	struct pollfd p;
-	
-	// Initializing the connection poll on our HCI socket :
-	p.fd = hci_socket->sock;
-	p.events = POLLIN;
-
-	char canceled = 0;
-	int8_t n = 0;
-	int16_t len = 0;
-
-	res = calloc(6*max_rsp, sizeof(char));
-	res[0] = '\0';
-	while(!canceled) {
-		p.revents = 0;
-		n = 0;
-		len = 0;
-
-		// Polling the BT device for an event :
-		if ((n = poll(&p, 1, HCI_CONTROLLER_DEFAULT_TIMEOUT)) < 0) {
-			if (errno == EAGAIN || EINTR) {
-				continue;
-			}
-			perror("hci_get_RSSI : error while polling the socket");
-			canceled = 1;
-			goto end;
-		}
-
-		if (!n) {
-			errno = ETIMEDOUT;
-			perror("hci_get_RSSI : error while polling the socket");
-			break;
-		}
-
-		while ((len = read(hci_socket->sock, buf, sizeof(buf))) < 0) {
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
-			perror("hci_get_RSSI : error while reading the socket");
-			canceled = 1;
-			goto end;
-		}
 
-		if (len == 0) {
-			print_trace(TRACE_WARNING, "hci_get_RSSI : nothing to read on the socket.\n");
-			break;
-		}
-
-
-		// WHAT IS buf[0] ? Maybe a parameter added by "read()" ???
-		event_header.evt = buf[1];
-		event_header.plen = buf[2];
-	
-		event_parameter = buf + HCI_EVENT_HDR_SIZE + 1;
-			
-		int num_results = event_parameter[0];
-		event_parameter = (void *)(event_parameter + 1); // We switch to the next byte.
-		
-		switch (event_header.evt) {
-		case EVT_CMD_COMPLETE: // Corresponding to the last "hci_send_cmd"
-			print_trace(TRACE_WARNING, "hci_get_RSSI : untreated \"Command Complete\" event.\n");
-			break;
+	/* The inquiry ends with an "Inquiry Complete" event : we only rely on the 
+	   timeout if the controller stays silent.
+	*/
+	char completed = 0;
+	res = hci_collect_reports(hci_socket, hci_controller, NULL, 0, HCI_CONTROLLER_DEFAULT_TIMEOUT,
+				  HCI_CONTROLLER_DEFAULT_TIMEOUT, batch, &completed);
+	/* Stopped before the end of the inquiry (full batch, deadline, cancellation or error) :
+	   the adapter would keep inquiring, and refuse the next commands, until its end.
+	*/
+	if (!completed && hci_inquiry_cancel_req(hci_socket, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+		perror("hci_get_reports : unable to cancel the inquiry");
+	}
+	// Released before the registration, which may ask the names of the new devices.
+	hci_change_state(hci_controller, HCI_STATE_SCANNING, HCI_STATE_OPEN);
+	if (res > 0) {
+		hci_register_reports(hci_socket, hci_controller, batch, 0);
+	}
 
-		case EVT_INQUIRY_RESULT_WITH_RSSI: // Code 0x22 
-			for (uint16_t i = 0; i < num_results; i++) {
-				bt_device_t bt_device;
-				bt_address_t *rsp_mac = (bt_address_t *)(event_parameter + 6*i); // @ on 6 bytes.
-				if (!bt_already_registered_device(*rsp_mac)) {
-					bt_device.mac = *rsp_mac;	
-					hci_compute_device_name(hci_socket, hci_controller, &bt_device);
-					strcpy(bt_device.custom_name, "UNKNOWN");
-					bt_device.add_type  = UNKNOWN_ADDRESS_TYPE;
-					bt_register_device(bt_device);
-				} else {
-					bt_device = bt_get_device(*rsp_mac);
-				}
-
-				if (mac != NULL && !(bt_compare_addresses(mac, rsp_mac))) {
-					continue;
-				}
-
-				/* To understand the meaning of the following offsets, please refer to
-				   the spec' p.1002. The structure of the HCI Packet "inquiry result with
-				   RSSI" is shown and explained. To sum up, during the inquiry period,
-				   several devices may respond and one event packet may contain several
-				   informations. But these informations are not stored device per device
-				   but rather "feature by feature". That is to say that the event packet
-				   contains first all of the mac@, then all of the 
-				   "page_scan_repetition_mode" etc...
-				*/
-				int8_t *rssi = (int8_t *)(event_parameter + (6+1+1+3+2)*num_results + i); 
-			
-				bt_device_display(bt_device);
-				if (file_descriptor && (*file_descriptor >= 0)) {
-					char rssi_string[RSSI_STRING_LENGTH] = {0};
-					snprintf(rssi_string, RSSI_STRING_LENGTH, "%i \n", *rssi);
-					if (write(*file_descriptor, rssi_string, RSSI_STRING_LENGTH) < RSSI_STRING_LENGTH) {
-						print_trace(TRACE_WARNING, "Unable to write rssi value into given fd\n");
-					}
-				} 
-				char rssi_string_val[5] = {0};
-				snprintf(rssi_string_val, 5, "%i;", *rssi);
-				strcat(res, rssi_string_val);
+	if (mac && res > 0) { // Only keeping the reports of the requested device :
+		uint16_t kept = 0;
+		for (uint16_t i = 0; i < batch->length; i++) {
+			if (bt_compare_addresses(mac, &(batch->reports[i].mac))) {
+				batch->reports[kept++] = batch->reports[i];
 			}
-			break;
-
-		case EVT_INQUIRY_COMPLETE:
-			print_trace(TRACE_INFO, "Inquiry complete !\n");
-			canceled = 1;
-			break;
-				
-		default:
-			print_trace(TRACE_WARNING, "hci_get_RSSI : an unknown event occurred : 0x%X\n", event_header.evt);
-			break;
 		}
-			
+		batch->length = kept;
+		res = kept;
 	}
 
-
  end :
-	if (!hci_controller->interrupted) {
-		hci_change_state(hci_controller, HCI_STATE_OPEN);
-	}
-	pthread_mutex_trylock(&hci_controller_mutex);
-	pthread_mutex_unlock(&hci_controller_mutex);
-	
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} else {
+	if (new_socket != HCI_SOCKET_NEW && saved_flt) {
 		// Restoring the old filter :
-		if (saved_flt) {
-			set_hci_socket_filter(*hci_socket, &old_flt);
-		}
+		apply_hci_socket_filter(hci_socket, &old_flt);
 	}
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
 	return res;
 }
 
 //------------------------------------------------------------------------------------
 
-char *hci_LE_get_RSSI(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
-		      int8_t *file_descriptor,
-		      bt_address_t *mac, uint16_t max_rsp, uint8_t scan_type, uint16_t scan_interval,
-		      uint16_t scan_window, uint8_t own_add_type, uint8_t scan_filter_policy) {
+char *hci_get_RSSI(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+		   int8_t *file_descriptor,
+		   bt_address_t *mac, uint8_t duration, uint16_t max_rsp) {
 
-	if (!hci_controller) {
-		print_trace(TRACE_ERROR, "hci_LE_get_RSSI : invalid controller reference.\n");
+	hci_report_batch_t batch;
+	if (hci_report_batch_init(&batch, (max_rsp ? max_rsp : HCI_REPORT_DEFAULT_CAPACITY)) < 0) {
 		return NULL;
 	}
 
-	if (hci_controller->interrupted) {
-		hci_resolve_interruption(hci_socket, hci_controller);
+	if (hci_controller) {
+		batch.dedup = hci_controller->dedup;
 	}
 
-	if (hci_controller->state != HCI_STATE_OPEN) {
-		print_trace(TRACE_ERROR, "hci_LE_get_RSSI : busy or closed controller.\n");
+	if (hci_get_reports(hci_socket, hci_controller, &batch, mac, duration, max_rsp) < 0) {
+		hci_report_batch_destroy(&batch);
 		return NULL;
 	}
 
-	// Resulting string :
-	char *res = NULL;
+	return hci_batch_to_RSSI_string(&batch, file_descriptor);
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_LE_get_reports(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+			   hci_report_batch_t *batch, bt_address_t *mac, uint8_t scan_type,
+			   uint16_t scan_interval, uint16_t scan_window, uint8_t own_add_type,
+			   uint8_t scan_filter_policy) {
 
-	FILE *file = NULL;
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_LE_get_reports");
+
+	if (!batch || !batch->capacity) {
+		print_trace(TRACE_ERROR, "hci_LE_get_reports : invalid batch reference.\n");
+		return -1;
+	}
+	hci_report_batch_clear(batch);
+
+	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, hci_socket);
+	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_LE_get_reports");
+
+	int16_t res = -1;
 
 	print_trace(TRACE_INFO, "1. Opening socket...");
 	char new_socket = 0;
 	char socket_err = 0;
 	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
 	if (socket_err) {
-		return NULL;
+		return -1;
 	}
 
 	print_trace(TRACE_INFO, " [DONE]\n");
 
-	struct pollfd p;
-	// Initializing the connection poll on our HCI socket :
-	p.fd = hci_socket->sock;
-	p.events = POLLIN;
-	unsigned char buf[HCI_MAX_EVENT_SIZE]; 
-
-	hci_event_hdr event_header;
-	unsigned char *event_parameter;
-
-	struct hci_filter flt;	
 	struct hci_filter old_flt;
 
-	// Creating our filter :
-	hci_compute_filter(&flt, EVT_CMD_COMPLETE,
-			   EVT_LE_META_EVENT,
-			   EVT_LE_ADVERTISING_REPORT,
-			   0);
-
-	//hci_filter_all_events(&flt);
-
 	/* Saving the old filter.
 	   This can be helpful in a case where we want to use a same socket for different purposes
 	   (even with multiple threads), we can replace the old filter and re-use it later.
+	   The filter recorded in the socket is used when known, and nothing is installed
+	   if the socket already has the LE scan filter.
 	*/
 	print_trace(TRACE_INFO, "2. Saving old filter...");
 	char saved_flt = 1;
-	if (!new_socket) {
-		if (get_hci_socket_filter(*hci_socket, &old_flt) < 0) {
+	if (new_socket != HCI_SOCKET_NEW) {
+		if (get_hci_socket_cached_filter(hci_socket, &old_flt) < 0) {
 			saved_flt = 0;
 		}
 	}
@@ -1060,203 +2043,564 @@ char *hci_LE_get_RSSI(hci_socket_t *hci_socket, hci_controller_t *hci_controller
 
 	// Applying the new filter :
 	print_trace(TRACE_INFO, "3. Applying new filter...");
-	if (set_hci_socket_filter(*hci_socket, &flt) < 0) {
+	if (apply_hci_socket_filter_profile(hci_socket, HCI_FILTER_PROFILE_LE_SCAN) < 0) {
 		goto end;
 	}
 	print_trace(TRACE_INFO, " [DONE]\n");
 
 	print_trace(TRACE_INFO, "4. Setting scan parameters...");
-	hci_change_state(hci_controller, HCI_STATE_WRITING);
-	pthread_mutex_lock(&hci_controller_mutex);
-	if (hci_le_set_scan_parameters(hci_socket->sock, scan_type, scan_interval, // cf p 1066 spec
-				      scan_window, own_add_type, scan_filter_policy, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) { 
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_WRITING) < 0) {
+		print_trace(TRACE_ERROR, " [ERROR] \n");
+		print_trace(TRACE_ERROR, "hci_LE_get_reports : busy or closed controller.\n");
+		goto end;
+	}
+	if (hci_LE_set_scan_parameters_req(hci_socket, scan_type, scan_interval, // cf p 1066 spec
+					   scan_window, own_add_type, scan_filter_policy, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) { 
 		// last parameter is timeout (for reaching the controler) 0 = infinity.
 		print_trace(TRACE_ERROR, " [ERROR] \n");
 		perror("set_scan_parameters");
+		hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
 		goto end;
 	}
 	print_trace(TRACE_INFO, " [DONE]\n");
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
-	pthread_mutex_unlock(&hci_controller_mutex);
 
 	print_trace(TRACE_INFO, "5. Enabling scan...");
-	pthread_mutex_lock(&hci_controller_mutex);
-	hci_change_state(hci_controller, HCI_STATE_SCANNING);
-	if (hci_le_set_scan_enable(hci_socket->sock, htobs(0x01), htobs(0x00), 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) { // Duplicate filtering ? (cf p1069)
+	hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_SCANNING);
+	if (hci_LE_set_scan_enable_req(hci_socket, 0x01, 0x00, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) { // Duplicate filtering ? (cf p1069)
 		print_trace(TRACE_ERROR, " [ERROR] \n");
 		perror("set_scan_enable");
+		hci_change_state(hci_controller, HCI_STATE_SCANNING, HCI_STATE_OPEN);
 		goto end;
 	}
 	print_trace(TRACE_INFO, " [DONE]\n"); 
-	pthread_mutex_unlock(&hci_controller_mutex);
-
-	char canceled = 0;
-	int k = 0;
 
 	print_trace(TRACE_INFO, "6. Checking response events...\n");
 
-	int8_t n = 0;
-	int16_t len = 0;
+	res = hci_collect_reports(hci_socket, hci_controller, mac, 0, HCI_SCAN_SESSION_DEFAULT_TIMEOUT,
+				  HCI_SCAN_SESSION_DEFAULT_TIMEOUT, batch, NULL);
+	if (res > 0) {
+		hci_register_reports(hci_socket, hci_controller, batch, 0);
+	}
 
-	res = calloc(6*max_rsp, sizeof(char));
-	res[0] = '\0';
+	print_trace(TRACE_INFO, "Scan complete !\n");
+	
+	print_trace(TRACE_INFO, "7. Disabling scan...");
+	if (hci_LE_set_scan_enable_req(hci_socket, 0x00, 0x00, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+		// The controller stays in the scanning state until the interruption is resolved.
+		print_trace(TRACE_ERROR, " [ERROR] \n");
+		perror("set_scan_disable");
+		hci_controller->interrupted = 1;
+		goto end;
+	}
+	print_trace(TRACE_INFO, " [DONE]\n"); 
+	hci_change_state(hci_controller, HCI_STATE_SCANNING, HCI_STATE_OPEN);
 
-	while(!canceled && (!(max_rsp > 0) || (k < max_rsp))) {
-		p.revents = 0;
-		n = 0;
-		len = 0;
+ end :	
+	if (new_socket != HCI_SOCKET_NEW && saved_flt) {
+		// Restoring the old filter :
+		apply_hci_socket_filter(hci_socket, &old_flt);
+	}
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
 
-		// Polling the BT device for an event :
-		while ((n = poll(&p, 1, 5000)) < 0) {
-			if (errno == EAGAIN || EINTR) {
-				continue;
-			}
-			perror("hci_LE_get_RSSI : error while polling the socket");
-			canceled = 1;
-		}
-		if (canceled) {
-			break;
-		}
+	return res;
+}
 
-		if (!n) {
-			errno = ETIMEDOUT;
-			perror("hci_LE_get_RSSI : error while polling the socket");
-			break;
-		}
+//------------------------------------------------------------------------------------
 
-		while ((len = read(hci_socket->sock, buf, sizeof(buf))) < 0) {
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
-			perror("hci_LE_get_RSSI : error while reading the socket");
-			canceled = 1;
+char *hci_LE_get_RSSI(hci_socket_t *hci_socket, hci_controller_t *hci_controller,
+		      int8_t *file_descriptor,
+		      bt_address_t *mac, uint16_t max_rsp, uint8_t scan_type, uint16_t scan_interval,
+		      uint16_t scan_window, uint8_t own_add_type, uint8_t scan_filter_policy) {
+
+	hci_report_batch_t batch;
+	if (hci_report_batch_init(&batch, (max_rsp ? max_rsp : HCI_REPORT_DEFAULT_CAPACITY)) < 0) {
+		return NULL;
+	}
+
+	if (hci_controller) {
+		batch.dedup = hci_controller->dedup;
+	}
+
+	if (hci_LE_get_reports(hci_socket, hci_controller, &batch, mac, scan_type, scan_interval,
+			       scan_window, own_add_type, scan_filter_policy) < 0) {
+		hci_report_batch_destroy(&batch);
+		return NULL;
+	}
+
+	return hci_batch_to_RSSI_string(&batch, file_descriptor);
+}
+
+//------------------------------------------------------------------------------------
+
+/* Static function starting a scan session, with the legacy scan commands if scan_phys is 0
+   or with the extended ones (on the given PHYs) otherwise. The BPF program, if any, is
+   attached to the socket of the session. "caller" is the name of the calling function,
+   used in the error messages.
+*/
+static int8_t hci_LE_open_scan_session(hci_scan_session_t *session, hci_controller_t *hci_controller,
+				       const hci_bpf_program_t *program, uint8_t scan_phys, uint8_t scan_type,
+				       uint16_t scan_interval, uint16_t scan_window, uint8_t own_add_type,
+				       uint8_t scan_filter_policy, const char *caller) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, caller);
+
+	if (!session) {
+		print_trace(TRACE_ERROR, "%s : invalid session reference.\n", caller);
+		return -1;
+	}
+	memset(session, 0, sizeof(hci_scan_session_t));
+	session->hci_socket.sock = -1;
+
+	if (scan_phys) {
+		if (scan_phys & ~(HCI_LE_SCAN_PHY_1M | HCI_LE_SCAN_PHY_CODED)) {
+			print_trace(TRACE_ERROR, "%s : invalid scanning PHYs.\n", caller);
+			return -1;
 		}
-		if (canceled) {
-			break;
+		if (hci_controller_has_LE_feature(hci_controller, HCI_LE_FEATURE_EXT_ADVERTISING) == 0) {
+			print_trace(TRACE_ERROR, "%s : extended scan not supported by the adapter.\n", caller);
+			return -1;
 		}
-
-		if (len == 0) {
-			print_trace(TRACE_WARNING, "hci_LE_get_RSSI : nothing to read on the socket.\n");
-			break;
+		if ((scan_phys & HCI_LE_SCAN_PHY_CODED) &&
+		    hci_controller_has_LE_feature(hci_controller, HCI_LE_FEATURE_CODED_PHY) == 0) {
+			print_trace(TRACE_ERROR, "%s : Coded PHY not supported by the adapter.\n", caller);
+			return -1;
 		}
+	}
 
-		// WHAT IS buf[0] ? Maybe a parameter added by "read()" ???
-		event_header.evt = buf[1];
-		event_header.plen = buf[2];
-			
-		event_parameter = (void *)(buf + HCI_EVENT_HDR_SIZE + 1);
-		uint8_t subevent_code = *(event_parameter);
-		event_parameter = (void *)(event_parameter + 1);
-		int num_reports = *event_parameter;
-		event_parameter = (void *)(event_parameter + 1);
-
-		switch (event_header.evt) {
-		case EVT_LE_META_EVENT: // Code 0x3E
-			switch (subevent_code) {
-			case EVT_LE_ADVERTISING_REPORT:
-				for (uint16_t i = 0; i < num_reports; i++) {
-					bt_device_t bt_device;
-					
-					// Address field :
-					bt_address_t *rsp_mac = (bt_address_t *)(event_parameter +
-									 num_reports*(1+1) +
-									 6*i); // @ on 6 bytes.
-					if (!bt_already_registered_device(*rsp_mac)) {
-						uint8_t *address_type;
-						// Address type field :
-						address_type = (uint8_t *)(event_parameter + 1*num_reports + i);
-						bt_device.mac = *rsp_mac;
-						bt_device.add_type = *address_type;
-						strcpy(bt_device.custom_name, "UNKNOWN");
-						bt_register_device(bt_device);
-					} else {
-						bt_device = bt_get_device(*rsp_mac);
-					}
-
-					if (mac != NULL && !(bt_compare_addresses(mac, rsp_mac))) {
-						continue;
-					}
-
-					// Length_data field :
-					uint8_t *length_data = (uint8_t *)(event_parameter +
-									   num_reports*(1+1+6) + i);
-
-					// RSSI field :
-					int8_t *rssi = (int8_t *)(event_parameter + 
-								  (1+1+6+1+(*length_data))*num_reports + i); // rssi on 1byte
-					if (*rssi == 127) {
-						print_trace(TRACE_WARNING, "hci_LE_get_rssi : RSSI measure unavailable.\n");
-					} else if (*rssi >= 21) {
-						print_trace(TRACE_ERROR, "hci_LE_get_rssi : error while reading RSSI measure.\n");
-					}
-
-					// Display info :
-					bt_device_display(bt_device);
-
-					if (file_descriptor && *file_descriptor >= 0) {
-						char rssi_string[RSSI_STRING_LENGTH] = {0};
-						snprintf(rssi_string, RSSI_STRING_LENGTH, "%i \n", *rssi);
-						if (write(*file_descriptor, rssi_string, RSSI_STRING_LENGTH) < RSSI_STRING_LENGTH) {
-							print_trace(TRACE_WARNING, "Unable to write rssi value into given fd\n");
-						}
-					}
-					if (file) {
-						fprintf(file, "%i\n", *rssi);
-					}
-					char rssi_string_val[5] = {0};
-					snprintf(rssi_string_val, 5, "%i ;", *rssi);
-					strcat(res, rssi_string_val);
-					k++;
-				}
-				break;
-					
-			default:
-				print_trace(TRACE_WARNING, "hci_LE_get_rssi : an unknown LE sub-event occured : 0x%X \n",
-					    subevent_code);
-				break;
-			}
-			break;
-		default:
-			print_trace(TRACE_WARNING, "hci_LE_get_rssi : an unknown LE sub-event occured : 0x%X \n",
-				    subevent_code);
-			break;
+	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, NULL);
+	CHECK_HCI_CONTROLLER_OPEN(hci_controller, caller);
+
+	/* The session works on its own socket : the filter is installed once and
+	   the kernel keeps queuing the reports between two reads, so that no report
+	   is lost while the caller is busy with the previous batch.
+	*/
+	session->hci_socket = open_hci_socket_transport(hci_controller->transport,
+							 hci_controller->transport_data,
+							 &(hci_controller->device.mac));
+	if (session->hci_socket.sock < 0) {
+		return -1;
+	}
+
+	if (hci_scan_session_filter(session, HCI_FILTER_PROFILE_LE_SCAN) < 0) {
+		goto fail;
+	}
+	if (program) {
+		if (hci_bpf_attach(&(session->hci_socket), program) < 0) {
+			print_trace(TRACE_ERROR, "%s : unable to attach the BPF program.\n", caller);
+			goto fail;
 		}
+		session->filtered = 1;
 	}
 
-	print_trace(TRACE_INFO, "Scan complete !\n");
-	
-	print_trace(TRACE_INFO, "7. Disabling scan...");
-	pthread_mutex_lock(&hci_controller_mutex);
-	if (hci_le_set_scan_enable(hci_socket->sock, htobs(0x00), htobs(0x00), 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
-		print_trace(TRACE_ERROR, " [ERROR] \n");
-		perror("set_scan_disable");
-		hci_controller->interrupted = 1;
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_WRITING) < 0) {
+		print_trace(TRACE_ERROR, "%s : busy or closed controller.\n", caller);
+		goto fail;
+	}
+	int8_t err;
+	if (scan_phys) {
+		err = hci_LE_set_ext_scan_parameters_req(&(session->hci_socket), scan_phys, scan_type,
+							 scan_interval, scan_window, own_add_type,
+							 scan_filter_policy, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT);
+	} else {
+		err = hci_LE_set_scan_parameters_req(&(session->hci_socket), scan_type, scan_interval,
+						     scan_window, own_add_type, scan_filter_policy,
+						     2*HCI_CONTROLLER_DEFAULT_TIMEOUT);
+	}
+	if (err < 0) {
+		print_trace(TRACE_ERROR, "%s : unable to set the scan parameters.\n", caller);
+		perror("set_scan_parameters");
+		hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
+		goto fail;
+	}
+
+	hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_SCANNING);
+	session->extended = (scan_phys != 0);
+	if (hci_LE_set_session_scan_enable_req(session, 0x01, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+		print_trace(TRACE_ERROR, "%s : unable to enable the scan.\n", caller);
+		perror("set_scan_enable");
+		hci_change_state(hci_controller, HCI_STATE_SCANNING, HCI_STATE_OPEN);
+		goto fail;
+	}
+
+	session->hci_controller = hci_controller;
+	session->active = 1;
+	session->scan_phys = scan_phys;
+	session->scan_type = scan_type;
+	session->scan_interval = scan_interval;
+	session->scan_window = scan_window;
+	session->own_add_type = own_add_type;
+	session->scan_filter_policy = scan_filter_policy;
+	pthread_mutex_lock(&(hci_controller->lock));
+	hci_controller->scan_session = session;
+	pthread_mutex_unlock(&(hci_controller->lock));
+	print_trace(TRACE_INFO, "%s : scanning on %s.\n", caller, hci_controller->device.custom_name);
+
+	return 0;
+
+ fail:
+	close_hci_socket(&(session->hci_socket));
+	return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_LE_start_scan_session(hci_scan_session_t *session, hci_controller_t *hci_controller,
+				 uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window,
+				 uint8_t own_add_type, uint8_t scan_filter_policy) {
+	return hci_LE_open_scan_session(session, hci_controller, NULL, 0, scan_type, scan_interval,
+					scan_window, own_add_type, scan_filter_policy,
+					"hci_LE_start_scan_session");
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_LE_start_ext_scan_session(hci_scan_session_t *session, hci_controller_t *hci_controller,
+				     uint8_t scan_phys, uint8_t scan_type, uint16_t scan_interval,
+				     uint16_t scan_window, uint8_t own_add_type, uint8_t scan_filter_policy) {
+	if (!scan_phys) {
+		print_trace(TRACE_ERROR, "hci_LE_start_ext_scan_session : invalid scanning PHYs.\n");
+		return -1;
+	}
+	return hci_LE_open_scan_session(session, hci_controller, NULL, scan_phys, scan_type, scan_interval,
+					scan_window, own_add_type, scan_filter_policy,
+					"hci_LE_start_ext_scan_session");
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_LE_start_filtered_scan_session(hci_scan_session_t *session, hci_controller_t *hci_controller,
+					  const hci_bpf_program_t *program, uint8_t scan_phys,
+					  uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window,
+					  uint8_t own_add_type, uint8_t scan_filter_policy) {
+	if (!program || !program->length) {
+		print_trace(TRACE_ERROR, "hci_LE_start_filtered_scan_session : invalid program.\n");
+		return -1;
+	}
+	return hci_LE_open_scan_session(session, hci_controller, program, scan_phys, scan_type, scan_interval,
+					scan_window, own_add_type, scan_filter_policy,
+					"hci_LE_start_filtered_scan_session");
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_start_periodic_inquiry_session(hci_scan_session_t *session, hci_controller_t *hci_controller,
+					  uint16_t min_period, uint16_t max_period,
+					  uint8_t duration, uint8_t max_rsp) {
+
+	CHECK_HCI_CONTROLLER_PTR(hci_controller, "hci_start_periodic_inquiry_session");
+
+	if (!session) {
+		print_trace(TRACE_ERROR, "hci_start_periodic_inquiry_session : invalid session reference.\n");
+		return -1;
+	}
+	memset(session, 0, sizeof(hci_scan_session_t));
+	session->hci_socket.sock = -1;
+
+	if (!duration || duration > 0x30 || min_period <= duration || max_period <= min_period) {
+		print_trace(TRACE_ERROR, "hci_start_periodic_inquiry_session : invalid periods or duration.\n");
+		return -1;
+	}
+
+	CHECK_HCI_CONTROLLER_INTERRUPTED(hci_controller, NULL);
+	CHECK_HCI_CONTROLLER_OPEN(hci_controller, "hci_start_periodic_inquiry_session");
+
+	// As for the LE scan sessions, the results are queued on a socket of the session :
+	session->hci_socket = open_hci_socket_transport(hci_controller->transport,
+							 hci_controller->transport_data,
+							 &(hci_controller->device.mac));
+	if (session->hci_socket.sock < 0) {
+		return -1;
+	}
+
+	if (hci_scan_session_filter(session, HCI_FILTER_PROFILE_PERIODIC_INQUIRY) < 0) {
+		goto fail;
+	}
+
+	if (hci_change_state(hci_controller, HCI_STATE_OPEN, HCI_STATE_WRITING) < 0) {
+		print_trace(TRACE_ERROR, "hci_start_periodic_inquiry_session : busy or closed controller.\n");
+		goto fail;
+	}
+	if (hci_write_inquiry_mode(&(session->hci_socket), hci_controller, HCI_INQUIRY_MODE_EXTENDED) < 0) {
+		hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_OPEN);
+		goto fail;
+	}
+
+	hci_change_state(hci_controller, HCI_STATE_WRITING, HCI_STATE_SCANNING);
+	if (hci_periodic_inquiry_req(&(session->hci_socket), min_period, max_period, duration, max_rsp,
+				     2*HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+		print_trace(TRACE_ERROR, "hci_start_periodic_inquiry_session : unable to start the inquiries.\n");
+		perror("periodic_inquiry");
+		hci_change_state(hci_controller, HCI_STATE_SCANNING, HCI_STATE_OPEN);
+		goto fail;
+	}
+
+	session->hci_controller = hci_controller;
+	session->active = 1;
+	session->classic = 1;
+	session->min_period = min_period;
+	session->max_period = max_period;
+	session->duration = duration;
+	session->max_rsp = max_rsp;
+	pthread_mutex_lock(&(hci_controller->lock));
+	hci_controller->scan_session = session;
+	pthread_mutex_unlock(&(hci_controller->lock));
+	print_trace(TRACE_INFO, "hci_start_periodic_inquiry_session : inquiring on %s.\n",
+		    hci_controller->device.custom_name);
+
+	return 0;
+
+ fail:
+	close_hci_socket(&(session->hci_socket));
+	return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_LE_scan_session_read(hci_scan_session_t *session, hci_report_batch_t *batch,
+				 bt_address_t *mac, int16_t timeout) {
+
+	if (!session || !session->active) {
+		print_trace(TRACE_ERROR, "hci_LE_scan_session_read : inactive scan session.\n");
+		return -1;
+	}
+
+	if (!batch || !batch->capacity) {
+		print_trace(TRACE_ERROR, "hci_LE_scan_session_read : invalid batch reference.\n");
+		return -1;
+	}
+	hci_report_batch_clear(batch);
+
+	int16_t res = hci_collect_reports(&(session->hci_socket), session->hci_controller, mac, 0,
+					  timeout, timeout, batch, NULL);
+	if (res > 0) {
+		hci_register_reports(&(session->hci_socket), session->hci_controller, batch, 0);
+	}
+
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_LE_scan_session_drain(hci_scan_session_t *session, hci_report_batch_t *batch,
+				  int16_t timeout) {
+
+	if (!session || !session->active) {
+		print_trace(TRACE_ERROR, "hci_LE_scan_session_drain : inactive scan session.\n");
+		return -1;
+	}
+
+	if (!batch || !batch->capacity) {
+		print_trace(TRACE_ERROR, "hci_LE_scan_session_drain : invalid batch reference.\n");
+		return -1;
+	}
+	hci_report_batch_clear(batch);
+
+	int16_t res = hci_collect_reports(&(session->hci_socket), session->hci_controller, NULL, 0,
+					  timeout, 0, batch, NULL);
+	if (res > 0) {
+		hci_register_reports(&(session->hci_socket), session->hci_controller, batch, 0);
+	}
+
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+char *hci_LE_scan_session_get_RSSI(hci_scan_session_t *session, int8_t *file_descriptor,
+				   bt_address_t *mac, uint16_t max_rsp, int16_t timeout) {
+
+	if (!max_rsp) {
+		print_trace(TRACE_ERROR, "hci_LE_scan_session_get_RSSI : max_rsp has to be > 0.\n");
+		return NULL;
+	}
+
+	hci_report_batch_t batch;
+	if (hci_report_batch_init(&batch, max_rsp) < 0) {
+		return NULL;
+	}
+
+	if (hci_LE_scan_session_read(session, &batch, mac, timeout) < 0) {
+		hci_report_batch_destroy(&batch);
+		return NULL;
+	}
+
+	return hci_batch_to_RSSI_string(&batch, file_descriptor);
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_LE_scan_session_set_parameters(hci_scan_session_t *session, uint8_t scan_type,
+					  uint16_t scan_interval, uint16_t scan_window) {
+
+	if (!session || !session->active || session->classic) {
+		print_trace(TRACE_ERROR, "hci_LE_scan_session_set_parameters : inactive or classic scan session.\n");
+		return -1;
+	}
+
+	hci_controller_t *hci_controller = session->hci_controller;
+	hci_socket_t *hci_socket = NULL;
+	char new_socket = 0;
+	char socket_err = 0;
+	int8_t res = -1;
+
+	/* The session's socket isn't used : the command requests would consume (and
+	   lose) the reports queued on it.
+	*/
+	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
+	if (socket_err) {
+		return -1;
+	}
+
+	int8_t err = session->extended ?
+		hci_LE_set_ext_scan_enable_req(hci_socket, 0x00, 0x00, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) :
+		hci_LE_set_scan_enable_req(hci_socket, 0x00, 0x00, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT);
+	if (err < 0) {
+		perror("hci_LE_scan_session_set_parameters : set_scan_disable");
 		goto end;
 	}
-	print_trace(TRACE_INFO, " [DONE]\n"); 
-	hci_change_state(hci_controller, HCI_STATE_OPEN);
-	pthread_mutex_unlock(&hci_controller_mutex);
 
- end :	
-	if (!hci_controller->interrupted) {
-		hci_change_state(hci_controller, HCI_STATE_OPEN);
+	if (session->extended) {
+		err = hci_LE_set_ext_scan_parameters_req(hci_socket, session->scan_phys, scan_type,
+							 scan_interval, scan_window, session->own_add_type,
+							 session->scan_filter_policy,
+							 2*HCI_CONTROLLER_DEFAULT_TIMEOUT);
+	} else {
+		err = hci_LE_set_scan_parameters_req(hci_socket, scan_type, scan_interval, scan_window,
+						     session->own_add_type, session->scan_filter_policy,
+						     2*HCI_CONTROLLER_DEFAULT_TIMEOUT);
 	}
-	pthread_mutex_trylock(&hci_controller_mutex);
-	pthread_mutex_unlock(&hci_controller_mutex);
-	
-	if (new_socket) {
-		close_hci_socket(hci_socket);
-		free(hci_socket);
-	} else {			
-		// Restoring the old filter :
-		if (saved_flt) {
-			set_hci_socket_filter(*hci_socket, &old_flt);
-		}
+	if (err < 0) {
+		print_trace(TRACE_ERROR, "hci_LE_scan_session_set_parameters : unable to set the scan parameters.\n");
+		perror("set_scan_parameters");
+	} else {
+		session->scan_type = scan_type;
+		session->scan_interval = scan_interval;
+		session->scan_window = scan_window;
+		res = 0;
+	}
+
+	// The scan is resumed in any case, with the previous parameters if the new ones were refused :
+	err = session->extended ?
+		hci_LE_set_ext_scan_enable_req(hci_socket, 0x01, 0x00, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) :
+		hci_LE_set_scan_enable_req(hci_socket, 0x01, 0x00, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT);
+	if (err < 0) {
+		perror("hci_LE_scan_session_set_parameters : set_scan_enable");
+		hci_controller->interrupted = 1;
+		res = -1;
 	}
 
-	if (file) {
-		fclose(file);
+ end:
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_LE_stop_scan_session(hci_scan_session_t *session) {
+
+	if (!session || !session->active) {
+		print_trace(TRACE_ERROR, "hci_LE_stop_scan_session : inactive scan session.\n");
+		return -1;
+	}
+
+	hci_controller_t *hci_controller = session->hci_controller;
+	int8_t res = 0;
+
+	// Once unregistered, the session is no longer restored by the watchdog :
+	pthread_mutex_lock(&(hci_controller->lock));
+	while (hci_controller->restoring) {
+		pthread_cond_wait(&(hci_controller->restored), &(hci_controller->lock));
+	}
+	if (hci_controller->scan_session == session) {
+		hci_controller->scan_session = NULL;
 	}
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	int8_t err = (session->classic ?
+		      hci_exit_periodic_inquiry_req(&(session->hci_socket), 2*HCI_CONTROLLER_DEFAULT_TIMEOUT) :
+		      hci_LE_set_session_scan_enable_req(session, 0x00, 2*HCI_CONTROLLER_DEFAULT_TIMEOUT));
+	if (err < 0) {
+		perror("hci_LE_stop_scan_session : set_scan_disable");
+		hci_controller->interrupted = 1;
+		res = -1;
+	} else {
+		hci_change_state(hci_controller, HCI_STATE_SCANNING, HCI_STATE_OPEN);
+	}
+
+	if (session->filtered && hci_bpf_detach(&(session->hci_socket)) < 0) {
+		res = -1;
+	}
+	session->filtered = 0;
+	close_hci_socket(&(session->hci_socket));
+	session->active = 0;
+	session->hci_controller = NULL;
 
 	return res;
 }
 
+//------------------------------------------------------------------------------------
+
+int8_t hci_LE_scan_session_restore(hci_scan_session_t *session, hci_socket_t *hci_socket) {
+
+	if (!session || !session->active) {
+		print_trace(TRACE_ERROR, "hci_LE_scan_session_restore : inactive scan session.\n");
+		return -1;
+	}
+
+	hci_controller_t *hci_controller = session->hci_controller;
+	char new_socket = 0;
+	char socket_err = 0;
+	int8_t res = -1;
+
+	// As when the parameters are changed, the reports queued on the session's socket are kept :
+	check_hci_socket_ptr(&hci_socket, hci_controller, &new_socket, &socket_err);
+	if (socket_err) {
+		return -1;
+	}
+
+	int8_t err;
+	if (session->classic) {
+		hci_exit_periodic_inquiry_req(hci_socket, HCI_CONTROLLER_DEFAULT_TIMEOUT);
+		if (hci_write_inquiry_mode(hci_socket, hci_controller, HCI_INQUIRY_MODE_EXTENDED) < 0) {
+			goto end;
+		}
+		err = hci_periodic_inquiry_req(hci_socket, session->min_period, session->max_period,
+					       session->duration, session->max_rsp, HCI_CONTROLLER_DEFAULT_TIMEOUT);
+		if (err < 0) {
+			perror("hci_LE_scan_session_restore : periodic_inquiry");
+			goto end;
+		}
+	} else {
+		// The scan may still be enabled, the parameters couldn't be written then :
+		if (session->extended) {
+			hci_LE_set_ext_scan_enable_req(hci_socket, 0x00, 0x00, HCI_CONTROLLER_DEFAULT_TIMEOUT);
+			err = hci_LE_set_ext_scan_parameters_req(hci_socket, session->scan_phys, session->scan_type,
+								 session->scan_interval, session->scan_window,
+								 session->own_add_type, session->scan_filter_policy,
+								 HCI_CONTROLLER_DEFAULT_TIMEOUT);
+		} else {
+			hci_LE_set_scan_enable_req(hci_socket, 0x00, 0x00, HCI_CONTROLLER_DEFAULT_TIMEOUT);
+			err = hci_LE_set_scan_parameters_req(hci_socket, session->scan_type, session->scan_interval,
+							     session->scan_window, session->own_add_type,
+							     session->scan_filter_policy, HCI_CONTROLLER_DEFAULT_TIMEOUT);
+		}
+		if (err < 0) {
+			perror("hci_LE_scan_session_restore : set_scan_parameters");
+			goto end;
+		}
+		err = session->extended ?
+			hci_LE_set_ext_scan_enable_req(hci_socket, 0x01, 0x00, HCI_CONTROLLER_DEFAULT_TIMEOUT) :
+			hci_LE_set_scan_enable_req(hci_socket, 0x01, 0x00, HCI_CONTROLLER_DEFAULT_TIMEOUT);
+		if (err < 0) {
+			perror("hci_LE_scan_session_restore : set_scan_enable");
+			goto end;
+		}
+	}
+	print_trace(TRACE_INFO, "hci_LE_scan_session_restore : scan restored on %s.\n",
+		    hci_controller->device.custom_name);
+	res = 0;
+
+ end:
+	release_hci_socket_ptr(hci_socket, hci_controller, new_socket);
+	return res;
+}
@@ -0,0 +1,171 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_dedup.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Number of consecutive entries of the hash set in which a device may be stored.
+ */
+#define HCI_DEDUP_PROBES 8
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline uint64_t hci_dedup_time(const hci_report_t *report) {
+	return (uint64_t)report->timestamp.tv_sec * 1000ULL + (uint64_t)report->timestamp.tv_nsec / 1000000ULL;
+}
+
+//---------------------------------
+
+static uint32_t hci_dedup_hash(const hci_report_t *report) {
+	uint32_t hash = 2166136261U; // FNV-1a
+	for (uint8_t i = 0; i < sizeof(bt_address_t); i++) {
+		hash = (hash ^ report->mac.b[i]) * 16777619U;
+	}
+	hash = (hash ^ report->add_type) * 16777619U;
+	hash = (hash ^ report->evt_type) * 16777619U;
+	for (uint16_t i = 0; report->data && i < report->data_length; i++) {
+		hash = (hash ^ report->data[i]) * 16777619U;
+	}
+	return hash;
+}
+
+//---------------------------------
+
+/* Static function returning the entry of the given report : the entry of the same
+   device and data if any, otherwise the entry to (re)use for it, whose "used"
+   field is then 0. An entry is reused if it is free or out of its time window,
+   otherwise the least recently kept entry is evicted.
+*/
+static hci_dedup_entry_t *hci_dedup_lookup(hci_dedup_t *dedup, const hci_report_t *report,
+					   uint32_t hash, uint64_t now) {
+	hci_dedup_entry_t *slot = NULL;
+	for (uint8_t i = 0; i < HCI_DEDUP_PROBES; i++) {
+		hci_dedup_entry_t *entry = &(dedup->entries[(hash + i) & (dedup->capacity - 1)]);
+		if (!entry->used) {
+			if (!slot || slot->used) {
+				slot = entry;
+			}
+			continue;
+		}
+		if (entry->hash == hash && bt_compare_addresses(&(entry->mac), &(report->mac))) {
+			return entry;
+		}
+		if (now >= entry->last && now - entry->last >= dedup->min_interval) { // Expired
+			entry->used = 0;
+			if (!slot || slot->used) {
+				slot = entry;
+			}
+		} else if (!slot || (slot->used && entry->last < slot->last)) {
+			slot = entry;
+		}
+	}
+
+	if (slot->used) {
+		dedup->stats.evictions++;
+		slot->used = 0;
+	}
+	return slot;
+}
+
+/*-------------------------
+  - DEDUPLICATOR FUNCTIONS -
+  -------------------------*/
+
+int8_t hci_dedup_init(hci_dedup_t *dedup, uint32_t capacity, uint32_t min_interval, uint8_t rssi_threshold) {
+	if (!dedup) {
+		print_trace(TRACE_ERROR, "hci_dedup_init : invalid deduplicator reference.\n");
+		return -1;
+	}
+	memset(dedup, 0, sizeof(hci_dedup_t));
+
+	uint32_t size = HCI_DEDUP_PROBES;
+	while (size < capacity && size < 0x80000000U) {
+		size <<= 1;
+	}
+
+	dedup->entries = calloc(size, sizeof(hci_dedup_entry_t));
+	if (!dedup->entries) {
+		perror("hci_dedup_init : error while allocating the hash set");
+		return -1;
+	}
+	dedup->capacity = size;
+	dedup->min_interval = min_interval;
+	dedup->rssi_threshold = rssi_threshold;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+char hci_dedup_accept(hci_dedup_t *dedup, const hci_report_t *report) {
+	uint32_t hash = hci_dedup_hash(report);
+	uint64_t now = hci_dedup_time(report);
+
+	hci_dedup_entry_t *entry = hci_dedup_lookup(dedup, report, hash, now);
+	if (entry->used) {
+		char keep = 0;
+		if (now < entry->last || now - entry->last >= dedup->min_interval) {
+			keep = 1;
+		} else if (dedup->rssi_threshold && report->rssi != HCI_REPORT_RSSI_UNAVAILABLE &&
+			   entry->rssi != HCI_REPORT_RSSI_UNAVAILABLE &&
+			   abs(report->rssi - entry->rssi) >= dedup->rssi_threshold) {
+			keep = 1;
+		}
+		if (!keep) {
+			dedup->stats.suppressed++;
+			return 0;
+		}
+	}
+
+	entry->hash = hash;
+	entry->mac = report->mac;
+	entry->rssi = report->rssi;
+	entry->last = now;
+	entry->used = 1;
+	dedup->stats.kept++;
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_dedup_clear(hci_dedup_t *dedup) {
+	if (dedup && dedup->entries) {
+		memset(dedup->entries, 0, dedup->capacity * sizeof(hci_dedup_entry_t));
+	}
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_dedup_destroy(hci_dedup_t *dedup) {
+	if (!dedup) {
+		return;
+	}
+	free(dedup->entries);
+	memset(dedup, 0, sizeof(hci_dedup_t));
+}
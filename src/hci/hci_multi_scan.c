@@ -0,0 +1,403 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_multi_scan.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Capacity of the batches read by the capture threads.
+ */
+#define HCI_MULTI_SCAN_BATCH_CAPACITY 64
+
+/**
+ * Time (in ms) a capture thread waits for reports before updating its watermark
+ * and checking whether it should stop.
+ */
+#define HCI_MULTI_SCAN_READ_TIMEOUT 10
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline uint64_t hci_multi_scan_ns(const struct timespec *ts) {
+	return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+//---------------------------------
+
+/* The reports are timestamped with CLOCK_REALTIME (@see hci_socket_t), which is
+   also the clock of the (default) condition variable.
+*/
+static inline uint64_t hci_multi_scan_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return hci_multi_scan_ns(&now);
+}
+
+//---------------------------------
+
+static inline struct timespec hci_multi_scan_timespec(uint64_t ns) {
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	return ts;
+}
+
+//---------------------------------
+
+static inline void hci_multi_scan_wake_reader(hci_multi_scan_t *scan) {
+	pthread_mutex_lock(&(scan->mutex));
+	pthread_cond_broadcast(&(scan->cond));
+	pthread_mutex_unlock(&(scan->mutex));
+}
+
+//---------------------------------
+
+/* Moves the reports of a batch into the ring of an adapter. Only called by the
+   capture thread of the adapter.
+*/
+static void hci_multi_scan_push(hci_multi_scan_adapter_t *adapter, hci_report_batch_t *batch) {
+	uint64_t head = adapter->head;
+	uint64_t tail = __atomic_load_n(&(adapter->tail), __ATOMIC_ACQUIRE);
+	uint64_t drops = 0;
+
+	for (uint16_t i = 0; i < batch->length; i++) {
+		if (head - tail >= HCI_MULTI_SCAN_RING_SIZE) {
+			drops++;
+			continue;
+		}
+		hci_multi_report_t *slot = &(adapter->ring[head & (HCI_MULTI_SCAN_RING_SIZE - 1)]);
+		uint16_t length = batch->reports[i].data_length;
+		if (length > HCI_MULTI_SCAN_MAX_DATA) {
+			length = HCI_MULTI_SCAN_MAX_DATA;
+		}
+		slot->adapter = adapter->index;
+		slot->report = batch->reports[i];
+		slot->report.data = NULL; // Set when the report is read.
+		slot->report.data_length = length;
+		if (length) {
+			memcpy(slot->data, batch->reports[i].data, length);
+		}
+		head++;
+	}
+
+	__atomic_store_n(&(adapter->head), head, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&(adapter->reports), batch->length - drops, __ATOMIC_RELAXED);
+	if (drops) {
+		__atomic_fetch_add(&(adapter->drops), drops, __ATOMIC_RELAXED);
+	}
+}
+
+//---------------------------------
+
+static void *hci_multi_scan_capture_routine(void *data) {
+	hci_multi_scan_adapter_t *adapter = (hci_multi_scan_adapter_t *)data;
+	hci_multi_scan_t *scan = adapter->scan;
+	hci_report_batch_t batch;
+
+	if (hci_report_batch_init(&batch, HCI_MULTI_SCAN_BATCH_CAPACITY) < 0) {
+		goto end;
+	}
+
+	while (scan->running) {
+		uint64_t since = hci_multi_scan_now();
+		int16_t n = hci_LE_scan_session_drain(&(adapter->session), &batch,
+						      HCI_MULTI_SCAN_READ_TIMEOUT);
+		if (n < 0) {
+			print_trace(TRACE_ERROR, "hci_multi_scan : capture of adapter %u stopped.\n",
+				    adapter->index);
+			break;
+		}
+		if (n > 0) {
+			hci_multi_scan_push(adapter, &batch);
+		}
+		/* The reports are timestamped by the kernel when queued on the socket :
+		   once a drain has emptied the queue, the following ones are timestamped
+		   after its beginning, otherwise after the last report read. The watermark
+		   is stored after the head so that a reader seeing it also sees the reports.
+		*/
+		uint64_t watermark = since;
+		if (n == (int16_t)batch.capacity) {
+			watermark = hci_multi_scan_ns(&(batch.reports[n - 1].timestamp));
+		}
+		if (watermark > adapter->watermark) {
+			__atomic_store_n(&(adapter->watermark), watermark, __ATOMIC_RELEASE);
+		}
+		hci_multi_scan_wake_reader(scan);
+	}
+
+	hci_report_batch_destroy(&batch);
+
+ end:
+	__atomic_store_n(&(adapter->stopped), 1, __ATOMIC_RELEASE);
+	hci_multi_scan_wake_reader(scan);
+	return NULL;
+}
+
+//---------------------------------
+
+/* Returns the index of the adapter holding the oldest report if this report can
+   be delivered, -1 otherwise. In the latter case, hold_until is set to the time
+   at which the oldest report will be delivered anyway (0 if there is no report).
+*/
+static int8_t hci_multi_scan_select(hci_multi_scan_t *scan, uint64_t *hold_until) {
+	int8_t best = -1;
+	uint64_t best_ts = 0;
+
+	*hold_until = 0;
+
+	for (uint8_t i = 0; i < scan->count; i++) {
+		hci_multi_scan_adapter_t *adapter = &(scan->adapters[i]);
+		if (adapter->tail == __atomic_load_n(&(adapter->head), __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		hci_multi_report_t *slot = &(adapter->ring[adapter->tail & (HCI_MULTI_SCAN_RING_SIZE - 1)]);
+		uint64_t ts = hci_multi_scan_ns(&(slot->report.timestamp));
+		if (best < 0 || ts < best_ts) {
+			best = i;
+			best_ts = ts;
+		}
+	}
+
+	if (best < 0) {
+		return -1;
+	}
+
+	// The report can only be delivered if no other adapter may still deliver an older one :
+	for (uint8_t i = 0; i < scan->count; i++) {
+		hci_multi_scan_adapter_t *adapter = &(scan->adapters[i]);
+		if (i == best) {
+			continue;
+		}
+		uint64_t watermark = __atomic_load_n(&(adapter->watermark), __ATOMIC_ACQUIRE);
+		if (adapter->tail != __atomic_load_n(&(adapter->head), __ATOMIC_ACQUIRE) ||
+		    watermark >= best_ts ||
+		    __atomic_load_n(&(adapter->stopped), __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		uint64_t deadline = best_ts + (uint64_t)scan->max_delay * 1000000ULL;
+		if (hci_multi_scan_now() < deadline) {
+			*hold_until = deadline;
+			return -1;
+		}
+		break;
+	}
+
+	return best;
+}
+
+/*------------------------
+  - MULTI SCAN FUNCTIONS -
+  ------------------------*/
+
+int8_t hci_multi_scan_start(hci_multi_scan_t *scan, hci_controller_t **controllers, uint8_t count,
+			    uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window,
+			    uint8_t own_add_type, uint8_t scan_filter_policy, uint16_t max_delay) {
+	uint8_t started = 0;
+	uint8_t launched = 0;
+
+	if (!scan || !controllers) {
+		print_trace(TRACE_ERROR, "hci_multi_scan_start : invalid arguments.\n");
+		return -1;
+	}
+
+	if (!count || count > HCI_MULTI_SCAN_MAX_CONTROLLERS) {
+		print_trace(TRACE_ERROR, "hci_multi_scan_start : between 1 and %d controllers are expected.\n",
+			    HCI_MULTI_SCAN_MAX_CONTROLLERS);
+		return -1;
+	}
+
+	memset(scan, 0, sizeof(hci_multi_scan_t));
+	scan->count = count;
+	scan->max_delay = max_delay;
+	scan->running = 1;
+	pthread_mutex_init(&(scan->mutex), NULL);
+	pthread_cond_init(&(scan->cond), NULL);
+
+	for (started = 0; started < count; started++) {
+		hci_multi_scan_adapter_t *adapter = &(scan->adapters[started]);
+		adapter->scan = scan;
+		adapter->index = started;
+		adapter->ring = calloc(HCI_MULTI_SCAN_RING_SIZE, sizeof(hci_multi_report_t));
+		if (!adapter->ring) {
+			perror("hci_multi_scan_start");
+			goto fail;
+		}
+		// Taken before the session starts, since its reports are timestamped when queued :
+		adapter->watermark = hci_multi_scan_now();
+		if (hci_LE_start_scan_session(&(adapter->session), controllers[started], scan_type,
+					      scan_interval, scan_window, own_add_type,
+					      scan_filter_policy) < 0) {
+			print_trace(TRACE_ERROR, "hci_multi_scan_start : unable to scan with controller %u.\n",
+				    started);
+			free(adapter->ring);
+			adapter->ring = NULL;
+			goto fail;
+		}
+	}
+
+	for (launched = 0; launched < count; launched++) {
+		if (pthread_create(&(scan->adapters[launched].thread), NULL,
+				   &hci_multi_scan_capture_routine, &(scan->adapters[launched])) != 0) {
+			perror("hci_multi_scan_start");
+			goto fail;
+		}
+	}
+
+	return 0;
+
+ fail:
+	scan->running = 0;
+	for (uint8_t i = 0; i < launched; i++) {
+		pthread_join(scan->adapters[i].thread, NULL);
+	}
+	for (uint8_t i = 0; i < started; i++) {
+		hci_LE_stop_scan_session(&(scan->adapters[i].session));
+		free(scan->adapters[i].ring);
+		scan->adapters[i].ring = NULL;
+	}
+	pthread_cond_destroy(&(scan->cond));
+	pthread_mutex_destroy(&(scan->mutex));
+	scan->count = 0;
+	return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_multi_scan_read(hci_multi_scan_t *scan, hci_multi_report_t *reports,
+			    uint16_t max_reports, int16_t timeout) {
+	uint64_t deadline = 0;
+	uint16_t n = 0;
+
+	if (!scan || !scan->count || !reports || !max_reports) {
+		print_trace(TRACE_ERROR, "hci_multi_scan_read : invalid arguments.\n");
+		return -1;
+	}
+
+	if (timeout >= 0) {
+		deadline = hci_multi_scan_now() + (uint64_t)timeout * 1000000ULL;
+	}
+
+	pthread_mutex_lock(&(scan->mutex));
+	while (n < max_reports) {
+		uint64_t hold_until = 0;
+		int8_t best = hci_multi_scan_select(scan, &hold_until);
+
+		if (best >= 0) {
+			hci_multi_scan_adapter_t *adapter = &(scan->adapters[best]);
+			hci_multi_report_t *slot = &(adapter->ring[adapter->tail & (HCI_MULTI_SCAN_RING_SIZE - 1)]);
+			reports[n] = *slot;
+			reports[n].report.data = (reports[n].report.data_length ? reports[n].data : NULL);
+			__atomic_store_n(&(adapter->tail), adapter->tail + 1, __ATOMIC_RELEASE);
+			n++;
+			continue;
+		}
+
+		// Nothing can be delivered right now :
+		if (n > 0) {
+			break;
+		}
+
+		char alive = 0;
+		for (uint8_t i = 0; i < scan->count; i++) {
+			alive |= !__atomic_load_n(&(scan->adapters[i].stopped), __ATOMIC_ACQUIRE);
+		}
+		if (!alive && !hold_until) {
+			print_trace(TRACE_ERROR, "hci_multi_scan_read : no running capture.\n");
+			pthread_mutex_unlock(&(scan->mutex));
+			return -1;
+		}
+
+		uint64_t wake_up = deadline;
+		if (hold_until && (!deadline || hold_until < deadline)) {
+			wake_up = hold_until;
+		}
+		if (deadline && hci_multi_scan_now() >= deadline) {
+			break;
+		}
+		if (wake_up) {
+			struct timespec ts = hci_multi_scan_timespec(wake_up);
+			pthread_cond_timedwait(&(scan->cond), &(scan->mutex), &ts);
+		} else {
+			pthread_cond_wait(&(scan->cond), &(scan->mutex));
+		}
+	}
+	pthread_mutex_unlock(&(scan->mutex));
+
+	return n;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_multi_scan_get_stats(hci_multi_scan_t *scan, uint8_t index, hci_multi_scan_stats_t *stats) {
+	if (!scan || !stats || index >= scan->count) {
+		print_trace(TRACE_ERROR, "hci_multi_scan_get_stats : invalid arguments.\n");
+		return -1;
+	}
+
+	hci_multi_scan_adapter_t *adapter = &(scan->adapters[index]);
+	stats->reports = __atomic_load_n(&(adapter->reports), __ATOMIC_RELAXED);
+	stats->drops = __atomic_load_n(&(adapter->drops), __ATOMIC_RELAXED);
+	stats->pending = (uint32_t)(__atomic_load_n(&(adapter->head), __ATOMIC_ACQUIRE) -
+				    __atomic_load_n(&(adapter->tail), __ATOMIC_ACQUIRE));
+	stats->stopped = __atomic_load_n(&(adapter->stopped), __ATOMIC_ACQUIRE);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_multi_scan_stop(hci_multi_scan_t *scan) {
+	int8_t res = 0;
+
+	if (!scan || !scan->count) {
+		print_trace(TRACE_ERROR, "hci_multi_scan_stop : inactive multi-controller scan.\n");
+		return -1;
+	}
+
+	scan->running = 0;
+	// The capture threads are woken up instead of waiting for the end of their reads :
+	for (uint8_t i = 0; i < scan->count; i++) {
+		hci_controller_cancel(scan->adapters[i].session.hci_controller);
+	}
+	for (uint8_t i = 0; i < scan->count; i++) {
+		pthread_join(scan->adapters[i].thread, NULL);
+	}
+
+	for (uint8_t i = 0; i < scan->count; i++) {
+		if (hci_LE_stop_scan_session(&(scan->adapters[i].session)) < 0) {
+			res = -1;
+		}
+		free(scan->adapters[i].ring);
+		scan->adapters[i].ring = NULL;
+	}
+
+	pthread_cond_destroy(&(scan->cond));
+	pthread_mutex_destroy(&(scan->mutex));
+	scan->count = 0;
+
+	return res;
+}
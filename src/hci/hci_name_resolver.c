@@ -0,0 +1,309 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_name_resolver.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Number of consecutive entries of the cache in which a device may be stored.
+ */
+#define HCI_NAME_RESOLVER_PROBES 8
+
+/**
+ * State of a free entry of the cache.
+ */
+#define HCI_NAME_FREE -1
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline uint64_t hci_name_resolver_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000ULL + (uint64_t)now.tv_nsec / 1000000ULL;
+}
+
+//---------------------------------
+
+static inline uint32_t hci_name_resolver_hash(const bt_address_t *mac) {
+	uint32_t hash = 2166136261U; // FNV-1a
+	for (uint8_t i = 0; i < sizeof(bt_address_t); i++) {
+		hash = (hash ^ mac->b[i]) * 16777619U;
+	}
+	return hash;
+}
+
+//---------------------------------
+
+/* Static function returning the entry of the cache of the given device, NULL if the
+   device isn't cached. The entries are never freed (only reused), so that the
+   lookup can go through all the probed entries. Must be called with the mutex held.
+*/
+static hci_name_entry_t *hci_name_resolver_find(hci_name_resolver_t *resolver, const bt_address_t *mac) {
+	uint32_t hash = hci_name_resolver_hash(mac);
+	for (uint8_t i = 0; i < HCI_NAME_RESOLVER_PROBES; i++) {
+		hci_name_entry_t *entry = &(resolver->cache[(hash + i) & (HCI_NAME_RESOLVER_CACHE_SIZE - 1)]);
+		if (entry->state == HCI_NAME_FREE) {
+			return NULL;
+		}
+		if (bt_compare_addresses(&(entry->mac), mac)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+//---------------------------------
+
+/* Static function choosing the entry of the cache in which a new device is to be stored :
+   a free entry if any, otherwise the (non pending) entry expiring first. Returns NULL if
+   all the probed entries are pending. Must be called with the mutex held.
+*/
+static hci_name_entry_t *hci_name_resolver_slot(hci_name_resolver_t *resolver, const bt_address_t *mac) {
+	uint32_t hash = hci_name_resolver_hash(mac);
+	hci_name_entry_t *best = NULL;
+	for (uint8_t i = 0; i < HCI_NAME_RESOLVER_PROBES; i++) {
+		hci_name_entry_t *entry = &(resolver->cache[(hash + i) & (HCI_NAME_RESOLVER_CACHE_SIZE - 1)]);
+		if (entry->state == HCI_NAME_FREE) {
+			return entry;
+		}
+		if (entry->state != HCI_NAME_PENDING && (!best || entry->expiration < best->expiration)) {
+			best = entry;
+		}
+	}
+	return best;
+}
+
+//---------------------------------
+
+static void *hci_name_resolver_routine(void *data) {
+	hci_name_resolver_t *resolver = (hci_name_resolver_t *)data;
+	char name[BT_NAME_LENGTH];
+	bt_address_t mac;
+
+	pthread_mutex_lock(&(resolver->mutex));
+	while (resolver->running) {
+		if (!resolver->queue_length) {
+			pthread_cond_wait(&(resolver->cond), &(resolver->mutex));
+			continue;
+		}
+		mac = resolver->queue[resolver->queue_head];
+		resolver->queue_head = (resolver->queue_head + 1) % HCI_NAME_RESOLVER_QUEUE_SIZE;
+		resolver->queue_length--;
+		pthread_mutex_unlock(&(resolver->mutex));
+
+		/* The request doesn't need the controller to be idle, so its state isn't taken
+		   (the resolver is stopped before the controller is closed).
+		*/
+		int8_t res = read_hci_socket_remote_name(&(resolver->hci_socket), &mac, name, BT_NAME_LENGTH,
+							 HCI_CONTROLLER_DEFAULT_TIMEOUT);
+		if (res < 0) {
+			char address[18] = {0};
+			ba2str(&mac, address);
+			print_trace(TRACE_INFO, "hci_name_resolver : unable to resolve the name of %s.\n", address);
+		} else {
+			bt_device_set_real_name(mac, name);
+		}
+
+		pthread_mutex_lock(&(resolver->mutex));
+		hci_name_entry_t *entry = hci_name_resolver_find(resolver, &mac); // Pending entries stay
+		if (entry) {
+			if (res < 0) {
+				entry->state = HCI_NAME_UNREACHABLE;
+				entry->expiration = hci_name_resolver_now() + resolver->negative_ttl;
+				resolver->stats.unreachable++;
+			} else {
+				entry->state = HCI_NAME_RESOLVED;
+				entry->expiration = hci_name_resolver_now() + resolver->ttl;
+				memcpy(entry->name, name, BT_NAME_LENGTH);
+				resolver->stats.resolved++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&(resolver->mutex));
+
+	return NULL;
+}
+
+/*---------------------------
+  - NAME RESOLVER FUNCTIONS -
+  ---------------------------*/
+
+int8_t hci_name_resolver_start(hci_name_resolver_t *resolver, hci_controller_t *hci_controller,
+			       uint32_t ttl, uint32_t negative_ttl) {
+	if (!resolver || !hci_controller) {
+		print_trace(TRACE_ERROR, "hci_name_resolver_start : invalid arguments.\n");
+		return -1;
+	}
+
+	if (__atomic_load_n(&(hci_controller->state), __ATOMIC_ACQUIRE) == HCI_STATE_CLOSED) {
+		print_trace(TRACE_ERROR, "hci_name_resolver_start : closed controller.\n");
+		return -1;
+	}
+
+	memset(resolver, 0, sizeof(hci_name_resolver_t));
+	for (uint16_t i = 0; i < HCI_NAME_RESOLVER_CACHE_SIZE; i++) {
+		resolver->cache[i].state = HCI_NAME_FREE;
+	}
+	resolver->hci_controller = hci_controller;
+	resolver->ttl = ttl;
+	resolver->negative_ttl = negative_ttl;
+
+	resolver->hci_socket = open_hci_socket_transport(hci_controller->transport,
+							  hci_controller->transport_data,
+							  &(hci_controller->device.mac));
+	if (resolver->hci_socket.sock < 0) {
+		return -1;
+	}
+	// Nothing is queued on the socket between two requests :
+	struct hci_filter flt;
+	hci_filter_clear(&flt);
+	if (apply_hci_socket_filter(&(resolver->hci_socket), &flt) < 0) {
+		goto fail;
+	}
+
+	pthread_mutex_init(&(resolver->mutex), NULL);
+	pthread_cond_init(&(resolver->cond), NULL);
+	resolver->running = 1;
+	if (pthread_create(&(resolver->thread), NULL, &hci_name_resolver_routine, resolver) != 0) {
+		perror("hci_name_resolver_start");
+		goto fail_thread;
+	}
+
+	pthread_mutex_lock(&(hci_controller->lock));
+	if (hci_controller->name_resolver) {
+		pthread_mutex_unlock(&(hci_controller->lock));
+		print_trace(TRACE_ERROR, "hci_name_resolver_start : the controller already has a resolver.\n");
+		pthread_mutex_lock(&(resolver->mutex));
+		resolver->running = 0;
+		pthread_cond_signal(&(resolver->cond));
+		pthread_mutex_unlock(&(resolver->mutex));
+		pthread_join(resolver->thread, NULL);
+		goto fail_thread;
+	}
+	hci_controller->name_resolver = resolver;
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	return 0;
+
+ fail_thread:
+	resolver->running = 0;
+	pthread_cond_destroy(&(resolver->cond));
+	pthread_mutex_destroy(&(resolver->mutex));
+ fail:
+	close_hci_socket(&(resolver->hci_socket));
+	resolver->hci_controller = NULL;
+	return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_name_resolver_lookup(hci_name_resolver_t *resolver, bt_address_t *mac, char *name) {
+	int8_t res = HCI_NAME_PENDING;
+
+	if (!resolver || !resolver->running || !mac) {
+		print_trace(TRACE_ERROR, "hci_name_resolver_lookup : invalid arguments.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(resolver->mutex));
+	resolver->stats.lookups++;
+
+	hci_name_entry_t *entry = hci_name_resolver_find(resolver, mac);
+	if (entry && (entry->state == HCI_NAME_PENDING || entry->expiration > hci_name_resolver_now())) {
+		res = entry->state;
+		if (res == HCI_NAME_RESOLVED) {
+			memcpy(name, entry->name, BT_NAME_LENGTH);
+		}
+		if (res != HCI_NAME_PENDING) {
+			resolver->stats.cache_hits++;
+		}
+		goto end;
+	}
+
+	if (!entry) {
+		entry = hci_name_resolver_slot(resolver, mac);
+	}
+	if (!entry || resolver->queue_length == HCI_NAME_RESOLVER_QUEUE_SIZE) {
+		resolver->stats.dropped++;
+		res = -1;
+		goto end;
+	}
+
+	entry->mac = *mac;
+	entry->state = HCI_NAME_PENDING;
+	resolver->queue[(resolver->queue_head + resolver->queue_length) % HCI_NAME_RESOLVER_QUEUE_SIZE] = *mac;
+	resolver->queue_length++;
+	pthread_cond_signal(&(resolver->cond));
+
+ end:
+	pthread_mutex_unlock(&(resolver->mutex));
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_name_resolver_get_stats(hci_name_resolver_t *resolver, hci_name_resolver_stats_t *stats) {
+	if (!resolver || !resolver->hci_controller || !stats) {
+		print_trace(TRACE_ERROR, "hci_name_resolver_get_stats : invalid arguments.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(resolver->mutex));
+	*stats = resolver->stats;
+	pthread_mutex_unlock(&(resolver->mutex));
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_name_resolver_stop(hci_name_resolver_t *resolver) {
+	if (!resolver || !resolver->hci_controller) {
+		print_trace(TRACE_ERROR, "hci_name_resolver_stop : inactive resolver.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(resolver->hci_controller->lock));
+	if (resolver->hci_controller->name_resolver == resolver) {
+		resolver->hci_controller->name_resolver = NULL;
+	}
+	pthread_mutex_unlock(&(resolver->hci_controller->lock));
+
+	pthread_mutex_lock(&(resolver->mutex));
+	resolver->running = 0;
+	pthread_cond_signal(&(resolver->cond));
+	pthread_mutex_unlock(&(resolver->mutex));
+	pthread_join(resolver->thread, NULL);
+
+	close_hci_socket(&(resolver->hci_socket));
+	pthread_cond_destroy(&(resolver->cond));
+	pthread_mutex_destroy(&(resolver->mutex));
+	resolver->hci_controller = NULL;
+
+	return 0;
+}
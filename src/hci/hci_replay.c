@@ -0,0 +1,603 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_replay.h"
+#include "hci_snoop.h"
+#include "trace.h"
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Opcodes of the monitor datalink (cf BlueZ "monitor/bt.h"). */
+#define HCI_REPLAY_MONITOR_COMMAND_PKT 0x0002
+#define HCI_REPLAY_MONITOR_EVENT_PKT 0x0003
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline char hci_replay_is_command(const hci_replay_record_t *record) {
+	return record->packet[0] == HCI_COMMAND_PKT;
+}
+
+//---------------------------------
+
+static inline uint16_t hci_replay_opcode(const hci_replay_record_t *record) {
+	uint16_t opcode;
+	memcpy(&opcode, record->packet + 1, 2);
+	return btohs(opcode);
+}
+
+//---------------------------------
+
+/* Tells whether the record is the answer ("Command Complete" or "Command Status") to the
+   given command.
+*/
+static char hci_replay_is_answer(const hci_replay_record_t *record, uint16_t opcode) {
+	uint16_t answered;
+	if (record->packet[0] != HCI_EVENT_PKT) {
+		return 0;
+	}
+	if (record->packet[1] == EVT_CMD_COMPLETE && record->length >= 1 + HCI_EVENT_HDR_SIZE + EVT_CMD_COMPLETE_SIZE) {
+		memcpy(&answered, record->packet + 1 + HCI_EVENT_HDR_SIZE + 1, 2);
+	} else if (record->packet[1] == EVT_CMD_STATUS && record->length >= 1 + HCI_EVENT_HDR_SIZE + EVT_CMD_STATUS_SIZE) {
+		memcpy(&answered, record->packet + 1 + HCI_EVENT_HDR_SIZE + 2, 2);
+	} else {
+		return 0;
+	}
+	return btohs(answered) == opcode;
+}
+
+//---------------------------------
+
+/* Loads the records of a capture, all the packets being converted to the H4 format. */
+static int8_t hci_replay_load(hci_replay_t *replay, const char *path) {
+	uint8_t *file = NULL;
+	long size;
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		perror("hci_replay_open : unable to open the capture");
+		return -1;
+	}
+	if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 16 || fseek(f, 0, SEEK_SET) < 0) {
+		print_trace(TRACE_ERROR, "hci_replay_open : invalid capture.\n");
+		goto fail;
+	}
+	file = malloc(size);
+	if (!file || fread(file, 1, size, f) != (size_t)size) {
+		perror("hci_replay_open : unable to read the capture");
+		goto fail;
+	}
+
+	uint32_t version, datalink;
+	memcpy(&version, file + 8, 4);
+	memcpy(&datalink, file + 12, 4);
+	version = be32toh(version);
+	datalink = be32toh(datalink);
+	if (memcmp(file, HCI_SNOOP_ID, sizeof(HCI_SNOOP_ID)) || version != HCI_SNOOP_VERSION ||
+	    (datalink != HCI_SNOOP_DATALINK_HCI && datalink != HCI_SNOOP_DATALINK_H4 &&
+	     datalink != HCI_SNOOP_DATALINK_MONITOR)) {
+		print_trace(TRACE_ERROR, "hci_replay_open : unsupported capture format.\n");
+		goto fail;
+	}
+
+	/* Each record having a 24 bytes header, this is enough to add the packet type 
+	   indicator to all the packets.
+	*/
+	uint32_t max_records = size / sizeof(hci_snoop_record_hdr_t) + 1;
+	replay->records = calloc(max_records, sizeof(hci_replay_record_t));
+	replay->data = malloc(size + max_records);
+	if (!replay->records || !replay->data) {
+		perror("hci_replay_open");
+		goto fail;
+	}
+
+	long offset = 16;
+	uint32_t data_used = 0;
+	int32_t index = -1;
+	while (offset + (long)sizeof(hci_snoop_record_hdr_t) <= size) {
+		hci_snoop_record_hdr_t hdr;
+		memcpy(&hdr, file + offset, sizeof(hdr));
+		uint32_t length = be32toh(hdr.included_length);
+		uint32_t flags = be32toh(hdr.flags);
+		const uint8_t *packet = file + offset + sizeof(hdr);
+		offset += sizeof(hdr) + length;
+		if (offset > size) {
+			print_trace(TRACE_WARNING, "hci_replay_open : truncated capture.\n");
+			break;
+		}
+
+		uint8_t type;
+		switch (datalink) {
+		case HCI_SNOOP_DATALINK_H4:
+			if (!length) {
+				continue;
+			}
+			type = packet[0];
+			packet++;
+			length--;
+			break;
+		case HCI_SNOOP_DATALINK_HCI:
+			if (!(flags & HCI_SNOOP_FLAG_COMMAND_EVENT)) {
+				continue;
+			}
+			type = (flags & HCI_SNOOP_FLAG_RECEIVED) ? HCI_EVENT_PKT : HCI_COMMAND_PKT;
+			break;
+		default: // HCI_SNOOP_DATALINK_MONITOR
+			if (index >= 0 && (int32_t)(flags >> 16) != index) {
+				continue;
+			}
+			if ((flags & 0xFFFF) == HCI_REPLAY_MONITOR_COMMAND_PKT) {
+				type = HCI_COMMAND_PKT;
+			} else if ((flags & 0xFFFF) == HCI_REPLAY_MONITOR_EVENT_PKT) {
+				type = HCI_EVENT_PKT;
+			} else {
+				continue;
+			}
+			index = flags >> 16;
+			break;
+		}
+
+		/* Only the well-formed commands and events are replayed. */
+		if ((type == HCI_COMMAND_PKT && length < HCI_COMMAND_HDR_SIZE) ||
+		    (type == HCI_EVENT_PKT && (length < HCI_EVENT_HDR_SIZE || length > HCI_MAX_EVENT_SIZE)) ||
+		    (type != HCI_COMMAND_PKT && type != HCI_EVENT_PKT)) {
+			continue;
+		}
+
+		hci_replay_record_t *record = &(replay->records[replay->length++]);
+		record->timestamp = be64toh(hdr.timestamp);
+		record->packet = replay->data + data_used;
+		record->length = length + 1;
+		replay->data[data_used] = type;
+		memcpy(replay->data + data_used + 1, packet, length);
+		data_used += length + 1;
+	}
+
+	free(file);
+	fclose(f);
+	print_trace(TRACE_INFO, "hci_replay : %u records loaded.\n", replay->length);
+	return 0;
+
+ fail:
+	free(file);
+	fclose(f);
+	return -1;
+}
+
+//---------------------------------
+
+/* Delivers an event to every socket accepting it. A socket whose reception queue is full
+   is waited for (without holding the mutex) up to HCI_REPLAY_BLOCK_TIMEOUT ms, so that 
+   no event is lost while the user reads them. The replay's mutex has to be held.
+*/
+static void hci_replay_deliver(hci_replay_t *replay, const uint8_t *packet, uint16_t length, char wait) {
+	for (uint8_t i = 0; i < HCI_REPLAY_MAX_SOCKETS; i++) {
+		int fd = replay->sockets[i].fd;
+		if (fd < 0 || !hci_transport_filter_event(&(replay->sockets[i].filter), packet)) {
+			continue;
+		}
+
+		int16_t waited = 0;
+		while (send(fd, packet, length, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+			if ((errno != EAGAIN && errno != EWOULDBLOCK) || !wait || waited >= HCI_REPLAY_BLOCK_TIMEOUT) {
+				replay->stats.dropped_events++;
+				replay->sockets[i].dropped++;
+				goto next;
+			}
+			struct pollfd p = {fd, POLLOUT, 0};
+			pthread_mutex_unlock(&(replay->mutex));
+			poll(&p, 1, 10);
+			pthread_mutex_lock(&(replay->mutex));
+			waited += 10;
+			if (!replay->running || replay->sockets[i].fd != fd) {
+				goto next; // Closed meanwhile
+			}
+		}
+		replay->stats.events++;
+	next:
+		continue;
+	}
+}
+
+//---------------------------------
+
+static void *hci_replay_thread_routine(void *arg) {
+	hci_replay_t *replay = (hci_replay_t *)arg;
+	struct timespec now, target;
+
+	pthread_mutex_lock(&(replay->mutex));
+	while (replay->running) {
+		if (replay->position >= replay->length || 
+		    hci_replay_is_command(&(replay->records[replay->position]))) {
+			// Waiting for the user to send a command
+			pthread_cond_wait(&(replay->cond), &(replay->mutex));
+			continue;
+		}
+
+		hci_replay_record_t *record = &(replay->records[replay->position]);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!replay->synchronized) {
+			replay->base = now;
+			replay->base_timestamp = record->timestamp;
+			replay->synchronized = 1;
+		}
+
+		if (replay->speed > 0 && record->timestamp > replay->base_timestamp) {
+			uint64_t delay = (record->timestamp - replay->base_timestamp) * 1000 / replay->speed;
+			target.tv_sec = replay->base.tv_sec + delay / 1000000000ULL;
+			target.tv_nsec = replay->base.tv_nsec + delay % 1000000000ULL;
+			if (target.tv_nsec >= 1000000000L) {
+				target.tv_sec++;
+				target.tv_nsec -= 1000000000L;
+			}
+			if (now.tv_sec < target.tv_sec || 
+			    (now.tv_sec == target.tv_sec && now.tv_nsec < target.tv_nsec)) {
+				pthread_cond_timedwait(&(replay->cond), &(replay->mutex), &target);
+				continue; // A command may have moved the position meanwhile
+			}
+		}
+
+		replay->position++;
+		hci_replay_deliver(replay, record->packet, record->length, 1);
+
+		if (replay->pending_opcode && hci_replay_is_answer(record, replay->pending_opcode)) {
+			replay->pending_opcode = 0;
+			replay->settling = 1;
+			clock_gettime(CLOCK_MONOTONIC, &target);
+			target.tv_nsec += HCI_REPLAY_SETTLE_TIME * 1000000L;
+			if (target.tv_nsec >= 1000000000L) {
+				target.tv_sec++;
+				target.tv_nsec -= 1000000000L;
+			}
+			while (replay->settling && replay->running) {
+				if (pthread_cond_timedwait(&(replay->cond), &(replay->mutex), &target) == ETIMEDOUT) {
+					break;
+				}
+			}
+			replay->settling = 0;
+		}
+	}
+	pthread_mutex_unlock(&(replay->mutex));
+
+	return NULL;
+}
+
+//------------------------------------------------------------------------------------
+
+/*-----------------------
+  - TRANSPORT FUNCTIONS -
+  -----------------------*/
+
+static int8_t replay_open(hci_socket_t *hci_socket, bt_address_t *adapter) {
+	hci_replay_t *replay = (hci_replay_t *)hci_socket->transport_data;
+
+	if (!replay) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	pthread_mutex_lock(&(replay->mutex));
+	int8_t res = hci_transport_pair_open(replay->sockets, HCI_REPLAY_MAX_SOCKETS, hci_socket);
+	pthread_mutex_unlock(&(replay->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static void replay_close(hci_socket_t *hci_socket) {
+	hci_replay_t *replay = (hci_replay_t *)hci_socket->transport_data;
+
+	pthread_mutex_lock(&(replay->mutex));
+	hci_transport_pair_t *pair = hci_transport_pair_get(replay->sockets, HCI_REPLAY_MAX_SOCKETS,
+							    hci_socket->sock);
+	if (pair) {
+		hci_transport_pair_close(pair);
+	}
+	pthread_mutex_unlock(&(replay->mutex));
+
+	close(hci_socket->sock);
+}
+
+//---------------------------------
+
+static int replay_send_cmd(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf, uint8_t plen, void *param) {
+	hci_replay_t *replay = (hci_replay_t *)hci_socket->transport_data;
+	uint16_t opcode = cmd_opcode_pack(ogf, ocf);
+	int64_t found = -1;
+
+	pthread_mutex_lock(&(replay->mutex));
+	replay->stats.commands++;
+
+	for (uint32_t i = replay->position; i < replay->length && found < 0; i++) {
+		if (hci_replay_is_command(&(replay->records[i])) && hci_replay_opcode(&(replay->records[i])) == opcode) {
+			found = i;
+		}
+	}
+	for (uint32_t i = 0; i < replay->position && i < replay->length && found < 0; i++) {
+		if (hci_replay_is_command(&(replay->records[i])) && hci_replay_opcode(&(replay->records[i])) == opcode) {
+			found = i;
+			replay->stats.loops++;
+		}
+	}
+
+	if (found >= 0) {
+		replay->position = found + 1;
+		clock_gettime(CLOCK_MONOTONIC, &(replay->base));
+		replay->base_timestamp = replay->records[found].timestamp;
+		replay->synchronized = 1;
+		replay->pending_opcode = opcode;
+		pthread_cond_signal(&(replay->cond));
+	} else {
+		uint8_t packet[1 + HCI_EVENT_HDR_SIZE + EVT_CMD_COMPLETE_SIZE + 1];
+		evt_cmd_complete *cc = (void *)(packet + 1 + HCI_EVENT_HDR_SIZE);
+		packet[0] = HCI_EVENT_PKT;
+		packet[1] = EVT_CMD_COMPLETE;
+		packet[2] = EVT_CMD_COMPLETE_SIZE + 1;
+		cc->ncmd = 1;
+		cc->opcode = htobs(opcode);
+		packet[sizeof(packet) - 1] = 0x00; // Success
+		replay->stats.unmatched_commands++;
+		hci_replay_deliver(replay, packet, sizeof(packet), 0);
+	}
+	pthread_mutex_unlock(&(replay->mutex));
+
+	return 0;
+}
+
+//---------------------------------
+
+static ssize_t replay_read(hci_socket_t *hci_socket, void *buf, size_t length) {
+	return hci_transport_recv(hci_socket, buf, length);
+}
+
+//---------------------------------
+
+static int replay_get_filter(hci_socket_t *hci_socket, struct hci_filter *flt) {
+	hci_replay_t *replay = (hci_replay_t *)hci_socket->transport_data;
+	int res = 0;
+
+	pthread_mutex_lock(&(replay->mutex));
+	hci_transport_pair_t *pair = hci_transport_pair_get(replay->sockets, HCI_REPLAY_MAX_SOCKETS,
+							    hci_socket->sock);
+	if (pair) {
+		*flt = pair->filter;
+	} else {
+		errno = EBADF;
+		res = -1;
+	}
+	pthread_mutex_unlock(&(replay->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static int replay_set_filter(hci_socket_t *hci_socket, const struct hci_filter *flt) {
+	hci_replay_t *replay = (hci_replay_t *)hci_socket->transport_data;
+	int res = 0;
+
+	pthread_mutex_lock(&(replay->mutex));
+	hci_transport_pair_t *pair = hci_transport_pair_get(replay->sockets, HCI_REPLAY_MAX_SOCKETS,
+							    hci_socket->sock);
+	if (pair) {
+		pair->filter = *flt;
+		if (replay->settling) {
+			replay->settling = 0;
+			pthread_cond_signal(&(replay->cond));
+		}
+	} else {
+		errno = EBADF;
+		res = -1;
+	}
+	pthread_mutex_unlock(&(replay->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static int replay_inquiry(hci_socket_t *hci_socket, uint8_t duration, uint16_t max_rsp,
+			  inquiry_info **ii, long flags) {
+	// The inquiries made by the kernel (hci_inquiry) are not part of the captures.
+	errno = ENOSYS;
+	return -1;
+}
+
+//---------------------------------
+
+static int replay_dev_info(hci_socket_t *hci_socket, struct hci_dev_info *info) {
+	memset(info, 0, sizeof(struct hci_dev_info));
+	info->dev_id = hci_socket->dev_id;
+	strcpy(info->name, "replay");
+	return 0;
+}
+
+//---------------------------------
+
+static int replay_get_drops(hci_socket_t *hci_socket, uint32_t *drops) {
+	hci_replay_t *replay = (hci_replay_t *)hci_socket->transport_data;
+	int res = 0;
+
+	pthread_mutex_lock(&(replay->mutex));
+	hci_transport_pair_t *pair = hci_transport_pair_get(replay->sockets, HCI_REPLAY_MAX_SOCKETS,
+							    hci_socket->sock);
+	if (pair) {
+		*drops = pair->dropped;
+	} else {
+		errno = EBADF;
+		res = -1;
+	}
+	pthread_mutex_unlock(&(replay->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static int replay_set_receive_buffer(hci_socket_t *hci_socket, int size) {
+	hci_replay_t *replay = (hci_replay_t *)hci_socket->transport_data;
+	int res = -1;
+
+	pthread_mutex_lock(&(replay->mutex));
+	hci_transport_pair_t *pair = hci_transport_pair_get(replay->sockets, HCI_REPLAY_MAX_SOCKETS,
+							    hci_socket->sock);
+	if (pair) {
+		res = hci_transport_pair_set_receive_buffer(pair, size);
+	} else {
+		errno = EBADF;
+	}
+	pthread_mutex_unlock(&(replay->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static int replay_attach_filter(hci_socket_t *hci_socket, const struct sock_fprog *program) {
+	hci_replay_t *replay = (hci_replay_t *)hci_socket->transport_data;
+	int res = -1;
+
+	pthread_mutex_lock(&(replay->mutex));
+	hci_transport_pair_t *pair = hci_transport_pair_get(replay->sockets, HCI_REPLAY_MAX_SOCKETS,
+							    hci_socket->sock);
+	if (pair) {
+		res = hci_transport_pair_attach_filter(pair, program);
+	} else {
+		errno = EBADF;
+	}
+	pthread_mutex_unlock(&(replay->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static int replay_restart(hci_socket_t *hci_socket) {
+	(void)hci_socket;
+	errno = ENOTSUP; // The recorded events can't be altered
+	return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+const hci_transport_t hci_replay_transport = {
+	.name = "replay",
+	.open = replay_open,
+	.close = replay_close,
+	.send_cmd = replay_send_cmd,
+	.send_req = hci_transport_generic_send_req,
+	.read = replay_read,
+	.get_filter = replay_get_filter,
+	.set_filter = replay_set_filter,
+	.inquiry = replay_inquiry,
+	.dev_info = replay_dev_info,
+	.get_drops = replay_get_drops,
+	.set_receive_buffer = replay_set_receive_buffer,
+	.attach_filter = replay_attach_filter,
+	.restart = replay_restart
+};
+
+//------------------------------------------------------------------------------------
+
+/*--------------------
+  - REPLAY FUNCTIONS -
+  --------------------*/
+
+hci_replay_t *hci_replay_open(const char *path, double speed) {
+	hci_replay_t *replay = calloc(1, sizeof(hci_replay_t));
+	if (!replay) {
+		perror("hci_replay_open");
+		return NULL;
+	}
+
+	if (hci_replay_load(replay, path) < 0) {
+		goto fail;
+	}
+	replay->speed = speed > 0 ? speed : HCI_REPLAY_AS_FAST_AS_POSSIBLE;
+	hci_transport_pairs_init(replay->sockets, HCI_REPLAY_MAX_SOCKETS);
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&(replay->cond), &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&(replay->mutex), NULL);
+
+	replay->running = 1;
+	if (pthread_create(&(replay->thread), NULL, hci_replay_thread_routine, replay) != 0) {
+		perror("hci_replay_open : unable to start the replaying thread");
+		pthread_cond_destroy(&(replay->cond));
+		pthread_mutex_destroy(&(replay->mutex));
+		goto fail;
+	}
+
+	return replay;
+
+ fail:
+	free(replay->records);
+	free(replay->data);
+	free(replay);
+	return NULL;
+}
+
+//---------------------------------
+
+void hci_replay_close(hci_replay_t *replay) {
+	if (!replay) {
+		print_trace(TRACE_ERROR, "hci_replay_close : invalid reference.\n");
+		return;
+	}
+
+	pthread_mutex_lock(&(replay->mutex));
+	replay->running = 0;
+	pthread_cond_signal(&(replay->cond));
+	pthread_mutex_unlock(&(replay->mutex));
+	pthread_join(replay->thread, NULL);
+
+	for (uint8_t i = 0; i < HCI_REPLAY_MAX_SOCKETS; i++) {
+		if (replay->sockets[i].fd >= 0) {
+			print_trace(TRACE_WARNING, "hci_replay_close : socket %i still opened.\n", replay->sockets[i].peer);
+			hci_transport_pair_close(&(replay->sockets[i]));
+		}
+	}
+
+	pthread_cond_destroy(&(replay->cond));
+	pthread_mutex_destroy(&(replay->mutex));
+	free(replay->records);
+	free(replay->data);
+	free(replay);
+}
+
+//---------------------------------
+
+void hci_replay_get_stats(hci_replay_t *replay, hci_replay_stats_t *stats) {
+	pthread_mutex_lock(&(replay->mutex));
+	*stats = replay->stats;
+	pthread_mutex_unlock(&(replay->mutex));
+}
@@ -0,0 +1,545 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_report.h"
+#include "hci_dedup.h"
+#include "hci_white_list.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Size of the fixed part of an LE advertising report : event type, address type,
+   address and data length (cf p1048 spec'). The data and the RSSI follow.
+*/
+#define LE_ADV_REPORT_FIXED_SIZE (1+1+6+1)
+
+/* Size of the fixed part of an LE extended advertising report : event type, address type,
+   address, primary and secondary PHYs, SID, Tx power, RSSI, periodic advertising interval,
+   direct address type, direct address and data length (cf Core v5.0, vol 2 part E, 7.7.65.13).
+   The data follows.
+*/
+#define LE_EXT_ADV_REPORT_FIXED_SIZE (2+1+6+1+1+1+1+1+2+1+6+1)
+
+/* Fields of a legacy (or classic) report which only extended reports carry. */
+#define HCI_REPORT_SET_LEGACY_FIELDS(report, phy) \
+do {\
+	(report)->extended = 0;\
+	(report)->data_status = HCI_REPORT_DATA_COMPLETE;\
+	(report)->primary_phy = (phy);\
+	(report)->secondary_phy = 0;\
+	(report)->sid = 0xFF;\
+	(report)->tx_power = HCI_REPORT_TX_POWER_UNAVAILABLE;\
+} while (0)
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_report_iterator_init(hci_report_iterator_t *it, const uint8_t *packet, uint16_t length,
+				 const struct timespec *timestamp) {
+
+	if (!it || !packet) {
+		print_trace(TRACE_ERROR, "hci_report_iterator_init : invalid reference.\n");
+		return -1;
+	}
+
+	memset(it, 0, sizeof(hci_report_iterator_t));
+
+	// Packet indicator, event header and number of reports :
+	if (length < 1 + HCI_EVENT_HDR_SIZE + 1 || packet[0] != HCI_EVENT_PKT) {
+		return -1;
+	}
+
+	const hci_event_hdr *hdr = (const hci_event_hdr *)(packet + 1);
+	const uint8_t *event_parameter = packet + 1 + HCI_EVENT_HDR_SIZE;
+	it->end = event_parameter + hdr->plen;
+	if (it->end > packet + length) {
+		return -1;
+	}
+
+	it->evt = hdr->evt;
+	switch (hdr->evt) {
+	case EVT_LE_META_EVENT:
+		if (hdr->plen < 2 || (event_parameter[0] != EVT_LE_ADVERTISING_REPORT &&
+				      event_parameter[0] != EVT_LE_EXT_ADVERTISING_REPORT)) {
+			return -1;
+		}
+		it->subevent = event_parameter[0];
+		it->remaining = event_parameter[1];
+		it->cursor = event_parameter + 2;
+		break;
+	case EVT_INQUIRY_RESULT:
+	case EVT_INQUIRY_RESULT_WITH_RSSI:
+	case EVT_EXTENDED_INQUIRY_RESULT:
+		it->remaining = event_parameter[0];
+		it->cursor = event_parameter + 1;
+		break;
+	default:
+		return -1;
+	}
+
+	if (timestamp) {
+		it->timestamp = *timestamp;
+	} else {
+		clock_gettime(CLOCK_REALTIME, &(it->timestamp));
+	}
+
+	return it->remaining;
+}
+
+//------------------------------------------------------------------------------------
+
+char hci_report_iterator_next(hci_report_iterator_t *it, hci_report_t *report) {
+
+	if (!it->remaining) {
+		return 0;
+	}
+
+	/* Even though the specification describes the reports parameters as arrays
+	   (all the addresses, then all the address types...), controllers send them
+	   report by report. This is also the way the kernel and BlueZ parse them.
+	*/
+	switch (it->evt) {
+	case EVT_LE_META_EVENT: {
+		if (it->subevent == EVT_LE_EXT_ADVERTISING_REPORT) {
+			const uint8_t *info = it->cursor;
+			if (info + LE_EXT_ADV_REPORT_FIXED_SIZE > it->end) {
+				goto truncated;
+			}
+			uint8_t length = info[LE_EXT_ADV_REPORT_FIXED_SIZE - 1];
+			if (info + LE_EXT_ADV_REPORT_FIXED_SIZE + length > it->end) {
+				goto truncated;
+			}
+			uint16_t evt_type = info[0] | (info[1] << 8);
+			report->evt_type = evt_type & 0x1F;
+			report->data_status = (evt_type >> 5) & 0x03;
+			report->add_type = info[2];
+			memcpy(&(report->mac), info + 3, sizeof(bt_address_t));
+			report->primary_phy = info[9];
+			report->secondary_phy = info[10];
+			report->sid = info[11];
+			report->tx_power = (int8_t)info[12];
+			report->rssi = (int8_t)info[13];
+			report->extended = 1;
+			report->data_length = length;
+			report->data = (length ? info + LE_EXT_ADV_REPORT_FIXED_SIZE : NULL);
+			it->cursor += LE_EXT_ADV_REPORT_FIXED_SIZE + length;
+			break;
+		}
+		if (it->cursor + LE_ADV_REPORT_FIXED_SIZE > it->end) {
+			goto truncated;
+		}
+		const le_advertising_info *info = (const le_advertising_info *)it->cursor;
+		if (it->cursor + LE_ADV_REPORT_FIXED_SIZE + info->length + 1 > it->end) {
+			goto truncated;
+		}
+		report->evt_type = info->evt_type;
+		report->add_type = info->bdaddr_type;
+		report->mac = info->bdaddr;
+		report->data_length = info->length;
+		report->data = (info->length ? info->data : NULL);
+		report->rssi = (int8_t)info->data[info->length];
+		HCI_REPORT_SET_LEGACY_FIELDS(report, 1);
+		it->cursor += LE_ADV_REPORT_FIXED_SIZE + info->length + 1;
+		break;
+	}
+	case EVT_INQUIRY_RESULT: {
+		if (it->cursor + INQUIRY_INFO_SIZE > it->end) {
+			goto truncated;
+		}
+		const inquiry_info *info = (const inquiry_info *)it->cursor;
+		report->evt_type = HCI_REPORT_CLASSIC_EVT_TYPE;
+		report->add_type = PUBLIC_DEVICE_ADDRESS;
+		report->mac = info->bdaddr;
+		report->data = NULL;
+		report->data_length = 0;
+		report->rssi = HCI_REPORT_RSSI_UNAVAILABLE;
+		HCI_REPORT_SET_LEGACY_FIELDS(report, 0);
+		it->cursor += INQUIRY_INFO_SIZE;
+		break;
+	}
+	case EVT_INQUIRY_RESULT_WITH_RSSI: {
+		if (it->cursor + INQUIRY_INFO_WITH_RSSI_SIZE > it->end) {
+			goto truncated;
+		}
+		const inquiry_info_with_rssi *info = (const inquiry_info_with_rssi *)it->cursor;
+		report->evt_type = HCI_REPORT_CLASSIC_EVT_TYPE;
+		report->add_type = PUBLIC_DEVICE_ADDRESS;
+		report->mac = info->bdaddr;
+		report->data = NULL;
+		report->data_length = 0;
+		report->rssi = info->rssi;
+		HCI_REPORT_SET_LEGACY_FIELDS(report, 0);
+		it->cursor += INQUIRY_INFO_WITH_RSSI_SIZE;
+		break;
+	}
+	case EVT_EXTENDED_INQUIRY_RESULT: {
+		if (it->cursor + EXTENDED_INQUIRY_INFO_SIZE > it->end) {
+			goto truncated;
+		}
+		const extended_inquiry_info *info = (const extended_inquiry_info *)it->cursor;
+		/* The extended inquiry response has the format of the advertising data, padded
+		   with zeros : only its significant part (up to the first empty structure) is kept.
+		*/
+		uint16_t length = 0;
+		while (length < sizeof(info->data) && info->data[length]) {
+			length += 1 + info->data[length];
+		}
+		if (length > sizeof(info->data)) {
+			length = sizeof(info->data);
+		}
+		report->evt_type = HCI_REPORT_CLASSIC_EVT_TYPE;
+		report->add_type = PUBLIC_DEVICE_ADDRESS;
+		report->mac = info->bdaddr;
+		report->data = (length ? info->data : NULL);
+		report->data_length = length;
+		report->rssi = info->rssi;
+		HCI_REPORT_SET_LEGACY_FIELDS(report, 0);
+		it->cursor += EXTENDED_INQUIRY_INFO_SIZE;
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	report->timestamp = it->timestamp;
+	it->remaining--;
+
+	return 1;
+
+ truncated:
+	print_trace(TRACE_WARNING, "hci_report_iterator_next : truncated report.\n");
+	it->remaining = 0;
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+char hci_report_reassemble(hci_report_reassembler_t *reassembler, hci_report_t *report) {
+	hci_report_fragments_t *slot = NULL;
+	uint8_t scan_rsp = report->evt_type & 0x08;
+
+	for (uint8_t i = 0; i < HCI_REPORT_REASSEMBLY_SLOTS; i++) {
+		hci_report_fragments_t *tmp = &(reassembler->slots[i]);
+		if (tmp->used && tmp->sid == report->sid && tmp->scan_rsp == scan_rsp &&
+		    tmp->add_type == report->add_type && bt_compare_addresses(&(tmp->mac), &(report->mac))) {
+			slot = tmp;
+			break;
+		}
+	}
+
+	if (!slot) {
+		if (report->data_status != HCI_REPORT_DATA_INCOMPLETE) {
+			return 1; // Not fragmented
+		}
+		// First fragment : we take a free slot, or the one waiting for the longest time.
+		slot = &(reassembler->slots[0]);
+		for (uint8_t i = 0; i < HCI_REPORT_REASSEMBLY_SLOTS && slot->used; i++) {
+			hci_report_fragments_t *tmp = &(reassembler->slots[i]);
+			if (!tmp->used || tmp->age < slot->age) {
+				slot = tmp;
+			}
+		}
+		if (slot->used) {
+			print_trace(TRACE_WARNING, "hci_report_reassemble : too many fragmented data, "
+				    "one of them is dropped.\n");
+		}
+		slot->mac = report->mac;
+		slot->add_type = report->add_type;
+		slot->sid = report->sid;
+		slot->scan_rsp = scan_rsp;
+		slot->used = 1;
+		slot->length = 0;
+	}
+
+	uint16_t room = HCI_REPORT_EXT_MAX_DATA - slot->length;
+	uint16_t copied = (report->data_length < room ? report->data_length : room);
+	if (copied) {
+		memcpy(slot->data + slot->length, report->data, copied);
+		slot->length += copied;
+	}
+
+	if (report->data_status == HCI_REPORT_DATA_INCOMPLETE && copied == report->data_length) {
+		slot->age = ++(reassembler->clock);
+		return 0;
+	}
+
+	if (copied < report->data_length) {
+		report->data_status = HCI_REPORT_DATA_TRUNCATED;
+	}
+	report->data = (slot->length ? slot->data : NULL);
+	report->data_length = slot->length;
+	slot->used = 0;
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_report_batch_init(hci_report_batch_t *batch, uint16_t capacity) {
+
+	if (!batch) {
+		print_trace(TRACE_ERROR, "hci_report_batch_init : invalid batch reference.\n");
+		return -1;
+	}
+
+	memset(batch, 0, sizeof(hci_report_batch_t));
+	if (!capacity) {
+		print_trace(TRACE_ERROR, "hci_report_batch_init : null capacity.\n");
+		return -1;
+	}
+
+	// In the worst case, each report comes in its own event :
+	batch->buffer_size = (uint32_t)capacity * HCI_MAX_EVENT_SIZE;
+	batch->buffer = malloc(batch->buffer_size);
+	batch->reports = calloc(capacity, sizeof(hci_report_t));
+	batch->reassembler = calloc(1, sizeof(hci_report_reassembler_t));
+	batch->pending = malloc(HCI_MAX_EVENT_SIZE);
+	if (!batch->buffer || !batch->reports || !batch->reassembler || !batch->pending) {
+		print_trace(TRACE_ERROR, "hci_report_batch_init : unable to allocate the batch.\n");
+		hci_report_batch_destroy(batch);
+		return -1;
+	}
+	batch->capacity = capacity;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_report_batch_clear(hci_report_batch_t *batch) {
+	batch->buffer_used = 0;
+	batch->length = 0;
+	batch->filtered = 0;
+	batch->overflowed = 0;
+	batch->truncated = 0;
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_report_batch_destroy(hci_report_batch_t *batch) {
+	if (!batch) {
+		return;
+	}
+	free(batch->buffer);
+	free(batch->reports);
+	free(batch->reassembler);
+	free(batch->pending);
+	memset(batch, 0, sizeof(hci_report_batch_t));
+}
+
+//------------------------------------------------------------------------------------
+
+/* Static function returning the room to keep in the storage of a batch for the data
+   held by its reassembler : once completed, they are copied after the event bringing
+   their last fragment (which may also bring the whole data of another report).
+*/
+static uint32_t hci_report_batch_reserved(const hci_report_batch_t *batch) {
+	uint32_t reserved = 0;
+	if (!batch->reassembler) {
+		return 0;
+	}
+	for (uint8_t i = 0; i < HCI_REPORT_REASSEMBLY_SLOTS; i++) {
+		if (batch->reassembler->slots[i].used) {
+			reserved += batch->reassembler->slots[i].length;
+		}
+	}
+	return (reserved ? reserved + HCI_MAX_EVENT_SIZE : 0);
+}
+
+//------------------------------------------------------------------------------------
+
+uint8_t *hci_report_batch_next_buffer(hci_report_batch_t *batch) {
+	if (batch->length >= batch->capacity ||
+	    batch->buffer_used + HCI_MAX_EVENT_SIZE > batch->buffer_size) {
+		return NULL;
+	}
+	// An empty batch takes the event anyway, the data which don't fit are truncated then :
+	if (batch->buffer_used &&
+	    batch->buffer_used + HCI_MAX_EVENT_SIZE + hci_report_batch_reserved(batch) > batch->buffer_size) {
+		return NULL;
+	}
+	return batch->buffer + batch->buffer_used;
+}
+
+//------------------------------------------------------------------------------------
+
+/* Static function adding to the batch the reports of an event stored at "packet", from the
+   given iterator. The reassembled data are copied after the event. If the batch fills up,
+   the reports not yet decoded are kept pending (@see hci_report_batch_resume).
+*/
+static uint16_t hci_report_batch_decode(hci_report_batch_t *batch, hci_report_iterator_t *it,
+					uint8_t *packet, uint16_t length, const bt_address_t *mac) {
+	uint16_t added = 0;
+	uint32_t copied = 0; // Reassembled data stored after the event
+	hci_report_t *report = &(batch->reports[batch->length]);
+	while (batch->length < batch->capacity && hci_report_iterator_next(it, report)) {
+		if (mac && !bt_compare_addresses(mac, &(report->mac))) {
+			batch->filtered++;
+			continue;
+		}
+		if (batch->white_list && !hci_white_list_accept(batch->white_list, &(report->mac))) {
+			batch->filtered++;
+			continue;
+		}
+		if (report->extended && batch->reassembler) {
+			const uint8_t *fragment = report->data;
+			uint16_t fragment_length = report->data_length;
+			if (!hci_report_reassemble(batch->reassembler, report)) {
+				continue;
+			}
+			if (batch->dedup && !hci_dedup_accept(batch->dedup, report)) {
+				batch->filtered++;
+				continue;
+			}
+			if (report->data && report->data != fragment) { // Stored by the reassembler
+				uint8_t *copy = packet + length + copied;
+				if (copy + report->data_length <= batch->buffer + batch->buffer_size) {
+					memcpy(copy, report->data, report->data_length);
+					report->data = copy;
+					copied += report->data_length;
+				} else {
+					batch->truncated++;
+					report->data = fragment;
+					report->data_length = fragment_length;
+					report->data_status = HCI_REPORT_DATA_TRUNCATED;
+				}
+			}
+		} else if (batch->dedup && !hci_dedup_accept(batch->dedup, report)) {
+			batch->filtered++;
+			continue;
+		}
+		batch->length++;
+		added++;
+		report = &(batch->reports[batch->length]);
+	}
+
+	if (it->remaining) {
+		if (batch->pending_length) { // Only if the pending reports weren't resumed
+			batch->overflowed += batch->pending_it.remaining;
+		}
+		// The end of the event is moved out of the storage, which is reused by the next collection :
+		batch->pending_length = it->end - it->cursor;
+		memmove(batch->pending, it->cursor, batch->pending_length);
+		batch->pending_it = *it;
+		batch->pending_it.cursor = batch->pending;
+		batch->pending_it.end = batch->pending + batch->pending_length;
+	}
+
+	if (added) {
+		batch->buffer_used += length + copied;
+	}
+
+	return added;
+}
+
+//------------------------------------------------------------------------------------
+
+uint16_t hci_report_batch_commit(hci_report_batch_t *batch, uint16_t length,
+				 const struct timespec *timestamp, const bt_address_t *mac) {
+
+	uint8_t *packet = hci_report_batch_next_buffer(batch);
+	if (!packet) {
+		return 0;
+	}
+
+	hci_report_iterator_t it;
+	if (hci_report_iterator_init(&it, packet, length, timestamp) <= 0) {
+		return 0;
+	}
+
+	return hci_report_batch_decode(batch, &it, packet, length, mac);
+}
+
+//------------------------------------------------------------------------------------
+
+uint16_t hci_report_batch_resume(hci_report_batch_t *batch, const bt_address_t *mac) {
+
+	uint8_t *packet = hci_report_batch_next_buffer(batch);
+	if (!batch->pending_length || !packet) {
+		return 0;
+	}
+
+	// The pending reports are decoded from the storage, as the ones of a new event :
+	hci_report_iterator_t it = batch->pending_it;
+	uint16_t length = batch->pending_length;
+	memcpy(packet, batch->pending, length);
+	it.cursor = packet;
+	it.end = packet + length;
+	batch->pending_length = 0;
+
+	return hci_report_batch_decode(batch, &it, packet, length, mac);
+}
+
+//------------------------------------------------------------------------------------
+
+uint16_t hci_report_batch_add(hci_report_batch_t *batch, const hci_report_t *report) {
+
+	uint8_t *storage = hci_report_batch_next_buffer(batch);
+	if (!storage) {
+		return 0;
+	}
+
+	if (batch->white_list && !hci_white_list_accept(batch->white_list, &(report->mac))) {
+		batch->filtered++;
+		return 0;
+	}
+	if (batch->dedup && !hci_dedup_accept(batch->dedup, report)) {
+		batch->filtered++;
+		return 0;
+	}
+
+	hci_report_t *copy = &(batch->reports[batch->length]);
+	*copy = *report;
+	if (report->data && report->data_length) {
+		if (copy->data_length > HCI_MAX_EVENT_SIZE) {
+			copy->data_length = HCI_MAX_EVENT_SIZE;
+			copy->data_status = HCI_REPORT_DATA_TRUNCATED;
+		}
+		memcpy(storage, report->data, copy->data_length);
+		copy->data = storage;
+		batch->buffer_used += copy->data_length;
+	} else {
+		copy->data = NULL;
+		copy->data_length = 0;
+	}
+	batch->length++;
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------------
+
+char *hci_report_batch_to_string(const hci_report_batch_t *batch) {
+
+	char *res = malloc(batch->length * HCI_REPORT_RSSI_STRING_LENGTH + 1);
+	if (!res) {
+		return NULL;
+	}
+
+	char *cursor = res;
+	for (uint16_t i = 0; i < batch->length; i++) {
+		cursor += sprintf(cursor, "%i;", batch->reports[i].rssi);
+	}
+	*cursor = '\0';
+
+	return res;
+}
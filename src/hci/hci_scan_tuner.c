@@ -0,0 +1,303 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_scan_tuner.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline char hci_scan_tuner_is_scan_response(const hci_report_t *report) {
+	return report->extended ? ((report->evt_type & 0x08) != 0) : (report->evt_type == 0x04);
+}
+
+//---------------------------------
+
+/* Static function looking for a tracked device. Returns its index if it is tracked,
+   otherwise -(index at which it would be inserted) - 1.
+*/
+static int32_t hci_scan_tuner_find(const hci_scan_tuner_t *tuner, const bt_address_t *mac) {
+	int32_t low = 0;
+	int32_t high = (int32_t)tuner->nb_devices - 1;
+	while (low <= high) {
+		int32_t mid = (low + high) / 2;
+		int res = memcmp(&(tuner->devices[mid].mac), mac, sizeof(bt_address_t));
+		if (!res) {
+			return mid;
+		}
+		if (res < 0) {
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return -low - 1;
+}
+
+//---------------------------------
+
+/* Static function inserting a device at the given position of the sorted table.
+*/
+static hci_scan_tuner_device_t *hci_scan_tuner_insert(hci_scan_tuner_t *tuner, int32_t position,
+						      const bt_address_t *mac) {
+	hci_scan_tuner_device_t *device = &(tuner->devices[position]);
+	memmove(device + 1, device, (tuner->nb_devices - position) * sizeof(hci_scan_tuner_device_t));
+	memset(device, 0, sizeof(hci_scan_tuner_device_t));
+	device->mac = *mac;
+	tuner->nb_devices++;
+	return device;
+}
+
+//---------------------------------
+
+/* Static function starting a new window from the given time.
+*/
+static void hci_scan_tuner_reset(hci_scan_tuner_t *tuner, const struct timespec *now) {
+	for (uint16_t i = 0; i < tuner->nb_devices; i++) {
+		memset(tuner->devices[i].reports, 0, sizeof(tuner->devices[i].reports));
+		memset(tuner->devices[i].scan_responses, 0, sizeof(tuner->devices[i].scan_responses));
+	}
+	tuner->slot = 0;
+	tuner->slot_start = *now;
+	tuner->completed = 0;
+}
+
+//---------------------------------
+
+/* Static function closing the slots elapsed at the given time. Returns the number of
+   closed slots. If the tuner wasn't fed during a whole window, the window is restarted.
+*/
+static uint16_t hci_scan_tuner_advance(hci_scan_tuner_t *tuner, const struct timespec *now) {
+	int64_t elapsed = (now->tv_sec - tuner->slot_start.tv_sec) * 1000LL +
+		(now->tv_nsec - tuner->slot_start.tv_nsec) / 1000000LL;
+	if (elapsed >= (int64_t)tuner->slot_duration * (HCI_SCAN_TUNER_SLOTS + 1)) {
+		hci_scan_tuner_reset(tuner, now);
+		return 0;
+	}
+
+	uint16_t closed = 0;
+	while (elapsed >= tuner->slot_duration) {
+		tuner->slot = (tuner->slot + 1) % (HCI_SCAN_TUNER_SLOTS + 1);
+		for (uint16_t i = 0; i < tuner->nb_devices; i++) {
+			tuner->devices[i].reports[tuner->slot] = 0;
+			tuner->devices[i].scan_responses[tuner->slot] = 0;
+		}
+		tuner->slot_start.tv_sec += tuner->slot_duration / 1000;
+		tuner->slot_start.tv_nsec += (tuner->slot_duration % 1000) * 1000000L;
+		if (tuner->slot_start.tv_nsec >= 1000000000L) {
+			tuner->slot_start.tv_sec++;
+			tuner->slot_start.tv_nsec -= 1000000000L;
+		}
+		if (tuner->completed < HCI_SCAN_TUNER_SLOTS) {
+			tuner->completed++;
+		}
+		elapsed -= tuner->slot_duration;
+		closed++;
+	}
+	return closed;
+}
+
+//---------------------------------
+
+/* Static function computing the measures of the last complete window.
+*/
+static void hci_scan_tuner_measure(hci_scan_tuner_t *tuner) {
+	hci_scan_tuner_stats_t *stats = &(tuner->stats);
+	float window = HCI_SCAN_TUNER_SLOTS * tuner->slot_duration / 1000.0f;
+	uint32_t missed = 0;
+	float sum = 0;
+
+	stats->in_range = 0;
+	stats->min_rate = 0;
+	stats->min_passive_rate = 0;
+	for (uint16_t i = 0; i < tuner->nb_devices; i++) {
+		const hci_scan_tuner_device_t *device = &(tuner->devices[i]);
+		uint32_t reports = 0;
+		uint32_t scan_responses = 0;
+		uint8_t device_missed = 0;
+		for (uint8_t slot = 0; slot <= HCI_SCAN_TUNER_SLOTS; slot++) {
+			if (slot == tuner->slot) { // In progress
+				continue;
+			}
+			reports += device->reports[slot];
+			scan_responses += device->scan_responses[slot];
+			device_missed += !device->reports[slot];
+		}
+		if (!reports) { // Out of range
+			continue;
+		}
+
+		float rate = reports / window;
+		float passive_rate = (reports - scan_responses) / window;
+		if (!stats->in_range || rate < stats->min_rate) {
+			stats->min_rate = rate;
+		}
+		if (!stats->in_range || passive_rate < stats->min_passive_rate) {
+			stats->min_passive_rate = passive_rate;
+		}
+		sum += rate;
+		missed += device_missed;
+		stats->in_range++;
+	}
+
+	stats->mean_rate = stats->in_range ? sum / stats->in_range : 0;
+	stats->missed = stats->in_range ? (float)missed / (stats->in_range * HCI_SCAN_TUNER_SLOTS) : 0;
+}
+
+//---------------------------------
+
+/* Static function choosing the parameters to use after a complete window, returning 1
+   if they differ from the current ones.
+*/
+static char hci_scan_tuner_decide(const hci_scan_tuner_t *tuner, uint8_t *scan_type, uint16_t *scan_interval) {
+	const hci_scan_tuner_stats_t *stats = &(tuner->stats);
+	const hci_scan_session_t *session = tuner->session;
+	*scan_type = session->scan_type;
+	*scan_interval = session->scan_interval;
+
+	if (!stats->in_range) {
+		return 0;
+	}
+
+	if (stats->min_rate < tuner->target_rate || stats->missed > HCI_SCAN_TUNER_MAX_MISSED) {
+		if (session->scan_interval > session->scan_window) {
+			*scan_interval = session->scan_interval / 2;
+			if (*scan_interval < session->scan_window) {
+				*scan_interval = session->scan_window;
+			}
+		} else if (session->scan_type == 0x00) {
+			*scan_type = 0x01; // Continuous scan : we also ask for the scan responses
+		} else {
+			return 0; // Nothing more can be done
+		}
+	} else if (session->scan_type == 0x01 &&
+		   stats->min_passive_rate >= HCI_SCAN_TUNER_MARGIN * tuner->target_rate) {
+		*scan_type = 0x00;
+	} else if (2 * (uint32_t)session->scan_interval <= HCI_SCAN_TUNER_MAX_INTERVAL &&
+		   stats->min_rate / 2 >= HCI_SCAN_TUNER_MARGIN * tuner->target_rate &&
+		   2 * stats->missed <= HCI_SCAN_TUNER_MAX_MISSED) {
+		*scan_interval = 2 * session->scan_interval;
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+/*-------------------
+  - TUNER FUNCTIONS -
+  -------------------*/
+
+int8_t hci_scan_tuner_init(hci_scan_tuner_t *tuner, hci_scan_session_t *session,
+			   float target_rate, uint16_t slot_duration) {
+	if (!tuner) {
+		print_trace(TRACE_ERROR, "hci_scan_tuner_init : invalid tuner reference.\n");
+		return -1;
+	}
+	if (!session || !session->active) {
+		print_trace(TRACE_ERROR, "hci_scan_tuner_init : inactive scan session.\n");
+		return -1;
+	}
+	if (target_rate <= 0 || !slot_duration) {
+		print_trace(TRACE_ERROR, "hci_scan_tuner_init : invalid target rate or slot duration.\n");
+		return -1;
+	}
+
+	memset(tuner, 0, sizeof(hci_scan_tuner_t));
+	tuner->session = session;
+	tuner->target_rate = target_rate;
+	tuner->slot_duration = slot_duration;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	hci_scan_tuner_reset(tuner, &now);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_scan_tuner_track(hci_scan_tuner_t *tuner, const bt_address_t *mac) {
+	int32_t position = hci_scan_tuner_find(tuner, mac);
+	if (position >= 0) {
+		return 0;
+	}
+	if (tuner->nb_devices == HCI_SCAN_TUNER_MAX_DEVICES) {
+		print_trace(TRACE_WARNING, "hci_scan_tuner_track : too many tracked devices.\n");
+		return -1;
+	}
+	hci_scan_tuner_insert(tuner, -position - 1, mac);
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_scan_tuner_feed(hci_scan_tuner_t *tuner, const hci_report_batch_t *batch) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint16_t closed = hci_scan_tuner_advance(tuner, &now);
+
+	for (uint16_t i = 0; batch && i < batch->length; i++) {
+		const hci_report_t *report = &(batch->reports[i]);
+		hci_scan_tuner_device_t *device;
+		int32_t position = hci_scan_tuner_find(tuner, &(report->mac));
+		if (position >= 0) {
+			device = &(tuner->devices[position]);
+		} else if (tuner->auto_track && tuner->nb_devices < HCI_SCAN_TUNER_MAX_DEVICES) {
+			device = hci_scan_tuner_insert(tuner, -position - 1, &(report->mac));
+		} else {
+			continue;
+		}
+		if (device->reports[tuner->slot] < UINT16_MAX) {
+			device->reports[tuner->slot]++;
+			device->scan_responses[tuner->slot] += hci_scan_tuner_is_scan_response(report);
+		}
+	}
+
+	if (!closed || tuner->completed < HCI_SCAN_TUNER_SLOTS) {
+		return 0;
+	}
+
+	hci_scan_tuner_measure(tuner);
+	uint8_t scan_type;
+	uint16_t scan_interval;
+	if (!hci_scan_tuner_decide(tuner, &scan_type, &scan_interval)) {
+		return 0;
+	}
+
+	print_trace(TRACE_INFO, "hci_scan_tuner_feed : slowest device at %.1f reports/s, scanning %s "
+		    "with an interval of 0x%04X.\n", tuner->stats.min_rate,
+		    scan_type ? "actively" : "passively", scan_interval);
+	int8_t res = hci_LE_scan_session_set_parameters(tuner->session, scan_type, scan_interval,
+							tuner->session->scan_window);
+	// The reports counted so far were received with the previous parameters :
+	hci_scan_tuner_reset(tuner, &now);
+	if (res < 0) {
+		return -1;
+	}
+	tuner->stats.reconfigurations++;
+
+	return 1;
+}
@@ -0,0 +1,1380 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_sim.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Address prefix (3 most significant bytes) of the simulated remote devices, 
+   the 3 others being the index of the device.
+*/
+#define HCI_SIM_DEVICE_PREFIX_0 0xC0
+#define HCI_SIM_DEVICE_PREFIX_1 0x51
+#define HCI_SIM_DEVICE_PREFIX_2 0x0D
+
+/* Status codes returned by the simulator (cf spec vol 2 part D). */
+#define HCI_SIM_SUCCESS 0x00
+#define HCI_SIM_UNKNOWN_COMMAND 0x01
+#define HCI_SIM_UNKNOWN_CONNECTION 0x02
+#define HCI_SIM_PAGE_TIMEOUT 0x04
+#define HCI_SIM_MEMORY_EXCEEDED 0x07
+#define HCI_SIM_CONNECTION_TIMEOUT 0x08
+#define HCI_SIM_CONNECTION_LIMIT 0x09
+#define HCI_SIM_CONNECTION_EXISTS 0x0B
+#define HCI_SIM_COMMAND_DISALLOWED 0x0C
+#define HCI_SIM_INVALID_PARAMETERS 0x12
+#define HCI_SIM_LOCAL_HOST_TERMINATED 0x16
+
+// Highest connection handle (cf spec vol 2 part E 5.4.2) :
+#define HCI_SIM_MAX_HANDLE 0x0EFF
+
+// Size of the fixed part of a report in an LE extended advertising report event :
+#define HCI_SIM_EXT_REPORT_FIXED_SIZE 24
+
+/* Supported commands bitmap of the simulator (cf spec vol 2 part E 6.27) : the commands
+   it answers.
+*/
+static const uint8_t hci_sim_commands[64] = {
+	[0] = 0x2F,  // Inquiry, Inquiry Cancel, Periodic Inquiry Mode, Exit Periodic Inquiry Mode, Disconnect
+	[2] = 0x08,  // Remote Name Request
+	[5] = 0xC0,  // Set Event Mask, Reset
+	[12] = 0x80, // Write Inquiry Mode
+	[14] = 0x88, // Read Local Version Information, Read Buffer Size
+	[15] = 0x20, // Read RSSI
+	[25] = 0x07, // LE Set Event Mask, LE Read Buffer Size, LE Read Local Supported Features
+	[26] = 0xFC, // LE Set Scan Parameters/Enable, LE Create Connection (Cancel), LE Read/Clear White List
+	[27] = 0x07, // LE Add/Remove Device To/From White List, LE Connection Update
+	[28] = 0x08, // LE Read Supported States
+	[37] = 0x60  // LE Set Extended Scan Parameters, LE Set Extended Scan Enable
+};
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+/* Xorshift pseudo-random generator : cheap enough to be called for each report. */
+static inline uint32_t hci_sim_random(hci_sim_t *sim) {
+	uint32_t x = sim->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sim->random = x;
+	return x;
+}
+
+//---------------------------------
+
+/* Returns the index of the simulated device having the given address, -1 if no
+   simulated device has this address.
+*/
+static int64_t hci_sim_device_index(hci_sim_t *sim, const bt_address_t *mac) {
+	if (mac->b[5] != HCI_SIM_DEVICE_PREFIX_0 || mac->b[4] != HCI_SIM_DEVICE_PREFIX_1 ||
+	    mac->b[3] != HCI_SIM_DEVICE_PREFIX_2) {
+		return -1;
+	}
+	uint32_t index = mac->b[0] | (mac->b[1] << 8) | (mac->b[2] << 16);
+	if (index >= sim->config.num_devices) {
+		return -1;
+	}
+	return index;
+}
+
+//---------------------------------
+
+/* Sends an event to every socket accepting it. The simulator's mutex has to be held. */
+static void hci_sim_send_event(hci_sim_t *sim, uint8_t evt, const void *param, uint8_t plen) {
+	uint8_t packet[1 + HCI_EVENT_HDR_SIZE + 255];
+	packet[0] = HCI_EVENT_PKT;
+	packet[1] = evt;
+	packet[2] = plen;
+	if (plen) {
+		memcpy(packet + 1 + HCI_EVENT_HDR_SIZE, param, plen);
+	}
+
+	for (uint8_t i = 0; i < HCI_SIM_MAX_SOCKETS; i++) {
+		hci_transport_pair_t *sim_socket = &(sim->sockets[i]);
+		if (sim_socket->fd < 0 || !hci_transport_filter_event(&(sim_socket->filter), packet)) {
+			continue;
+		}
+		if (send(sim_socket->fd, packet, 1 + HCI_EVENT_HDR_SIZE + plen, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+			sim->stats.dropped_events++;
+			sim_socket->dropped++;
+		} else {
+			sim->stats.events++;
+		}
+	}
+}
+
+//---------------------------------
+
+/* Sends an event answering a command, after the configured command latency. The 
+   simulator's mutex has to be held.
+*/
+static void hci_sim_answer_event(hci_sim_t *sim, uint8_t evt, const void *param, uint8_t plen) {
+	if (!sim->config.command_latency) {
+		hci_sim_send_event(sim, evt, param, plen);
+		return;
+	}
+
+	hci_sim_delayed_event_t *delayed = malloc(sizeof(hci_sim_delayed_event_t));
+	if (!delayed) {
+		sim->stats.dropped_events++;
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &(delayed->due));
+	delayed->due.tv_sec += sim->config.command_latency / 1000000;
+	delayed->due.tv_nsec += (sim->config.command_latency % 1000000) * 1000L;
+	if (delayed->due.tv_nsec >= 1000000000L) {
+		delayed->due.tv_sec++;
+		delayed->due.tv_nsec -= 1000000000L;
+	}
+	delayed->evt = evt;
+	delayed->plen = plen;
+	memcpy(delayed->param, param, plen);
+	delayed->next = NULL;
+
+	if (sim->delayed_tail) {
+		sim->delayed_tail->next = delayed;
+	} else {
+		sim->delayed_head = delayed;
+	}
+	sim->delayed_tail = delayed;
+}
+
+//---------------------------------
+
+/* Delivers the answers whose due time has passed. The simulator's mutex has to be held. */
+static void hci_sim_deliver_answers(hci_sim_t *sim, const struct timespec *now) {
+	while (sim->delayed_head && (sim->delayed_head->due.tv_sec < now->tv_sec ||
+				     (sim->delayed_head->due.tv_sec == now->tv_sec &&
+				      sim->delayed_head->due.tv_nsec <= now->tv_nsec))) {
+		hci_sim_delayed_event_t *delayed = sim->delayed_head;
+		sim->delayed_head = delayed->next;
+		if (!sim->delayed_head) {
+			sim->delayed_tail = NULL;
+		}
+		hci_sim_send_event(sim, delayed->evt, delayed->param, delayed->plen);
+		free(delayed);
+	}
+}
+
+//---------------------------------
+
+static void hci_sim_cmd_complete(hci_sim_t *sim, uint16_t opcode, const void *rparam, uint8_t rlen) {
+	uint8_t param[EVT_CMD_COMPLETE_SIZE + 252];
+	evt_cmd_complete *cc = (void *)param;
+	cc->ncmd = sim->config.command_credits;
+	cc->opcode = htobs(opcode);
+	memcpy(param + EVT_CMD_COMPLETE_SIZE, rparam, rlen);
+	hci_sim_answer_event(sim, EVT_CMD_COMPLETE, param, EVT_CMD_COMPLETE_SIZE + rlen);
+}
+
+//---------------------------------
+
+static void hci_sim_cmd_status(hci_sim_t *sim, uint16_t opcode, uint8_t status) {
+	evt_cmd_status cs;
+	cs.status = status;
+	cs.ncmd = sim->config.command_credits;
+	cs.opcode = htobs(opcode);
+	hci_sim_answer_event(sim, EVT_CMD_STATUS, &cs, EVT_CMD_STATUS_SIZE);
+}
+
+//---------------------------------
+
+/* Writes the advertising data of the given device. */
+static void hci_sim_write_data(uint32_t index, uint8_t *data, uint16_t data_length) {
+	memset(data, 0, data_length);
+	if (data_length >= 3) { // Flags : LE General Discoverable, BR/EDR not supported
+		data[0] = 0x02; data[1] = 0x01; data[2] = 0x06;
+	}
+	/* Manufacturer specific data carrying the index of the device (an AD structure
+	   is at most 255 bytes long, the following ones are filled the same way).
+	*/
+	for (uint16_t start = 3; start + 4 <= data_length; start += 256) {
+		uint16_t length = data_length - start - 1;
+		data[start] = (length > 255 ? 255 : length);
+		data[start + 1] = 0xFF; data[start + 2] = 0xFF; data[start + 3] = 0xFF;
+		for (uint16_t i = start + 4; i < data_length && i < start + 256; i++) {
+			data[i] = (index >> (8 * ((i - start - 4) % 4))) & 0xFF;
+		}
+	}
+}
+
+//---------------------------------
+
+/* Returns the RSSI of a report of the given device : each device has its own
+   mean RSSI with a small jitter around it.
+*/
+static int8_t hci_sim_device_rssi(hci_sim_t *sim, uint32_t index) {
+	int16_t range = sim->config.rssi_max - sim->config.rssi_min + 1;
+	int16_t rssi = sim->config.rssi_min + (int16_t)((index * 2654435761u) % range);
+	rssi += (int16_t)(hci_sim_random(sim) % 7) - 3;
+	if (rssi < sim->config.rssi_min) {
+		rssi = sim->config.rssi_min;
+	} else if (rssi > sim->config.rssi_max) {
+		rssi = sim->config.rssi_max;
+	}
+	return (int8_t)rssi;
+}
+
+//---------------------------------
+
+/* Writes the advertising report of the given device at the given position and returns
+   the length of the written report.
+*/
+static uint8_t hci_sim_write_report(hci_sim_t *sim, uint32_t index, uint8_t *ptr) {
+	bt_address_t mac = hci_sim_device_address(sim, index);
+	uint8_t data_length = sim->config.data_length;
+
+	ptr[0] = (sim->scan_type == 0x01 && (index & 0x01)) ? 0x04 : 0x00; // SCAN_RSP or ADV_IND
+	ptr[1] = LE_PUBLIC_ADDRESS;
+	memcpy(ptr + 2, &mac, sizeof(bt_address_t));
+	ptr[8] = data_length;
+	hci_sim_write_data(index, ptr + 9, data_length);
+	ptr[9 + data_length] = (uint8_t)hci_sim_device_rssi(sim, index);
+
+	return LE_ADVERTISING_INFO_SIZE + data_length + 1;
+}
+
+//---------------------------------
+
+/* Chooses the next device to advertise, taking the white list into account.
+   Returns -1 if no device can be reported.
+*/
+static int64_t hci_sim_next_device(hci_sim_t *sim) {
+	if (sim->scan_filter_policy & 0x01) {
+		for (uint8_t i = 0; i < sim->white_list_length; i++) {
+			hci_sim_white_list_entry_t *entry = &(sim->white_list[(sim->next_device++) % sim->white_list_length]);
+			int64_t index = hci_sim_device_index(sim, &(entry->mac));
+			if (index >= 0) {
+				return index;
+			}
+		}
+		return -1;
+	}
+
+	if (!sim->config.num_devices) {
+		return -1;
+	}
+	return (sim->next_device++) % sim->config.num_devices;
+}
+
+//---------------------------------
+
+/* Sends an LE advertising report event containing up to "max" reports and returns
+   the number of generated reports. The simulator's mutex has to be held.
+*/
+static uint8_t hci_sim_advertise(hci_sim_t *sim, uint8_t max) {
+	uint8_t param[255];
+	uint8_t length = 2;
+	uint8_t num_reports = 0;
+	
+	param[0] = EVT_LE_ADVERTISING_REPORT;
+	while (num_reports < max) {
+		int64_t index = hci_sim_next_device(sim);
+		if (index < 0) {
+			break;
+		}
+		length += hci_sim_write_report(sim, index, param + length);
+		num_reports++;
+	}
+
+	if (num_reports) {
+		param[1] = num_reports;
+		sim->stats.reports += num_reports;
+		hci_sim_send_event(sim, EVT_LE_META_EVENT, param, length);
+	}
+
+	return num_reports;
+}
+
+//---------------------------------
+
+/* Sends LE extended advertising report events for up to "max" devices and returns the
+   number of advertising devices. The data of a device is split over several reports
+   (in several events) when it doesn't fit in one. With the Coded PHY enabled, the odd
+   devices are received on it. The simulator's mutex has to be held.
+*/
+static uint8_t hci_sim_advertise_extended(hci_sim_t *sim, uint8_t max) {
+	uint8_t param[255];
+	uint8_t data[HCI_REPORT_EXT_MAX_DATA];
+	uint8_t length = 2;
+	uint8_t num_reports = 0;
+	uint8_t num_devices = 0;
+	uint16_t data_length = (sim->config.extended_data_length ? sim->config.extended_data_length :
+				sim->config.data_length);
+	const uint8_t max_fragment = sizeof(param) - 2 - HCI_SIM_EXT_REPORT_FIXED_SIZE;
+
+	param[0] = EVT_LE_EXT_ADVERTISING_REPORT;
+	while (num_devices < max) {
+		int64_t index = hci_sim_next_device(sim);
+		if (index < 0) {
+			break;
+		}
+		bt_address_t mac = hci_sim_device_address(sim, index);
+		int8_t rssi = hci_sim_device_rssi(sim, index);
+		uint8_t phy = 0x01; // LE 1M
+		if ((sim->scan_phys & HCI_LE_SCAN_PHY_CODED) &&
+		    (!(sim->scan_phys & HCI_LE_SCAN_PHY_1M) || (index & 0x01))) {
+			phy = 0x03; // LE Coded
+		}
+		hci_sim_write_data(index, data, data_length);
+
+		uint16_t offset = 0;
+		do {
+			uint16_t fragment = data_length - offset;
+			if (fragment > max_fragment) {
+				fragment = max_fragment;
+			}
+			if (length + HCI_SIM_EXT_REPORT_FIXED_SIZE + fragment > sizeof(param)) {
+				param[1] = num_reports;
+				hci_sim_send_event(sim, EVT_LE_META_EVENT, param, length);
+				length = 2;
+				num_reports = 0;
+			}
+			uint8_t *ptr = param + length;
+			memset(ptr, 0, HCI_SIM_EXT_REPORT_FIXED_SIZE);
+			uint8_t status = (offset + fragment < data_length ? HCI_REPORT_DATA_INCOMPLETE :
+					  HCI_REPORT_DATA_COMPLETE);
+			ptr[0] = 0x01 | (status << 5); // Connectable, non legacy
+			ptr[2] = LE_PUBLIC_ADDRESS;
+			memcpy(ptr + 3, &mac, sizeof(bt_address_t));
+			ptr[9] = phy;
+			ptr[10] = 0x00; // No secondary PHY
+			ptr[11] = (uint8_t)(index & 0x0F); // SID
+			ptr[12] = (uint8_t)HCI_REPORT_TX_POWER_UNAVAILABLE;
+			ptr[13] = (uint8_t)rssi;
+			ptr[16] = LE_PUBLIC_ADDRESS;
+			ptr[HCI_SIM_EXT_REPORT_FIXED_SIZE - 1] = fragment;
+			memcpy(ptr + HCI_SIM_EXT_REPORT_FIXED_SIZE, data + offset, fragment);
+			length += HCI_SIM_EXT_REPORT_FIXED_SIZE + fragment;
+			num_reports++;
+			offset += fragment;
+		} while (offset < data_length);
+		num_devices++;
+	}
+
+	if (num_reports) {
+		param[1] = num_reports;
+		hci_sim_send_event(sim, EVT_LE_META_EVENT, param, length);
+	}
+	sim->stats.reports += num_devices;
+
+	return num_devices;
+}
+
+//---------------------------------
+
+/* Answers an inquiry : every simulated device (up to "max_rsp") responds at once. */
+static void hci_sim_inquiry_results(hci_sim_t *sim, uint8_t max_rsp) {
+	uint32_t num_rsp = sim->config.num_devices;
+	if (max_rsp && max_rsp < num_rsp) {
+		num_rsp = max_rsp;
+	}
+
+	for (uint32_t i = 0; i < num_rsp; i++) {
+		uint8_t param[1 + sizeof(extended_inquiry_info)];
+		bt_address_t mac = hci_sim_device_address(sim, i);
+		param[0] = 1;
+		if (sim->inquiry_mode == 0x02) { // The extended inquiry response holds the device's name
+			extended_inquiry_info *info = (void *)(param + 1);
+			memset(info, 0, sizeof(*info));
+			bacpy(&(info->bdaddr), &mac);
+			info->pscan_rep_mode = 0x01;
+			info->rssi = sim->config.rssi_min + (int8_t)((i * 2654435761u) %
+								     (sim->config.rssi_max - sim->config.rssi_min + 1));
+			int length = snprintf((char *)info->data + 2, sizeof(info->data) - 2, "SIM-%06u", i);
+			info->data[0] = (uint8_t)(length + 1);
+			info->data[1] = 0x09; // Complete Local Name
+			hci_sim_answer_event(sim, EVT_EXTENDED_INQUIRY_RESULT, param, 1 + EXTENDED_INQUIRY_INFO_SIZE);
+		} else if (sim->inquiry_mode) {
+			inquiry_info_with_rssi *info = (void *)(param + 1);
+			memset(info, 0, sizeof(*info));
+			bacpy(&(info->bdaddr), &mac);
+			info->pscan_rep_mode = 0x01;
+			info->rssi = sim->config.rssi_min + (int8_t)((i * 2654435761u) % 
+								     (sim->config.rssi_max - sim->config.rssi_min + 1));
+			hci_sim_answer_event(sim, EVT_INQUIRY_RESULT_WITH_RSSI, param, 1 + sizeof(*info));
+		} else {
+			inquiry_info *info = (void *)(param + 1);
+			memset(info, 0, sizeof(*info));
+			bacpy(&(info->bdaddr), &mac);
+			info->pscan_rep_mode = 0x01;
+			hci_sim_answer_event(sim, EVT_INQUIRY_RESULT, param, 1 + INQUIRY_INFO_SIZE);
+		}
+	}
+
+	uint8_t status = HCI_SIM_SUCCESS;
+	hci_sim_answer_event(sim, EVT_INQUIRY_COMPLETE, &status, 1);
+}
+
+//---------------------------------
+
+/* Starts the next inquiry of the periodic inquiry mode once its time has come. The
+   simulator's mutex has to be held.
+*/
+static void hci_sim_periodic_inquiry(hci_sim_t *sim, const struct timespec *now) {
+	if (!sim->periodic_inquiry || now->tv_sec < sim->periodic_next.tv_sec ||
+	    (now->tv_sec == sim->periodic_next.tv_sec && now->tv_nsec < sim->periodic_next.tv_nsec)) {
+		return;
+	}
+	hci_sim_inquiry_results(sim, sim->periodic_num_rsp);
+	sim->periodic_next = *now;
+	sim->periodic_next.tv_sec += sim->periodic_period / 1000;
+	sim->periodic_next.tv_nsec += (sim->periodic_period % 1000) * 1000000L;
+	if (sim->periodic_next.tv_nsec >= 1000000000L) {
+		sim->periodic_next.tv_sec++;
+		sim->periodic_next.tv_nsec -= 1000000000L;
+	}
+}
+
+//---------------------------------
+
+/* Returns the established connection having the given handle, or the one established with
+   the given device if the handle is negative. NULL if there isn't any.
+*/
+static hci_sim_connection_t *hci_sim_get_connection(hci_sim_t *sim, int32_t handle, int64_t index) {
+	for (uint8_t i = 0; i < HCI_SIM_MAX_CONNECTIONS; i++) {
+		hci_sim_connection_t *conn = &(sim->connections[i]);
+		if (conn->used && (handle >= 0 ? conn->handle == handle : conn->index == index)) {
+			return conn;
+		}
+	}
+	return NULL;
+}
+
+//---------------------------------
+
+/* Sends an "LE Connection Complete" event (the connection is NULL for a failure). */
+static void hci_sim_connection_complete(hci_sim_t *sim, uint8_t status, const hci_sim_connection_t *conn,
+					const bt_address_t *mac, uint8_t add_type) {
+	uint8_t param[EVT_LE_META_EVENT_SIZE + EVT_LE_CONN_COMPLETE_SIZE];
+	evt_le_connection_complete *cc = (void *)(param + EVT_LE_META_EVENT_SIZE);
+	memset(param, 0, sizeof(param));
+	param[0] = EVT_LE_CONN_COMPLETE;
+	cc->status = status;
+	cc->role = 0x00; // Master
+	cc->peer_bdaddr_type = add_type;
+	bacpy(&(cc->peer_bdaddr), mac);
+	if (conn) {
+		cc->handle = htobs(conn->handle);
+		cc->interval = htobs(conn->interval);
+		cc->latency = htobs(conn->latency);
+		cc->supervision_timeout = htobs(conn->supervision_timeout);
+	}
+	hci_sim_answer_event(sim, EVT_LE_META_EVENT, param, sizeof(param));
+}
+
+//---------------------------------
+
+/* Establishes a connection with the given device (which is advertising all the time). */
+static void hci_sim_connect(hci_sim_t *sim, uint32_t index, const le_create_connection_cp *cp) {
+	hci_sim_connection_t *conn = NULL;
+	for (uint8_t i = 0; i < HCI_SIM_MAX_CONNECTIONS && !conn; i++) {
+		if (!sim->connections[i].used) {
+			conn = &(sim->connections[i]);
+		}
+	}
+	if (!conn) {
+		hci_sim_connection_complete(sim, HCI_SIM_CONNECTION_LIMIT, NULL, &(cp->peer_bdaddr),
+					    cp->peer_bdaddr_type);
+		return;
+	}
+
+	conn->used = 1;
+	conn->index = index;
+	conn->handle = sim->next_handle;
+	sim->next_handle = (sim->next_handle + 1) % (HCI_SIM_MAX_HANDLE + 1);
+	conn->interval = btohs(cp->max_interval);
+	conn->latency = btohs(cp->latency);
+	conn->supervision_timeout = btohs(cp->supervision_timeout);
+	sim->stats.connections++;
+	hci_sim_connection_complete(sim, HCI_SIM_SUCCESS, conn, &(cp->peer_bdaddr), cp->peer_bdaddr_type);
+}
+
+//---------------------------------
+
+/* Terminates a connection with the given reason. The event is delayed as an answer if
+   the host asked for the disconnection.
+*/
+static void hci_sim_terminate(hci_sim_t *sim, hci_sim_connection_t *conn, uint8_t reason, char answer) {
+	evt_disconn_complete dc;
+	dc.status = HCI_SIM_SUCCESS;
+	dc.handle = htobs(conn->handle);
+	dc.reason = reason;
+	conn->used = 0;
+	sim->stats.disconnections++;
+	if (answer) {
+		hci_sim_answer_event(sim, EVT_DISCONN_COMPLETE, &dc, EVT_DISCONN_COMPLETE_SIZE);
+	} else {
+		hci_sim_send_event(sim, EVT_DISCONN_COMPLETE, &dc, EVT_DISCONN_COMPLETE_SIZE);
+	}
+}
+
+//---------------------------------
+
+/* Brings the adapter back to its initial configuration (HCI reset or restart). The
+   simulator's mutex has to be held.
+*/
+static void hci_sim_reset(hci_sim_t *sim) {
+	sim->scan_enabled = 0;
+	sim->scan_extended = 0;
+	sim->scan_phys = 0;
+	sim->scan_filter_policy = 0;
+	sim->white_list_length = 0;
+	sim->inquiry_mode = 0;
+	sim->periodic_inquiry = 0;
+	// The connections are dropped without any event, as with a real reset :
+	memset(sim->connections, 0, sizeof(sim->connections));
+	sim->connecting = 0;
+	sim->fault = HCI_SIM_FAULT_NONE;
+}
+
+//---------------------------------
+
+/* Processes a command as a real controller would. The simulator's mutex has to be held. */
+static void hci_sim_process_cmd(hci_sim_t *sim, uint16_t ogf, uint16_t ocf, uint8_t plen, const uint8_t *param) {
+	uint16_t opcode = cmd_opcode_pack(ogf, ocf);
+	uint8_t rparam[1 + 64];
+	memset(rparam, 0, sizeof(rparam));
+	sim->stats.commands++;
+
+	// A faulty adapter doesn't answer, except an unresponsive one to the resets :
+	if (sim->fault == HCI_SIM_FAULT_HUNG ||
+	    (sim->fault == HCI_SIM_FAULT_UNRESPONSIVE && opcode != cmd_opcode_pack(OGF_HOST_CTL, OCF_RESET))) {
+		return;
+	}
+
+	switch (opcode) {
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_PARAMETERS): {
+		const le_set_scan_parameters_cp *cp = (const void *)param;
+		if (plen < LE_SET_SCAN_PARAMETERS_CP_SIZE) {
+			rparam[0] = HCI_SIM_INVALID_PARAMETERS;
+		} else if (sim->scan_enabled) {
+			rparam[0] = HCI_SIM_COMMAND_DISALLOWED;
+		} else {
+			sim->scan_type = cp->type;
+			sim->scan_interval = btohs(cp->interval);
+			sim->scan_window = btohs(cp->window);
+			sim->scan_filter_policy = cp->filter;
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE): {
+		const le_set_scan_enable_cp *cp = (const void *)param;
+		if (plen < LE_SET_SCAN_ENABLE_CP_SIZE) {
+			rparam[0] = HCI_SIM_INVALID_PARAMETERS;
+		} else {
+			if (cp->enable && !sim->scan_enabled) {
+				clock_gettime(CLOCK_MONOTONIC, &(sim->scan_start));
+				sim->scan_reports = 0;
+			}
+			sim->scan_enabled = cp->enable ? 1 : 0;
+			sim->scan_extended = 0;
+			if (!cp->enable && sim->fault == HCI_SIM_FAULT_SCAN_STALLED) {
+				sim->fault = HCI_SIM_FAULT_NONE;
+			}
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_EXT_SCAN_PARAMETERS): {
+		const hci_le_ext_scan_parameters_cp *cp = (const void *)param;
+		uint8_t num_phys = 0;
+		if (plen >= HCI_LE_EXT_SCAN_PARAMETERS_CP_SIZE) {
+			num_phys = ((cp->phys & HCI_LE_SCAN_PHY_1M) ? 1 : 0) + ((cp->phys & HCI_LE_SCAN_PHY_CODED) ? 1 : 0);
+		}
+		if (!num_phys || (cp->phys & ~(HCI_LE_SCAN_PHY_1M | HCI_LE_SCAN_PHY_CODED)) ||
+		    plen < HCI_LE_EXT_SCAN_PARAMETERS_CP_SIZE + num_phys * HCI_LE_EXT_SCAN_PHY_CP_SIZE) {
+			rparam[0] = HCI_SIM_INVALID_PARAMETERS;
+		} else if (sim->scan_enabled) {
+			rparam[0] = HCI_SIM_COMMAND_DISALLOWED;
+		} else {
+			const hci_le_ext_scan_phy_cp *phy_cp = (const void *)(param + HCI_LE_EXT_SCAN_PARAMETERS_CP_SIZE);
+			sim->scan_type = phy_cp->type;
+			sim->scan_interval = btohs(phy_cp->interval);
+			sim->scan_window = btohs(phy_cp->window);
+			sim->scan_filter_policy = cp->filter;
+			sim->scan_phys = cp->phys;
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_EXT_SCAN_ENABLE): {
+		const hci_le_ext_scan_enable_cp *cp = (const void *)param;
+		if (plen < HCI_LE_EXT_SCAN_ENABLE_CP_SIZE) {
+			rparam[0] = HCI_SIM_INVALID_PARAMETERS;
+		} else if (cp->enable && !sim->scan_phys) { // Parameters never set
+			rparam[0] = HCI_SIM_COMMAND_DISALLOWED;
+		} else {
+			if (cp->enable && !sim->scan_enabled) {
+				clock_gettime(CLOCK_MONOTONIC, &(sim->scan_start));
+				sim->scan_reports = 0;
+			}
+			sim->scan_enabled = cp->enable ? 1 : 0;
+			sim->scan_extended = sim->scan_enabled;
+			if (!cp->enable && sim->fault == HCI_SIM_FAULT_SCAN_STALLED) {
+				sim->fault = HCI_SIM_FAULT_NONE;
+			}
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CLEAR_WHITE_LIST):
+		if (sim->scan_enabled && (sim->scan_filter_policy & 0x01)) {
+			rparam[0] = HCI_SIM_COMMAND_DISALLOWED;
+		} else {
+			sim->white_list_length = 0;
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_ADD_DEVICE_TO_WHITE_LIST):
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_REMOVE_DEVICE_FROM_WHITE_LIST): {
+		const le_add_device_to_white_list_cp *cp = (const void *)param;
+		int16_t found = -1;
+		if (plen < LE_ADD_DEVICE_TO_WHITE_LIST_CP_SIZE) {
+			rparam[0] = HCI_SIM_INVALID_PARAMETERS;
+			hci_sim_cmd_complete(sim, opcode, rparam, 1);
+			break;
+		}
+		if (sim->scan_enabled && (sim->scan_filter_policy & 0x01)) {
+			rparam[0] = HCI_SIM_COMMAND_DISALLOWED;
+			hci_sim_cmd_complete(sim, opcode, rparam, 1);
+			break;
+		}
+		for (uint8_t i = 0; i < sim->white_list_length; i++) {
+			if (!bacmp(&(sim->white_list[i].mac), &(cp->bdaddr)) &&
+			    sim->white_list[i].add_type == cp->bdaddr_type) {
+				found = i;
+				break;
+			}
+		}
+		if (ocf == OCF_LE_ADD_DEVICE_TO_WHITE_LIST) {
+			if (found < 0) {
+				if (sim->white_list_length >= sim->config.white_list_size) {
+					rparam[0] = HCI_SIM_MEMORY_EXCEEDED;
+				} else {
+					bacpy(&(sim->white_list[sim->white_list_length].mac), &(cp->bdaddr));
+					sim->white_list[sim->white_list_length].add_type = cp->bdaddr_type;
+					sim->white_list_length++;
+				}
+			}
+		} else if (found >= 0) {
+			sim->white_list[found] = sim->white_list[--sim->white_list_length];
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_READ_WHITE_LIST_SIZE):
+		rparam[1] = sim->config.white_list_size;
+		hci_sim_cmd_complete(sim, opcode, rparam, 2);
+		break;
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_READ_LOCAL_SUPPORTED_FEATURES):
+		rparam[1] = 0x01; // LE Encryption
+		rparam[2] = 0x18; // LE Coded PHY and LE Extended Advertising
+		hci_sim_cmd_complete(sim, opcode, rparam, 9);
+		break;
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_READ_SUPPORTED_STATES):
+		memset(rparam + 1, 0xFF, 5); // All the states combinations of a 4.0 controller
+		rparam[6] = 0x03;
+		hci_sim_cmd_complete(sim, opcode, rparam, 9);
+		break;
+
+	case cmd_opcode_pack(OGF_HOST_CTL, OCF_WRITE_INQUIRY_MODE):
+		if (plen < WRITE_INQUIRY_MODE_CP_SIZE) {
+			rparam[0] = HCI_SIM_INVALID_PARAMETERS;
+		} else {
+			sim->inquiry_mode = param[0];
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+
+	case cmd_opcode_pack(OGF_HOST_CTL, OCF_RESET):
+		hci_sim_reset(sim);
+		sim->stats.resets++;
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+
+	case cmd_opcode_pack(OGF_HOST_CTL, OCF_SET_EVENT_MASK):
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_EVENT_MASK):
+		if (plen < 8) {
+			rparam[0] = HCI_SIM_INVALID_PARAMETERS;
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+
+	case cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_LOCAL_COMMANDS):
+		memcpy(rparam + 1, hci_sim_commands, sizeof(hci_sim_commands));
+		hci_sim_cmd_complete(sim, opcode, rparam, READ_LOCAL_COMMANDS_RP_SIZE);
+		break;
+
+	case cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_BUFFER_SIZE):
+		rparam[1] = 0xFD; // 1021 bytes ACL packets (little endian)
+		rparam[2] = 0x03;
+		rparam[3] = 0x40; // 64 bytes SCO packets
+		rparam[4] = 0x08; // 8 ACL packets
+		rparam[6] = 0x08; // 8 SCO packets
+		hci_sim_cmd_complete(sim, opcode, rparam, READ_BUFFER_SIZE_RP_SIZE);
+		break;
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_READ_BUFFER_SIZE):
+		rparam[1] = 0xFB; // 251 bytes LE packets
+		rparam[3] = 0x08; // 8 LE packets
+		hci_sim_cmd_complete(sim, opcode, rparam, LE_READ_BUFFER_SIZE_RP_SIZE);
+		break;
+
+	case cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_LOCAL_VERSION):
+		rparam[1] = 0x09; // HCI and LMP versions 5.0
+		rparam[4] = 0x09;
+		rparam[5] = 0xFF; // No manufacturer
+		rparam[6] = 0xFF;
+		hci_sim_cmd_complete(sim, opcode, rparam, 9);
+		break;
+
+	case cmd_opcode_pack(OGF_LINK_CTL, OCF_INQUIRY):
+		if (plen < INQUIRY_CP_SIZE) {
+			hci_sim_cmd_status(sim, opcode, HCI_SIM_INVALID_PARAMETERS);
+			break;
+		}
+		hci_sim_cmd_status(sim, opcode, HCI_SIM_SUCCESS);
+		hci_sim_inquiry_results(sim, ((const inquiry_cp *)param)->num_rsp);
+		break;
+
+	case cmd_opcode_pack(OGF_LINK_CTL, OCF_PERIODIC_INQUIRY): {
+		const periodic_inquiry_cp *cp = (const void *)param;
+		if (plen < PERIODIC_INQUIRY_CP_SIZE || !cp->length || cp->length > 0x30 ||
+		    btohs(cp->min_period) <= cp->length || btohs(cp->max_period) <= btohs(cp->min_period)) {
+			rparam[0] = HCI_SIM_INVALID_PARAMETERS;
+		} else if (sim->periodic_inquiry) {
+			rparam[0] = HCI_SIM_COMMAND_DISALLOWED;
+		} else {
+			sim->periodic_inquiry = 1;
+			sim->periodic_num_rsp = cp->num_rsp;
+			sim->periodic_period = btohs(cp->min_period) * 1280;
+			clock_gettime(CLOCK_MONOTONIC, &(sim->periodic_next)); // The first inquiry starts at once
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_LINK_CTL, OCF_EXIT_PERIODIC_INQUIRY):
+		if (!sim->periodic_inquiry) {
+			rparam[0] = HCI_SIM_COMMAND_DISALLOWED;
+		}
+		sim->periodic_inquiry = 0;
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+
+	case cmd_opcode_pack(OGF_LINK_CTL, OCF_INQUIRY_CANCEL):
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+
+	case cmd_opcode_pack(OGF_LINK_CTL, OCF_REMOTE_NAME_REQ): {
+		const remote_name_req_cp *cp = (const void *)param;
+		evt_remote_name_req_complete rn;
+		if (plen < REMOTE_NAME_REQ_CP_SIZE) {
+			hci_sim_cmd_status(sim, opcode, HCI_SIM_INVALID_PARAMETERS);
+			break;
+		}
+		hci_sim_cmd_status(sim, opcode, HCI_SIM_SUCCESS);
+
+		memset(&rn, 0, sizeof(rn));
+		bacpy(&(rn.bdaddr), &(cp->bdaddr));
+		int64_t index = hci_sim_device_index(sim, &(cp->bdaddr));
+		if (index < 0) {
+			rn.status = HCI_SIM_PAGE_TIMEOUT;
+		} else {
+			snprintf((char *)rn.name, sizeof(rn.name), "SIM-%06u", (uint32_t)index);
+		}
+		hci_sim_answer_event(sim, EVT_REMOTE_NAME_REQ_COMPLETE, &rn, EVT_REMOTE_NAME_REQ_COMPLETE_SIZE);
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CREATE_CONN): {
+		const le_create_connection_cp *cp = (const void *)param;
+		if (plen < LE_CREATE_CONN_CP_SIZE) {
+			hci_sim_cmd_status(sim, opcode, HCI_SIM_INVALID_PARAMETERS);
+			break;
+		}
+		if (sim->connecting) {
+			hci_sim_cmd_status(sim, opcode, HCI_SIM_COMMAND_DISALLOWED);
+			break;
+		}
+		int64_t index = hci_sim_device_index(sim, &(cp->peer_bdaddr));
+		if (index >= 0 && hci_sim_get_connection(sim, -1, index)) {
+			hci_sim_cmd_status(sim, opcode, HCI_SIM_CONNECTION_EXISTS);
+			break;
+		}
+		hci_sim_cmd_status(sim, opcode, HCI_SIM_SUCCESS);
+		if (index < 0) { // Waiting for an advertisement which will never come
+			sim->connecting = 1;
+			bacpy(&(sim->connecting_mac), &(cp->peer_bdaddr));
+			break;
+		}
+		hci_sim_connect(sim, index, cp);
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CREATE_CONN_CANCEL):
+		if (!sim->connecting) {
+			rparam[0] = HCI_SIM_COMMAND_DISALLOWED;
+			hci_sim_cmd_complete(sim, opcode, rparam, 1);
+			break;
+		}
+		sim->connecting = 0;
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		hci_sim_connection_complete(sim, HCI_SIM_UNKNOWN_CONNECTION, NULL, &(sim->connecting_mac), 0x00);
+		break;
+
+	case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CONN_UPDATE): {
+		const le_connection_update_cp *cp = (const void *)param;
+		hci_sim_connection_t *conn = (plen < LE_CONN_UPDATE_CP_SIZE ? NULL :
+					      hci_sim_get_connection(sim, btohs(cp->handle) & 0x0FFF, -1));
+		if (!conn) {
+			hci_sim_cmd_status(sim, opcode, (plen < LE_CONN_UPDATE_CP_SIZE ? HCI_SIM_INVALID_PARAMETERS :
+							 HCI_SIM_UNKNOWN_CONNECTION));
+			break;
+		}
+		if (btohs(cp->min_interval) > btohs(cp->max_interval) || btohs(cp->max_interval) < 0x0006 ||
+		    btohs(cp->max_interval) > 0x0C80) {
+			hci_sim_cmd_status(sim, opcode, HCI_SIM_INVALID_PARAMETERS);
+			break;
+		}
+		hci_sim_cmd_status(sim, opcode, HCI_SIM_SUCCESS);
+		conn->interval = btohs(cp->max_interval);
+		conn->latency = btohs(cp->latency);
+		conn->supervision_timeout = btohs(cp->supervision_timeout);
+
+		uint8_t event[EVT_LE_META_EVENT_SIZE + EVT_LE_CONN_UPDATE_COMPLETE_SIZE];
+		evt_le_connection_update_complete *uc = (void *)(event + EVT_LE_META_EVENT_SIZE);
+		event[0] = EVT_LE_CONN_UPDATE_COMPLETE;
+		uc->status = HCI_SIM_SUCCESS;
+		uc->handle = htobs(conn->handle);
+		uc->interval = htobs(conn->interval);
+		uc->latency = htobs(conn->latency);
+		uc->supervision_timeout = htobs(conn->supervision_timeout);
+		hci_sim_answer_event(sim, EVT_LE_META_EVENT, event, sizeof(event));
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_LINK_CTL, OCF_DISCONNECT): {
+		const disconnect_cp *cp = (const void *)param;
+		hci_sim_connection_t *conn = (plen < DISCONNECT_CP_SIZE ? NULL :
+					      hci_sim_get_connection(sim, btohs(cp->handle) & 0x0FFF, -1));
+		if (!conn) {
+			hci_sim_cmd_status(sim, opcode, (plen < DISCONNECT_CP_SIZE ? HCI_SIM_INVALID_PARAMETERS :
+							 HCI_SIM_UNKNOWN_CONNECTION));
+			break;
+		}
+		hci_sim_cmd_status(sim, opcode, HCI_SIM_SUCCESS);
+		hci_sim_terminate(sim, conn, HCI_SIM_LOCAL_HOST_TERMINATED, 1);
+		break;
+	}
+
+	case cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI): {
+		uint16_t handle = (param[0] | (param[1] << 8)) & 0x0FFF;
+		hci_sim_connection_t *conn = hci_sim_get_connection(sim, handle, -1);
+		rparam[1] = handle & 0xFF; // Little endian
+		rparam[2] = handle >> 8;
+		if (plen < 2 || !conn) {
+			rparam[0] = (plen < 2 ? HCI_SIM_INVALID_PARAMETERS : HCI_SIM_UNKNOWN_CONNECTION);
+		} else { // The RSSI of a connection is steadier than the one of the advertisements
+			rparam[3] = (uint8_t)hci_sim_device_rssi(sim, conn->index);
+		}
+		hci_sim_cmd_complete(sim, opcode, rparam, READ_RSSI_RP_SIZE);
+		break;
+	}
+
+	default:
+		print_trace(TRACE_WARNING, "hci_sim : unsupported command (OGF 0x%02X, OCF 0x%04X).\n", ogf, ocf);
+		rparam[0] = HCI_SIM_UNKNOWN_COMMAND;
+		hci_sim_cmd_complete(sim, opcode, rparam, 1);
+		break;
+	}
+}
+
+//---------------------------------
+
+/* Thread generating the advertising reports at the configured rate. The number of
+   reports owed since the beginning of the scan is computed at each tick, so that the
+   rate doesn't drift with the scheduling latency.
+*/
+static void *hci_sim_thread_routine(void *arg) {
+	hci_sim_t *sim = (hci_sim_t *)arg;
+	struct timespec tick = {0, HCI_SIM_TICK * 1000};
+	struct timespec now;
+
+	while (sim->running) {
+		pthread_mutex_lock(&(sim->mutex));
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		hci_sim_deliver_answers(sim, &now);
+		if (sim->fault != HCI_SIM_FAULT_NONE) { // No report generated while faulty
+			pthread_mutex_unlock(&(sim->mutex));
+			nanosleep(&tick, NULL);
+			continue;
+		}
+		hci_sim_periodic_inquiry(sim, &now);
+		uint64_t rate = sim->config.reports_per_second;
+		if (sim->config.duty_cycle) {
+			rate = (sim->scan_interval && sim->scan_window <= sim->scan_interval) ?
+				rate * sim->scan_window / sim->scan_interval : 0;
+			if (sim->scan_type == 0x01) {
+				rate += rate / 2;
+			}
+		}
+		if (sim->scan_enabled && rate) {
+			uint64_t elapsed = (now.tv_sec - sim->scan_start.tv_sec) * 1000000000ULL +
+				now.tv_nsec - sim->scan_start.tv_nsec;
+			uint64_t due = elapsed * rate / 1000000000ULL;
+			uint64_t owed = due - sim->scan_reports;
+			/* After a stall, we don't try to catch up more than one second of reports. */
+			if (owed > rate) {
+				sim->scan_reports = due - rate;
+				owed = rate;
+			}
+			while (owed > 0) {
+				uint8_t max = owed < sim->config.reports_per_event ? owed : sim->config.reports_per_event;
+				uint8_t generated = (sim->scan_extended ? hci_sim_advertise_extended(sim, max) :
+						     hci_sim_advertise(sim, max));
+				if (!generated) {
+					sim->scan_reports = due;
+					break;
+				}
+				sim->scan_reports += generated;
+				owed -= generated;
+			}
+		}
+		pthread_mutex_unlock(&(sim->mutex));
+		nanosleep(&tick, NULL);
+	}
+
+	return NULL;
+}
+
+//------------------------------------------------------------------------------------
+
+/*-----------------------
+  - TRANSPORT FUNCTIONS -
+  -----------------------*/
+
+static int8_t sim_open(hci_socket_t *hci_socket, bt_address_t *adapter) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+
+	if (!sim || (adapter && bacmp(adapter, &(sim->config.address)) &&
+		     bacmp(adapter, BDADDR_ANY))) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	pthread_mutex_lock(&(sim->mutex));
+	int8_t res = hci_transport_pair_open(sim->sockets, HCI_SIM_MAX_SOCKETS, hci_socket);
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static void sim_close(hci_socket_t *hci_socket) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+
+	pthread_mutex_lock(&(sim->mutex));
+	hci_transport_pair_t *sim_socket = hci_transport_pair_get(sim->sockets, HCI_SIM_MAX_SOCKETS,
+								   hci_socket->sock);
+	if (sim_socket) {
+		hci_transport_pair_close(sim_socket);
+	}
+	pthread_mutex_unlock(&(sim->mutex));
+
+	close(hci_socket->sock);
+}
+
+//---------------------------------
+
+static int sim_send_cmd(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf, uint8_t plen, void *param) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+	uint8_t cparam[255];
+
+	if (plen && !param) {
+		errno = EINVAL;
+		return -1;
+	}
+	/* The missing parameters are read as zeros. */
+	memset(cparam, 0, sizeof(cparam));
+	memcpy(cparam, param, plen);
+
+	pthread_mutex_lock(&(sim->mutex));
+	hci_sim_process_cmd(sim, ogf, ocf, plen, cparam);
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return 0;
+}
+
+//---------------------------------
+
+static ssize_t sim_read(hci_socket_t *hci_socket, void *buf, size_t length) {
+	return hci_transport_recv(hci_socket, buf, length);
+}
+
+//---------------------------------
+
+static int sim_get_filter(hci_socket_t *hci_socket, struct hci_filter *flt) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+	int res = 0;
+
+	pthread_mutex_lock(&(sim->mutex));
+	hci_transport_pair_t *sim_socket = hci_transport_pair_get(sim->sockets, HCI_SIM_MAX_SOCKETS,
+								   hci_socket->sock);
+	if (sim_socket) {
+		*flt = sim_socket->filter;
+	} else {
+		errno = EBADF;
+		res = -1;
+	}
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static int sim_set_filter(hci_socket_t *hci_socket, const struct hci_filter *flt) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+	int res = 0;
+
+	pthread_mutex_lock(&(sim->mutex));
+	hci_transport_pair_t *sim_socket = hci_transport_pair_get(sim->sockets, HCI_SIM_MAX_SOCKETS,
+								   hci_socket->sock);
+	if (sim_socket) {
+		sim_socket->filter = *flt;
+	} else {
+		errno = EBADF;
+		res = -1;
+	}
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static int sim_inquiry(hci_socket_t *hci_socket, uint8_t duration, uint16_t max_rsp,
+		       inquiry_info **ii, long flags) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+
+	if (!max_rsp) {
+		max_rsp = 255;
+	}
+	uint32_t num_rsp = sim->config.num_devices < max_rsp ? sim->config.num_devices : max_rsp;
+
+	if (!*ii) {
+		*ii = malloc(max_rsp * sizeof(inquiry_info));
+		if (!*ii) {
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&(sim->mutex));
+	sim->stats.commands++;
+	for (uint32_t i = 0; i < num_rsp; i++) {
+		memset(&((*ii)[i]), 0, sizeof(inquiry_info));
+		(*ii)[i].bdaddr = hci_sim_device_address(sim, i);
+		(*ii)[i].pscan_rep_mode = 0x01;
+	}
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return num_rsp;
+}
+
+//---------------------------------
+
+static int sim_dev_info(hci_socket_t *hci_socket, struct hci_dev_info *info) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+
+	memset(info, 0, sizeof(struct hci_dev_info));
+	info->dev_id = hci_socket->dev_id;
+	strcpy(info->name, "sim0");
+	bacpy(&(info->bdaddr), &(sim->config.address));
+
+	return 0;
+}
+
+//---------------------------------
+
+static int sim_get_drops(hci_socket_t *hci_socket, uint32_t *drops) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+	int res = 0;
+
+	pthread_mutex_lock(&(sim->mutex));
+	hci_transport_pair_t *sim_socket = hci_transport_pair_get(sim->sockets, HCI_SIM_MAX_SOCKETS,
+								   hci_socket->sock);
+	if (sim_socket) {
+		*drops = sim_socket->dropped;
+	} else {
+		errno = EBADF;
+		res = -1;
+	}
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static int sim_set_receive_buffer(hci_socket_t *hci_socket, int size) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+	int res = -1;
+
+	pthread_mutex_lock(&(sim->mutex));
+	hci_transport_pair_t *sim_socket = hci_transport_pair_get(sim->sockets, HCI_SIM_MAX_SOCKETS,
+								   hci_socket->sock);
+	if (sim_socket) {
+		res = hci_transport_pair_set_receive_buffer(sim_socket, size);
+	} else {
+		errno = EBADF;
+	}
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+static int sim_attach_filter(hci_socket_t *hci_socket, const struct sock_fprog *program) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+	int res = -1;
+
+	pthread_mutex_lock(&(sim->mutex));
+	hci_transport_pair_t *sim_socket = hci_transport_pair_get(sim->sockets, HCI_SIM_MAX_SOCKETS,
+								   hci_socket->sock);
+	if (sim_socket) {
+		res = hci_transport_pair_attach_filter(sim_socket, program);
+	} else {
+		errno = EBADF;
+	}
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return res;
+}
+
+//---------------------------------
+
+/* The answers not delivered yet are lost with the restart, the sockets are kept. */
+static int sim_restart(hci_socket_t *hci_socket) {
+	hci_sim_t *sim = (hci_sim_t *)hci_socket->transport_data;
+
+	pthread_mutex_lock(&(sim->mutex));
+	hci_sim_reset(sim);
+	while (sim->delayed_head) {
+		hci_sim_delayed_event_t *delayed = sim->delayed_head;
+		sim->delayed_head = delayed->next;
+		free(delayed);
+	}
+	sim->delayed_tail = NULL;
+	sim->stats.restarts++;
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+const hci_transport_t hci_sim_transport = {
+	.name = "sim",
+	.open = sim_open,
+	.close = sim_close,
+	.send_cmd = sim_send_cmd,
+	.send_req = hci_transport_generic_send_req,
+	.read = sim_read,
+	.get_filter = sim_get_filter,
+	.set_filter = sim_set_filter,
+	.inquiry = sim_inquiry,
+	.dev_info = sim_dev_info,
+	.get_drops = sim_get_drops,
+	.set_receive_buffer = sim_set_receive_buffer,
+	.attach_filter = sim_attach_filter,
+	.restart = sim_restart
+};
+
+//------------------------------------------------------------------------------------
+
+/*-----------------------
+  - SIMULATOR FUNCTIONS -
+  -----------------------*/
+
+hci_sim_config_t hci_sim_default_config(void) {
+	hci_sim_config_t config;
+	memset(&config, 0, sizeof(config));
+	str2ba("02:51:0D:00:00:01", &(config.address));
+	config.num_devices = 100;
+	config.reports_per_second = 1000;
+	config.reports_per_event = 1;
+	config.data_length = 16;
+	config.rssi_min = -95;
+	config.rssi_max = -35;
+	config.white_list_size = 16;
+	config.seed = 0x5EED;
+	config.command_latency = 0;
+	config.command_credits = 1;
+	return config;
+}
+
+//---------------------------------
+
+hci_sim_t *hci_sim_create(const hci_sim_config_t *config) {
+	hci_sim_t *sim = calloc(1, sizeof(hci_sim_t));
+	if (!sim) {
+		perror("hci_sim_create");
+		return NULL;
+	}
+
+	sim->config = config ? *config : hci_sim_default_config();
+	if (sim->config.data_length > 31) {
+		sim->config.data_length = 31;
+	}
+	if (sim->config.extended_data_length > HCI_REPORT_EXT_MAX_DATA) {
+		sim->config.extended_data_length = HCI_REPORT_EXT_MAX_DATA;
+	}
+	/* Each report takes 10 bytes plus its data and an event carries at most 253 bytes of reports. */
+	uint8_t max_per_event = 253 / (LE_ADVERTISING_INFO_SIZE + 1 + sim->config.data_length);
+	if (!sim->config.reports_per_event) {
+		sim->config.reports_per_event = 1;
+	} else if (sim->config.reports_per_event > max_per_event) {
+		sim->config.reports_per_event = max_per_event;
+	}
+	if (sim->config.rssi_min > sim->config.rssi_max) {
+		int8_t tmp = sim->config.rssi_min;
+		sim->config.rssi_min = sim->config.rssi_max;
+		sim->config.rssi_max = tmp;
+	}
+	if (sim->config.white_list_size > HCI_SIM_MAX_WHITE_LIST_SIZE) {
+		sim->config.white_list_size = HCI_SIM_MAX_WHITE_LIST_SIZE;
+	}
+	if (!sim->config.command_credits) {
+		sim->config.command_credits = 1;
+	}
+	if (sim->config.num_devices > 0xFFFFFF) {
+		sim->config.num_devices = 0xFFFFFF;
+	}
+
+	sim->random = sim->config.seed ? sim->config.seed : 1;
+	hci_transport_pairs_init(sim->sockets, HCI_SIM_MAX_SOCKETS);
+	pthread_mutex_init(&(sim->mutex), NULL);
+
+	sim->running = 1;
+	if (pthread_create(&(sim->thread), NULL, hci_sim_thread_routine, sim) != 0) {
+		perror("hci_sim_create : unable to start the generating thread");
+		pthread_mutex_destroy(&(sim->mutex));
+		free(sim);
+		return NULL;
+	}
+
+	return sim;
+}
+
+//---------------------------------
+
+void hci_sim_destroy(hci_sim_t *sim) {
+	if (!sim) {
+		print_trace(TRACE_ERROR, "hci_sim_destroy : invalid reference.\n");
+		return;
+	}
+
+	sim->running = 0;
+	pthread_join(sim->thread, NULL);
+
+	for (uint8_t i = 0; i < HCI_SIM_MAX_SOCKETS; i++) {
+		if (sim->sockets[i].fd >= 0) {
+			print_trace(TRACE_WARNING, "hci_sim_destroy : socket %i still opened.\n", sim->sockets[i].peer);
+			close(sim->sockets[i].fd);
+		}
+	}
+
+	while (sim->delayed_head) {
+		hci_sim_delayed_event_t *delayed = sim->delayed_head;
+		sim->delayed_head = delayed->next;
+		free(delayed);
+	}
+
+	pthread_mutex_destroy(&(sim->mutex));
+	free(sim);
+}
+
+//---------------------------------
+
+bt_address_t hci_sim_device_address(hci_sim_t *sim, uint32_t index) {
+	bt_address_t mac;
+	mac.b[0] = index & 0xFF;
+	mac.b[1] = (index >> 8) & 0xFF;
+	mac.b[2] = (index >> 16) & 0xFF;
+	mac.b[3] = HCI_SIM_DEVICE_PREFIX_2;
+	mac.b[4] = HCI_SIM_DEVICE_PREFIX_1;
+	mac.b[5] = HCI_SIM_DEVICE_PREFIX_0;
+	return mac;
+}
+
+//---------------------------------
+
+void hci_sim_get_stats(hci_sim_t *sim, hci_sim_stats_t *stats) {
+	pthread_mutex_lock(&(sim->mutex));
+	*stats = sim->stats;
+	pthread_mutex_unlock(&(sim->mutex));
+}
+
+//---------------------------------
+
+void hci_sim_set_fault(hci_sim_t *sim, hci_sim_fault_t fault) {
+	pthread_mutex_lock(&(sim->mutex));
+	sim->fault = fault;
+	pthread_mutex_unlock(&(sim->mutex));
+}
+
+//---------------------------------
+
+int8_t hci_sim_disconnect(hci_sim_t *sim, const bt_address_t *mac) {
+	int8_t res = -1;
+
+	pthread_mutex_lock(&(sim->mutex));
+	int64_t index = hci_sim_device_index(sim, mac);
+	hci_sim_connection_t *conn = (index < 0 ? NULL : hci_sim_get_connection(sim, -1, index));
+	if (conn) {
+		hci_sim_terminate(sim, conn, HCI_SIM_CONNECTION_TIMEOUT, 0);
+		res = 0;
+	}
+	pthread_mutex_unlock(&(sim->mutex));
+
+	return res;
+}
@@ -0,0 +1,307 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_snoop.h"
+#include "trace.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+/* Writes the whole buffer into the capture file. The recorder's mutex has to be held. */
+static int8_t hci_snoop_write_buffer(hci_snoop_t *snoop) {
+	uint32_t written = 0;
+	while (written < snoop->buffer_used) {
+		ssize_t n = write(snoop->fd, snoop->buffer + written, snoop->buffer_used - written);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("hci_snoop : unable to write the capture");
+			snoop->drops += snoop->buffer_records;
+			snoop->records -= snoop->buffer_records;
+			snoop->buffer_used = 0;
+			snoop->buffer_records = 0;
+			return -1;
+		}
+		written += n;
+	}
+	snoop->buffer_used = 0;
+	snoop->buffer_records = 0;
+	return 0;
+}
+
+//---------------------------------
+
+/* Socket seen by the recorded transport : the same one, with the recorded transport. */
+static inline hci_socket_t hci_snoop_inner_socket(hci_socket_t *hci_socket) {
+	hci_snoop_t *snoop = (hci_snoop_t *)hci_socket->transport_data;
+	hci_socket_t inner = *hci_socket;
+	inner.transport = snoop->transport;
+	inner.transport_data = snoop->transport_data;
+	return inner;
+}
+
+//------------------------------------------------------------------------------------
+
+/*-----------------------
+  - TRANSPORT FUNCTIONS -
+  -----------------------*/
+
+static int8_t snoop_open(hci_socket_t *hci_socket, bt_address_t *adapter) {
+	if (!hci_socket->transport_data) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	int8_t res = inner.transport->open(&inner, adapter);
+	hci_socket->sock = inner.sock;
+	hci_socket->dev_id = inner.dev_id;
+
+	return res;
+}
+
+//---------------------------------
+
+static void snoop_close(hci_socket_t *hci_socket) {
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	inner.transport->close(&inner);
+}
+
+//---------------------------------
+
+static int snoop_send_cmd(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf, uint8_t plen, void *param) {
+	hci_snoop_t *snoop = (hci_snoop_t *)hci_socket->transport_data;
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	uint8_t packet[1 + HCI_COMMAND_HDR_SIZE + 255];
+	hci_command_hdr *hdr = (void *)(packet + 1);
+
+	packet[0] = HCI_COMMAND_PKT;
+	hdr->opcode = htobs(cmd_opcode_pack(ogf, ocf));
+	hdr->plen = plen;
+	if (plen) {
+		memcpy(packet + 1 + HCI_COMMAND_HDR_SIZE, param, plen);
+	}
+	hci_snoop_record(snoop, packet, 1 + HCI_COMMAND_HDR_SIZE + plen, 0, NULL);
+
+	return inner.transport->send_cmd(&inner, ogf, ocf, plen, param);
+}
+
+//---------------------------------
+
+static ssize_t snoop_read(hci_socket_t *hci_socket, void *buf, size_t length) {
+	hci_snoop_t *snoop = (hci_snoop_t *)hci_socket->transport_data;
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+
+	ssize_t len = inner.transport->read(&inner, buf, length);
+	hci_socket->stats.dropped = inner.stats.dropped;
+	hci_socket->drops = inner.drops;
+	if (len > 0) {
+		hci_socket->timestamp = inner.timestamp;
+		hci_snoop_record(snoop, buf, len, 1, &(hci_socket->timestamp));
+	}
+
+	return len;
+}
+
+//---------------------------------
+
+static int snoop_get_filter(hci_socket_t *hci_socket, struct hci_filter *flt) {
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	return inner.transport->get_filter(&inner, flt);
+}
+
+//---------------------------------
+
+static int snoop_set_filter(hci_socket_t *hci_socket, const struct hci_filter *flt) {
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	return inner.transport->set_filter(&inner, flt);
+}
+
+//---------------------------------
+
+static int snoop_inquiry(hci_socket_t *hci_socket, uint8_t duration, uint16_t max_rsp,
+			 inquiry_info **ii, long flags) {
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	return inner.transport->inquiry(&inner, duration, max_rsp, ii, flags);
+}
+
+//---------------------------------
+
+static int snoop_dev_info(hci_socket_t *hci_socket, struct hci_dev_info *info) {
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	return inner.transport->dev_info(&inner, info);
+}
+
+//---------------------------------
+
+static int snoop_get_drops(hci_socket_t *hci_socket, uint32_t *drops) {
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	return inner.transport->get_drops(&inner, drops);
+}
+
+//---------------------------------
+
+static int snoop_set_receive_buffer(hci_socket_t *hci_socket, int size) {
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	return inner.transport->set_receive_buffer(&inner, size);
+}
+
+//---------------------------------
+
+static int snoop_attach_filter(hci_socket_t *hci_socket, const struct sock_fprog *program) {
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	return inner.transport->attach_filter(&inner, program);
+}
+
+//---------------------------------
+
+static int snoop_restart(hci_socket_t *hci_socket) {
+	hci_socket_t inner = hci_snoop_inner_socket(hci_socket);
+	return inner.transport->restart(&inner);
+}
+
+//------------------------------------------------------------------------------------
+
+/* The requests are performed with the generic implementation so that the commands
+   and events they involve go through the recording functions.
+*/
+const hci_transport_t hci_snoop_transport = {
+	.name = "snoop",
+	.open = snoop_open,
+	.close = snoop_close,
+	.send_cmd = snoop_send_cmd,
+	.send_req = hci_transport_generic_send_req,
+	.read = snoop_read,
+	.get_filter = snoop_get_filter,
+	.set_filter = snoop_set_filter,
+	.inquiry = snoop_inquiry,
+	.dev_info = snoop_dev_info,
+	.get_drops = snoop_get_drops,
+	.set_receive_buffer = snoop_set_receive_buffer,
+	.attach_filter = snoop_attach_filter,
+	.restart = snoop_restart
+};
+
+//------------------------------------------------------------------------------------
+
+/*----------------------
+  - RECORDER FUNCTIONS -
+  ----------------------*/
+
+hci_snoop_t *hci_snoop_open(const char *path, const hci_transport_t *transport, void *transport_data) {
+	hci_snoop_t *snoop = calloc(1, sizeof(hci_snoop_t));
+	if (!snoop) {
+		perror("hci_snoop_open");
+		return NULL;
+	}
+
+	snoop->transport = transport ? transport : &hci_bluez_transport;
+	snoop->transport_data = transport_data;
+	snoop->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (snoop->fd < 0) {
+		perror("hci_snoop_open : unable to create the capture");
+		free(snoop);
+		return NULL;
+	}
+	pthread_mutex_init(&(snoop->mutex), NULL);
+
+	/* File header : identification pattern, version and datalink type. */
+	uint32_t version = htobe32(HCI_SNOOP_VERSION);
+	uint32_t datalink = htobe32(HCI_SNOOP_DATALINK_H4);
+	memcpy(snoop->buffer, HCI_SNOOP_ID, sizeof(HCI_SNOOP_ID));
+	memcpy(snoop->buffer + 8, &version, 4);
+	memcpy(snoop->buffer + 12, &datalink, 4);
+	snoop->buffer_used = 16;
+
+	return snoop;
+}
+
+//---------------------------------
+
+void hci_snoop_record(hci_snoop_t *snoop, const uint8_t *packet, uint16_t length, char received,
+		      const struct timespec *timestamp) {
+	struct timespec now;
+	hci_snoop_record_hdr_t hdr;
+
+	if (!timestamp) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		timestamp = &now;
+	}
+
+	uint32_t flags = received ? HCI_SNOOP_FLAG_RECEIVED : 0;
+	if (packet[0] == HCI_COMMAND_PKT || packet[0] == HCI_EVENT_PKT) {
+		flags |= HCI_SNOOP_FLAG_COMMAND_EVENT;
+	}
+	uint64_t us = (uint64_t)timestamp->tv_sec * 1000000ULL + timestamp->tv_nsec / 1000 +
+		HCI_SNOOP_EPOCH_DELTA;
+
+	hdr.original_length = htobe32(length);
+	hdr.included_length = htobe32(length);
+	hdr.flags = htobe32(flags);
+	hdr.timestamp = htobe64(us);
+
+	pthread_mutex_lock(&(snoop->mutex));
+	if (snoop->buffer_used + sizeof(hdr) + length > HCI_SNOOP_BUFFER_SIZE) {
+		hci_snoop_write_buffer(snoop);
+	}
+	hdr.drops = htobe32((uint32_t)snoop->drops);
+	memcpy(snoop->buffer + snoop->buffer_used, &hdr, sizeof(hdr));
+	memcpy(snoop->buffer + snoop->buffer_used + sizeof(hdr), packet, length);
+	snoop->buffer_used += sizeof(hdr) + length;
+	snoop->buffer_records++;
+	snoop->records++;
+	pthread_mutex_unlock(&(snoop->mutex));
+}
+
+//---------------------------------
+
+int8_t hci_snoop_flush(hci_snoop_t *snoop) {
+	pthread_mutex_lock(&(snoop->mutex));
+	int8_t res = hci_snoop_write_buffer(snoop);
+	pthread_mutex_unlock(&(snoop->mutex));
+	return res;
+}
+
+//---------------------------------
+
+void hci_snoop_close(hci_snoop_t *snoop) {
+	if (!snoop) {
+		print_trace(TRACE_ERROR, "hci_snoop_close : invalid reference.\n");
+		return;
+	}
+
+	hci_snoop_flush(snoop);
+	close(snoop->fd);
+	print_trace(TRACE_INFO, "hci_snoop : %llu records written, %llu lost.\n",
+		    (unsigned long long)snoop->records, (unsigned long long)snoop->drops);
+	pthread_mutex_destroy(&(snoop->mutex));
+	free(snoop);
+}
@@ -21,38 +21,94 @@
  */
 
 #include "hci_socket.h"
+#include "hci_transport.h"
 #include "trace.h"
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <sys/socket.h>
 #include <bluetooth/hci_lib.h>
 
 
+/* Precompiled filters of the profiles, in the layout of "struct hci_filter" : events
+   0 to 31 are in the first word of the event mask, events 32 to 63 in the second one.
+*/
+#define HCI_FILTER_EVENT_BIT(event, word) (((event) >> 5) == (word) ? (1U << ((event) & 31)) : 0U)
+
+static const struct hci_filter hci_filter_profiles[HCI_FILTER_PROFILE_COUNT] = {
+	[HCI_FILTER_PROFILE_CMD_COMPLETE] = {
+		.type_mask = 1U << HCI_EVENT_PKT,
+		.event_mask = {HCI_FILTER_EVENT_BIT(EVT_CMD_COMPLETE, 0) | HCI_FILTER_EVENT_BIT(EVT_CMD_STATUS, 0),
+			       HCI_FILTER_EVENT_BIT(EVT_CMD_COMPLETE, 1) | HCI_FILTER_EVENT_BIT(EVT_CMD_STATUS, 1)},
+	},
+	[HCI_FILTER_PROFILE_INQUIRY] = {
+		.type_mask = 1U << HCI_EVENT_PKT,
+		.event_mask = {HCI_FILTER_EVENT_BIT(EVT_CMD_COMPLETE, 0) |
+			       HCI_FILTER_EVENT_BIT(EVT_INQUIRY_RESULT_WITH_RSSI, 0) |
+			       HCI_FILTER_EVENT_BIT(EVT_EXTENDED_INQUIRY_RESULT, 0) |
+			       HCI_FILTER_EVENT_BIT(EVT_INQUIRY_COMPLETE, 0),
+			       HCI_FILTER_EVENT_BIT(EVT_CMD_COMPLETE, 1) |
+			       HCI_FILTER_EVENT_BIT(EVT_INQUIRY_RESULT_WITH_RSSI, 1) |
+			       HCI_FILTER_EVENT_BIT(EVT_EXTENDED_INQUIRY_RESULT, 1) |
+			       HCI_FILTER_EVENT_BIT(EVT_INQUIRY_COMPLETE, 1)},
+	},
+	[HCI_FILTER_PROFILE_PERIODIC_INQUIRY] = {
+		.type_mask = 1U << HCI_EVENT_PKT,
+		.event_mask = {HCI_FILTER_EVENT_BIT(EVT_CMD_COMPLETE, 0) |
+			       HCI_FILTER_EVENT_BIT(EVT_INQUIRY_RESULT, 0) |
+			       HCI_FILTER_EVENT_BIT(EVT_INQUIRY_RESULT_WITH_RSSI, 0) |
+			       HCI_FILTER_EVENT_BIT(EVT_EXTENDED_INQUIRY_RESULT, 0),
+			       HCI_FILTER_EVENT_BIT(EVT_CMD_COMPLETE, 1) |
+			       HCI_FILTER_EVENT_BIT(EVT_INQUIRY_RESULT, 1) |
+			       HCI_FILTER_EVENT_BIT(EVT_INQUIRY_RESULT_WITH_RSSI, 1) |
+			       HCI_FILTER_EVENT_BIT(EVT_EXTENDED_INQUIRY_RESULT, 1)},
+	},
+	[HCI_FILTER_PROFILE_LE_SCAN] = {
+		.type_mask = 1U << HCI_EVENT_PKT,
+		.event_mask = {HCI_FILTER_EVENT_BIT(EVT_CMD_COMPLETE, 0) | HCI_FILTER_EVENT_BIT(EVT_LE_META_EVENT, 0),
+			       HCI_FILTER_EVENT_BIT(EVT_CMD_COMPLETE, 1) | HCI_FILTER_EVENT_BIT(EVT_LE_META_EVENT, 1)},
+	},
+	[HCI_FILTER_PROFILE_LE_CONNECTIONS] = {
+		.type_mask = 1U << HCI_EVENT_PKT,
+		.event_mask = {HCI_FILTER_EVENT_BIT(EVT_DISCONN_COMPLETE, 0) | HCI_FILTER_EVENT_BIT(EVT_LE_META_EVENT, 0),
+			       HCI_FILTER_EVENT_BIT(EVT_DISCONN_COMPLETE, 1) | HCI_FILTER_EVENT_BIT(EVT_LE_META_EVENT, 1)},
+	},
+};
+
+//------------------------------------------------------------------------------------
+
+/* Compares two filters field by field (the padding of the structure is not
+   necessarily initialized).
+*/
+static inline char hci_filter_equal(const struct hci_filter *a, const struct hci_filter *b) {
+	return (a->type_mask == b->type_mask &&
+		a->event_mask[0] == b->event_mask[0] &&
+		a->event_mask[1] == b->event_mask[1] &&
+		a->opcode == b->opcode);
+}
+
+//------------------------------------------------------------------------------------
+
 // If controler == NULL, we take the first present available BT adaptator.
 hci_socket_t open_hci_socket(bt_address_t *controller) {
+	return open_hci_socket_transport(NULL, NULL, controller);
+}
+
+//------------------------------------------------------------------------------------
+
+hci_socket_t open_hci_socket_transport(const hci_transport_t *transport, void *transport_data,
+				       bt_address_t *controller) {
 	hci_socket_t result;
 	memset(&result, 0, sizeof(result));
 
-	if (controller) {
-		char add[18];
-		ba2str(controller, add);
-		result.dev_id = hci_devid(add);
-	} else {
-		result.dev_id = hci_get_route(NULL);
-	}
-			
-	if (result.dev_id < 0) {
-		perror("open_hci_socket");
-		result.sock = -1;
-		return result;
-	}
+	result.transport = transport ? transport : &hci_bluez_transport;
+	result.transport_data = transport_data;
 
-	result.sock = hci_open_dev(result.dev_id);
-	if (result.sock < 0) {
+	if (result.transport->open(&result, controller) < 0) {
 		perror("open_hci_socket");
 		result.sock = -1;
-		return result;	
 	}
 
 	return result;		
@@ -65,7 +121,7 @@ void close_hci_socket(hci_socket_t *hci_socket) {
 		print_trace(TRACE_WARNING, "close_hci_socket : already closed socket.\n");
 		return;
 	}
-	hci_close_dev(hci_socket->sock);
+	hci_socket->transport->close(hci_socket);
 	hci_socket->sock = -1;
 
 	return;
@@ -89,7 +145,7 @@ void close_all_hci_sockets(list_t **hci_socket_list) {
 	while (*hci_socket_list != NULL) {
 		hci_socket = (hci_socket_t *)list_pop(hci_socket_list);
 		if (hci_socket->sock >= 0) {
-			hci_close_dev(hci_socket->sock);
+			hci_socket->transport->close(hci_socket);
 		} else {
 			print_trace(TRACE_WARNING, "close_all_hci_sockets : already closed socket.\n");
 		}
@@ -100,9 +156,7 @@ void close_all_hci_sockets(list_t **hci_socket_list) {
 //------------------------------------------------------------------------------------
 
 int8_t get_hci_socket_filter(hci_socket_t hci_socket, struct hci_filter *old_flt) {
-	int8_t err_code;
-	socklen_t old_flt_len = sizeof(struct hci_filter);
-	err_code = getsockopt(hci_socket.sock, SOL_HCI, HCI_FILTER, (void *)old_flt, &old_flt_len);
+	int8_t err_code = hci_socket.transport->get_filter(&hci_socket, old_flt);
 	if (err_code < 0) {
 		perror("get_hci_socket_filter : cannot save the old filter");
 		memset((void *)old_flt, 0, sizeof(struct hci_filter));
@@ -112,24 +166,219 @@ int8_t get_hci_socket_filter(hci_socket_t hci_socket, struct hci_filter *old_flt
 
 //------------------------------------------------------------------------------------
 
-int8_t set_hci_socket_filter(hci_socket_t hci_socket, struct hci_filter *flt) {
-	int8_t err_code = setsockopt(hci_socket.sock, SOL_HCI, HCI_FILTER, (void *)flt,
-				     sizeof(struct hci_filter));
+int8_t set_hci_socket_filter(hci_socket_t *hci_socket, struct hci_filter *flt) {
+	int8_t err_code = hci_socket->transport->set_filter(hci_socket, flt);
 	if (err_code < 0) {
 		perror("set_hci_socket_filter : can't set HCI filter");
+		hci_socket->filter_known = 0; // The kernel may have kept either filter
+		return err_code;
 	}
+	hci_socket->filter = *flt;
+	hci_socket->filter_known = 1;
 	return err_code;
 }
 
 //------------------------------------------------------------------------------------
 
+const struct hci_filter *hci_filter_profile(hci_filter_profile_t profile) {
+	if (profile >= HCI_FILTER_PROFILE_COUNT) {
+		print_trace(TRACE_ERROR, "hci_filter_profile : invalid profile.\n");
+		return NULL;
+	}
+	return &(hci_filter_profiles[profile]);
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t get_hci_socket_cached_filter(hci_socket_t *hci_socket, struct hci_filter *flt) {
+	if (!hci_socket->filter_known) {
+		if (hci_socket->transport->get_filter(hci_socket, &(hci_socket->filter)) < 0) {
+			perror("get_hci_socket_cached_filter : cannot save the old filter");
+			return -1;
+		}
+		hci_socket->filter_known = 1;
+	}
+	*flt = hci_socket->filter;
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t apply_hci_socket_filter(hci_socket_t *hci_socket, const struct hci_filter *flt) {
+	if (hci_socket->filter_known && hci_filter_equal(&(hci_socket->filter), flt)) {
+		return 0;
+	}
+	if (hci_socket->transport->set_filter(hci_socket, flt) < 0) {
+		perror("apply_hci_socket_filter : can't set HCI filter");
+		hci_socket->filter_known = 0; // The kernel may have kept either filter
+		return -1;
+	}
+	hci_socket->filter = *flt;
+	hci_socket->filter_known = 1;
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t apply_hci_socket_filter_profile(hci_socket_t *hci_socket, hci_filter_profile_t profile) {
+	const struct hci_filter *flt = hci_filter_profile(profile);
+	if (!flt) {
+		return -1;
+	}
+	return apply_hci_socket_filter(hci_socket, flt);
+}
+
+//------------------------------------------------------------------------------------
+
+void forget_hci_socket_filter(hci_socket_t *hci_socket) {
+	hci_socket->filter_known = 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t send_hci_socket_cmd(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf,
+			   uint8_t plen, void *param) {
+	if (hci_socket->transport->send_cmd(hci_socket, ogf, ocf, plen, param) < 0) {
+		perror("send_hci_socket_cmd");
+		return -1;
+	}
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t send_hci_socket_req(hci_socket_t *hci_socket, struct hci_request *rq, int timeout) {
+	if (hci_socket->transport->send_req(hci_socket, rq, timeout) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t send_hci_socket_simple_req(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf,
+				  void *cparam, uint8_t clen, void *rparam, uint8_t rlen,
+				  int timeout) {
+	struct hci_request rq;
+	memset(&rq, 0, sizeof(rq));
+	rq.ogf = ogf;
+	rq.ocf = ocf;
+	rq.cparam = cparam;
+	rq.clen = clen;
+	rq.rparam = rparam;
+	rq.rlen = rlen;
+
+	if (send_hci_socket_req(hci_socket, &rq, timeout) < 0) {
+		return -1;
+	}
+
+	if (rlen > 0 && ((uint8_t *)rparam)[0]) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t read_hci_socket_remote_name(hci_socket_t *hci_socket, bt_address_t *mac, char *name,
+				   size_t length, int timeout) {
+	remote_name_req_cp cp;
+	evt_remote_name_req_complete rn;
+	struct hci_request rq;
+	memset(&cp, 0, sizeof(cp));
+	memset(&rn, 0, sizeof(rn));
+	bacpy(&(cp.bdaddr), mac);
+	cp.pscan_rep_mode = 0x02;
+
+	memset(&rq, 0, sizeof(rq));
+	rq.ogf = OGF_LINK_CTL;
+	rq.ocf = OCF_REMOTE_NAME_REQ;
+	rq.cparam = &cp;
+	rq.clen = REMOTE_NAME_REQ_CP_SIZE;
+	rq.event = EVT_REMOTE_NAME_REQ_COMPLETE;
+	rq.rparam = &rn;
+	rq.rlen = EVT_REMOTE_NAME_REQ_COMPLETE_SIZE;
+
+	if (send_hci_socket_req(hci_socket, &rq, timeout) < 0) {
+		return -1;
+	}
+	if (rn.status) {
+		errno = EIO;
+		return -1;
+	}
+
+	strncpy(name, (char *)rn.name, length - 1);
+	name[length - 1] = '\0';
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+ssize_t read_hci_socket(hci_socket_t *hci_socket, void *buf, size_t length) {
+	ssize_t len = hci_socket->transport->read(hci_socket, buf, length);
+	if (len > 0) {
+		hci_socket->stats.events++;
+	}
+	return len;
+}
+
+//------------------------------------------------------------------------------------
+
+int32_t set_hci_socket_receive_buffer(hci_socket_t *hci_socket, int32_t size) {
+	int rcvbuf = hci_socket->transport->set_receive_buffer(hci_socket, size);
+	if (rcvbuf < 0) {
+		perror("set_hci_socket_receive_buffer : unable to size the reception queue");
+		return -1;
+	}
+	if (size > 0 && rcvbuf < size) {
+		print_trace(TRACE_WARNING, "set_hci_socket_receive_buffer : reception queue limited to %i bytes.\n",
+			    rcvbuf);
+	}
+
+	return rcvbuf;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t get_hci_socket_stats(hci_socket_t *hci_socket, hci_socket_stats_t *stats) {
+	int8_t res = 0;
+
+	uint32_t drops;
+	if (hci_socket->transport->get_drops(hci_socket, &drops) < 0) {
+		res = -1;
+	} else {
+		hci_transport_account_drops(hci_socket, drops);
+	}
+	*stats = hci_socket->stats;
+
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+void reset_hci_socket_stats(hci_socket_t *hci_socket) {
+	memset(&(hci_socket->stats), 0, sizeof(hci_socket_stats_t));
+
+	// The drops which occurred before the reset are left out :
+	uint32_t drops;
+	if (hci_socket->transport->get_drops(hci_socket, &drops) == 0) {
+		hci_socket->drops = drops;
+	}
+}
+
+//------------------------------------------------------------------------------------
+
 void display_hci_socket_list(list_t *hci_socket_list) {
 	list_t *tmp = hci_socket_list;
 	hci_socket_t val;
 	fprintf(stdout, "\nState of the current opened sockets list :\n");
 	while (tmp != NULL) {
 		val = *((hci_socket_t *)tmp->val);
-		fprintf(stdout, "  -> dev_id : %u | socket : %u \n", val.dev_id, val.sock);
+		fprintf(stdout, "  -> dev_id : %u | socket : %u | transport : %s\n", val.dev_id, val.sock,
+			val.transport ? val.transport->name : "none");
 		tmp = tmp->next;
 	}
 	fprintf(stdout, "\n");
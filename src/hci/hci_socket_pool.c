@@ -0,0 +1,146 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_socket_pool.h"
+#include "hci_transport.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline uint64_t hci_socket_pool_tag(uint64_t old_head, uint8_t index) {
+	return (((old_head >> 8) + 1) << 8) | index;
+}
+
+//---------------------------------
+
+static void hci_socket_pool_push(hci_socket_pool_t *pool, uint8_t index) {
+	uint64_t old_head = __atomic_load_n(&(pool->head), __ATOMIC_ACQUIRE);
+	uint64_t new_head;
+	do {
+		__atomic_store_n(&(pool->next[index]), (uint8_t)(old_head & 0xFF), __ATOMIC_RELAXED);
+		new_head = hci_socket_pool_tag(old_head, index);
+	} while (!__atomic_compare_exchange_n(&(pool->head), &old_head, new_head, 1,
+					      __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+/*------------------
+  - POOL FUNCTIONS -
+  ------------------*/
+
+int8_t hci_socket_pool_init(hci_socket_pool_t *pool, const struct hci_transport_t *transport,
+			    void *transport_data, bt_address_t *controller, uint8_t size) {
+	if (!pool) {
+		print_trace(TRACE_ERROR, "hci_socket_pool_init : invalid pool reference.\n");
+		return -1;
+	}
+
+	memset(pool, 0, sizeof(hci_socket_pool_t));
+	pool->head = HCI_SOCKET_POOL_END;
+
+	if (size > HCI_SOCKET_POOL_MAX_SIZE) {
+		print_trace(TRACE_WARNING, "hci_socket_pool_init : size limited to %d sockets.\n",
+			    HCI_SOCKET_POOL_MAX_SIZE);
+		size = HCI_SOCKET_POOL_MAX_SIZE;
+	}
+
+	struct hci_filter flt;
+	hci_filter_clear(&flt);
+
+	for (uint8_t i = 0; i < size; i++) {
+		hci_socket_t hci_socket = open_hci_socket_transport(transport, transport_data, controller);
+		if (hci_socket.sock < 0) {
+			break;
+		}
+		if (apply_hci_socket_filter(&hci_socket, &flt) < 0) {
+			close_hci_socket(&hci_socket);
+			break;
+		}
+		pool->sockets[pool->size] = hci_socket;
+		hci_socket_pool_push(pool, pool->size);
+		pool->size++;
+	}
+
+	if (!pool->size && size) {
+		print_trace(TRACE_ERROR, "hci_socket_pool_init : unable to open any socket.\n");
+		return -1;
+	}
+
+	return pool->size;
+}
+
+//------------------------------------------------------------------------------------
+
+hci_socket_t *hci_socket_pool_acquire(hci_socket_pool_t *pool) {
+	uint64_t old_head = __atomic_load_n(&(pool->head), __ATOMIC_ACQUIRE);
+	uint64_t new_head;
+	uint8_t index;
+	do {
+		index = old_head & 0xFF;
+		if (index == HCI_SOCKET_POOL_END) {
+			return NULL;
+		}
+		/* next[index] may be concurrently rewritten if the socket was taken and given back
+		   meanwhile, but then the tag of the head changed and the CAS fails.
+		*/
+		new_head = hci_socket_pool_tag(old_head, __atomic_load_n(&(pool->next[index]), __ATOMIC_RELAXED));
+	} while (!__atomic_compare_exchange_n(&(pool->head), &old_head, new_head, 1,
+					      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+	return &(pool->sockets[index]);
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_socket_pool_release(hci_socket_pool_t *pool, hci_socket_t *hci_socket) {
+	if (!hci_socket_pool_owns(pool, hci_socket)) {
+		print_trace(TRACE_ERROR, "hci_socket_pool_release : socket not owned by the pool.\n");
+		return;
+	}
+	hci_socket_pool_push(pool, (uint8_t)(hci_socket - pool->sockets));
+}
+
+//------------------------------------------------------------------------------------
+
+char hci_socket_pool_owns(const hci_socket_pool_t *pool, const hci_socket_t *hci_socket) {
+	return (pool && hci_socket >= pool->sockets && hci_socket < pool->sockets + pool->size);
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_socket_pool_close(hci_socket_pool_t *pool) {
+	if (!pool) {
+		print_trace(TRACE_ERROR, "hci_socket_pool_close : invalid pool reference.\n");
+		return;
+	}
+
+	for (uint8_t i = 0; i < pool->size; i++) {
+		if (pool->sockets[i].sock >= 0) {
+			close_hci_socket(&(pool->sockets[i]));
+		}
+	}
+	pool->size = 0;
+	pool->head = HCI_SOCKET_POOL_END;
+}
@@ -0,0 +1,565 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_transport.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef SO_MEMINFO
+#include <linux/sock_diag.h>
+#endif
+
+/* -------------------
+   - BLUEZ TRANSPORT -
+   -------------------
+*/
+
+static int8_t bluez_open(hci_socket_t *hci_socket, bt_address_t *adapter) {
+	if (adapter) {
+		char add[18];
+		ba2str(adapter, add);
+		hci_socket->dev_id = hci_devid(add);
+	} else {
+		hci_socket->dev_id = hci_get_route(NULL);
+	}
+
+	if (hci_socket->dev_id < 0) {
+		return -1;
+	}
+
+	hci_socket->sock = hci_open_dev(hci_socket->dev_id);
+	if (hci_socket->sock < 0) {
+		return -1;
+	}
+
+	/* Raw HCI sockets don't honour SO_TIMESTAMPNS : the kernel's reception time
+	   is given by the HCI timestamps (in microseconds).
+	*/
+	int opt = 1;
+	if (setsockopt(hci_socket->sock, SOL_HCI, HCI_TIME_STAMP, &opt, sizeof(opt)) < 0) {
+		print_trace(TRACE_WARNING, "bluez_open : no kernel timestamps, the reading times will be used.\n");
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+static void bluez_close(hci_socket_t *hci_socket) {
+	hci_close_dev(hci_socket->sock);
+}
+
+//------------------------------------------------------------------------------------
+
+static int bluez_send_cmd(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf, uint8_t plen, void *param) {
+	return hci_send_cmd(hci_socket->sock, ogf, ocf, plen, param);
+}
+
+//------------------------------------------------------------------------------------
+
+static int bluez_send_req(hci_socket_t *hci_socket, struct hci_request *rq, int timeout) {
+	return hci_send_req(hci_socket->sock, rq, timeout);
+}
+
+//------------------------------------------------------------------------------------
+
+static ssize_t bluez_read(hci_socket_t *hci_socket, void *buf, size_t length) {
+	return hci_transport_recv(hci_socket, buf, length);
+}
+
+//------------------------------------------------------------------------------------
+
+static int bluez_get_filter(hci_socket_t *hci_socket, struct hci_filter *flt) {
+	socklen_t flt_len = sizeof(struct hci_filter);
+	return getsockopt(hci_socket->sock, SOL_HCI, HCI_FILTER, (void *)flt, &flt_len);
+}
+
+//------------------------------------------------------------------------------------
+
+static int bluez_set_filter(hci_socket_t *hci_socket, const struct hci_filter *flt) {
+	return setsockopt(hci_socket->sock, SOL_HCI, HCI_FILTER, (const void *)flt,
+			  sizeof(struct hci_filter));
+}
+
+//------------------------------------------------------------------------------------
+
+static int bluez_inquiry(hci_socket_t *hci_socket, uint8_t duration, uint16_t max_rsp,
+			 inquiry_info **ii, long flags) {
+	return hci_inquiry(hci_socket->dev_id, duration, max_rsp, NULL, ii, flags);
+}
+
+//------------------------------------------------------------------------------------
+
+static int bluez_dev_info(hci_socket_t *hci_socket, struct hci_dev_info *info) {
+	return hci_devinfo(hci_socket->dev_id, info);
+}
+
+//------------------------------------------------------------------------------------
+
+/* Raw HCI sockets don't report their drop counter along with the events (SO_RXQ_OVFL
+   is ignored), but the kernel counts the events it drops on any socket.
+*/
+static int bluez_get_drops(hci_socket_t *hci_socket, uint32_t *drops) {
+#ifdef SO_MEMINFO
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t meminfo_len = sizeof(meminfo);
+	if (getsockopt(hci_socket->sock, SOL_SOCKET, SO_MEMINFO, meminfo, &meminfo_len) < 0) {
+		return -1;
+	}
+	if (meminfo_len <= SK_MEMINFO_DROPS * sizeof(uint32_t)) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	*drops = meminfo[SK_MEMINFO_DROPS];
+	return 0;
+#else
+	(void)hci_socket;
+	(void)drops;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+//------------------------------------------------------------------------------------
+
+static int bluez_set_receive_buffer(hci_socket_t *hci_socket, int size) {
+	if (size > 0 &&
+	    setsockopt(hci_socket->sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0 &&
+	    setsockopt(hci_socket->sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+		return -1;
+	}
+
+	int opt = 1;
+	if (setsockopt(hci_socket->sock, SOL_SOCKET, SO_RXQ_OVFL, &opt, sizeof(opt)) < 0) {
+		print_trace(TRACE_WARNING, "bluez_set_receive_buffer : the drops won't be reported "
+			    "along with the events.\n");
+	}
+
+	int rcvbuf = 0;
+	socklen_t rcvbuf_len = sizeof(rcvbuf);
+	if (getsockopt(hci_socket->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_len) < 0) {
+		return -1;
+	}
+	return rcvbuf;
+}
+
+//------------------------------------------------------------------------------------
+
+static int bluez_attach_filter(hci_socket_t *hci_socket, const struct sock_fprog *program) {
+	if (!program) {
+		int dummy = 0;
+		return setsockopt(hci_socket->sock, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy));
+	}
+	return setsockopt(hci_socket->sock, SOL_SOCKET, SO_ATTACH_FILTER, program, sizeof(struct sock_fprog));
+}
+
+//------------------------------------------------------------------------------------
+
+/* The kernel initializes the adapter again when it is brought up, the raw sockets stay
+   bound to it meanwhile. Requires the CAP_NET_ADMIN capability.
+*/
+static int bluez_restart(hci_socket_t *hci_socket) {
+	if (ioctl(hci_socket->sock, HCIDEVDOWN, hci_socket->dev_id) < 0) {
+		return -1;
+	}
+	if (ioctl(hci_socket->sock, HCIDEVUP, hci_socket->dev_id) < 0 && errno != EALREADY) {
+		return -1;
+	}
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+const hci_transport_t hci_bluez_transport = {
+	.name = "bluez",
+	.open = bluez_open,
+	.close = bluez_close,
+	.send_cmd = bluez_send_cmd,
+	.send_req = bluez_send_req,
+	.read = bluez_read,
+	.get_filter = bluez_get_filter,
+	.set_filter = bluez_set_filter,
+	.inquiry = bluez_inquiry,
+	.dev_info = bluez_dev_info,
+	.get_drops = bluez_get_drops,
+	.set_receive_buffer = bluez_set_receive_buffer,
+	.attach_filter = bluez_attach_filter,
+	.restart = bluez_restart
+};
+
+//------------------------------------------------------------------------------------
+
+/* ---------------------
+   - GENERIC FUNCTIONS -
+   ---------------------
+*/
+
+int hci_transport_generic_send_req(hci_socket_t *hci_socket, struct hci_request *rq, int timeout) {
+	const hci_transport_t *transport = hci_socket->transport;
+	uint8_t buf[HCI_MAX_EVENT_SIZE], *ptr;
+	uint16_t opcode = htobs(cmd_opcode_pack(rq->ogf, rq->ocf));
+	struct hci_filter nf, of;
+	hci_event_hdr *hdr;
+	ssize_t len;
+	int err;
+
+	if (get_hci_socket_cached_filter(hci_socket, &of) < 0) {
+		return -1;
+	}
+
+	hci_filter_clear(&nf);
+	hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
+	hci_filter_set_event(EVT_CMD_STATUS, &nf);
+	hci_filter_set_event(EVT_CMD_COMPLETE, &nf);
+	if (rq->event) { // LE subevents are only awaited by the requests setting an event
+		hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+		hci_filter_set_event(rq->event, &nf);
+	}
+	hci_filter_set_opcode(opcode, &nf);
+	if (apply_hci_socket_filter(hci_socket, &nf) < 0) {
+		return -1;
+	}
+
+	if (transport->send_cmd(hci_socket, rq->ogf, rq->ocf, rq->clen, rq->cparam) < 0) {
+		goto fail;
+	}
+
+	/* Unlike BlueZ, which gives up after 10 unrelated events, we wait until the deadline : 
+	   a socket flooded with advertising reports would otherwise never see its answer.
+	*/
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	while (1) {
+		evt_cmd_complete *cc;
+		evt_cmd_status *cs;
+		evt_le_meta_event *me;
+
+		if (timeout) {
+			struct pollfd p;
+			struct timespec now;
+			int n, remaining;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining = (deadline.tv_sec - now.tv_sec) * 1000 + 
+				(deadline.tv_nsec - now.tv_nsec) / 1000000L;
+			if (remaining <= 0) {
+				errno = ETIMEDOUT;
+				goto fail;
+			}
+
+			p.fd = hci_socket->sock; 
+			p.events = POLLIN;
+			while ((n = poll(&p, 1, remaining)) < 0) {
+				if (errno == EAGAIN || errno == EINTR) {
+					continue;
+				}
+				goto fail;
+			}
+
+			if (!n) {
+				errno = ETIMEDOUT;
+				goto fail;
+			}
+		}
+
+		while ((len = transport->read(hci_socket, buf, sizeof(buf))) < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			goto fail;
+		}
+
+		if (len < (ssize_t)(1 + HCI_EVENT_HDR_SIZE)) {
+			continue;
+		}
+
+		hdr = (void *)(buf + 1);
+		ptr = buf + (1 + HCI_EVENT_HDR_SIZE);
+		len -= (1 + HCI_EVENT_HDR_SIZE);
+
+		switch (hdr->evt) {
+		case EVT_CMD_STATUS:
+			cs = (void *)ptr;
+
+			if (cs->opcode != opcode) {
+				continue;
+			}
+
+			if (rq->event != EVT_CMD_STATUS) {
+				if (cs->status) {
+					errno = EIO;
+					goto fail;
+				}
+				break;
+			}
+
+			rq->rlen = (len < rq->rlen ? len : rq->rlen);
+			memcpy(rq->rparam, ptr, rq->rlen);
+			goto done;
+
+		case EVT_CMD_COMPLETE:
+			cc = (void *)ptr;
+
+			if (cc->opcode != opcode) {
+				continue;
+			}
+
+			ptr += EVT_CMD_COMPLETE_SIZE;
+			len -= EVT_CMD_COMPLETE_SIZE;
+
+			rq->rlen = (len < rq->rlen ? len : rq->rlen);
+			memcpy(rq->rparam, ptr, rq->rlen);
+			goto done;
+
+		case EVT_LE_META_EVENT:
+			me = (void *)ptr;
+
+			if (me->subevent != rq->event) {
+				continue;
+			}
+
+			len -= 1;
+			rq->rlen = (len < rq->rlen ? len : rq->rlen);
+			memcpy(rq->rparam, me->data, rq->rlen);
+			goto done;
+
+		default:
+			if (hdr->evt != rq->event) {
+				break;
+			}
+
+			rq->rlen = (len < rq->rlen ? len : rq->rlen);
+			memcpy(rq->rparam, ptr, rq->rlen);
+			goto done;
+		}
+	}
+
+ fail:
+	err = errno;
+	apply_hci_socket_filter(hci_socket, &of);
+	errno = err;
+	return -1;
+
+ done:
+	apply_hci_socket_filter(hci_socket, &of);
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+ssize_t hci_transport_recv(hci_socket_t *hci_socket, void *buf, size_t length) {
+	struct iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = length;
+
+	// Large enough for any of the timestamps and the drop counter :
+	union {
+		struct cmsghdr align;
+		uint8_t buf[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(struct timeval)) +
+			    CMSG_SPACE(sizeof(uint32_t))];
+	} control;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ssize_t len = recvmsg(hci_socket->sock, &msg, 0);
+	if (len < 0) {
+		return len;
+	}
+
+	char stamped = 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&(hci_socket->timestamp), CMSG_DATA(cmsg), sizeof(struct timespec));
+			stamped = 1;
+		} else if (cmsg->cmsg_level == SOL_HCI && cmsg->cmsg_type == HCI_CMSG_TSTAMP) {
+			struct timeval tv;
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof(struct timeval));
+			hci_socket->timestamp.tv_sec = tv.tv_sec;
+			hci_socket->timestamp.tv_nsec = tv.tv_usec * 1000L;
+			stamped = 1;
+		} else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+			uint32_t drops;
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+			hci_transport_account_drops(hci_socket, drops);
+		}
+	}
+	if (!stamped) {
+		clock_gettime(CLOCK_REALTIME, &(hci_socket->timestamp));
+	}
+
+	return len;
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_transport_account_drops(hci_socket_t *hci_socket, uint32_t drops) {
+	// The counter of the kernel may wrap around :
+	hci_socket->stats.dropped += (uint32_t)(drops - hci_socket->drops);
+	hci_socket->drops = drops;
+}
+
+//------------------------------------------------------------------------------------
+
+char hci_transport_filter_event(struct hci_filter *flt, const uint8_t *packet) {
+	uint8_t evt = packet[1];
+
+	if (!hci_filter_test_ptype(HCI_EVENT_PKT, flt) || !hci_filter_test_event(evt, flt)) {
+		return 0;
+	}
+
+	if (flt->opcode) {
+		uint16_t opcode;
+		if (evt == EVT_CMD_COMPLETE) {
+			memcpy(&opcode, packet + 1 + HCI_EVENT_HDR_SIZE + 1, 2);
+		} else if (evt == EVT_CMD_STATUS) {
+			memcpy(&opcode, packet + 1 + HCI_EVENT_HDR_SIZE + 2, 2);
+		} else {
+			return 1;
+		}
+		if (opcode != flt->opcode) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_transport_pairs_init(hci_transport_pair_t *pairs, uint8_t count) {
+	for (uint8_t i = 0; i < count; i++) {
+		pairs[i].fd = -1;
+		pairs[i].peer = -1;
+	}
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_transport_pair_open(hci_transport_pair_t *pairs, uint8_t count, hci_socket_t *hci_socket) {
+	hci_transport_pair_t *pair = NULL;
+	int fds[2];
+
+	for (uint8_t i = 0; i < count; i++) {
+		if (pairs[i].fd < 0) {
+			pair = &(pairs[i]);
+			break;
+		}
+	}
+	if (!pair) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+		return -1;
+	}
+
+	/* The "sock" field of a hci_socket being a int8_t, the descriptor has to fit. */
+	if (fds[0] > INT8_MAX) {
+		close(fds[0]);
+		close(fds[1]);
+		errno = EMFILE;
+		return -1;
+	}
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	int opt = 1;
+	if (setsockopt(fds[0], SOL_SOCKET, SO_TIMESTAMPNS, &opt, sizeof(opt)) < 0) {
+		print_trace(TRACE_WARNING, "hci_transport_pair_open : no kernel timestamps, "
+			    "the reading times will be used.\n");
+	}
+
+	pair->fd = fds[1];
+	pair->peer = fds[0];
+	memset(&(pair->filter), 0, sizeof(struct hci_filter));
+	pair->dropped = 0;
+
+	hci_socket->sock = fds[0];
+	hci_socket->dev_id = 0;
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+hci_transport_pair_t *hci_transport_pair_get(hci_transport_pair_t *pairs, uint8_t count, int peer) {
+	for (uint8_t i = 0; i < count; i++) {
+		if (pairs[i].fd >= 0 && pairs[i].peer == peer) {
+			return &(pairs[i]);
+		}
+	}
+	return NULL;
+}
+
+//------------------------------------------------------------------------------------
+
+int hci_transport_pair_set_receive_buffer(hci_transport_pair_t *pair, int size) {
+	if (size > 0 &&
+	    setsockopt(pair->fd, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) < 0 &&
+	    setsockopt(pair->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0) {
+		return -1;
+	}
+
+	int sndbuf = 0;
+	socklen_t sndbuf_len = sizeof(sndbuf);
+	if (getsockopt(pair->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &sndbuf_len) < 0) {
+		return -1;
+	}
+	return sndbuf;
+}
+
+//------------------------------------------------------------------------------------
+
+int hci_transport_pair_attach_filter(hci_transport_pair_t *pair, const struct sock_fprog *program) {
+	if (!program) {
+		int dummy = 0;
+		return setsockopt(pair->peer, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy));
+	}
+	return setsockopt(pair->peer, SOL_SOCKET, SO_ATTACH_FILTER, program, sizeof(struct sock_fprog));
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_transport_pair_close(hci_transport_pair_t *pair) {
+	close(pair->fd);
+	pair->fd = -1;
+	pair->peer = -1;
+}
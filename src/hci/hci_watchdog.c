@@ -0,0 +1,409 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_watchdog.h"
+#include "hci_white_list.h"
+#include "trace.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static inline uint64_t hci_watchdog_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000ULL + (uint64_t)now.tv_nsec / 1000000ULL;
+}
+
+//---------------------------------
+
+/* Static function probing the adapter : an error status still means that it answers. */
+static int8_t hci_watchdog_probe(hci_watchdog_t *watchdog) {
+	read_local_version_rp rp;
+	if (send_hci_socket_simple_req(&(watchdog->hci_socket), OGF_INFO_PARAM, OCF_READ_LOCAL_VERSION,
+				       NULL, 0, &rp, READ_LOCAL_VERSION_RP_SIZE,
+				       watchdog->config.probe_timeout) < 0 && errno != EIO) {
+		return -1;
+	}
+	return 0;
+}
+
+//---------------------------------
+
+/* Static function performing one level of recovery. */
+static int8_t hci_watchdog_escalate(hci_watchdog_t *watchdog, hci_watchdog_level_t level) {
+	hci_controller_t *hci_controller = watchdog->hci_controller;
+	hci_socket_t *hci_socket = &(watchdog->hci_socket);
+
+	print_trace(TRACE_WARNING, "hci_watchdog : recovering %s (level %i).\n",
+		    hci_controller->device.custom_name, level);
+	switch (level) {
+	case HCI_WATCHDOG_LEVEL_SCAN_DISABLE :
+		return hci_force_scan_disable(hci_socket, hci_controller, watchdog->config.probe_timeout);
+	case HCI_WATCHDOG_LEVEL_RESET :
+		return hci_reset_adapter(hci_socket, hci_controller, watchdog->config.probe_timeout);
+	case HCI_WATCHDOG_LEVEL_RESTART :
+		if (hci_socket->transport->restart(hci_socket) < 0) {
+			perror("hci_watchdog : restart");
+			return -1;
+		}
+		hci_controller->inquiry_mode = HCI_INQUIRY_MODE_UNKNOWN;
+		return 0;
+	default :
+		return -1;
+	}
+}
+
+//---------------------------------
+
+/* Static function programming the configuration of the controller into the adapter again
+   once it answers : the white list (lost with the resets) and the scan of the session.
+*/
+static int8_t hci_watchdog_restore(hci_watchdog_t *watchdog, hci_watchdog_level_t level,
+				   hci_scan_session_t *session, hci_white_list_t *white_list) {
+	if (level >= HCI_WATCHDOG_LEVEL_RESET && white_list && hci_white_list_restore(white_list) < 0) {
+		return -1;
+	}
+	if (session && hci_LE_scan_session_restore(session, &(watchdog->hci_socket)) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+//---------------------------------
+
+/* Static function recovering the adapter, from the level following the one of the last
+   recovery. The controller is taken for the recovery if it is idle, or if its owner gave
+   up (interrupted controller) : a state whose owner still runs is never taken. A scan
+   session owning the controller is restored on its behalf instead. The lock of the
+   controller is only held to take this snapshot : the session and the white list are
+   kept registered meanwhile by the "restoring" flag.
+*/
+static void hci_watchdog_recover(hci_watchdog_t *watchdog) {
+	hci_controller_t *hci_controller = watchdog->hci_controller;
+	hci_watchdog_level_t level = HCI_WATCHDOG_LEVEL_NONE;
+	int8_t res = -1;
+
+	pthread_mutex_lock(&(hci_controller->lock));
+	hci_scan_session_t *session = hci_controller->scan_session;
+	hci_white_list_t *white_list = hci_controller->white_list;
+	hci_state_t state = __atomic_load_n(&(hci_controller->state), __ATOMIC_ACQUIRE);
+	if (!session && ((state != HCI_STATE_OPEN && !hci_controller->interrupted) ||
+			 state == HCI_STATE_CLOSED || state == HCI_STATE_RECOVERING ||
+			 hci_change_state(hci_controller, state, HCI_STATE_RECOVERING) < 0)) {
+		pthread_mutex_unlock(&(hci_controller->lock));
+		print_trace(TRACE_DEBUG, "hci_watchdog : %s left to its owner.\n", hci_controller->device.custom_name);
+		return;
+	}
+	hci_controller->restoring = 1;
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	level = watchdog->level + 1;
+	if (level > watchdog->config.max_level) {
+		level = watchdog->config.max_level;
+	}
+	for (; level <= watchdog->config.max_level; level++) {
+		if (hci_watchdog_escalate(watchdog, level) == 0 && hci_watchdog_probe(watchdog) == 0 &&
+		    hci_watchdog_restore(watchdog, level, session, white_list) == 0) {
+			res = 0;
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&(hci_controller->lock));
+	if (res == 0) {
+		hci_controller->interrupted = 0;
+	}
+	hci_controller->restoring = 0;
+	pthread_cond_broadcast(&(hci_controller->restored));
+	pthread_mutex_unlock(&(hci_controller->lock));
+	if (!session) {
+		hci_change_state(hci_controller, HCI_STATE_RECOVERING, HCI_STATE_OPEN);
+	}
+
+	// The adapter is given a whole period (or stall time) to show that it works again :
+	watchdog->missed = 0;
+	watchdog->session_since = watchdog->state_since = hci_watchdog_now();
+	pthread_mutex_lock(&(watchdog->mutex));
+	if (res == 0) {
+		print_trace(TRACE_INFO, "hci_watchdog : %s recovered (level %i).\n",
+			    hci_controller->device.custom_name, level);
+		watchdog->level = level;
+		watchdog->stats.recoveries[level]++;
+	} else {
+		print_trace(TRACE_ERROR, "hci_watchdog : unable to recover %s.\n", hci_controller->device.custom_name);
+		watchdog->level = HCI_WATCHDOG_LEVEL_NONE;
+		watchdog->stats.failures++;
+	}
+	pthread_mutex_unlock(&(watchdog->mutex));
+}
+
+//---------------------------------
+
+/* Static function checking the adapter, and recovering it if needed. */
+static void hci_watchdog_check(hci_watchdog_t *watchdog) {
+	hci_controller_t *hci_controller = watchdog->hci_controller;
+	hci_state_t state = __atomic_load_n(&(hci_controller->state), __ATOMIC_ACQUIRE);
+	uint64_t now = hci_watchdog_now();
+
+	if (state == HCI_STATE_CLOSED || state == HCI_STATE_RECOVERING) {
+		return;
+	}
+
+	char alive = (hci_watchdog_probe(watchdog) == 0);
+	pthread_mutex_lock(&(watchdog->mutex));
+	watchdog->stats.checks++;
+	if (!alive) {
+		watchdog->stats.missed_probes++;
+	}
+	pthread_mutex_unlock(&(watchdog->mutex));
+	watchdog->missed = alive ? 0 : watchdog->missed + 1;
+
+	uint32_t state_changes = __atomic_load_n(&(hci_controller->state_changes), __ATOMIC_RELAXED);
+	if (state_changes != watchdog->state_changes) {
+		watchdog->state_changes = state_changes;
+		watchdog->state_since = now;
+		watchdog->stuck = 0;
+	}
+
+	/* The session is considered as active as long as it receives reports, or some events
+	   are waiting to be read on its socket.
+	*/
+	char healthy = alive;
+	char stalled = 0;
+	pthread_mutex_lock(&(hci_controller->lock));
+	const hci_scan_session_t *session = hci_controller->scan_session;
+	if (session && watchdog->config.stall_time) {
+		uint64_t reports = (__atomic_load_n(&(session->hci_socket.stats.delivered), __ATOMIC_RELAXED) +
+				    __atomic_load_n(&(session->hci_socket.stats.filtered), __ATOMIC_RELAXED));
+		struct pollfd pfd = {session->hci_socket.sock, POLLIN, 0};
+		if (session != watchdog->session || reports != watchdog->session_reports || poll(&pfd, 1, 0) > 0) {
+			watchdog->session_reports = reports;
+			watchdog->session_since = now;
+		} else {
+			healthy = 0;
+			stalled = (now - watchdog->session_since >= watchdog->config.stall_time);
+		}
+	}
+	watchdog->session = session;
+	char interrupted = hci_controller->interrupted;
+	char stuck = (!session && !interrupted && state != HCI_STATE_OPEN &&
+		      now - watchdog->state_since >= watchdog->config.stuck_time);
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	/* The owner of a stuck state didn't give up (it would have marked the controller as
+	   interrupted) : the state is reported once, but left to it.
+	*/
+	if (stuck && !watchdog->stuck) {
+		print_trace(TRACE_WARNING, "hci_watchdog : %s is stuck in state %i.\n",
+			    hci_controller->device.custom_name, state);
+		watchdog->stuck = 1;
+		pthread_mutex_lock(&(watchdog->mutex));
+		watchdog->stats.stuck_states++;
+		pthread_mutex_unlock(&(watchdog->mutex));
+	}
+
+	if (interrupted && alive && hci_resolve_interruption(&(watchdog->hci_socket), hci_controller) == 0) {
+		pthread_mutex_lock(&(watchdog->mutex));
+		watchdog->stats.recoveries[HCI_WATCHDOG_LEVEL_NONE]++;
+		pthread_mutex_unlock(&(watchdog->mutex));
+		return;
+	}
+
+	if (watchdog->missed >= watchdog->config.max_missed || stalled || interrupted) {
+		print_trace(TRACE_WARNING, "hci_watchdog : %s %s.\n", hci_controller->device.custom_name,
+			    (watchdog->missed >= watchdog->config.max_missed) ? "doesn't answer" :
+			    (stalled ? "stopped scanning" : "is interrupted"));
+		hci_watchdog_recover(watchdog);
+	} else if (healthy) {
+		watchdog->level = HCI_WATCHDOG_LEVEL_NONE;
+	}
+}
+
+//---------------------------------
+
+static void *hci_watchdog_routine(void *data) {
+	hci_watchdog_t *watchdog = (hci_watchdog_t *)data;
+	struct timespec wakeup;
+
+	pthread_mutex_lock(&(watchdog->mutex));
+	while (watchdog->running) {
+		clock_gettime(CLOCK_MONOTONIC, &wakeup);
+		wakeup.tv_sec += watchdog->config.period / 1000;
+		wakeup.tv_nsec += (watchdog->config.period % 1000) * 1000000L;
+		if (wakeup.tv_nsec >= 1000000000L) {
+			wakeup.tv_sec++;
+			wakeup.tv_nsec -= 1000000000L;
+		}
+		while (watchdog->running &&
+		       pthread_cond_timedwait(&(watchdog->cond), &(watchdog->mutex), &wakeup) != ETIMEDOUT);
+		if (!watchdog->running) {
+			break;
+		}
+		pthread_mutex_unlock(&(watchdog->mutex));
+		hci_watchdog_check(watchdog);
+		pthread_mutex_lock(&(watchdog->mutex));
+	}
+	pthread_mutex_unlock(&(watchdog->mutex));
+
+	return NULL;
+}
+
+/*----------------------
+  - WATCHDOG FUNCTIONS -
+  ----------------------*/
+
+hci_watchdog_config_t hci_watchdog_default_config(void) {
+	hci_watchdog_config_t config;
+	memset(&config, 0, sizeof(config));
+	config.period = HCI_WATCHDOG_DEFAULT_PERIOD;
+	config.probe_timeout = HCI_WATCHDOG_DEFAULT_PROBE_TIMEOUT;
+	config.max_missed = HCI_WATCHDOG_DEFAULT_MAX_MISSED;
+	config.stuck_time = HCI_WATCHDOG_DEFAULT_STUCK_TIME;
+	config.stall_time = 0;
+	config.max_level = HCI_WATCHDOG_LEVEL_RESTART;
+	return config;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_watchdog_start(hci_watchdog_t *watchdog, hci_controller_t *hci_controller,
+			  const hci_watchdog_config_t *config) {
+	if (!watchdog || !hci_controller) {
+		print_trace(TRACE_ERROR, "hci_watchdog_start : invalid arguments.\n");
+		return -1;
+	}
+
+	if (__atomic_load_n(&(hci_controller->state), __ATOMIC_ACQUIRE) == HCI_STATE_CLOSED) {
+		print_trace(TRACE_ERROR, "hci_watchdog_start : closed controller.\n");
+		return -1;
+	}
+
+	memset(watchdog, 0, sizeof(hci_watchdog_t));
+	watchdog->hci_controller = hci_controller;
+	watchdog->config = config ? *config : hci_watchdog_default_config();
+	if (!watchdog->config.period || !watchdog->config.max_missed ||
+	    watchdog->config.max_level < HCI_WATCHDOG_LEVEL_SCAN_DISABLE ||
+	    watchdog->config.max_level > HCI_WATCHDOG_LEVEL_RESTART) {
+		print_trace(TRACE_ERROR, "hci_watchdog_start : invalid configuration.\n");
+		watchdog->hci_controller = NULL;
+		return -1;
+	}
+	watchdog->state_changes = __atomic_load_n(&(hci_controller->state_changes), __ATOMIC_RELAXED);
+	watchdog->state_since = watchdog->session_since = hci_watchdog_now();
+	watchdog->stuck = 0;
+
+	watchdog->hci_socket = open_hci_socket_transport(hci_controller->transport,
+							  hci_controller->transport_data,
+							  &(hci_controller->device.mac));
+	if (watchdog->hci_socket.sock < 0) {
+		watchdog->hci_controller = NULL;
+		return -1;
+	}
+	// Nothing is queued on the socket between two requests :
+	struct hci_filter flt;
+	hci_filter_clear(&flt);
+	if (apply_hci_socket_filter(&(watchdog->hci_socket), &flt) < 0) {
+		goto fail;
+	}
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&(watchdog->mutex), NULL);
+	pthread_cond_init(&(watchdog->cond), &attr);
+	pthread_condattr_destroy(&attr);
+
+	pthread_mutex_lock(&(hci_controller->lock));
+	if (hci_controller->watchdog) {
+		pthread_mutex_unlock(&(hci_controller->lock));
+		print_trace(TRACE_ERROR, "hci_watchdog_start : the controller already has a watchdog.\n");
+		goto fail_thread;
+	}
+	watchdog->running = 1;
+	if (pthread_create(&(watchdog->thread), NULL, &hci_watchdog_routine, watchdog) != 0) {
+		pthread_mutex_unlock(&(hci_controller->lock));
+		perror("hci_watchdog_start");
+		goto fail_thread;
+	}
+	hci_controller->watchdog = watchdog;
+	pthread_mutex_unlock(&(hci_controller->lock));
+
+	return 0;
+
+ fail_thread:
+	watchdog->running = 0;
+	pthread_cond_destroy(&(watchdog->cond));
+	pthread_mutex_destroy(&(watchdog->mutex));
+ fail:
+	close_hci_socket(&(watchdog->hci_socket));
+	watchdog->hci_controller = NULL;
+	return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_watchdog_get_stats(hci_watchdog_t *watchdog, hci_watchdog_stats_t *stats) {
+	if (!watchdog || !watchdog->hci_controller || !stats) {
+		print_trace(TRACE_ERROR, "hci_watchdog_get_stats : invalid arguments.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(watchdog->mutex));
+	*stats = watchdog->stats;
+	pthread_mutex_unlock(&(watchdog->mutex));
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t hci_watchdog_stop(hci_watchdog_t *watchdog) {
+	if (!watchdog || !watchdog->hci_controller) {
+		print_trace(TRACE_ERROR, "hci_watchdog_stop : inactive watchdog.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(watchdog->hci_controller->lock));
+	if (watchdog->hci_controller->watchdog == watchdog) {
+		watchdog->hci_controller->watchdog = NULL;
+	}
+	pthread_mutex_unlock(&(watchdog->hci_controller->lock));
+
+	pthread_mutex_lock(&(watchdog->mutex));
+	watchdog->running = 0;
+	pthread_cond_signal(&(watchdog->cond));
+	pthread_mutex_unlock(&(watchdog->mutex));
+	pthread_join(watchdog->thread, NULL);
+
+	close_hci_socket(&(watchdog->hci_socket));
+	pthread_cond_destroy(&(watchdog->cond));
+	pthread_mutex_destroy(&(watchdog->mutex));
+	watchdog->hci_controller = NULL;
+
+	return 0;
+}
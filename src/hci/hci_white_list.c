@@ -0,0 +1,377 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "hci_white_list.h"
+#include "hci_cmd_queue.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+static int hci_white_list_compare(const void *a, const void *b) {
+	const hci_white_list_entry_t *e1 = (const hci_white_list_entry_t *)a;
+	const hci_white_list_entry_t *e2 = (const hci_white_list_entry_t *)b;
+	int res = memcmp(&(e1->mac), &(e2->mac), sizeof(bt_address_t));
+	if (!res) {
+		res = (int)e1->add_type - (int)e2->add_type;
+	}
+	return res;
+}
+
+//---------------------------------
+
+/* Static function looking for an entry in a sorted table. If "add_type" is < 0, only
+   the address is compared.
+*/
+static const hci_white_list_entry_t *hci_white_list_find(const hci_white_list_entry_t *entries, uint16_t length,
+							 const bt_address_t *mac, int16_t add_type) {
+	int32_t low = 0;
+	int32_t high = (int32_t)length - 1;
+	while (low <= high) {
+		int32_t mid = (low + high) / 2;
+		int res = memcmp(&(entries[mid].mac), mac, sizeof(bt_address_t));
+		if (!res && add_type >= 0) {
+			res = (int)entries[mid].add_type - add_type;
+		}
+		if (!res) {
+			return &(entries[mid]);
+		}
+		if (res < 0) {
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return NULL;
+}
+
+//---------------------------------
+
+/* Static function building the sorted table of the given devices, without duplicates.
+   Returns its length, -1 if it couldn't be allocated.
+*/
+static int32_t hci_white_list_build(const bt_device_t *devices, uint16_t length, hci_white_list_entry_t **entries) {
+	*entries = NULL;
+	if (!length) {
+		return 0;
+	}
+	*entries = malloc(length * sizeof(hci_white_list_entry_t));
+	if (!*entries) {
+		perror("hci_white_list_sync");
+		return -1;
+	}
+
+	for (uint16_t i = 0; i < length; i++) {
+		(*entries)[i].mac = devices[i].mac;
+		(*entries)[i].add_type = (devices[i].add_type == UNKNOWN_ADDRESS_TYPE) ?
+			PUBLIC_DEVICE_ADDRESS : devices[i].add_type;
+	}
+	qsort(*entries, length, sizeof(hci_white_list_entry_t), hci_white_list_compare);
+	uint16_t unique = 0;
+	for (uint16_t i = 0; i < length; i++) {
+		if (unique && !hci_white_list_compare(&((*entries)[unique - 1]), &((*entries)[i]))) {
+			continue;
+		}
+		(*entries)[unique++] = (*entries)[i];
+	}
+
+	return unique;
+}
+
+//---------------------------------
+
+/* Static function replacing the devices of the manager with the given table (the lock has
+   to be held for writing). The devices which weren't already part of them are registered.
+*/
+static void hci_white_list_set_devices(hci_white_list_t *white_list, hci_white_list_entry_t *entries,
+				       uint16_t unique, const bt_device_t *devices, uint16_t length) {
+	// Only the new devices are looked for in the table of the registered devices :
+	for (uint16_t i = 0; i < length; i++) {
+		if (hci_white_list_find(white_list->devices, white_list->length, &(devices[i].mac), -1)) {
+			continue;
+		}
+		if (!bt_already_registered_device(devices[i].mac)) {
+			bt_register_device(devices[i]);
+		}
+	}
+
+	free(white_list->devices);
+	white_list->devices = entries;
+	white_list->length = unique;
+	white_list->allocated = length;
+}
+
+/*------------------------
+  - WHITE LIST FUNCTIONS -
+  ------------------------*/
+
+int8_t hci_white_list_init(hci_white_list_t *white_list, hci_controller_t *hci_controller) {
+	if (!white_list || !hci_controller) {
+		print_trace(TRACE_ERROR, "hci_white_list_init : invalid arguments.\n");
+		return -1;
+	}
+	memset(white_list, 0, sizeof(hci_white_list_t));
+
+	if (hci_LE_get_white_list_size(NULL, hci_controller, &(white_list->capacity)) < 0) {
+		print_trace(TRACE_ERROR, "hci_white_list_init : unable to read the white list size.\n");
+		return -1;
+	}
+	if (hci_LE_clear_white_list(NULL, hci_controller) < 0) {
+		print_trace(TRACE_ERROR, "hci_white_list_init : unable to clear the white list.\n");
+		return -1;
+	}
+	white_list->hci_controller = hci_controller;
+	pthread_rwlock_init(&(white_list->lock), NULL);
+	pthread_mutex_lock(&(hci_controller->lock));
+	hci_controller->white_list = white_list;
+	pthread_mutex_unlock(&(hci_controller->lock));
+	print_trace(TRACE_DEBUG, "hci_white_list_init : %u entries in the white list.\n", white_list->capacity);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_white_list_sync(hci_white_list_t *white_list, const bt_device_t *devices, uint16_t length) {
+	if (!white_list || !white_list->hci_controller || (length && !devices)) {
+		print_trace(TRACE_ERROR, "hci_white_list_sync : invalid arguments.\n");
+		return -1;
+	}
+
+	/* Nothing is changed unless the controller is idle : a scan would keep filtering on
+	   the former list while the batches filter on the new one.
+	*/
+	if (__atomic_load_n(&(white_list->hci_controller->state), __ATOMIC_ACQUIRE) != HCI_STATE_OPEN) {
+		print_trace(TRACE_ERROR, "hci_white_list_sync : busy or closed controller.\n");
+		return -1;
+	}
+
+	hci_white_list_entry_t *entries;
+	int32_t unique = hci_white_list_build(devices, length, &entries);
+	if (unique < 0) {
+		return -1;
+	}
+
+	if (unique > white_list->capacity) {
+		print_trace(TRACE_INFO, "hci_white_list_sync : %i devices for %u entries, filtering on the host.\n",
+			    unique, white_list->capacity);
+		pthread_rwlock_wrlock(&(white_list->lock));
+		hci_white_list_set_devices(white_list, entries, unique, devices, length);
+		white_list->host_filtering = 1;
+		pthread_rwlock_unlock(&(white_list->lock));
+		return 0;
+	}
+
+	/* Both lists being sorted, their differences are found by binary searches : the
+	   removals are sent first, to make room for the additions.
+	*/
+	uint16_t nb_cmds = 0;
+	hci_cmd_t *cmds = calloc(white_list->shadow_length + unique + 1, sizeof(hci_cmd_t));
+	hci_white_list_entry_t *targets = calloc(white_list->shadow_length + unique + 1,
+						 sizeof(hci_white_list_entry_t));
+	int16_t res = -1;
+	if (!cmds || !targets) {
+		perror("hci_white_list_sync");
+		free(entries);
+		goto end;
+	}
+	for (uint16_t i = 0; i < white_list->shadow_length; i++) {
+		if (!hci_white_list_find(entries, unique, &(white_list->shadow[i].mac), white_list->shadow[i].add_type)) {
+			targets[nb_cmds++] = white_list->shadow[i];
+		}
+	}
+	uint16_t nb_removals = nb_cmds;
+	for (int32_t i = 0; i < unique; i++) {
+		if (!hci_white_list_find(white_list->shadow, white_list->shadow_length, &(entries[i].mac),
+					 entries[i].add_type)) {
+			targets[nb_cmds++] = entries[i];
+		}
+	}
+
+	for (uint16_t i = 0; i < nb_cmds; i++) {
+		le_add_device_to_white_list_cp cp;
+		cp.bdaddr_type = targets[i].add_type;
+		bacpy(&(cp.bdaddr), &(targets[i].mac));
+		hci_cmd_init(&(cmds[i]), OGF_LE_CTL, (i < nb_removals ? OCF_LE_REMOVE_DEVICE_FROM_WHITE_LIST :
+						     OCF_LE_ADD_DEVICE_TO_WHITE_LIST), &cp, sizeof(cp), NULL, NULL);
+	}
+	// The controller is reserved while the commands run, and checked again :
+	if (nb_cmds && hci_run_cmds(white_list->hci_controller, cmds, nb_cmds) < 0) {
+		free(entries);
+		goto end;
+	}
+
+	pthread_rwlock_wrlock(&(white_list->lock));
+	hci_white_list_set_devices(white_list, entries, unique, devices, length);
+
+	// Updating the shadow copy with the commands which succeeded :
+	uint8_t kept = 0;
+	for (uint16_t i = 0; i < white_list->shadow_length; i++) {
+		const hci_white_list_entry_t *removal = hci_white_list_find(targets, nb_removals,
+									    &(white_list->shadow[i].mac),
+									    white_list->shadow[i].add_type);
+		if (removal && !cmds[removal - targets].result && !cmds[removal - targets].status) {
+			continue;
+		}
+		white_list->shadow[kept++] = white_list->shadow[i];
+	}
+	for (uint16_t i = nb_removals; i < nb_cmds; i++) {
+		if (cmds[i].result < 0 || cmds[i].status) {
+			print_trace(TRACE_WARNING, "hci_white_list_sync : command %u failed (status 0x%02X).\n",
+				    i, cmds[i].status);
+			continue;
+		}
+		if (kept < HCI_WHITE_LIST_MAX_SIZE) {
+			white_list->shadow[kept++] = targets[i];
+		}
+	}
+	white_list->shadow_length = kept;
+	qsort(white_list->shadow, kept, sizeof(hci_white_list_entry_t), hci_white_list_compare);
+
+	// The host filters the devices as long as the controller's list differs from them :
+	white_list->host_filtering = (white_list->shadow_length != white_list->length ||
+				      memcmp(white_list->shadow, white_list->devices,
+					     kept * sizeof(hci_white_list_entry_t)));
+	pthread_rwlock_unlock(&(white_list->lock));
+	if (white_list->host_filtering) {
+		print_trace(TRACE_WARNING, "hci_white_list_sync : white list partially set, filtering on the host.\n");
+	}
+	res = nb_cmds;
+
+ end:
+	free(cmds);
+	free(targets);
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t hci_white_list_restore(hci_white_list_t *white_list) {
+	if (!white_list || !white_list->hci_controller) {
+		print_trace(TRACE_ERROR, "hci_white_list_restore : invalid arguments.\n");
+		return -1;
+	}
+
+	/* The commands are sent through a queue of their own rather than with hci_run_cmds :
+	   the controller is owned by the caller, not idle.
+	*/
+	hci_cmd_queue_t queue;
+	if (hci_cmd_queue_open(&queue, white_list->hci_controller, HCI_CONTROLLER_DEFAULT_TIMEOUT) < 0) {
+		return -1;
+	}
+	hci_cmd_t *cmds = calloc(white_list->shadow_length + 1, sizeof(hci_cmd_t));
+	if (!cmds) {
+		perror("hci_white_list_restore");
+		hci_cmd_queue_close(&queue);
+		return -1;
+	}
+
+	hci_cmd_init(&(cmds[0]), OGF_LE_CTL, OCF_LE_CLEAR_WHITE_LIST, NULL, 0, NULL, NULL);
+	for (uint16_t i = 0; i < white_list->shadow_length; i++) {
+		le_add_device_to_white_list_cp cp;
+		cp.bdaddr_type = white_list->shadow[i].add_type;
+		bacpy(&(cp.bdaddr), &(white_list->shadow[i].mac));
+		hci_cmd_init(&(cmds[i + 1]), OGF_LE_CTL, OCF_LE_ADD_DEVICE_TO_WHITE_LIST, &cp, sizeof(cp), NULL, NULL);
+	}
+	for (uint16_t i = 0; i <= white_list->shadow_length; i++) {
+		hci_cmd_queue_submit(&queue, &(cmds[i]));
+	}
+	hci_cmd_queue_flush(&queue);
+	hci_cmd_queue_close(&queue);
+
+	int16_t res = -1;
+	if (cmds[0].result < 0 || cmds[0].status) {
+		print_trace(TRACE_ERROR, "hci_white_list_restore : unable to clear the white list.\n");
+		goto end;
+	}
+
+	// The shadow copy keeps the devices added again, the others are filtered by the host :
+	pthread_rwlock_wrlock(&(white_list->lock));
+	uint8_t kept = 0;
+	for (uint16_t i = 0; i < white_list->shadow_length; i++) {
+		if (cmds[i + 1].result < 0 || cmds[i + 1].status) {
+			print_trace(TRACE_WARNING, "hci_white_list_restore : device %u not added (status 0x%02X).\n",
+				    i, cmds[i + 1].status);
+			continue;
+		}
+		white_list->shadow[kept++] = white_list->shadow[i];
+	}
+	white_list->shadow_length = kept;
+	if (white_list->length <= white_list->capacity) {
+		white_list->host_filtering = (white_list->shadow_length != white_list->length ||
+					      memcmp(white_list->shadow, white_list->devices,
+						     kept * sizeof(hci_white_list_entry_t)));
+	}
+	pthread_rwlock_unlock(&(white_list->lock));
+	res = kept;
+
+ end:
+	free(cmds);
+	return res;
+}
+
+//------------------------------------------------------------------------------------
+
+uint8_t hci_white_list_scan_filter_policy(hci_white_list_t *white_list) {
+	pthread_rwlock_rdlock(&(white_list->lock));
+	uint8_t policy = (white_list->length && !white_list->host_filtering) ? 0x01 : 0x00;
+	pthread_rwlock_unlock(&(white_list->lock));
+	return policy;
+}
+
+//------------------------------------------------------------------------------------
+
+char hci_white_list_accept(hci_white_list_t *white_list, const bt_address_t *mac) {
+	pthread_rwlock_rdlock(&(white_list->lock));
+	char accepted = (!white_list->length ||
+			 hci_white_list_find(white_list->devices, white_list->length, mac, -1) != NULL);
+	pthread_rwlock_unlock(&(white_list->lock));
+	return accepted;
+}
+
+//------------------------------------------------------------------------------------
+
+void hci_white_list_destroy(hci_white_list_t *white_list) {
+	if (!white_list) {
+		return;
+	}
+	hci_controller_t *hci_controller = white_list->hci_controller;
+	if (hci_controller && __atomic_load_n(&(hci_controller->state), __ATOMIC_ACQUIRE) != HCI_STATE_CLOSED) {
+		pthread_mutex_lock(&(hci_controller->lock));
+		while (hci_controller->restoring) { // The watchdog may be writing it back
+			pthread_cond_wait(&(hci_controller->restored), &(hci_controller->lock));
+		}
+		if (hci_controller->white_list == white_list) {
+			hci_controller->white_list = NULL;
+		}
+		pthread_mutex_unlock(&(hci_controller->lock));
+	}
+	free(white_list->devices);
+	if (hci_controller) {
+		pthread_rwlock_destroy(&(white_list->lock));
+	}
+	memset(white_list, 0, sizeof(hci_white_list_t));
+}
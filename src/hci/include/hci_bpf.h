@@ -0,0 +1,149 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+/**
+ * @file hci_bpf.h
+ * @brief Module bluez_tools.hci.hci_bpf filtering the reports in the kernel.
+ *
+ * While scanning in busy places, most of the advertising reports come from devices
+ * which aren't tracked, and each of them is copied to the user space and decoded.
+ * This module compiles the set of the tracked devices into a classic BPF program
+ * which, once attached to a socket (SO_ATTACH_FILTER), makes the kernel drop the
+ * other reports before they are queued on the socket.
+ * A report passes the program if it matches any of the criteria : its address is
+ * one of the given ones, or its advertising data contains the given manufacturer
+ * (company) identifier or 16-bit service UUID. The events which aren't reports pass,
+ * as well as the events carrying several reports, which BPF can't look through : the
+ * program is only a first sieve, the reports still have to be filtered by the host
+ * (@see hci_white_list_accept). The data is looked through for its first
+ * {@code HCI_BPF_AD_STRUCTURES} AD structures, and only the first three UUIDs of a
+ * UUID list are compared. The classic inquiry results are matched by address only.
+ * The program is meant to be attached to the dedicated socket of a scan session, from
+ * its start to its end :
+ * {@code
+ * hci_bpf_program_t program;
+ * hci_bpf_match_t match = {.addresses = tags, .nb_addresses = nb_tags};
+ * hci_bpf_compile(&program, &match);
+ * hci_LE_start_filtered_scan_session(&session, &hci_controller, &program, 0, 0x00, 0x10, 0x10,
+ *				      0x00, 0x00);
+ * hci_bpf_free(&program); // The kernel has its own copy
+ * ...
+ * hci_LE_stop_scan_session(&session);
+ * }
+ * The program is attached through the transport of the socket (@see hci_transport_t).
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_BPF_H__
+#define __HCI_BPF_H__
+
+#include <stdint.h>
+#include <linux/filter.h>
+#include "hci_socket.h"
+
+/**
+ * Maximum number of addresses of a program (a program has at most 4096 instructions).
+ */
+#define HCI_BPF_MAX_ADDRESSES 640
+
+/**
+ * Number of AD structures of an advertising data looked through by a program.
+ */
+#define HCI_BPF_AD_STRUCTURES 8
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Criteria of the reports to let through.
+ */
+typedef struct hci_bpf_match_t {
+	/**
+	 * Addresses of the devices (at most {@code HCI_BPF_MAX_ADDRESSES}).
+	 */
+	const bt_address_t *addresses;
+	uint16_t nb_addresses;
+	/**
+	 * Manufacturer identifier to look for in the "Manufacturer Specific Data" AD
+	 * structures, if {@code match_company} is set.
+	 */
+	char match_company;
+	uint16_t company_id;
+	/**
+	 * 16-bit service UUID to look for in the lists of 16-bit UUIDs, if
+	 * {@code match_uuid16} is set.
+	 */
+	char match_uuid16;
+	uint16_t uuid16;
+} hci_bpf_match_t;
+
+/**
+ * Compiled program.
+ */
+typedef struct hci_bpf_program_t {
+	struct sock_filter *instructions;
+	uint16_t length;
+} hci_bpf_program_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Compiles the given criteria into a BPF program.
+ * @param program program to fill, to be freed with {@code hci_bpf_free}.
+ * @param match criteria of the reports to let through (at least one criterion).
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_bpf_compile(hci_bpf_program_t *program, const hci_bpf_match_t *match);
+
+/**
+ * @brief Frees a compiled program.
+ * @param program the program.
+ */
+extern void hci_bpf_free(hci_bpf_program_t *program);
+
+/**
+ * @brief Attaches a program to a socket, replacing the previous one if any. The kernel
+ * keeps its own copy of the program. The program applies in addition to the HCI filter
+ * of the socket (@see apply_hci_socket_filter), and only to the events received after
+ * its attachment : the ones already queued on the socket are left. As it drops the
+ * reports for every user of the socket, it should only be attached to a dedicated
+ * socket (as the one of a scan session), not to a socket shared through a pool.
+ * @param hci_socket the socket.
+ * @param program a compiled program.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_bpf_attach(hci_socket_t *hci_socket, const hci_bpf_program_t *program);
+
+/**
+ * @brief Detaches the program attached to a socket.
+ * @param hci_socket the socket.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_bpf_detach(hci_socket_t *hci_socket);
+
+#endif // __HCI_BPF_H__
@@ -0,0 +1,253 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+/**
+ * @file hci_cmd_queue.h
+ * @brief Module bluez_tools.hci.hci_cmd_queue implementing an asynchronous HCI
+ * command queue.
+ *
+ * Instead of waiting for the completion of each command before sending the next
+ * one (as {@code hci_send_req} does), the commands submitted to a queue are sent as
+ * soon as the controller can accept them, that is to say up to the number of command
+ * credits (Num_HCI_Command_Packets) advertised in its last "Command Complete" or
+ * "Command Status" event. A dedicated thread reads those events, matches them with
+ * the oldest sent command having the same opcode and completes it : its callback is 
+ * called (from the queue's thread) and the threads waiting for it are woken up.
+ * {@code
+ * hci_cmd_t cmds[50];
+ * for (...) {
+ *	hci_cmd_init(&cmds[i], OGF_LE_CTL, OCF_LE_ADD_DEVICE_TO_WHITE_LIST, &cp[i], sizeof(cp[i]), NULL, NULL);
+ *	hci_cmd_queue_submit(&queue, &cmds[i]);
+ * }
+ * hci_cmd_queue_flush(&queue);
+ * }
+ * Note that a command answered by a "Command Status" event is completed by this
+ * event, the possible following events being not handled by the queue.
+ * Note also that on a real adapter, the kernel resets its own credit counter to 1
+ * each time it sends a command on a raw socket : the commands are serialized by the
+ * kernel anyway, the queue only saving the round trips to the caller. Only an adapter
+ * whose transport bypasses the kernel (such as the simulator, with 8 credits) receives
+ * several commands at once.
+ * If the queue's thread can't read the socket anymore (e.g. the adapter was
+ * unplugged), the queue stops : the commands not completed yet fail with the error
+ * which stopped it, and the next submissions fail.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_CMD_QUEUE_H__
+#define __HCI_CMD_QUEUE_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "hci_controller.h"
+
+/**
+ * Maximum length of the parameters of a command or of its returned parameters.
+ */
+#define HCI_CMD_MAX_PARAM_SIZE 255
+
+/**
+ * Period (in ms) at which the queue's thread checks the commands' timeouts.
+ */
+#define HCI_CMD_QUEUE_POLL_PERIOD 100
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+struct hci_cmd_t;
+
+/**
+ * Completion callback of a command, called from the queue's thread.
+ */
+typedef void (*hci_cmd_callback_t)(struct hci_cmd_t *cmd, void *user_data);
+
+/**
+ * Command submitted to a queue. The memory of a command belongs to the caller and
+ * has to remain valid until its completion.
+ */
+typedef struct hci_cmd_t {
+	/**
+	 * Opcode and parameters of the command.
+	 */
+	uint16_t opcode;
+	uint8_t cparam[HCI_CMD_MAX_PARAM_SIZE];
+	uint8_t clen;
+	/**
+	 * Parameters returned by the "Command Complete" event (status included), or
+	 * status of the "Command Status" event.
+	 */
+	uint8_t rparam[HCI_CMD_MAX_PARAM_SIZE];
+	uint8_t rlen;
+	/**
+	 * Status of the command returned by the controller (0 = success).
+	 */
+	uint8_t status;
+	/**
+	 * Result of the command : 0 if it was answered by the controller, < 0 if it
+	 * couldn't be sent or answered (errno value in {@code error}).
+	 */
+	int8_t result;
+	int error;
+	/**
+	 * Indicates whether the command has been completed (1) or not (0).
+	 */
+	volatile char done;
+	/**
+	 * Completion callback (can be NULL) and its parameter.
+	 */
+	hci_cmd_callback_t callback;
+	void *user_data;
+	/**
+	 * Time after which a sent command is considered as lost.
+	 */
+	struct timespec deadline;
+	/**
+	 * Next command in the queue.
+	 */
+	struct hci_cmd_t *next;
+} hci_cmd_t;
+
+/**
+ * Asynchronous command queue.
+ */
+typedef struct hci_cmd_queue_t {
+	/**
+	 * Controller to which the commands are sent.
+	 */
+	hci_controller_t *hci_controller;
+	/**
+	 * Socket dedicated to the queue.
+	 */
+	hci_socket_t hci_socket;
+	/**
+	 * Mutex protecting the queue and condition signaled at each completion.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/**
+	 * Thread reading the answers of the controller, and whether the queue accepts
+	 * commands (cleared when the queue is closed or its thread stopped on an error).
+	 */
+	pthread_t thread;
+	volatile char running;
+	/**
+	 * Error which stopped the queue (ECANCELED once closed).
+	 */
+	int error;
+	/**
+	 * Event file descriptor waking the queue's thread up when the queue is closed.
+	 */
+	int wakeup_fd;
+	/**
+	 * Number of commands the controller can currently accept.
+	 */
+	uint8_t credits;
+	/**
+	 * Commands not sent yet (FIFO).
+	 */
+	hci_cmd_t *pending_head;
+	hci_cmd_t *pending_tail;
+	/**
+	 * Commands sent and waiting for their answer (FIFO).
+	 */
+	hci_cmd_t *sent_head;
+	hci_cmd_t *sent_tail;
+	/**
+	 * Number of submitted commands not completed yet.
+	 */
+	uint32_t in_flight;
+	/**
+	 * Maximum time (in ms) to wait for the answer to a command.
+	 */
+	uint32_t timeout;
+} hci_cmd_queue_t;
+
+//------------------------------------------------------------------------------------
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Initializes a command.
+ * @param cmd reference on the command to initialize.
+ * @param ogf OpCode Group Field of the command.
+ * @param ocf OpCode Command Field of the command.
+ * @param cparam parameters of the command (copied).
+ * @param clen length of the parameters.
+ * @param callback completion callback, can be NULL.
+ * @param user_data parameter given to the callback.
+ */
+extern void hci_cmd_init(hci_cmd_t *cmd, uint16_t ogf, uint16_t ocf, const void *cparam, uint8_t clen,
+			 hci_cmd_callback_t callback, void *user_data);
+
+/**
+ * @brief Opens a command queue on a controller : a dedicated socket is opened and the
+ * queue's thread is started.
+ * @param queue reference on the queue to open.
+ * @param hci_controller controller to which the commands are sent.
+ * @param timeout maximum time (in ms) to wait for the answer to a command.
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int8_t hci_cmd_queue_open(hci_cmd_queue_t *queue, hci_controller_t *hci_controller, uint32_t timeout);
+
+/**
+ * @brief Submits a command to a queue. The command is sent immediately if the
+ * controller has some credits left, and later otherwise. If the queue was stopped
+ * (@see hci_cmd_queue_t), the command is completed at once (without its callback)
+ * with the error which stopped it.
+ * @param queue reference on the queue.
+ * @param cmd reference on the command (initialized with hci_cmd_init).
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int8_t hci_cmd_queue_submit(hci_cmd_queue_t *queue, hci_cmd_t *cmd);
+
+/**
+ * @brief Waits for the completion of a command.
+ * @param queue reference on the queue to which the command was submitted.
+ * @param cmd reference on the command.
+ * @return the result of the command (0 if the controller answered it, < 0 otherwise).
+ */
+extern int8_t hci_cmd_wait(hci_cmd_queue_t *queue, hci_cmd_t *cmd);
+
+/**
+ * @brief Waits for the completion of all the commands submitted to a queue.
+ * @param queue reference on the queue.
+ * @return 0 upon success.
+ */
+extern int8_t hci_cmd_queue_flush(hci_cmd_queue_t *queue);
+
+/**
+ * @brief Closes a queue : its thread is stopped, the commands not completed yet
+ * fail with the ECANCELED error and its socket is closed. A queue stopped by an error
+ * still has to be closed.
+ * @param queue reference on the queue.
+ */
+extern void hci_cmd_queue_close(hci_cmd_queue_t *queue);
+
+#endif // __HCI_CMD_QUEUE_H__
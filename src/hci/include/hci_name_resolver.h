@@ -0,0 +1,246 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+/**
+ * @file hci_name_resolver.h
+ * @brief Module bluez_tools.hci.hci_name_resolver resolving remote names in the background.
+ *
+ * A "Remote Name Request" can take several seconds (up to the page timeout when the
+ * device is out of range). A name resolver performs these requests one at a time in
+ * a background thread, on a socket of its own, so that the scanning functions don't
+ * wait for them : once a resolver is started on a controller, {@code hci_scan_devices}
+ * and {@code hci_get_RSSI} (and {@code hci_get_reports}) only ask it for the names of
+ * the new devices, and the registered devices get their name once it is resolved.
+ * The resolved names are cached for {@code ttl} ms, and the devices which could not
+ * be reached are not asked again for {@code negative_ttl} ms. A device is queued
+ * at most once at a time.
+ * {@code
+ * hci_name_resolver_t resolver;
+ * hci_name_resolver_start(&resolver, &hci_controller, HCI_NAME_RESOLVER_DEFAULT_TTL,
+ *			   HCI_NAME_RESOLVER_DEFAULT_NEGATIVE_TTL);
+ * hci_get_RSSI(NULL, &hci_controller, NULL, NULL, 8, 255); // Doesn't wait for the names
+ * ...
+ * hci_name_resolver_stop(&resolver);
+ * }
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_NAME_RESOLVER_H__
+#define __HCI_NAME_RESOLVER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include "hci_controller.h"
+
+/**
+ * Maximum number of names waiting to be resolved. The requests made while the
+ * queue is full are dropped (the name will be asked again at the next lookup).
+ */
+#define HCI_NAME_RESOLVER_QUEUE_SIZE 64
+
+/**
+ * Number of entries of the cache (has to be a power of 2).
+ */
+#define HCI_NAME_RESOLVER_CACHE_SIZE 256
+
+/**
+ * Default time (in ms) a resolved name is kept in the cache.
+ */
+#define HCI_NAME_RESOLVER_DEFAULT_TTL 600000
+
+/**
+ * Default time (in ms) during which an unreachable device is not asked again.
+ */
+#define HCI_NAME_RESOLVER_DEFAULT_NEGATIVE_TTL 60000
+
+/**
+ * Results of a lookup (@see hci_name_resolver_lookup).
+ */
+typedef enum hci_name_status_t {
+	/**
+	 * The name is known.
+	 */
+	HCI_NAME_RESOLVED = 0,
+	/**
+	 * The name is being resolved.
+	 */
+	HCI_NAME_PENDING = 1,
+	/**
+	 * The device could not be reached recently.
+	 */
+	HCI_NAME_UNREACHABLE = 2
+} hci_name_status_t;
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Entry of the cache of a name resolver.
+ */
+typedef struct hci_name_entry_t {
+	/**
+	 * Address of the device.
+	 */
+	bt_address_t mac;
+	/**
+	 * Resolved name (meaningful if {@code state} is {@code HCI_NAME_RESOLVED}).
+	 */
+	char name[BT_NAME_LENGTH];
+	/**
+	 * Time (CLOCK_MONOTONIC, in ms) at which the entry expires. Pending entries
+	 * never expire.
+	 */
+	uint64_t expiration;
+	/**
+	 * State of the entry (a {@code hci_name_status_t} value, or -1 for a free entry).
+	 */
+	int8_t state;
+} hci_name_entry_t;
+
+/**
+ * Statistics of a name resolver.
+ */
+typedef struct hci_name_resolver_stats_t {
+	/**
+	 * Number of lookups.
+	 */
+	uint64_t lookups;
+	/**
+	 * Number of lookups answered by the cache (positively or negatively).
+	 */
+	uint64_t cache_hits;
+	/**
+	 * Number of names resolved.
+	 */
+	uint64_t resolved;
+	/**
+	 * Number of devices which could not be reached.
+	 */
+	uint64_t unreachable;
+	/**
+	 * Number of requests dropped because the queue (or the cache) was full.
+	 */
+	uint64_t dropped;
+} hci_name_resolver_stats_t;
+
+/**
+ * Name resolver.
+ */
+typedef struct hci_name_resolver_t {
+	/**
+	 * Controller the names are resolved with.
+	 */
+	hci_controller_t *hci_controller;
+	/**
+	 * Socket dedicated to the remote name requests.
+	 */
+	hci_socket_t hci_socket;
+	/**
+	 * Resolving thread.
+	 */
+	pthread_t thread;
+	/**
+	 * Mutex protecting the queue, the cache and the statistics, and condition
+	 * used to wake the resolving thread up.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/**
+	 * Addresses waiting to be resolved (circular buffer).
+	 */
+	bt_address_t queue[HCI_NAME_RESOLVER_QUEUE_SIZE];
+	uint16_t queue_head;
+	uint16_t queue_length;
+	/**
+	 * Cache of the names (open addressing).
+	 */
+	hci_name_entry_t cache[HCI_NAME_RESOLVER_CACHE_SIZE];
+	/**
+	 * Time (in ms) a resolved name is kept in the cache.
+	 */
+	uint32_t ttl;
+	/**
+	 * Time (in ms) during which an unreachable device is not asked again.
+	 */
+	uint32_t negative_ttl;
+	/**
+	 * Indicates whether or not the resolving thread should keep running.
+	 */
+	volatile char running;
+	/**
+	 * Statistics.
+	 */
+	hci_name_resolver_stats_t stats;
+} hci_name_resolver_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Starts a name resolver on the given controller. The controller then uses
+ * it for the names of the devices it discovers, until {@code hci_name_resolver_stop}
+ * or {@code hci_close_controller} is called. A controller has at most one resolver.
+ * @param resolver the resolver to initialize.
+ * @param hci_controller an opened controller.
+ * @param ttl time (in ms) a resolved name is kept in the cache.
+ * @param negative_ttl time (in ms) during which an unreachable device is not asked again.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_name_resolver_start(hci_name_resolver_t *resolver, hci_controller_t *hci_controller,
+				      uint32_t ttl, uint32_t negative_ttl);
+
+/**
+ * @brief Looks for the name of a device. If the name is neither cached nor being
+ * resolved, the device is queued : once resolved, the name is cached and set in
+ * the registered device (@see bt_device_set_real_name), if any.
+ * This function never waits for a remote device.
+ * @param resolver a started resolver.
+ * @param mac address of the device.
+ * @param name buffer of {@code BT_NAME_LENGTH} characters receiving the name if it is known.
+ * @return a {@code hci_name_status_t} value, or a value < 0 if the device could not
+ * be queued.
+ */
+extern int8_t hci_name_resolver_lookup(hci_name_resolver_t *resolver, bt_address_t *mac, char *name);
+
+/**
+ * @brief Retrieves the statistics of a name resolver.
+ * @param resolver the resolver.
+ * @param stats structure receiving the statistics.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_name_resolver_get_stats(hci_name_resolver_t *resolver, hci_name_resolver_stats_t *stats);
+
+/**
+ * @brief Stops a name resolver : the resolving thread is joined (after the end of
+ * the request in progress, if any) and the resolver is detached from its controller.
+ * The names still queued are not resolved.
+ * @param resolver the resolver.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_name_resolver_stop(hci_name_resolver_t *resolver);
+
+#endif // __HCI_NAME_RESOLVER_H__
@@ -0,0 +1,219 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+/**
+ * @file hci_scan_tuner.h
+ * @brief Module bluez_tools.hci.hci_scan_tuner adapting the scan parameters of a scan
+ * session to the measured report rates.
+ *
+ * A tuner counts the reports of the tracked devices over a sliding window, made of
+ * {@code HCI_SCAN_TUNER_SLOTS} slots. Once a whole window has been measured with the
+ * current parameters, the slowest device in range (heard at least once in the window)
+ * is compared to the target rate :
+ * - if it is below the target, or if the devices miss too many slots, the duty cycle
+ *   (scan window / scan interval) is doubled by halving the scan interval. With a
+ *   continuous scan, the tuner switches to active scanning to get the scan responses.
+ * - if the rates measured without the scan responses are high enough, the tuner switches
+ *   back to passive scanning. Otherwise, if the rates would still be above the target
+ *   with half the duty cycle, the scan interval is doubled.
+ * The scan window is kept as given when starting the session, so that the duty cycle only
+ * depends on the interval. A tuner is fed with the batches drained from its session,
+ * which don't wait for the batch to be filled :
+ * {@code
+ * hci_scan_tuner_t tuner;
+ * hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x0400, 0x0010, 0x00, 0x00);
+ * hci_scan_tuner_init(&tuner, &session, 10.0, 250); // 10 reports/s per device
+ * hci_scan_tuner_track(&tuner, &tag);
+ * while (...) {
+ *	hci_LE_scan_session_drain(&session, &batch, 100);
+ *	hci_scan_tuner_feed(&tuner, &batch); // May re-program the scan
+ *	...
+ * }
+ * }
+ * A tuner isn't thread-safe : it must be fed by the session's reader.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_SCAN_TUNER_H__
+#define __HCI_SCAN_TUNER_H__
+
+#include <stdint.h>
+#include <time.h>
+#include "hci_controller.h"
+#include "hci_report.h"
+
+/**
+ * Maximum number of devices tracked by a tuner.
+ */
+#define HCI_SCAN_TUNER_MAX_DEVICES 64
+
+/**
+ * Number of slots of the sliding window.
+ */
+#define HCI_SCAN_TUNER_SLOTS 8
+
+/**
+ * Bounds of the LE scan interval (in 0.625 ms units).
+ */
+#define HCI_SCAN_TUNER_MIN_INTERVAL 0x0004
+#define HCI_SCAN_TUNER_MAX_INTERVAL 0x4000
+
+/**
+ * Maximum proportion of slots in which a device in range may not be heard.
+ */
+#define HCI_SCAN_TUNER_MAX_MISSED 0.125
+
+/**
+ * Margin over the target rate required before lowering the duty cycle, so that the
+ * tuner doesn't oscillate between two settings.
+ */
+#define HCI_SCAN_TUNER_MARGIN 1.25
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Device tracked by a tuner.
+ */
+typedef struct hci_scan_tuner_device_t {
+	/**
+	 * Address of the device.
+	 */
+	bt_address_t mac;
+	/**
+	 * Number of reports (and of scan responses among them) received in each slot,
+	 * the extra one being the slot in progress.
+	 */
+	uint16_t reports[HCI_SCAN_TUNER_SLOTS + 1];
+	uint16_t scan_responses[HCI_SCAN_TUNER_SLOTS + 1];
+} hci_scan_tuner_device_t;
+
+/**
+ * Measures of the last complete window.
+ */
+typedef struct hci_scan_tuner_stats_t {
+	/**
+	 * Number of tracked devices heard during the window.
+	 */
+	uint16_t in_range;
+	/**
+	 * Lowest and mean report rates (reports/s) of the devices in range.
+	 */
+	float min_rate;
+	float mean_rate;
+	/**
+	 * Lowest report rate of the devices in range without their scan responses.
+	 */
+	float min_passive_rate;
+	/**
+	 * Proportion of slots in which the devices in range weren't heard.
+	 */
+	float missed;
+	/**
+	 * Number of times the scan was re-programmed.
+	 */
+	uint32_t reconfigurations;
+} hci_scan_tuner_stats_t;
+
+/**
+ * Scan tuner.
+ */
+typedef struct hci_scan_tuner_t {
+	/**
+	 * Scan session whose parameters are adapted.
+	 */
+	hci_scan_session_t *session;
+	/**
+	 * Number of reports per second to get from each tracked device.
+	 */
+	float target_rate;
+	/**
+	 * Duration (in ms) of a slot of the sliding window.
+	 */
+	uint16_t slot_duration;
+	/**
+	 * Tracked devices (sorted by address).
+	 */
+	hci_scan_tuner_device_t devices[HCI_SCAN_TUNER_MAX_DEVICES];
+	uint16_t nb_devices;
+	/**
+	 * If set, the devices heard are tracked, until {@code HCI_SCAN_TUNER_MAX_DEVICES}
+	 * are. Otherwise, only the devices given to {@code hci_scan_tuner_track} are.
+	 */
+	char auto_track;
+	/**
+	 * Current slot, its beginning, and number of slots completed since the last change
+	 * of parameters.
+	 */
+	uint8_t slot;
+	struct timespec slot_start;
+	uint8_t completed;
+	/**
+	 * Measures of the last complete window.
+	 */
+	hci_scan_tuner_stats_t stats;
+} hci_scan_tuner_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Initializes a tuner for an active scan session. The measures start with the
+ * session's current parameters.
+ * @param tuner the tuner to initialize.
+ * @param session an active scan session.
+ * @param target_rate number of reports per second to get from each tracked device (> 0).
+ * @param slot_duration duration (in ms) of a slot of the sliding window. It should be
+ * long enough for a device to be reported at the target rate (at least 1000 / target_rate).
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_scan_tuner_init(hci_scan_tuner_t *tuner, hci_scan_session_t *session,
+				  float target_rate, uint16_t slot_duration);
+
+/**
+ * @brief Adds a device to the ones tracked by a tuner.
+ * @param tuner an initialized tuner.
+ * @param mac address of the device.
+ * @return 0 on success (or if the device was already tracked), a value < 0 if the
+ * tuner already tracks {@code HCI_SCAN_TUNER_MAX_DEVICES} devices.
+ */
+extern int8_t hci_scan_tuner_track(hci_scan_tuner_t *tuner, const bt_address_t *mac);
+
+/**
+ * @brief Counts the reports of a batch read from the tuner's session. The reports are
+ * counted in the current slot, so the tuner has to be fed at least once per slot (with
+ * empty batches if need be). When a window has been measured with the current
+ * parameters, the session is re-programmed if needed
+ * (@see hci_LE_scan_session_set_parameters) and a new window begins.
+ * @param tuner an initialized tuner.
+ * @param batch batch of reports (NULL to only let the time go by).
+ * @return 1 if the scan parameters were changed, 0 if not, a value < 0 if the session
+ * couldn't be re-programmed.
+ */
+extern int8_t hci_scan_tuner_feed(hci_scan_tuner_t *tuner, const hci_report_batch_t *batch);
+
+#endif // __HCI_SCAN_TUNER_H__
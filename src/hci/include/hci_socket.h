@@ -35,7 +35,10 @@
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
 #include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 #include "list.h"
 #include "bt_device.h"
 
@@ -44,11 +47,49 @@
    --------------
 */
 
+struct hci_transport_t;
+
 // TODO : cf ioctl FIONBIO : donner possibilité d'avoir dd non bloquant ?
 // => On pourrait par exemple lancer un scan en asynchrone, et, tout en maintenant
 // un groupe de n données dans un buffer, récupérer n données quand bon nous semble sans jamais
 // avoir à relancer de scan ?
 
+/**
+ * Counters of the reception path of an hci_socket (@see get_hci_socket_stats).
+ * Comparing {@code dropped} with {@code events} tells whether the adapter receives
+ * more events than the application reads.
+ */
+typedef struct hci_socket_stats_t {
+	/**
+	 * Number of events read on the socket.
+	 */
+	uint64_t events;
+	/**
+	 * Number of events dropped (by the kernel, or the transport) because the
+	 * reception queue of the socket was full.
+	 */
+	uint64_t dropped;
+	/**
+	 * Number of reports read but left out of the batches by their filters
+	 * (address, white list, deduplicator). The reports rejected by a filter
+	 * attached to the socket (@see hci_bpf.h) never reach it and aren't counted.
+	 */
+	uint64_t filtered;
+	/**
+	 * Number of reports delivered in batches.
+	 */
+	uint64_t delivered;
+	/**
+	 * Number of reports lost because the batches were full (@see hci_report_batch_t).
+	 */
+	uint64_t overflowed;
+	/**
+	 * Number of reports delivered with their reassembled data truncated because the
+	 * batches were full.
+	 */
+	uint64_t truncated;
+} hci_socket_stats_t;
+
 /**
  * HCI socket strucutre.
  */
@@ -64,8 +105,69 @@ typedef struct hci_socket_t {
 	 * "hci_devba(int dev_id, bt_address_t *bdaddr)" function
 	 * */
 	int8_t dev_id;
+	/**
+	 * Transport performing the I/O of the socket (@see hci_transport.h).
+	 */
+	const struct hci_transport_t *transport;
+	/**
+	 * Private data of the transport (for instance the simulated controller
+	 * the socket is connected to).
+	 */
+	void *transport_data;
+	/**
+	 * Copy of the filter installed on the socket, only meaningful if
+	 * {@code filter_known} is set (@see apply_hci_socket_filter).
+	 */
+	struct hci_filter filter;
+	/**
+	 * Indicates whether {@code filter} is the filter installed on the socket.
+	 */
+	char filter_known;
+	/**
+	 * Reception time (CLOCK_REALTIME) of the last packet read on the socket
+	 * (@see read_hci_socket).
+	 */
+	struct timespec timestamp;
+	/**
+	 * Counters of the socket (@see get_hci_socket_stats).
+	 */
+	hci_socket_stats_t stats;
+	/**
+	 * Drop counter of the transport when {@code stats.dropped} was last updated
+	 * (@see hci_transport_account_drops).
+	 */
+	uint32_t drops;
 } hci_socket_t;
 
+/**
+ * Precompiled filters (@see apply_hci_socket_filter_profile).
+ */
+typedef enum hci_filter_profile_t {
+	/**
+	 * "Command Complete" and "Command Status" events.
+	 */
+	HCI_FILTER_PROFILE_CMD_COMPLETE,
+	/**
+	 * Classic inquiry with RSSI : "Command Complete", "Inquiry Result with RSSI",
+	 * "Extended Inquiry Result" and "Inquiry Complete" events.
+	 */
+	HCI_FILTER_PROFILE_INQUIRY,
+	/**
+	 * Periodic classic inquiry : "Command Complete" and the three kinds of inquiry
+	 * results. The "Inquiry Complete" events ending each inquiry are left out.
+	 */
+	HCI_FILTER_PROFILE_PERIODIC_INQUIRY,
+	/**
+	 * LE scan : "Command Complete" and "LE Meta" events.
+	 */
+	HCI_FILTER_PROFILE_LE_SCAN,
+	/**
+	 * LE connections : "Disconnection Complete" and "LE Meta" events.
+	 */
+	HCI_FILTER_PROFILE_LE_CONNECTIONS,
+	HCI_FILTER_PROFILE_COUNT
+} hci_filter_profile_t;
+
 //------------------------------------------------------------------------------------
 
 /* --------------
@@ -85,6 +187,20 @@ typedef struct hci_socket_t {
  */
 extern hci_socket_t open_hci_socket(bt_address_t *controller);
 
+/**
+ * @brief Opens an hci_socket on the given controller through the given transport.
+ * {@code open_hci_socket} is equivalent to this function used with the 
+ * {@code hci_bluez_transport} transport.
+ * @param transport transport to use, NULL for the default (BlueZ) one.
+ * @param transport_data private data of the transport.
+ * @param controller address of the controller on which the socket is to
+ * be opened.
+ * @return the newly created socket. Upon succes, its fields "sock" and "dev_id"
+ * should be non-negative.
+ */
+extern hci_socket_t open_hci_socket_transport(const struct hci_transport_t *transport,
+					      void *transport_data, bt_address_t *controller);
+
 /**
  * @brief Closes a previsouly opened hci_socket. 
  * If the given socket's reference is invalid or if the socket 
@@ -117,13 +233,159 @@ extern int8_t get_hci_socket_filter(hci_socket_t hci_socket, struct hci_filter *
 
 /**
  * @brief Sets the filter of the given hci_socket by using the given filter's reference.
- * The reference has to be a valid one. 
+ * The reference has to be a valid one. Unlike {@code apply_hci_socket_filter}, the
+ * filter is always installed, and then recorded in the socket.
  * @param hci_socket socket on which the filter is to be set.
  * @param flt filter to apply.
  * @return upon success, the filter has been set on the socket and the function returns 0.
  * If an error occured, the filter has bot been set and -1 is returned.
 */
-extern int8_t set_hci_socket_filter(hci_socket_t hci_socket, struct hci_filter *flt);
+extern int8_t set_hci_socket_filter(hci_socket_t *hci_socket, struct hci_filter *flt);
+
+/**
+ * @brief Returns the precompiled filter of the given profile.
+ * @param profile the profile.
+ * @return a reference on the filter, NULL if the profile is invalid.
+ */
+extern const struct hci_filter *hci_filter_profile(hci_filter_profile_t profile);
+
+/**
+ * @brief Retrieves the filter installed on the given socket. The filter recorded in
+ * the socket is used if known, otherwise it is asked to the transport and recorded.
+ * @param hci_socket the socket from which the filter is to be retrieved.
+ * @param flt reference on the retrieved filter.
+ * @return 0 upon success, -1 otherwise.
+ */
+extern int8_t get_hci_socket_cached_filter(hci_socket_t *hci_socket, struct hci_filter *flt);
+
+/**
+ * @brief Installs the given filter on the socket and records it in the socket.
+ * Nothing is done if the recorded filter is already the given one.
+ * @param hci_socket socket on which the filter is to be set.
+ * @param flt filter to apply.
+ * @return 0 upon success, -1 otherwise.
+ */
+extern int8_t apply_hci_socket_filter(hci_socket_t *hci_socket, const struct hci_filter *flt);
+
+/**
+ * @brief Same as {@code apply_hci_socket_filter} with a precompiled filter.
+ * @param hci_socket socket on which the filter is to be set.
+ * @param profile the profile to apply.
+ * @return 0 upon success, -1 otherwise.
+ */
+extern int8_t apply_hci_socket_filter_profile(hci_socket_t *hci_socket, hci_filter_profile_t profile);
+
+/**
+ * @brief Forgets the filter recorded in the socket, so that the next
+ * {@code apply_hci_socket_filter} really installs its filter.
+ * @param hci_socket the socket.
+ */
+extern void forget_hci_socket_filter(hci_socket_t *hci_socket);
+
+/**
+ * @brief Sends an HCI command through the given socket without waiting for its
+ * completion.
+ * @param hci_socket socket to use.
+ * @param ogf OpCode Group Field of the command.
+ * @param ocf OpCode Command Field of the command.
+ * @param plen length of the parameters.
+ * @param param parameters of the command.
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int8_t send_hci_socket_cmd(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf,
+				  uint8_t plen, void *param);
+
+/**
+ * @brief Sends an HCI request through the given socket and waits for its completion
+ * (@see hci_send_req).
+ * @param hci_socket socket to use.
+ * @param rq the request.
+ * @param timeout maximum time to wait (in ms).
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int8_t send_hci_socket_req(hci_socket_t *hci_socket, struct hci_request *rq, int timeout);
+
+/**
+ * @brief Sends an HCI command through the given socket and waits for its
+ * "Command Complete" event. The first byte of the returned parameters has to
+ * be the status of the command, which is checked : if it isn't 0, errno is set to
+ * EIO and the function fails (as the BlueZ "hci_le_*" functions do).
+ * @param hci_socket socket to use.
+ * @param ogf OpCode Group Field of the command.
+ * @param ocf OpCode Command Field of the command.
+ * @param cparam parameters of the command.
+ * @param clen length of the parameters.
+ * @param rparam buffer receiving the returned parameters (status included).
+ * @param rlen length of the {@code rparam} buffer (at least 1).
+ * @param timeout maximum time to wait (in ms).
+ * @return 0 upon success, < 0 otherwise.
+ */
+extern int8_t send_hci_socket_simple_req(hci_socket_t *hci_socket, uint16_t ogf, uint16_t ocf,
+					 void *cparam, uint8_t clen, void *rparam, uint8_t rlen,
+					 int timeout);
+
+/**
+ * @brief Asks a remote device for its name ("Remote Name Request") and waits for the
+ * answer. This can take several seconds when the device is out of range.
+ * @param hci_socket socket to use.
+ * @param mac address of the remote device.
+ * @param name buffer receiving the name (always null-terminated upon success).
+ * @param length size of the {@code name} buffer.
+ * @param timeout maximum time to wait (in ms).
+ * @return 0 upon success, < 0 otherwise (errno is set to EIO if the device
+ * could not be reached).
+ */
+extern int8_t read_hci_socket_remote_name(hci_socket_t *hci_socket, bt_address_t *mac, char *name,
+					  size_t length, int timeout);
+
+/**
+ * @brief Reads one packet (packet type indicator included) received on the socket.
+ * Its reception time is stored in the {@code timestamp} field of the socket : the time
+ * at which the kernel received it when the transport provides it, the reading time
+ * otherwise.
+ * @param hci_socket socket to read from.
+ * @param buf reception buffer.
+ * @param length size of the reception buffer.
+ * @return the length of the read packet, < 0 if an error occured.
+ */
+extern ssize_t read_hci_socket(hci_socket_t *hci_socket, void *buf, size_t length);
+
+/**
+ * @brief Sizes the reception queue of the socket and asks the kernel to report the
+ * number of events it dropped along with each event ({@code SO_RXQ_OVFL}), so that the
+ * {@code dropped} counter of the socket follows without any additional system call.
+ * During report storms, the kernel drops the events which don't fit in the queue : a
+ * larger queue absorbs the bursts an application can't read in time.
+ * The queue is sized by the transport of the socket. With the BlueZ one,
+ * {@code SO_RCVBUFFORCE} is tried first, in order to exceed the system's limit
+ * ({@code net.core.rmem_max}), then {@code SO_RCVBUF}. The kernel doubles the
+ * given size to account for its own overhead. The transports based on socket pairs
+ * size the queue of the events written to the socket, whose drops they count themselves.
+ * @param hci_socket the socket.
+ * @param size size (in bytes) of the reception queue, 0 to keep the current one.
+ * @return the resulting size of the reception queue (as reported by the kernel), < 0
+ * if it could not be set.
+ */
+extern int32_t set_hci_socket_receive_buffer(hci_socket_t *hci_socket, int32_t size);
+
+/**
+ * @brief Retrieves the counters of the socket. The drop counter of the transport is
+ * read first, so that {@code dropped} is up to date even if the kernel doesn't report
+ * it along with the events.
+ * NOTE : the counters are updated by the thread reading the socket, they should be
+ * retrieved by the same thread.
+ * @param hci_socket the socket.
+ * @param stats structure receiving the counters.
+ * @return 0 upon success, < 0 if the drop counter could not be read (the other
+ * counters are retrieved anyway).
+ */
+extern int8_t get_hci_socket_stats(hci_socket_t *hci_socket, hci_socket_stats_t *stats);
+
+/**
+ * @brief Resets the counters of the socket.
+ * @param hci_socket the socket.
+ */
+extern void reset_hci_socket_stats(hci_socket_t *hci_socket);
 
 /**
  * @brief Displays all hci_sockets stored in an hci_socket
@@ -37,6 +37,55 @@
 #include <stdint.h>
 #include <stdarg.h>
 
+/* Bluetooth 5 LE extended scanning commands (cf Core v5.0, vol 2 part E, 7.8.64 and 7.8.65),
+   which older BlueZ headers don't define.
+*/
+#ifndef OCF_LE_SET_EXT_SCAN_PARAMETERS
+#define OCF_LE_SET_EXT_SCAN_PARAMETERS 0x0041
+#endif
+#ifndef OCF_LE_SET_EXT_SCAN_ENABLE
+#define OCF_LE_SET_EXT_SCAN_ENABLE 0x0042
+#endif
+
+/**
+ * Scanning PHYs (bits of the {@code phys} field of {@code hci_le_ext_scan_parameters_cp}).
+ */
+#define HCI_LE_SCAN_PHY_1M 0x01
+#define HCI_LE_SCAN_PHY_CODED 0x04
+
+/**
+ * Fixed part of the "LE Set Extended Scan Parameters" command, followed by one
+ * {@code hci_le_ext_scan_phy_cp} per bit set in {@code phys} (1M first).
+ */
+typedef struct {
+	uint8_t own_bdaddr_type;
+	uint8_t filter;
+	uint8_t phys;
+} __attribute__ ((packed)) hci_le_ext_scan_parameters_cp;
+#define HCI_LE_EXT_SCAN_PARAMETERS_CP_SIZE 3
+
+/**
+ * Scan parameters of one PHY.
+ */
+typedef struct {
+	uint8_t type;
+	uint16_t interval;
+	uint16_t window;
+} __attribute__ ((packed)) hci_le_ext_scan_phy_cp;
+#define HCI_LE_EXT_SCAN_PHY_CP_SIZE 5
+
+/**
+ * "LE Set Extended Scan Enable" command (duration and period in units of 10 ms
+ * and 1.28 s, 0 to scan until disabled).
+ */
+typedef struct {
+	uint8_t enable;
+	uint8_t filter_dup;
+	uint16_t duration;
+	uint16_t period;
+} __attribute__ ((packed)) hci_le_ext_scan_enable_cp;
+#define HCI_LE_EXT_SCAN_ENABLE_CP_SIZE 6
+
 /**
  * @brief Computes an hci_filter using the given event types.
  * hci_filters are used to filter out only the events one is
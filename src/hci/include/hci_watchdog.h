@@ -0,0 +1,284 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+/**
+ * @file hci_watchdog.h
+ * @brief Module bluez_tools.hci.hci_watchdog recovering the adapters which stopped
+ * working, without waiting for the next call to the library.
+ *
+ * An interruption is only resolved by the next function called on the controller
+ * (@see hci_resolve_interruption), and an adapter which stopped answering or scanning
+ * isn't detected at all. A watchdog checks its controller periodically from a
+ * background thread, on a socket of its own :
+ * - the adapter is probed with a "Read Local Version Information" command, which any
+ *   adapter answers at once ;
+ * - the state machine of the controller is watched : a state other than the default one
+ *   which doesn't change for {@code stuck_time} ms, while no scan session owns the
+ *   controller, is reported as stuck. It is only taken back from its owner once the
+ *   controller is marked as interrupted (the owner gave up) : an owner still running,
+ *   a long inquiry for instance, would otherwise fail to give the controller back ;
+ * - the scan session registered on the controller, if any, is considered as stalled
+ *   once no report was received for {@code stall_time} ms.
+ * When an interruption is pending, it is resolved first. Otherwise, as long as the
+ * adapter doesn't answer its probe again, the recovery escalates from disabling the
+ * scans to an HCI reset, then to a restart of the adapter (@see hci_transport_t). Once
+ * it answers, the white list of the controller (@see hci_white_list_restore) and the
+ * scan of its session (@see hci_LE_scan_session_restore) are programmed again. A
+ * problem coming back right after a recovery is handled from the next level.
+ * {@code
+ * hci_watchdog_t watchdog;
+ * hci_watchdog_config_t config = hci_watchdog_default_config();
+ * config.stall_time = 5000; // At least one report every 5 s
+ * hci_watchdog_start(&watchdog, &hci_controller, &config);
+ * hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00, 0x00);
+ * ...
+ * hci_watchdog_stop(&watchdog);
+ * }
+ * During a recovery, the functions of the library fail as with a busy controller if the
+ * watchdog took it (@see HCI_STATE_RECOVERING). The lock of the controller is only held
+ * to look its scan session and white list up : stopping the session or destroying the
+ * white list waits for the end of the recovery, the other functions don't.
+ *
+ * @author Thomas Bertauld
+ * @date 03/03/2016
+ */
+
+#ifndef __HCI_WATCHDOG_H__
+#define __HCI_WATCHDOG_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include "hci_controller.h"
+
+/**
+ * Default time (in ms) between two checks of the adapter.
+ */
+#define HCI_WATCHDOG_DEFAULT_PERIOD 1000
+
+/**
+ * Default time (in ms) the adapter has to answer a probe or a recovery command.
+ */
+#define HCI_WATCHDOG_DEFAULT_PROBE_TIMEOUT 1000
+
+/**
+ * Default number of consecutive unanswered probes after which the adapter is recovered.
+ */
+#define HCI_WATCHDOG_DEFAULT_MAX_MISSED 2
+
+/**
+ * Default time (in ms) after which a state is reported as stuck. It has to exceed the
+ * longest operation of the library (a collection of reports lasts at most 32767 ms).
+ */
+#define HCI_WATCHDOG_DEFAULT_STUCK_TIME 60000
+
+/**
+ * Recovery levels, from the lightest to the heaviest.
+ */
+typedef enum hci_watchdog_level_t {
+	/**
+	 * No recovery (or the pending interruption was resolved).
+	 */
+	HCI_WATCHDOG_LEVEL_NONE = 0,
+	/**
+	 * The scans are disabled (@see hci_force_scan_disable).
+	 */
+	HCI_WATCHDOG_LEVEL_SCAN_DISABLE = 1,
+	/**
+	 * The adapter is reset (@see hci_reset_adapter).
+	 */
+	HCI_WATCHDOG_LEVEL_RESET = 2,
+	/**
+	 * The adapter is restarted through its transport.
+	 */
+	HCI_WATCHDOG_LEVEL_RESTART = 3
+} hci_watchdog_level_t;
+
+/**
+ * Number of recovery levels.
+ */
+#define HCI_WATCHDOG_LEVELS 4
+
+/* --------------
+   - STRUCTURES -
+   --------------
+*/
+
+/**
+ * Configuration of a watchdog.
+ */
+typedef struct hci_watchdog_config_t {
+	/**
+	 * Time (in ms) between two checks.
+	 */
+	uint32_t period;
+	/**
+	 * Time (in ms) the adapter has to answer a probe or a recovery command.
+	 */
+	uint32_t probe_timeout;
+	/**
+	 * Number of consecutive unanswered probes after which the adapter is recovered.
+	 */
+	uint8_t max_missed;
+	/**
+	 * Time (in ms) after which a state which doesn't change is reported as stuck (it is
+	 * only recovered if the controller is interrupted).
+	 */
+	uint32_t stuck_time;
+	/**
+	 * Time (in ms) without any report after which a scan session is considered as stalled,
+	 * 0 not to watch the sessions (the default : a scan may legitimately receive nothing).
+	 * A session whose reports are left queued is not considered as stalled.
+	 */
+	uint32_t stall_time;
+	/**
+	 * Heaviest recovery level allowed.
+	 */
+	hci_watchdog_level_t max_level;
+} hci_watchdog_config_t;
+
+/**
+ * Statistics of a watchdog.
+ */
+typedef struct hci_watchdog_stats_t {
+	/**
+	 * Number of checks.
+	 */
+	uint64_t checks;
+	/**
+	 * Number of unanswered probes.
+	 */
+	uint64_t missed_probes;
+	/**
+	 * Number of successful recoveries per level : {@code recoveries[HCI_WATCHDOG_LEVEL_NONE]}
+	 * counts the interruptions resolved by {@code hci_resolve_interruption}.
+	 */
+	uint64_t recoveries[HCI_WATCHDOG_LEVELS];
+	/**
+	 * Number of recoveries which failed at every level.
+	 */
+	uint64_t failures;
+	/**
+	 * Number of states reported as stuck while their owner still held them.
+	 */
+	uint64_t stuck_states;
+} hci_watchdog_stats_t;
+
+/**
+ * Watchdog.
+ */
+typedef struct hci_watchdog_t {
+	/**
+	 * Watched controller.
+	 */
+	hci_controller_t *hci_controller;
+	/**
+	 * Socket dedicated to the probes and the recovery commands.
+	 */
+	hci_socket_t hci_socket;
+	/**
+	 * Configuration of the watchdog.
+	 */
+	hci_watchdog_config_t config;
+	/**
+	 * Watching thread.
+	 */
+	pthread_t thread;
+	/**
+	 * Mutex protecting the statistics, and condition used to wake the watching thread up.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/**
+	 * Indicates whether or not the watching thread should keep running.
+	 */
+	volatile char running;
+	/**
+	 * Number of consecutive unanswered probes.
+	 */
+	uint8_t missed;
+	/**
+	 * Level of the last recovery, {@code HCI_WATCHDOG_LEVEL_NONE} once the adapter worked
+	 * again since.
+	 */
+	hci_watchdog_level_t level;
+	/**
+	 * Number of state changes of the controller at the last check, and time (CLOCK_MONOTONIC,
+	 * in ms) since which it didn't change.
+	 */
+	uint32_t state_changes;
+	uint64_t state_since;
+	/**
+	 * Indicates whether the current state was already reported as stuck.
+	 */
+	char stuck;
+	/**
+	 * Session watched at the last check, number of reports it had received and time
+	 * (CLOCK_MONOTONIC, in ms) since which it didn't receive any.
+	 */
+	const hci_scan_session_t *session;
+	uint64_t session_reports;
+	uint64_t session_since;
+	/**
+	 * Statistics.
+	 */
+	hci_watchdog_stats_t stats;
+} hci_watchdog_t;
+
+/* --------------
+   - PROTOTYPES -
+   --------------
+*/
+
+/**
+ * @brief Returns the default configuration of a watchdog (checks every second, recovery
+ * after 2 unanswered probes, a state reported as stuck after a minute, sessions not
+ * watched, every recovery level allowed).
+ * @return the default configuration.
+ */
+extern hci_watchdog_config_t hci_watchdog_default_config(void);
+
+/**
+ * @brief Starts a watchdog on a controller, which can have only one.
+ * The watchdog is stopped when the controller is closed.
+ * @param watchdog the watchdog to start.
+ * @param hci_controller an opened controller.
+ * @param config configuration of the watchdog, NULL for the default one.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_watchdog_start(hci_watchdog_t *watchdog, hci_controller_t *hci_controller,
+				 const hci_watchdog_config_t *config);
+
+/**
+ * @brief Retrieves the statistics of a watchdog.
+ * @param watchdog a started watchdog.
+ * @param stats reference on the structure receiving the statistics.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_watchdog_get_stats(hci_watchdog_t *watchdog, hci_watchdog_stats_t *stats);
+
+/**
+ * @brief Stops a watchdog (waiting for the end of the recovery in progress, if any).
+ * @param watchdog a started watchdog.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t hci_watchdog_stop(hci_watchdog_t *watchdog);
+
+#endif // __HCI_WATCHDOG_H__
@@ -35,6 +35,7 @@
 
 #include "l2cap_socket.h"
 #include "bt_device.h"
+#include "reactor.h"
 #include <bluetooth/bluetooth.h>
 #include <stdint.h>
 
@@ -54,6 +55,7 @@
 typedef struct l2cap_client_proxy_t {
 	/**
 	 * Id of the established connection between a server and this client.
+	 * -1 indicates that no client is connected.
 	 */
 	int8_t conn_id;
 	/**
@@ -148,6 +150,30 @@ extern int8_t l2cap_server_create(l2cap_server_t *server, bt_address_t *adapter,
  */
 extern int8_t l2cap_server_launch(l2cap_server_t *server, int16_t timeout, uint16_t max_req);
 
+/**
+ * @brief Launches a server in a reactor.
+ * Event-driven alternative to {@code l2cap_server_launch} : the server's socket
+ * is put in the listening state and registered in the reactor, which then accepts
+ * the clients (up to {@code max_clients} simultaneously) and treats their requests
+ * from its own thread, without creating any thread per client.
+ * A client is disconnected when it sends {@code L2CAP_SERVER_UNIVERSAL_STOP} or
+ * closes the connection. Contrary to {@code l2cap_server_launch}, no timeout
+ * is applied on the clients' requests.
+ * @param server server to launch.
+ * @param reactor reactor in which the server is to be registered.
+ * @return 0 on success, a value < 0 otherwise.
+ */
+extern int8_t l2cap_server_add_to_reactor(l2cap_server_t *server, reactor_t *reactor);
+
+/**
+ * @brief Stops a server launched with {@code l2cap_server_add_to_reactor} :
+ * its sockets are unregistered from the reactor and the connections with its
+ * clients are closed. The server can then be destroyed with {@code l2cap_server_close}.
+ * @param server server to stop.
+ * @param reactor reactor in which the server was registered.
+ */
+extern void l2cap_server_remove_from_reactor(l2cap_server_t *server, reactor_t *reactor);
+
 /**
  * @brief Destroys a server.
  * WARNING: this function DOES NOT terminate the connections with
@@ -89,6 +89,7 @@ int8_t l2cap_server_create(l2cap_server_t *server, bt_address_t *adapter, uint16
 	server->max_clients = max_clients;
 	server->clients = calloc(max_clients, sizeof(l2cap_client_proxy_t));
 	for (uint8_t i = 0; i < max_clients; i++) {
+		server->clients[i].conn_id = -1;
 		server->clients[i].buffer = calloc(buffer_length, sizeof(char));
 	}
 	
@@ -262,6 +263,159 @@ fail:
 
 //------------------------------------------------------------------------------------
 
+/* Disconnects a client of a server launched in a reactor.
+*/
+static void l2cap_server_drop_client(l2cap_server_t *server, reactor_t *reactor, uint8_t client_i) {
+	int conn_id = server->clients[client_i].conn_id;
+	print_trace(TRACE_INFO, "l2cap_server : connection %i ended.\n", conn_id);
+	reactor_remove(reactor, conn_id);
+	close(conn_id);
+	server->clients[client_i].conn_id = -1;
+}
+
+//---------------------------------
+
+/* Reactor callback treating the requests of a client (the reactor counterpart of
+   server_thread_routine).
+*/
+static void l2cap_server_client_callback(reactor_t *reactor, int fd, uint32_t events,
+					 void *data, void *user_data) {
+	l2cap_server_t *server = (l2cap_server_t *)data;
+	uint8_t i = 0;
+
+	while (i < server->max_clients && server->clients[i].conn_id != fd) {
+		i++;
+	}
+	if (i == server->max_clients) {
+		print_trace(TRACE_WARNING, "l2cap_server : event on an unknown connection.\n");
+		reactor_remove(reactor, fd);
+		return;
+	}
+
+	char *buffer = server->clients[i].buffer;
+	memset(buffer, 0, server->buffer_length);
+
+	ssize_t bytes_read = read(fd, buffer, server->buffer_length);
+	if (bytes_read < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			return;
+		}
+		perror("l2cap_server_client_callback : error while reading socket");
+		l2cap_server_drop_client(server, reactor, i);
+		return;
+	}
+
+	if (bytes_read == 0) { // 0 Bytes read means that the connection has been lost.
+		print_trace(TRACE_WARNING, "l2cap_server : nothing to read on the socket.\n");
+		l2cap_server_drop_client(server, reactor, i);
+		return;
+	}
+
+	char stop = 0;
+	if (strcmp(buffer, L2CAP_SERVER_UNIVERSAL_STOP) == 0) {
+		char closeACK[10] = "STOP_ACK";
+		if (write(fd, closeACK, 10) < 10) {
+			print_trace(TRACE_WARNING, "l2cap_server : unable to send STOP_ACK.\n");
+		}
+		stop = 1;
+	}
+	server->treat_buffer(server, i);
+
+	if (stop) {
+		l2cap_server_drop_client(server, reactor, i);
+	}
+}
+
+//---------------------------------
+
+/* Reactor callback accepting the connections on the listening socket of a server.
+*/
+static void l2cap_server_accept_callback(reactor_t *reactor, int fd, uint32_t events,
+					 void *data, void *user_data) {
+	l2cap_server_t *server = (l2cap_server_t *)data;
+	l2cap_sockaddr_t rem_addr;
+	socklen_t sockaddr_len = sizeof(l2cap_sockaddr_t);
+
+	int client_sock = accept(fd, (struct sockaddr *)&rem_addr, &sockaddr_len);
+	if (client_sock < 0) {
+		perror("l2cap_server_accept_callback : accept failed");
+		return;
+	}
+
+	uint8_t i = 0;
+	while (i < server->max_clients && server->clients[i].conn_id >= 0) {
+		i++;
+	}
+	if (i == server->max_clients || client_sock > INT8_MAX) {
+		print_trace(TRACE_WARNING, "l2cap_server : no slot available, connection %i refused.\n", client_sock);
+		close(client_sock);
+		return;
+	}
+
+	if (reactor_add(reactor, client_sock, EPOLLIN, server, &(l2cap_server_client_callback), NULL) < 0) {
+		close(client_sock);
+		return;
+	}
+
+	print_trace(TRACE_INFO, "Connection established on socket %i, connection id : %i...\n", fd, client_sock);
+	server->clients[i].conn_id = client_sock;
+	server->clients[i].rem_addr = rem_addr;
+	server->launched = 1;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t l2cap_server_add_to_reactor(l2cap_server_t *server, reactor_t *reactor) {
+	if (server == NULL || reactor == NULL) {
+		print_trace(TRACE_ERROR, "l2cap_server_add_to_reactor : invalid arguments.\n");
+		return -1;
+	}
+
+	if (server->max_clients == 0) {
+		print_trace(TRACE_ERROR, "l2cap_server_add_to_reactor : no socket available to run the server.\n");
+		return -1;
+	}
+
+	if (server->socket.sock < 0) {
+		print_trace(TRACE_ERROR, "l2cap_server_add_to_reactor : invalid socket.\n");
+		return -1;
+	}
+
+	if (listen(server->socket.sock, server->max_clients) < 0) {
+		perror("l2cap_server_add_to_reactor");
+		return -1;
+	}
+
+	if (reactor_add(reactor, server->socket.sock, EPOLLIN, server,
+			&(l2cap_server_accept_callback), NULL) < 0) {
+		return -1;
+	}
+	print_trace(TRACE_INFO, "Waiting for connection on socket %i...\n", server->socket.sock);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+void l2cap_server_remove_from_reactor(l2cap_server_t *server, reactor_t *reactor) {
+	if (server == NULL || reactor == NULL) {
+		print_trace(TRACE_ERROR, "l2cap_server_remove_from_reactor : invalid arguments.\n");
+		return;
+	}
+
+	for (uint8_t i = 0; i < server->max_clients; i++) {
+		if (server->clients[i].conn_id >= 0) {
+			l2cap_server_drop_client(server, reactor, i);
+		}
+	}
+	if (server->socket.sock >= 0) {
+		reactor_remove(reactor, server->socket.sock);
+	}
+	server->launched = 0;
+}
+
+//------------------------------------------------------------------------------------
+
 void l2cap_server_close(l2cap_server_t * server) {
 	for (uint8_t i = 0; i < server->max_clients; i++) {
 		free(server->clients[i].buffer);
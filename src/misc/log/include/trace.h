@@ -38,6 +38,8 @@ typedef enum {
 } trace_lvl_t;
 
 extern void set_trace_lvl(trace_lvl_t lvl);
+
+extern trace_lvl_t get_trace_lvl(void);
 	
 extern void print_trace(trace_lvl_t lvl, const char *format, ...);
 
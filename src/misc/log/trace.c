@@ -55,6 +55,10 @@ void set_trace_lvl(trace_lvl_t lvl) {
 	trace_lvl = lvl;
 }
 
+trace_lvl_t get_trace_lvl(void) {
+	return trace_lvl;
+}
+
 void print_trace(trace_lvl_t lvl, const char *format, ...) {
 	
 	va_list ap;
@@ -0,0 +1,338 @@
+/* The MIT License (MIT)
+ Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+
+#include "reactor.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*--------------------
+  - STATIC FUNCTIONS -
+  --------------------*/
+
+/* Returns the source registered for the given file descriptor. The mutex has to be held.
+   If prev is not NULL, it is set to the link pointing on the source.
+*/
+static reactor_source_t *reactor_find_source(reactor_t *reactor, int fd, reactor_source_t ***prev) {
+	reactor_source_t **link = &(reactor->sources);
+	while (*link) {
+		if ((*link)->fd == fd) {
+			if (prev) {
+				*prev = link;
+			}
+			return *link;
+		}
+		link = &((*link)->next);
+	}
+	return NULL;
+}
+
+//---------------------------------
+
+static void reactor_free_sources(reactor_source_t *list) {
+	while (list) {
+		reactor_source_t *next = list->next;
+		free(list);
+		list = next;
+	}
+}
+
+/*---------------------
+  - REACTOR FUNCTIONS -
+  ---------------------*/
+
+int8_t reactor_init(reactor_t *reactor) {
+	if (!reactor) {
+		print_trace(TRACE_ERROR, "reactor_init : invalid reactor reference.\n");
+		return -1;
+	}
+	memset(reactor, 0, sizeof(reactor_t));
+	reactor->wakeup_fd = -1;
+
+	reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor->epoll_fd < 0) {
+		perror("reactor_init");
+		goto fail;
+	}
+
+	reactor->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (reactor->wakeup_fd < 0) {
+		perror("reactor_init");
+		goto fail;
+	}
+
+	// The wake up descriptor is the only one registered without source.
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wakeup_fd, &event) < 0) {
+		perror("reactor_init");
+		goto fail;
+	}
+
+	pthread_mutex_init(&(reactor->mutex), NULL);
+
+	return 0;
+
+ fail:
+	if (reactor->wakeup_fd >= 0) {
+		close(reactor->wakeup_fd);
+	}
+	if (reactor->epoll_fd >= 0) {
+		close(reactor->epoll_fd);
+	}
+	reactor->epoll_fd = -1;
+	reactor->wakeup_fd = -1;
+	return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t reactor_add(reactor_t *reactor, int fd, uint32_t events, void *data,
+		   reactor_callback_t callback, void *user_data) {
+	if (!reactor || fd < 0 || !callback) {
+		print_trace(TRACE_ERROR, "reactor_add : invalid arguments.\n");
+		return -1;
+	}
+
+	reactor_source_t *source = calloc(1, sizeof(reactor_source_t));
+	if (!source) {
+		perror("reactor_add");
+		return -1;
+	}
+	source->fd = fd;
+	source->events = events;
+	source->data = data;
+	source->callback = callback;
+	source->user_data = user_data;
+
+	pthread_mutex_lock(&(reactor->mutex));
+
+	if (reactor_find_source(reactor, fd, NULL)) {
+		print_trace(TRACE_ERROR, "reactor_add : file descriptor %d already registered.\n", fd);
+		goto fail;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = source;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		perror("reactor_add");
+		goto fail;
+	}
+
+	source->next = reactor->sources;
+	reactor->sources = source;
+	reactor->nb_sources++;
+
+	pthread_mutex_unlock(&(reactor->mutex));
+	return 0;
+
+ fail:
+	pthread_mutex_unlock(&(reactor->mutex));
+	free(source);
+	return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t reactor_modify(reactor_t *reactor, int fd, uint32_t events) {
+	int8_t err_code = -1;
+
+	if (!reactor) {
+		print_trace(TRACE_ERROR, "reactor_modify : invalid reactor reference.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(reactor->mutex));
+
+	reactor_source_t *source = reactor_find_source(reactor, fd, NULL);
+	if (!source) {
+		print_trace(TRACE_ERROR, "reactor_modify : file descriptor %d not registered.\n", fd);
+		goto end;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = source;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+		perror("reactor_modify");
+		goto end;
+	}
+	source->events = events;
+	err_code = 0;
+
+ end:
+	pthread_mutex_unlock(&(reactor->mutex));
+	return err_code;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t reactor_remove(reactor_t *reactor, int fd) {
+	reactor_source_t **link = NULL;
+
+	if (!reactor) {
+		print_trace(TRACE_ERROR, "reactor_remove : invalid reactor reference.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(reactor->mutex));
+
+	reactor_source_t *source = reactor_find_source(reactor, fd, &link);
+	if (!source) {
+		pthread_mutex_unlock(&(reactor->mutex));
+		print_trace(TRACE_WARNING, "reactor_remove : file descriptor %d not registered.\n", fd);
+		return -1;
+	}
+
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+		// The descriptor may have already been closed, the source is removed anyway.
+		perror("reactor_remove");
+	}
+
+	// The source may still be referenced by the events of the current iteration :
+	// it is only released at the end of it.
+	*link = source->next;
+	source->removed = 1;
+	source->next = reactor->removed;
+	reactor->removed = source;
+	reactor->nb_sources--;
+
+	pthread_mutex_unlock(&(reactor->mutex));
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+int16_t reactor_dispatch(reactor_t *reactor, int timeout) {
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	int16_t dispatched = 0;
+
+	if (!reactor || reactor->epoll_fd < 0) {
+		print_trace(TRACE_ERROR, "reactor_dispatch : invalid reactor.\n");
+		return -1;
+	}
+
+	int n = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+	if (n < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		perror("reactor_dispatch");
+		return -1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		reactor_source_t *source = (reactor_source_t *)events[i].data.ptr;
+
+		if (!source) {
+			uint64_t value;
+			if (read(reactor->wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+				perror("reactor_dispatch");
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&(reactor->mutex));
+		char removed = source->removed;
+		pthread_mutex_unlock(&(reactor->mutex));
+		if (removed) {
+			continue;
+		}
+
+		source->callback(reactor, source->fd, events[i].events, source->data, source->user_data);
+		dispatched++;
+	}
+
+	pthread_mutex_lock(&(reactor->mutex));
+	reactor_source_t *removed_list = reactor->removed;
+	reactor->removed = NULL;
+	pthread_mutex_unlock(&(reactor->mutex));
+	reactor_free_sources(removed_list);
+
+	return dispatched;
+}
+
+//------------------------------------------------------------------------------------
+
+int8_t reactor_run(reactor_t *reactor) {
+	if (!reactor) {
+		print_trace(TRACE_ERROR, "reactor_run : invalid reactor reference.\n");
+		return -1;
+	}
+
+	reactor->running = 1;
+	while (reactor->running) {
+		if (reactor_dispatch(reactor, -1) < 0) {
+			reactor->running = 0;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+void reactor_stop(reactor_t *reactor) {
+	if (!reactor || reactor->wakeup_fd < 0) {
+		print_trace(TRACE_ERROR, "reactor_stop : invalid reactor.\n");
+		return;
+	}
+
+	reactor->running = 0;
+	uint64_t value = 1;
+	if (write(reactor->wakeup_fd, &value, sizeof(value)) < 0) {
+		perror("reactor_stop");
+	}
+}
+
+//------------------------------------------------------------------------------------
+
+void reactor_close(reactor_t *reactor) {
+	if (!reactor || reactor->epoll_fd < 0) {
+		print_trace(TRACE_WARNING, "reactor_close : already closed reactor.\n");
+		return;
+	}
+
+	pthread_mutex_lock(&(reactor->mutex));
+	reactor_free_sources(reactor->sources);
+	reactor_free_sources(reactor->removed);
+	reactor->sources = NULL;
+	reactor->removed = NULL;
+	reactor->nb_sources = 0;
+	pthread_mutex_unlock(&(reactor->mutex));
+
+	close(reactor->wakeup_fd);
+	close(reactor->epoll_fd);
+	reactor->wakeup_fd = -1;
+	reactor->epoll_fd = -1;
+	pthread_mutex_destroy(&(reactor->mutex));
+}
@@ -0,0 +1,141 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the AD structure iterator and the beacon matcher, on crafted frames and on the
+   reports of a simulated adapter.
+   Usage : ./test_ad
+*/
+
+#include "hci_ad.h"
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(void) {
+	uint8_t uuid[16], other_uuid[16];
+	for (int i = 0; i < 16; i++) {
+		uuid[i] = 0xA0 + i;
+		other_uuid[i] = 0x10 + i;
+	}
+	uint8_t ibeacon[30] = {0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15};
+	memcpy(ibeacon + 9, uuid, 16);
+	ibeacon[29] = 0xC5; // Measured power
+	const uint8_t namespace_id[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+	const uint8_t eddystone[] = {0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE,
+				     0x15, 0x16, 0xAA, 0xFE, 0x00, 0xEE, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+				     1, 2, 3, 4, 5, 6, 0x00, 0x00};
+	const uint8_t overflowing[] = {0x02, 0x01, 0x06, 0x28, 0xFF, 0x4C, 0x00, 0x02, 0x15};
+	hci_ad_iterator_t it;
+	hci_ad_structure_t ad;
+
+	// The structures point into the data, and the iteration stops at the padding :
+	hci_ad_iterator_init(&it, eddystone, sizeof(eddystone));
+	CHECK(hci_ad_iterator_next(&it, &ad) && ad.type == HCI_AD_FLAGS && ad.length == 1 && ad.value == eddystone + 2);
+	CHECK(hci_ad_iterator_next(&it, &ad) && ad.type == HCI_AD_COMPLETE_UUID16 && ad.length == 2);
+	CHECK(hci_ad_iterator_next(&it, &ad) && ad.type == HCI_AD_SERVICE_DATA_UUID16 && ad.length == 20);
+	CHECK(!hci_ad_iterator_next(&it, &ad));
+	// ... or at a structure exceeding the data :
+	hci_ad_iterator_init(&it, overflowing, sizeof(overflowing));
+	CHECK(hci_ad_iterator_next(&it, &ad) && ad.type == HCI_AD_FLAGS);
+	CHECK(!hci_ad_iterator_next(&it, &ad));
+	CHECK(hci_ad_find(eddystone, sizeof(eddystone), HCI_AD_SERVICE_DATA_UUID16, &ad) == 1);
+	CHECK(ad.value == eddystone + 9 && ad.length == 20);
+	CHECK(hci_ad_find(eddystone, sizeof(eddystone), HCI_AD_MANUFACTURER_DATA, &ad) == 0);
+
+	// The first pattern added wins, and the unmatched frames aren't classified :
+	hci_ad_matcher_t matcher;
+	hci_ad_matcher_init(&matcher);
+	CHECK(hci_ad_matcher_match(&matcher, ibeacon, sizeof(ibeacon)) == HCI_AD_NO_MATCH);
+	CHECK(hci_ad_matcher_add_ibeacon(&matcher, other_uuid) == 0);
+	CHECK(hci_ad_matcher_add_ibeacon(&matcher, uuid) == 1);
+	CHECK(hci_ad_matcher_add_eddystone(&matcher, 0x00, namespace_id) == 2);
+	CHECK(hci_ad_matcher_add_ibeacon(&matcher, NULL) == 3);
+	CHECK(hci_ad_matcher_match(&matcher, ibeacon, sizeof(ibeacon)) == 1);
+	CHECK(hci_ad_matcher_match(&matcher, eddystone, sizeof(eddystone)) == 2);
+	CHECK(hci_ad_matcher_match(&matcher, overflowing, sizeof(overflowing)) == HCI_AD_NO_MATCH);
+	CHECK(hci_ad_matcher_match(&matcher, NULL, 0) == HCI_AD_NO_MATCH);
+	ibeacon[20] ^= 0x01; // Another UUID : only the generic iBeacon pattern matches
+	CHECK(hci_ad_matcher_match(&matcher, ibeacon, sizeof(ibeacon)) == 3);
+	CHECK(hci_ad_matcher_match(&matcher, ibeacon, 20) == HCI_AD_NO_MATCH); // Truncated frame
+
+	// A mask only compares some bits, and a shorter value never matches :
+	hci_ad_matcher_init(&matcher);
+	const uint8_t bytes[] = {0x4C, 0x00, 0x02};
+	const uint8_t mask[] = {0xFF, 0xFF, 0x00};
+	CHECK(hci_ad_matcher_add(&matcher, HCI_AD_MANUFACTURER_DATA, bytes, mask, sizeof(bytes)) == 0);
+	CHECK(hci_ad_matcher_match(&matcher, ibeacon, sizeof(ibeacon)) == 0);
+	const uint8_t short_value[] = {0x03, 0xFF, 0x4C, 0x00};
+	CHECK(hci_ad_matcher_match(&matcher, short_value, sizeof(short_value)) == HCI_AD_NO_MATCH);
+	CHECK(hci_ad_matcher_add(&matcher, HCI_AD_FLAGS, bytes, NULL, HCI_AD_PATTERN_SIZE + 1) < 0);
+	for (int i = 1; i < HCI_AD_MATCHER_MAX_PATTERNS; i++) {
+		CHECK(hci_ad_matcher_add(&matcher, HCI_AD_FLAGS, bytes, NULL, 1) == i);
+	}
+	CHECK(hci_ad_matcher_add(&matcher, HCI_AD_FLAGS, bytes, NULL, 1) < 0);
+
+	// Classification of scanned reports : the simulated devices advertise their index
+	// in manufacturer data of the company 0xFFFF (@see hci_sim.c).
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = 8;
+	config.reports_per_second = 5000;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	hci_ad_matcher_init(&matcher);
+	const uint8_t index[] = {0x03, 0x00, 0x00, 0x00};
+	CHECK(hci_ad_matcher_add_manufacturer(&matcher, 0xFFFF, index, sizeof(index)) == 0);
+	hci_scan_session_t session;
+	hci_report_batch_t batch;
+	CHECK(hci_report_batch_init(&batch, HCI_REPORT_DEFAULT_CAPACITY) == 0);
+	CHECK(hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00, 0x00) == 0);
+	CHECK(hci_LE_scan_session_read(&session, &batch, NULL, 1000) > 0);
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+	int16_t classes[HCI_REPORT_DEFAULT_CAPACITY];
+	bt_address_t mac = hci_sim_device_address(sim, 3);
+	uint16_t expected = 0, misclassified = 0;
+	for (uint16_t i = 0; i < batch.length; i++) {
+		expected += bt_compare_addresses(&(batch.reports[i].mac), &mac);
+	}
+	CHECK(expected > 0);
+	CHECK(hci_ad_matcher_classify(&matcher, &batch, classes) == expected);
+	for (uint16_t i = 0; i < batch.length; i++) {
+		if (classes[i] != (bt_compare_addresses(&(batch.reports[i].mac), &mac) ? 0 : HCI_AD_NO_MATCH)) {
+			misclassified++;
+		}
+	}
+	CHECK(misclassified == 0);
+
+	hci_report_batch_destroy(&batch);
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_ad");
+}
@@ -0,0 +1,152 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the offsets of the BPF programs filtering the reports in the kernel, by
+   attaching them to the socket of scan sessions on a simulated adapter (legacy and
+   extended advertising reports).
+   Usage : ./test_bpf
+*/
+
+#include "hci_controller.h"
+#include "hci_bpf.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_DEVICES 100
+#define NB_TRACKED 5
+
+/* Scans for 500 ms with the program of the given criteria attached to the session's
+   socket. The reports received from each simulated device are counted in "seen". If
+   "detach" is set, the program is detached before the scan.
+   Returns the number of received reports, -1 if the scan failed.
+*/
+static int32_t scan(hci_controller_t *hci_controller, char extended, const hci_bpf_match_t *match,
+		    char detach, uint32_t seen[NB_DEVICES]) {
+	hci_scan_session_t session;
+	hci_bpf_program_t program;
+	hci_report_batch_t batch;
+	int32_t total = 0;
+
+	memset(seen, 0, NB_DEVICES * sizeof(uint32_t));
+	if (hci_bpf_compile(&program, match) < 0) {
+		return -1;
+	}
+	int8_t err = hci_LE_start_filtered_scan_session(&session, hci_controller, &program,
+						     extended ? HCI_LE_SCAN_PHY_1M : 0,
+						     0x00, 0x10, 0x10, 0x00, 0x00);
+	hci_bpf_free(&program);
+	if (err < 0) {
+		return -1;
+	}
+	if (!session.filtered || (detach && hci_bpf_detach(&(session.hci_socket)) < 0)) {
+		total = -1;
+		goto end;
+	}
+	if (detach) {
+		session.filtered = 0; // Nothing left to detach when the session stops
+	}
+	hci_report_batch_init(&batch, HCI_REPORT_DEFAULT_CAPACITY);
+	for (int i = 0; i < 5; i++) {
+		int16_t n = hci_LE_scan_session_read(&session, &batch, NULL, 100);
+		for (int16_t j = 0; j < n; j++) {
+			uint32_t index = batch.reports[j].mac.b[0] | (batch.reports[j].mac.b[1] << 8);
+			if (index < NB_DEVICES) {
+				seen[index]++;
+			}
+			total++;
+		}
+	}
+	hci_report_batch_destroy(&batch);
+
+ end:
+	if (hci_LE_stop_scan_session(&session) < 0 || session.filtered) {
+		total = -1;
+	}
+	return total;
+}
+
+//---------------------------------
+
+static uint32_t count_devices(const uint32_t seen[NB_DEVICES]) {
+	uint32_t devices = 0;
+	for (int i = 0; i < NB_DEVICES; i++) {
+		devices += (seen[i] > 0);
+	}
+	return devices;
+}
+
+//---------------------------------
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = NB_DEVICES;
+	config.reports_per_second = 20000;
+	config.reports_per_event = 1; // The events carrying several reports aren't filtered
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+
+	bt_address_t tracked[NB_TRACKED];
+	for (int i = 0; i < NB_TRACKED; i++) {
+		tracked[i] = hci_sim_device_address(sim, 10 + 7*i);
+	}
+	hci_bpf_match_t by_address = {.addresses = tracked, .nb_addresses = NB_TRACKED};
+	// The simulated devices send "Manufacturer Specific Data" with the 0xFFFF identifier :
+	hci_bpf_match_t by_company = {.match_company = 1, .company_id = 0xFFFF};
+	hci_bpf_match_t by_other_company = {.match_company = 1, .company_id = 0x004C};
+	hci_bpf_match_t by_uuid = {.match_uuid16 = 1, .uuid16 = 0x180F};
+	uint32_t seen[NB_DEVICES];
+
+	for (char extended = 0; extended <= 1; extended++) {
+		// Only the tracked devices, and all of them, pass :
+		CHECK(scan(&hci_controller, extended, &by_address, 0, seen) > 0);
+		CHECK(count_devices(seen) == NB_TRACKED);
+		for (int i = 0; i < NB_TRACKED; i++) {
+			CHECK(seen[10 + 7*i] > 0);
+		}
+
+		// The AD structures are found in the data :
+		CHECK(scan(&hci_controller, extended, &by_company, 0, seen) > 0);
+		CHECK(count_devices(seen) == NB_DEVICES);
+		CHECK(scan(&hci_controller, extended, &by_other_company, 0, seen) == 0);
+		CHECK(scan(&hci_controller, extended, &by_uuid, 0, seen) == 0);
+
+		// Once detached, the program doesn't filter anymore :
+		CHECK(scan(&hci_controller, extended, &by_other_company, 1, seen) > 0);
+		CHECK(count_devices(seen) == NB_DEVICES);
+	}
+
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_bpf");
+}
@@ -0,0 +1,165 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the cancellation and the deadline of the collections of reports against a
+   simulated adapter : a blocked read is woken up at once, a deadline bounds a collection
+   whether the reports keep arriving or not, and neither affects the following ones.
+   Usage : ./test_cancel
+*/
+
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEADLINE 250 // ms
+
+static hci_scan_session_t session;
+static hci_report_batch_t batch;
+static int16_t read_result;
+static struct timespec read_end;
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void set_deadline(hci_controller_t *hci_controller, uint32_t ms) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += ms / 1000;
+	deadline.tv_nsec += (ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	hci_controller_set_deadline(hci_controller, &deadline);
+}
+
+static void *read_routine(void *arg) {
+	(void)arg;
+	read_result = hci_LE_scan_session_read(&session, &batch, NULL, 5000);
+	clock_gettime(CLOCK_MONOTONIC, &read_end);
+	return NULL;
+}
+
+static void *get_reports_routine(void *arg) {
+	read_result = hci_LE_get_reports(NULL, arg, &batch, NULL, 0x00, 0x0010, 0x0010, 0x00, 0x00);
+	clock_gettime(CLOCK_MONOTONIC, &read_end);
+	return NULL;
+}
+
+int main(void) {
+	// A silent adapter first, so that the reads only end when they are told to :
+	hci_sim_config_t config = hci_sim_default_config();
+	config.reports_per_second = 0;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	CHECK(hci_controller.cancel_fd >= 0);
+	CHECK(hci_report_batch_init(&batch, 1000) == 0);
+	CHECK(hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x0010, 0x0010, 0x00, 0x00) == 0);
+	struct timespec start, end;
+	pthread_t reader;
+
+	// A blocked read is cancelled at once, as many times as needed :
+	for (uint8_t i = 0; i < 3; i++) {
+		pthread_create(&reader, NULL, read_routine, NULL);
+		usleep(100000);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		hci_controller_cancel(&hci_controller);
+		pthread_join(reader, NULL);
+		CHECK(read_result == 0);
+		CHECK(elapsed_ms(&start, &read_end) < 100);
+		CHECK(hci_controller.cancel_waiters == 0);
+	}
+
+	// Cancelling while nothing is collected doesn't affect the following reads :
+	hci_controller_cancel(&hci_controller);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CHECK(hci_LE_scan_session_read(&session, &batch, NULL, 200) == 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	CHECK(elapsed_ms(&start, &end) >= 190);
+
+	// A deadline ends a read long before its timeout, then is cleared :
+	set_deadline(&hci_controller, DEADLINE);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CHECK(hci_LE_scan_session_read(&session, &batch, NULL, 5000) == 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	CHECK(elapsed_ms(&start, &end) >= DEADLINE - 10 && elapsed_ms(&start, &end) < DEADLINE + 200);
+	CHECK(__atomic_load_n(&(hci_controller.deadline), __ATOMIC_ACQUIRE) == 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CHECK(hci_LE_scan_session_drain(&session, &batch, 200) == 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	CHECK(elapsed_ms(&start, &end) >= 190);
+
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+	hci_close_controller(&hci_controller);
+	hci_sim_destroy(sim);
+
+	// Then an adapter whose reports keep arriving, which no timeout would stop :
+	config.reports_per_second = 2000;
+	sim = hci_sim_create(&config);
+	if (!sim || hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	hci_report_batch_destroy(&batch);
+	CHECK(hci_report_batch_init(&batch, 30000) == 0);
+
+	// The deadline bounds the whole collection, which keeps the reports received :
+	set_deadline(&hci_controller, DEADLINE);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int16_t n = hci_LE_get_reports(NULL, &hci_controller, &batch, NULL, 0x00, 0x0010, 0x0010, 0x00, 0x00);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	CHECK(n > 0 && n < 30000);
+	CHECK(elapsed_ms(&start, &end) < DEADLINE + 300);
+	CHECK(hci_controller.state == HCI_STATE_OPEN);
+
+	// A cancelled collection too, and the scan is disabled as usual :
+	pthread_create(&reader, NULL, get_reports_routine, &hci_controller);
+	usleep(DEADLINE * 1000);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	hci_controller_cancel(&hci_controller);
+	pthread_join(reader, NULL);
+	CHECK(read_result > 0 && read_result < 30000);
+	CHECK(elapsed_ms(&start, &read_end) < 300);
+	CHECK(hci_controller.state == HCI_STATE_OPEN);
+	pthread_mutex_lock(&(sim->mutex));
+	CHECK(!sim->scan_enabled);
+	pthread_mutex_unlock(&(sim->mutex));
+
+	hci_report_batch_destroy(&batch);
+	hci_close_controller(&hci_controller);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+	return CHECK_RESULT("test_cancel");
+}
@@ -0,0 +1,111 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the capability cache of a controller against a simulated adapter : the
+   capabilities are read at open time, then answered without any command, even while
+   the controller is busy or interrupted.
+   Usage : ./test_caps
+*/
+
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t sim_commands(hci_sim_t *sim) {
+	hci_sim_stats_t stats;
+	hci_sim_get_stats(sim, &stats);
+	return stats.commands;
+}
+
+/* Reads the three cached capabilities, which must match the simulated adapter
+   (@see hci_sim.c).
+*/
+static void check_cached_caps(hci_controller_t *hci_controller, uint8_t white_list_size) {
+	uint8_t features[8];
+	uint64_t states = 0;
+	uint8_t size = 0;
+
+	memset(features, 0, sizeof(features));
+	CHECK(hci_LE_read_local_supported_features(NULL, hci_controller, features) == 0);
+	CHECK(features[0] == 0x01 && features[1] == 0x18);
+	CHECK(hci_LE_read_supported_states(NULL, hci_controller, &states) == 0);
+	CHECK(states == 0x03FFFFFFFFFFULL);
+	CHECK(hci_LE_get_white_list_size(NULL, hci_controller, &size) == 0);
+	CHECK(size == white_list_size);
+}
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.white_list_size = 12;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+
+	// Everything is read at open time :
+	hci_controller_caps_t *caps = &(hci_controller.caps);
+	CHECK(caps->known == (HCI_CAPS_VERSION | HCI_CAPS_COMMANDS | HCI_CAPS_BUFFER_SIZE |
+			      HCI_CAPS_LE_BUFFER_SIZE | HCI_CAPS_LE_FEATURES | HCI_CAPS_LE_STATES |
+			      HCI_CAPS_WHITE_LIST_SIZE));
+	CHECK(caps->hci_ver == 0x09 && caps->lmp_ver == 0x09);
+	CHECK(caps->acl_mtu == 1021 && caps->acl_max_pkt == 8);
+	CHECK(caps->le_mtu == 251 && caps->le_max_pkt == 8);
+	CHECK(caps->white_list_size == 12);
+	CHECK(hci_controller_has_LE_feature(&hci_controller, HCI_LE_FEATURE_ENCRYPTION) == 1);
+	CHECK(hci_controller_has_LE_feature(&hci_controller, HCI_LE_FEATURE_CODED_PHY) == 1);
+	CHECK(hci_controller_has_LE_feature(&hci_controller, HCI_LE_FEATURE_2M_PHY) == 0);
+
+	// The getters don't send any command :
+	uint64_t commands = sim_commands(sim);
+	check_cached_caps(&hci_controller, 12);
+	CHECK(sim_commands(sim) == commands);
+
+	// Nor do they need an idle controller :
+	CHECK(hci_change_state(&hci_controller, HCI_STATE_OPEN, HCI_STATE_WRITING) == 0);
+	check_cached_caps(&hci_controller, 12);
+	hci_controller.interrupted = 1;
+	check_cached_caps(&hci_controller, 12);
+	CHECK(sim_commands(sim) == commands);
+	CHECK(__atomic_load_n(&(hci_controller.state), __ATOMIC_ACQUIRE) == HCI_STATE_WRITING && hci_controller.interrupted);
+	CHECK(hci_resolve_interruption(NULL, &hci_controller) == 0);
+	CHECK(__atomic_load_n(&(hci_controller.state), __ATOMIC_ACQUIRE) == HCI_STATE_OPEN && !hci_controller.interrupted);
+
+	// A refresh reads the adapter again :
+	CHECK(hci_controller_refresh_caps(NULL, &hci_controller) == 0);
+	CHECK(sim_commands(sim) > commands);
+	CHECK(caps->white_list_size == 12);
+	check_cached_caps(&hci_controller, 12);
+
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_caps");
+}
@@ -0,0 +1,50 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Assertions shared by the tests : a failed check is reported and counted, and the
+   test goes on.
+*/
+
+#ifndef __TEST_CHECK_H__
+#define __TEST_CHECK_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(__cond)\
+do {\
+	if (!(__cond)) {\
+		fprintf(stderr, "%s:%d : check failed : %s\n", __FILE__, __LINE__, #__cond);\
+		failures++;\
+	}\
+} while(0);
+// CHECK
+
+/* Reports the number of failed checks of a test and returns its exit status. */
+#define CHECK_RESULT(__test)\
+	(fprintf(stderr, "%s : %d check(s) failed.\n", (__test), failures),\
+	 failures ? EXIT_FAILURE : EXIT_SUCCESS)
+// CHECK_RESULT
+
+#endif // __TEST_CHECK_H__
@@ -0,0 +1,116 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the asynchronous command queue against a simulated adapter : pipelined
+   commands, lost answers and the queue's thread stopping on a socket error.
+   Usage : ./test_cmd_queue
+*/
+
+#include "hci_controller.h"
+#include "hci_cmd_queue.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#define NB_CMDS 20
+
+static void count_completion(hci_cmd_t *cmd, void *user_data) {
+	(void)cmd;
+	(*(int *)user_data)++;
+}
+
+int main(void) {
+	hci_sim_t *sim = hci_sim_create(NULL);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+
+	hci_cmd_queue_t queue;
+	hci_cmd_t cmds[NB_CMDS];
+	hci_sim_stats_t before, after;
+
+	// All the commands are answered, in order :
+	int completed = 0;
+	CHECK(hci_cmd_queue_open(&queue, &hci_controller, 1000) == 0);
+	hci_sim_get_stats(sim, &before);
+	for (int i = 0; i < NB_CMDS; i++) {
+		hci_cmd_init(&cmds[i], OGF_INFO_PARAM, OCF_READ_LOCAL_VERSION, NULL, 0, count_completion, &completed);
+		CHECK(hci_cmd_queue_submit(&queue, &cmds[i]) == 0);
+	}
+	CHECK(hci_cmd_queue_flush(&queue) == 0);
+	hci_sim_get_stats(sim, &after);
+	CHECK(completed == NB_CMDS);
+	CHECK(after.commands - before.commands == NB_CMDS);
+	for (int i = 0; i < NB_CMDS; i++) {
+		CHECK(cmds[i].done && cmds[i].result == 0 && cmds[i].status == 0);
+		CHECK(cmds[i].rlen == 9); // Status and local version information
+	}
+	CHECK(queue.in_flight == 0);
+	hci_cmd_queue_close(&queue);
+
+	// The unanswered commands time out :
+	CHECK(hci_cmd_queue_open(&queue, &hci_controller, 200) == 0);
+	hci_sim_set_fault(sim, HCI_SIM_FAULT_UNRESPONSIVE);
+	for (int i = 0; i < 3; i++) {
+		hci_cmd_init(&cmds[i], OGF_INFO_PARAM, OCF_READ_LOCAL_VERSION, NULL, 0, NULL, NULL);
+		CHECK(hci_cmd_queue_submit(&queue, &cmds[i]) == 0);
+	}
+	for (int i = 0; i < 3; i++) {
+		CHECK(hci_cmd_wait(&queue, &cmds[i]) < 0 && errno == ETIMEDOUT);
+	}
+	hci_cmd_queue_close(&queue);
+
+	/* The queue's thread stops once its socket can't be read anymore : the commands
+	   waiting for their answer fail with its error, as well as the later ones.
+	*/
+	CHECK(hci_cmd_queue_open(&queue, &hci_controller, 5000) == 0);
+	for (int i = 0; i < NB_CMDS; i++) {
+		hci_cmd_init(&cmds[i], OGF_INFO_PARAM, OCF_READ_LOCAL_VERSION, NULL, 0, NULL, NULL);
+		CHECK(hci_cmd_queue_submit(&queue, &cmds[i]) == 0);
+	}
+	shutdown(queue.hci_socket.sock, SHUT_RD);
+	CHECK(hci_cmd_queue_flush(&queue) == 0);
+	for (int i = 0; i < NB_CMDS; i++) {
+		CHECK(hci_cmd_wait(&queue, &cmds[i]) < 0 && errno == ENODEV);
+	}
+	CHECK(!queue.running);
+	hci_cmd_t late;
+	hci_cmd_init(&late, OGF_INFO_PARAM, OCF_READ_LOCAL_VERSION, NULL, 0, NULL, NULL);
+	CHECK(hci_cmd_queue_submit(&queue, &late) < 0);
+	CHECK(late.done && late.result < 0 && late.error == ENODEV);
+	hci_cmd_queue_close(&queue);
+	hci_sim_set_fault(sim, HCI_SIM_FAULT_NONE);
+
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_cmd_queue");
+}
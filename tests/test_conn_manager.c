@@ -0,0 +1,195 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks a connection manager against a simulated adapter : the devices in range are
+   connected, their RSSI is read periodically on every link, the lost links are connected
+   again, and the removed ones are disconnected.
+   Usage : ./test_conn_manager
+*/
+
+#include "bt_device.h"
+#include "hci_conn_manager.h"
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEVICES 10
+#define LINKS 6
+#define QUEUE_SIZE 32
+
+/* Waits (at most timeout ms) for the given condition to hold.
+*/
+#define WAIT_FOR(condition, timeout)							\
+	for (uint32_t _waited = 0; !(condition) && _waited < (timeout); _waited += 20)	\
+		usleep(20000)
+
+static hci_conn_manager_stats_t get_stats(hci_conn_manager_t *manager) {
+	hci_conn_manager_stats_t stats;
+	hci_conn_manager_get_stats(manager, &stats);
+	return stats;
+}
+
+static hci_conn_state_t get_state(hci_conn_manager_t *manager, const bt_address_t *mac) {
+	hci_conn_link_t link;
+	if (hci_conn_manager_get_link(manager, mac, &link) < 0) {
+		return HCI_CONN_STATE_FREE;
+	}
+	return link.state;
+}
+
+static bt_device_t device(bt_address_t mac) {
+	bt_device_t bt_device;
+	memset(&bt_device, 0, sizeof(bt_device));
+	bt_device.mac = mac;
+	bt_device.add_type = PUBLIC_DEVICE_ADDRESS;
+	return bt_device;
+}
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = DEVICES;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	bt_address_t macs[LINKS];
+	for (uint32_t i = 0; i < LINKS; i++) {
+		macs[i] = hci_sim_device_address(sim, i);
+	}
+	bt_address_t unknown;
+	str2ba("11:22:33:44:55:66", &unknown);
+
+	// One manager per controller :
+	hci_conn_manager_t manager, other;
+	hci_conn_manager_config_t manager_config = hci_conn_manager_default_config();
+	manager_config.connect_timeout = 300;
+	manager_config.retry_delay = 200;
+	manager_config.rssi_period = 50;
+	manager_config.queue_size = QUEUE_SIZE;
+	CHECK(hci_conn_manager_start(&manager, &hci_controller, &manager_config) == 0);
+	CHECK(hci_conn_manager_start(&other, &hci_controller, &manager_config) < 0);
+
+	// The devices in range are connected, the unknown one never is :
+	for (uint32_t i = 0; i < LINKS; i++) {
+		bt_device_t bt_device = device(macs[i]);
+		CHECK(hci_conn_manager_add(&manager, &bt_device) == 0);
+	}
+	bt_device_t bt_device = device(unknown);
+	CHECK(hci_conn_manager_add(&manager, &bt_device) == 0);
+	bt_device = device(macs[0]);
+	CHECK(hci_conn_manager_add(&manager, &bt_device) < 0); // Already managed
+	WAIT_FOR(get_stats(&manager).connected == LINKS, 5000);
+	CHECK(get_stats(&manager).connected == LINKS);
+	CHECK(get_state(&manager, &unknown) != HCI_CONN_STATE_CONNECTED);
+	WAIT_FOR(get_stats(&manager).failures > 0, 2000);
+	CHECK(get_stats(&manager).failures > 0);
+
+	// The RSSI of every link is read at each round :
+	hci_report_batch_t batch;
+	CHECK(hci_report_batch_init(&batch, 64) == 0);
+	uint32_t measures[LINKS] = {0};
+	uint32_t others = 0;
+	for (uint8_t round = 0; round < 10; round++) {
+		int16_t n = hci_conn_manager_read(&manager, &batch, 200);
+		CHECK(n >= 0);
+		for (int16_t i = 0; i < n; i++) {
+			hci_report_t *report = &(batch.reports[i]);
+			CHECK(report->evt_type == HCI_REPORT_CONNECTION_EVT_TYPE);
+			CHECK(report->rssi >= config.rssi_min && report->rssi <= config.rssi_max);
+			uint32_t j = 0;
+			while (j < LINKS && bacmp(&(report->mac), &macs[j])) {
+				j++;
+			}
+			if (j < LINKS) {
+				measures[j]++;
+			} else {
+				others++;
+			}
+		}
+	}
+	for (uint32_t i = 0; i < LINKS; i++) {
+		CHECK(measures[i] >= 5);
+	}
+	CHECK(others == 0);
+	hci_conn_manager_stats_t stats = get_stats(&manager);
+	CHECK(stats.rounds > 0 && stats.rssi_reads >= stats.rounds);
+	CHECK(stats.rssi_errors == 0);
+	hci_conn_link_t link;
+	CHECK(hci_conn_manager_get_link(&manager, &macs[0], &link) == 0);
+	CHECK(link.rssi != HCI_REPORT_RSSI_UNAVAILABLE);
+	CHECK(link.interval >= manager_config.min_interval && link.interval <= manager_config.max_interval);
+
+	// The measures not read in time are dropped, the oldest first :
+	usleep(1000 * manager_config.rssi_period * (QUEUE_SIZE / LINKS + 4));
+	CHECK(get_stats(&manager).dropped > 0);
+	CHECK(hci_conn_manager_read(&manager, &batch, 0) == QUEUE_SIZE);
+
+	// A lost link is connected again :
+	uint64_t connections = get_stats(&manager).connections;
+	CHECK(hci_sim_disconnect(sim, &macs[0]) == 0);
+	WAIT_FOR(get_stats(&manager).disconnections == 1, 1000);
+	CHECK(get_stats(&manager).disconnections == 1);
+	WAIT_FOR(get_stats(&manager).connections > connections &&
+		 get_state(&manager, &macs[0]) == HCI_CONN_STATE_CONNECTED, 2000);
+	CHECK(get_stats(&manager).connections > connections);
+	CHECK(get_state(&manager, &macs[0]) == HCI_CONN_STATE_CONNECTED);
+
+	// The connection parameters of the links are updated :
+	CHECK(hci_conn_manager_set_parameters(&manager, 0x0040, 0x0030, 0x0000, 0x0200) < 0);
+	CHECK(hci_conn_manager_set_parameters(&manager, 0x0030, 0x0040, 0x0000, 0x0200) == 0);
+	WAIT_FOR(hci_conn_manager_get_link(&manager, &macs[1], &link) == 0 &&
+		 link.supervision_timeout == 0x0200, 2000);
+	CHECK(link.supervision_timeout == 0x0200);
+	CHECK(link.interval >= 0x0030 && link.interval <= 0x0040);
+
+	// A removed link is disconnected and forgotten :
+	hci_sim_stats_t sim_stats;
+	hci_sim_get_stats(sim, &sim_stats);
+	uint64_t disconnections = sim_stats.disconnections;
+	CHECK(hci_conn_manager_remove(&manager, &macs[1]) == 0);
+	WAIT_FOR(get_state(&manager, &macs[1]) == HCI_CONN_STATE_FREE, 2000);
+	CHECK(hci_conn_manager_get_link(&manager, &macs[1], &link) < 0);
+	CHECK(hci_conn_manager_remove(&manager, &macs[1]) < 0);
+	CHECK(get_stats(&manager).connected == LINKS - 1);
+	hci_sim_get_stats(sim, &sim_stats);
+	CHECK(sim_stats.disconnections == disconnections + 1);
+
+	// Closing the controller stops the manager, which disconnects its links :
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	CHECK(manager.hci_controller == NULL);
+	hci_sim_get_stats(sim, &sim_stats);
+	CHECK(sim_stats.disconnections == sim_stats.connections);
+
+	hci_report_batch_destroy(&batch);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+	return CHECK_RESULT("test_conn_manager");
+}
@@ -0,0 +1,95 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the host-side duplicate filtering of the reports (no adapter needed).
+   Usage : ./test_dedup
+*/
+
+#include "hci_dedup.h"
+#include "hci_report.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static hci_report_t make_report(uint8_t device, const uint8_t *data, uint16_t data_length,
+				int8_t rssi, uint32_t time_ms) {
+	hci_report_t report;
+	memset(&report, 0, sizeof(report));
+	report.mac.b[0] = device;
+	report.mac.b[5] = 0xC0;
+	report.rssi = rssi;
+	report.data = data;
+	report.data_length = data_length;
+	report.timestamp.tv_sec = time_ms / 1000;
+	report.timestamp.tv_nsec = (time_ms % 1000) * 1000000L;
+	return report;
+}
+
+int main(void) {
+	const uint8_t data[] = {0x02, 0x01, 0x06};
+	const uint8_t other_data[] = {0x02, 0x01, 0x04};
+	hci_dedup_t dedup;
+	hci_report_t report;
+
+	// 500 ms window, RSSI moves of 3 dBm kept :
+	CHECK(hci_dedup_init(&dedup, 64, 500, 3) == 0);
+	report = make_report(1, data, sizeof(data), -60, 1000);
+	CHECK(hci_dedup_accept(&dedup, &report));
+	report = make_report(1, data, sizeof(data), -61, 1100);
+	CHECK(!hci_dedup_accept(&dedup, &report)); // Duplicate
+	report = make_report(2, data, sizeof(data), -61, 1100);
+	CHECK(hci_dedup_accept(&dedup, &report)); // Other device
+	report = make_report(1, other_data, sizeof(other_data), -61, 1150);
+	CHECK(hci_dedup_accept(&dedup, &report)); // Other data
+	report = make_report(1, data, sizeof(data), -56, 1200);
+	CHECK(hci_dedup_accept(&dedup, &report)); // RSSI moved
+	report = make_report(1, data, sizeof(data), -57, 1300);
+	CHECK(!hci_dedup_accept(&dedup, &report)); // Compared with the last kept RSSI
+	report = make_report(1, data, sizeof(data), -57, 1700);
+	CHECK(hci_dedup_accept(&dedup, &report)); // Window elapsed
+	report = make_report(1, data, sizeof(data), HCI_REPORT_RSSI_UNAVAILABLE, 1800);
+	CHECK(!hci_dedup_accept(&dedup, &report));
+	CHECK(dedup.stats.kept == 5 && dedup.stats.suppressed == 3);
+
+	hci_dedup_clear(&dedup);
+	report = make_report(1, data, sizeof(data), -57, 1800);
+	CHECK(hci_dedup_accept(&dedup, &report)); // Forgotten
+	hci_dedup_destroy(&dedup);
+
+	/* A full hash set evicts its least recently kept entries : the devices keep being
+	   accepted, the evicted ones being taken for new ones.
+	*/
+	CHECK(hci_dedup_init(&dedup, 8, 10000, 0) == 0);
+	uint32_t accepted = 0;
+	for (uint8_t device = 0; device < 64; device++) {
+		report = make_report(device, data, sizeof(data), -60, 1000 + device);
+		accepted += hci_dedup_accept(&dedup, &report);
+	}
+	CHECK(accepted == 64);
+	CHECK(dedup.stats.evictions >= 64 - dedup.capacity);
+	report = make_report(63, data, sizeof(data), -60, 2000);
+	CHECK(!hci_dedup_accept(&dedup, &report)); // Most recent entry kept
+	hci_dedup_destroy(&dedup);
+
+	return CHECK_RESULT("test_dedup");
+}
@@ -0,0 +1,142 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the Bluetooth 5 extended scan sessions against a simulated adapter : the long
+   advertising data split over several reports are reassembled, on both scanning PHYs.
+   Usage : ./test_ext_scan
+*/
+
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEVICES 20
+#define DATA_LENGTH 600 // Split over three reports by the simulator
+
+/* Checks a data written by the simulator for the given device : flags, then manufacturer
+   specific structures carrying the index of the device (@see hci_sim.c).
+*/
+static char check_data(const uint8_t *data, uint16_t length, uint32_t index) {
+	if (length < 3 || data[0] != 0x02 || data[1] != 0x01 || data[2] != 0x06) {
+		return 0;
+	}
+	for (uint16_t start = 3; start + 4 <= length; start += 256) {
+		if (data[start + 1] != 0xFF) {
+			return 0;
+		}
+		for (uint16_t i = start + 4; i < length && i < start + 256; i++) {
+			if (data[i] != ((index >> (8 * ((i - start - 4) % 4))) & 0xFF)) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = DEVICES;
+	config.reports_per_second = 5000;
+	config.extended_data_length = DATA_LENGTH;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	bt_address_t macs[DEVICES];
+	for (uint32_t i = 0; i < DEVICES; i++) {
+		macs[i] = hci_sim_device_address(sim, i);
+	}
+	hci_scan_session_t session;
+
+	// The sessions the adapter can't run are refused :
+	CHECK(hci_LE_start_ext_scan_session(&session, &hci_controller, 0x02, 0x00, 0x10, 0x10, 0x00, 0x00) < 0);
+	uint64_t features = hci_controller.caps.le_features;
+	hci_controller.caps.le_features &= ~(1ULL << HCI_LE_FEATURE_CODED_PHY);
+	CHECK(hci_LE_start_ext_scan_session(&session, &hci_controller, HCI_LE_SCAN_PHY_CODED,
+					    0x00, 0x10, 0x10, 0x00, 0x00) < 0);
+	hci_controller.caps.le_features &= ~(1ULL << HCI_LE_FEATURE_EXT_ADVERTISING);
+	CHECK(hci_LE_start_ext_scan_session(&session, &hci_controller, HCI_LE_SCAN_PHY_1M,
+					    0x00, 0x10, 0x10, 0x00, 0x00) < 0);
+	hci_controller.caps.le_features = features;
+	CHECK(hci_controller.state == HCI_STATE_OPEN);
+
+	// Every report carries the whole data of its device :
+	CHECK(hci_LE_start_ext_scan_session(&session, &hci_controller, HCI_LE_SCAN_PHY_1M | HCI_LE_SCAN_PHY_CODED,
+					    0x00, 0x10, 0x10, 0x00, 0x00) == 0);
+	CHECK(session.extended);
+	hci_report_batch_t batch;
+	CHECK(hci_report_batch_init(&batch, HCI_REPORT_DEFAULT_CAPACITY) == 0);
+	uint32_t total = 0, coded = 0, unknown = 0, incomplete = 0, wrong_data = 0, wrong_phy = 0;
+	for (int k = 0; k < 10; k++) {
+		int16_t n = hci_LE_scan_session_read(&session, &batch, NULL, 1000);
+		CHECK(n > 0);
+		for (int16_t i = 0; i < n; i++) {
+			const hci_report_t *report = &(batch.reports[i]);
+			int64_t index = -1;
+			for (uint32_t j = 0; j < DEVICES && index < 0; j++) {
+				if (bt_compare_addresses(&(report->mac), &macs[j])) {
+					index = j;
+				}
+			}
+			total++;
+			if (index < 0) {
+				unknown++;
+				continue;
+			}
+			if (!report->extended || report->data_status != HCI_REPORT_DATA_COMPLETE ||
+			    report->data_length != DATA_LENGTH) {
+				incomplete++;
+			} else if (!check_data(report->data, report->data_length, index)) {
+				wrong_data++;
+			}
+			// The simulator advertises the odd devices on the Coded PHY when both are scanned :
+			if (report->primary_phy != ((index & 0x01) ? 0x03 : 0x01)) {
+				wrong_phy++;
+			}
+			coded += (report->primary_phy == 0x03);
+		}
+	}
+	CHECK(total > 0 && coded > 0 && coded < total);
+	CHECK(unknown == 0 && incomplete == 0 && wrong_data == 0 && wrong_phy == 0);
+	CHECK(batch.truncated == 0);
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+
+	// The legacy commands work again once the extended scan is disabled :
+	char *rssi = hci_LE_get_RSSI(NULL, &hci_controller, NULL, NULL, 10, 0x00, 0x10, 0x10, 0x00, 0x00);
+	CHECK(rssi && strlen(rssi) > 0);
+	free(rssi);
+
+	hci_report_batch_destroy(&batch);
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_ext_scan");
+}
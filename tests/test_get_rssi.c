@@ -36,7 +36,8 @@ int main(int argc, char **argv) {
 	bdaddr_t controllerAdd;
 	bdaddr_t sensorMac;
 	str2ba(btControllerAdd, &controllerAdd);
-	hci_controller_t hci_controller = hci_open_controller(&controllerAdd, "SERVER_TEST");
+	hci_controller_t hci_controller;
+	hci_controller_init(&hci_controller, NULL, NULL, &controllerAdd, "SERVER_TEST");
 
 	bt_device_t sensor;
 	str2ba(sensorAdd, &(sensorMac));
@@ -0,0 +1,126 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Scans with three simulated adapters at once and checks that their reports are merged
+   into a single stream ordered by reception time.
+   Usage : ./test_multi_scan
+*/
+
+#include "hci_multi_scan.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ADAPTERS 3
+
+static char sim_scanning(hci_sim_t *sim) {
+	pthread_mutex_lock(&(sim->mutex));
+	char scanning = sim->scan_enabled;
+	pthread_mutex_unlock(&(sim->mutex));
+	return scanning;
+}
+
+int main(void) {
+	hci_sim_t *sims[ADAPTERS];
+	hci_controller_t hci_controllers[ADAPTERS];
+	hci_controller_t *controllers[ADAPTERS];
+	hci_sim_config_t config = hci_sim_default_config();
+	config.reports_per_second = 5000;
+	for (int i = 0; i < ADAPTERS; i++) {
+		config.seed = i + 1;
+		config.address.b[0] = i; // As distinct dongles
+		sims[i] = hci_sim_create(&config);
+		if (!sims[i] ||
+		    hci_controller_init(&hci_controllers[i], &hci_sim_transport, sims[i], NULL, "SIM_TEST") < 0) {
+			fprintf(stderr, "Unable to open the simulated controller.\n");
+			return EXIT_FAILURE;
+		}
+		controllers[i] = &hci_controllers[i];
+	}
+	hci_multi_scan_t scan;
+
+	// A busy controller makes the whole scan fail, and the other ones are left idle :
+	hci_scan_session_t session;
+	CHECK(hci_LE_start_scan_session(&session, controllers[2], 0x00, 0x10, 0x10, 0x00, 0x00) == 0);
+	CHECK(hci_multi_scan_start(&scan, controllers, ADAPTERS, 0x00, 0x10, 0x10, 0x00, 0x00,
+				   HCI_MULTI_SCAN_DEFAULT_MAX_DELAY) < 0);
+	CHECK(controllers[0]->state == HCI_STATE_OPEN && !sim_scanning(sims[0]));
+	CHECK(controllers[1]->state == HCI_STATE_OPEN && !sim_scanning(sims[1]));
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+
+	CHECK(hci_multi_scan_start(&scan, controllers, ADAPTERS, 0x00, 0x10, 0x10, 0x00, 0x00,
+				   HCI_MULTI_SCAN_DEFAULT_MAX_DELAY) == 0);
+	for (int i = 0; i < ADAPTERS; i++) {
+		CHECK(controllers[i]->state == HCI_STATE_SCANNING && sim_scanning(sims[i]));
+	}
+
+	static hci_multi_report_t reports[256];
+	uint64_t read[ADAPTERS] = {0};
+	uint64_t last = 0;
+	uint32_t out_of_order = 0;
+	uint32_t wrong_data = 0;
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		int16_t n = hci_multi_scan_read(&scan, reports, 256, 100);
+		CHECK(n >= 0);
+		for (int16_t i = 0; i < n; i++) {
+			const hci_report_t *report = &(reports[i].report);
+			uint64_t timestamp = report->timestamp.tv_sec * 1000000000ULL + report->timestamp.tv_nsec;
+			if (timestamp < last) {
+				out_of_order++;
+			}
+			last = timestamp;
+			if (report->data != reports[i].data || report->data_length != config.data_length) {
+				wrong_data++;
+			}
+			if (reports[i].adapter < ADAPTERS) {
+				read[reports[i].adapter]++;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (now.tv_sec - start.tv_sec < 1);
+	CHECK(out_of_order == 0);
+	CHECK(wrong_data == 0);
+
+	// Every captured report is either read, waiting or dropped :
+	for (int i = 0; i < ADAPTERS; i++) {
+		hci_multi_scan_stats_t stats;
+		CHECK(hci_multi_scan_get_stats(&scan, i, &stats) == 0);
+		CHECK(read[i] > 0 && !stats.stopped);
+		CHECK(stats.reports == read[i] + stats.pending + stats.drops);
+	}
+	CHECK(hci_multi_scan_get_stats(&scan, ADAPTERS, &(hci_multi_scan_stats_t){0}) < 0);
+
+	CHECK(hci_multi_scan_stop(&scan) == 0);
+	for (int i = 0; i < ADAPTERS; i++) {
+		CHECK(controllers[i]->state == HCI_STATE_OPEN && !sim_scanning(sims[i]));
+		CHECK(hci_close_controller(&hci_controllers[i]) == 0);
+		hci_sim_destroy(sims[i]);
+	}
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_multi_scan");
+}
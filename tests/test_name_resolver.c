@@ -0,0 +1,115 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the background name resolution against a simulated adapter : queuing, positive
+   and negative caching, and expiration of the cached entries.
+   Usage : ./test_name_resolver
+*/
+
+#include "hci_controller.h"
+#include "hci_name_resolver.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TTL 1000 // ms
+#define NEGATIVE_TTL 200 // ms
+
+/* Looks a device up until its name leaves the pending state (at most 2 s). */
+static int8_t wait_name(hci_name_resolver_t *resolver, bt_address_t *mac, char *name) {
+	int8_t status = HCI_NAME_PENDING;
+	for (int i = 0; i < 200 && status == HCI_NAME_PENDING; i++) {
+		usleep(10000);
+		status = hci_name_resolver_lookup(resolver, mac, name);
+	}
+	return status;
+}
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = 8;
+	config.command_latency = 20000; // The requests take some time, as with real devices
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	hci_name_resolver_t resolver, other;
+	hci_name_resolver_stats_t stats;
+	char name[BT_NAME_LENGTH];
+	CHECK(hci_name_resolver_start(&resolver, &hci_controller, TTL, NEGATIVE_TTL) == 0);
+	CHECK(hci_controller.name_resolver == &resolver);
+	CHECK(hci_name_resolver_start(&other, &hci_controller, TTL, NEGATIVE_TTL) < 0);
+
+	// A device is queued once, and its registered entry gets the resolved name :
+	bt_device_t device = bt_device_create(hci_sim_device_address(sim, 3), PUBLIC_DEVICE_ADDRESS, NULL, "SIM_DEVICE");
+	CHECK(hci_name_resolver_lookup(&resolver, &(device.mac), name) == HCI_NAME_PENDING);
+	CHECK(hci_name_resolver_lookup(&resolver, &(device.mac), name) == HCI_NAME_PENDING);
+	CHECK(wait_name(&resolver, &(device.mac), name) == HCI_NAME_RESOLVED);
+	CHECK(strcmp(name, "SIM-000003") == 0);
+	CHECK(strcmp(bt_get_device(device.mac).real_name, "SIM-000003") == 0);
+	hci_name_resolver_get_stats(&resolver, &stats);
+	CHECK(stats.resolved == 1 && stats.unreachable == 0 && stats.cache_hits >= 1);
+
+	// A device out of range isn't asked again until its negative entry expires :
+	bt_address_t unknown;
+	str2ba("11:22:33:44:55:66", &unknown);
+	CHECK(hci_name_resolver_lookup(&resolver, &unknown, name) == HCI_NAME_PENDING);
+	CHECK(wait_name(&resolver, &unknown, name) == HCI_NAME_UNREACHABLE);
+	CHECK(hci_name_resolver_lookup(&resolver, &unknown, name) == HCI_NAME_UNREACHABLE);
+	usleep((NEGATIVE_TTL + 50) * 1000);
+	CHECK(hci_name_resolver_lookup(&resolver, &unknown, name) == HCI_NAME_PENDING);
+	CHECK(wait_name(&resolver, &unknown, name) == HCI_NAME_UNREACHABLE);
+	hci_name_resolver_get_stats(&resolver, &stats);
+	CHECK(stats.unreachable == 2);
+
+	// A resolved name is answered by the cache until its TTL passes :
+	memset(name, 0, sizeof(name));
+	CHECK(hci_name_resolver_lookup(&resolver, &(device.mac), name) == HCI_NAME_RESOLVED);
+	CHECK(strcmp(name, "SIM-000003") == 0);
+	usleep(TTL * 1000);
+	CHECK(hci_name_resolver_lookup(&resolver, &(device.mac), name) == HCI_NAME_PENDING);
+	CHECK(wait_name(&resolver, &(device.mac), name) == HCI_NAME_RESOLVED);
+	hci_name_resolver_get_stats(&resolver, &stats);
+	CHECK(stats.resolved == 2 && stats.dropped == 0);
+	CHECK(stats.lookups > stats.cache_hits);
+
+	// The controller resolves the names by itself once the resolver is stopped :
+	CHECK(hci_name_resolver_stop(&resolver) == 0);
+	CHECK(hci_controller.name_resolver == NULL);
+	device = bt_device_create(hci_sim_device_address(sim, 5), PUBLIC_DEVICE_ADDRESS, NULL, "SIM_DEVICE");
+	CHECK(hci_compute_device_name(NULL, &hci_controller, &device) == 0);
+	CHECK(strcmp(device.real_name, "SIM-000005") == 0);
+
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_name_resolver");
+}
@@ -0,0 +1,149 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the periodic inquiry sessions against a simulated adapter : the results of each
+   inquiry are delivered as typed reports carrying the RSSI and the extended inquiry
+   response, until the session is stopped.
+   Usage : ./test_periodic_inquiry
+*/
+
+#include "hci_ad.h"
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEVICES 10
+#define MAX_RSP 6 // Results per inquiry
+#define INQUIRIES 2
+
+/* Returns the index of the simulated device having the given address, -1 if none.
+*/
+static int32_t device_index(hci_sim_t *sim, const bt_address_t *mac) {
+	for (uint32_t i = 0; i < DEVICES; i++) {
+		bt_address_t device = hci_sim_device_address(sim, i);
+		if (!bacmp(&device, mac)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = DEVICES;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	hci_report_batch_t batch;
+	CHECK(hci_report_batch_init(&batch, 64) == 0);
+	hci_scan_session_t session;
+
+	// Invalid periods and durations are refused :
+	CHECK(hci_start_periodic_inquiry_session(&session, &hci_controller, 2, 2, 1, 0) < 0);
+	CHECK(hci_start_periodic_inquiry_session(&session, &hci_controller, 2, 3, 2, 0) < 0);
+	CHECK(hci_controller.state == HCI_STATE_OPEN);
+
+	// The session puts the adapter in the extended inquiry mode and runs the periodic inquiry :
+	CHECK(hci_start_periodic_inquiry_session(&session, &hci_controller, 2, 3, 1, MAX_RSP) == 0);
+	CHECK(session.active && session.classic);
+	CHECK(hci_controller.state == HCI_STATE_SCANNING);
+	CHECK(hci_controller.inquiry_mode == HCI_INQUIRY_MODE_EXTENDED);
+	pthread_mutex_lock(&(sim->mutex));
+	CHECK(sim->periodic_inquiry && sim->inquiry_mode == HCI_INQUIRY_MODE_EXTENDED);
+	pthread_mutex_unlock(&(sim->mutex));
+
+	// Its parameters can't be changed, and the controller stays busy :
+	CHECK(hci_LE_scan_session_set_parameters(&session, 0x00, 0x0010, 0x0010) < 0);
+	hci_scan_session_t other;
+	CHECK(hci_LE_start_scan_session(&other, &hci_controller, 0x00, 0x0010, 0x0010, 0x00, 0x00) < 0);
+	CHECK(hci_start_periodic_inquiry_session(&other, &hci_controller, 2, 3, 1, 0) < 0);
+
+	// The results of successive inquiries are delivered continuously (an inquiry every 2.56 s) :
+	uint32_t received[DEVICES] = {0};
+	uint32_t total = 0, named = 0, unknown = 0;
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		int16_t n = hci_LE_scan_session_drain(&session, &batch, 200);
+		CHECK(n >= 0);
+		for (int16_t i = 0; i < n; i++) {
+			hci_report_t *report = &(batch.reports[i]);
+			int32_t index = device_index(sim, &(report->mac));
+			if (index < 0) {
+				unknown++;
+				continue;
+			}
+			received[index]++;
+			total++;
+			CHECK(report->evt_type == HCI_REPORT_CLASSIC_EVT_TYPE);
+			CHECK(report->rssi != HCI_REPORT_RSSI_UNAVAILABLE);
+			CHECK(report->rssi >= config.rssi_min && report->rssi <= config.rssi_max);
+			// The extended inquiry response holds the name of the device :
+			hci_ad_structure_t name;
+			char expected[16];
+			snprintf(expected, sizeof(expected), "SIM-%06u", (uint32_t)index);
+			if (hci_ad_find(report->data, report->data_length, 0x09, &name) > 0 &&
+			    name.length == strlen(expected) && !memcmp(name.value, expected, name.length)) {
+				named++;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (total < INQUIRIES * MAX_RSP && now.tv_sec - start.tv_sec < 8);
+	CHECK(total >= INQUIRIES * MAX_RSP);
+	CHECK(named == total);
+	CHECK(unknown == 0);
+	// Each inquiry is limited to MAX_RSP results :
+	for (uint32_t i = 0; i < DEVICES; i++) {
+		CHECK(i < MAX_RSP ? received[i] >= INQUIRIES : received[i] == 0);
+	}
+
+	// Stopping the session exits the periodic inquiry mode :
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+	CHECK(!session.active);
+	CHECK(hci_controller.state == HCI_STATE_OPEN);
+	pthread_mutex_lock(&(sim->mutex));
+	CHECK(!sim->periodic_inquiry);
+	pthread_mutex_unlock(&(sim->mutex));
+	CHECK(hci_LE_stop_scan_session(&session) < 0);
+
+	// A one-shot inquiry keeps working, in the extended inquiry mode :
+	int16_t n = hci_get_reports(NULL, &hci_controller, &batch, NULL, 1, 0);
+	CHECK(n == DEVICES);
+	CHECK(n > 0 && batch.reports[0].data_length > 0);
+
+	hci_report_batch_destroy(&batch);
+	hci_close_controller(&hci_controller);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+	return CHECK_RESULT("test_periodic_inquiry");
+}
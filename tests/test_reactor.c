@@ -0,0 +1,131 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Drives two simulated adapters from a single reactor : the sockets of the controllers
+   are registered and unregistered with them, and each one gets its own events.
+   Usage : ./test_reactor
+*/
+
+#include "hci_controller.h"
+#include "hci_socket.h"
+#include "hci_sim.h"
+#include "reactor.h"
+#include "test_check.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STOP_EVENTS 200 // Events of the first adapter stopping the reactor
+#define REMOVE_EVENTS 20 // Events of the second adapter unregistering its socket
+
+static int events[2];
+static int foreign_events = 0;
+
+static void on_event(reactor_t *reactor, int fd, uint32_t ev, void *data, void *user_data) {
+	hci_socket_t *hci_socket = (hci_socket_t *)data;
+	long index = (long)user_data;
+	uint8_t buffer[HCI_MAX_EVENT_SIZE];
+
+	(void)ev;
+	if (hci_socket->sock != fd) {
+		foreign_events++;
+	}
+	if (read_hci_socket(hci_socket, buffer, sizeof(buffer)) <= 0) {
+		return;
+	}
+	events[index]++;
+	if (index == 1 && events[index] == REMOVE_EVENTS) {
+		reactor_remove(reactor, fd); // Removed while its event is being dispatched
+	} else if (index == 0 && events[index] == STOP_EVENTS) {
+		reactor_stop(reactor);
+	}
+}
+
+static void *stop_routine(void *data) {
+	sleep(5); // Guard against a reactor which wouldn't dispatch anything
+	reactor_stop((reactor_t *)data);
+	return NULL;
+}
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.reports_per_second = 2000;
+	hci_sim_t *sims[2] = {hci_sim_create(&config), hci_sim_create(&config)};
+	if (!sims[0] || !sims[1]) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controllers[2];
+	for (int i = 0; i < 2; i++) {
+		if (hci_controller_init(&hci_controllers[i], &hci_sim_transport, sims[i], NULL, "SIM_TEST") < 0) {
+			fprintf(stderr, "Unable to open the simulated controller.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// The listed sockets are registered, as well as the ones opened afterwards :
+	reactor_t reactor;
+	CHECK(reactor_init(&reactor) == 0);
+	CHECK(hci_controller_add_to_reactor(&hci_controllers[0], &reactor, on_event, (void *)0) == 0);
+	CHECK(hci_controller_add_to_reactor(&hci_controllers[1], &reactor, on_event, (void *)1) == 0);
+	CHECK(hci_controller_add_to_reactor(&hci_controllers[1], &reactor, on_event, (void *)1) < 0);
+	uint16_t sources = reactor.nb_sources;
+	CHECK(sources == 2);
+	hci_socket_t extra = hci_open_socket_controller(&hci_controllers[1]);
+	CHECK(extra.sock >= 0 && reactor.nb_sources == sources + 1);
+	CHECK(hci_close_socket_controller(&hci_controllers[1], &extra) == 0);
+	CHECK(reactor.nb_sources == sources);
+
+	// ... while the commands still use the unregistered sockets of the pool :
+	CHECK(hci_LE_clear_white_list(NULL, &hci_controllers[0]) == 0);
+
+	for (int i = 0; i < 2; i++) {
+		hci_socket_t *hci_socket = hci_controllers[i].sockets_list->val;
+		CHECK(apply_hci_socket_filter_profile(hci_socket, HCI_FILTER_PROFILE_LE_SCAN) == 0);
+		le_set_scan_enable_cp cp;
+		cp.enable = 0x01;
+		cp.filter_dup = 0x00;
+		CHECK(send_hci_socket_cmd(hci_socket, OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE,
+					  LE_SET_SCAN_ENABLE_CP_SIZE, &cp) == 0);
+	}
+	pthread_t guard;
+	pthread_create(&guard, NULL, stop_routine, &reactor);
+	CHECK(reactor_run(&reactor) == 0);
+	pthread_cancel(guard);
+	pthread_join(guard, NULL);
+	CHECK(events[0] == STOP_EVENTS);
+	CHECK(events[1] == REMOVE_EVENTS); // Nothing dispatched once removed
+	CHECK(foreign_events == 0);
+	CHECK(reactor.nb_sources == sources - 1);
+
+	// Closing the controllers unregisters what is left :
+	for (int i = 0; i < 2; i++) {
+		CHECK(hci_close_controller(&hci_controllers[i]) == 0);
+		hci_sim_destroy(sims[i]);
+	}
+	CHECK(reactor.nb_sources == 0);
+	reactor_close(&reactor);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_reactor");
+}
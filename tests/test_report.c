@@ -0,0 +1,150 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the decoding of the report events into report records, and their storage in
+   the batches (no adapter needed).
+   Usage : ./test_report
+*/
+
+#include "hci_report.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Starts an LE advertising report event (packet indicator included) in packet. */
+static uint16_t le_report_event(uint8_t *packet) {
+	packet[0] = HCI_EVENT_PKT;
+	packet[1] = EVT_LE_META_EVENT;
+	packet[2] = 2; // Parameters length
+	packet[3] = EVT_LE_ADVERTISING_REPORT;
+	packet[4] = 0; // Number of reports
+	return 5;
+}
+
+/* Appends a report to the event started in packet, and returns the new event length. */
+static uint16_t le_report_add(uint8_t *packet, uint16_t length, uint8_t device, const uint8_t *data,
+			      uint8_t data_length, int8_t rssi) {
+	uint8_t *report = packet + length;
+	report[0] = 0x03; // ADV_NONCONN_IND
+	report[1] = LE_RANDOM_ADDRESS;
+	memset(report + 2, 0, 6);
+	report[2] = device;
+	report[7] = 0xC0;
+	report[8] = data_length;
+	memcpy(report + 9, data, data_length);
+	report[9 + data_length] = (uint8_t)rssi;
+	packet[2] += 10 + data_length;
+	packet[4]++;
+	return length + 10 + data_length;
+}
+
+int main(void) {
+	const uint8_t data[] = {0x02, 0x01, 0x06, 0x03, 0xFF, 0x34, 0x12};
+	uint8_t packet[HCI_MAX_EVENT_SIZE];
+	hci_report_iterator_t it;
+	hci_report_t report;
+	struct timespec timestamp = {12, 345};
+
+	// The records point into the event, which is decoded report by report :
+	uint16_t length = le_report_event(packet);
+	length = le_report_add(packet, length, 1, data, sizeof(data), -42);
+	length = le_report_add(packet, length, 2, NULL, 0, -80);
+	CHECK(hci_report_iterator_init(&it, packet, length, &timestamp) == 2);
+	CHECK(hci_report_iterator_next(&it, &report) == 1);
+	CHECK(report.mac.b[0] == 1 && report.mac.b[5] == 0xC0 && report.add_type == LE_RANDOM_ADDRESS);
+	CHECK(report.evt_type == 0x03 && !report.extended && report.data_status == HCI_REPORT_DATA_COMPLETE);
+	CHECK(report.rssi == -42 && report.tx_power == HCI_REPORT_TX_POWER_UNAVAILABLE);
+	CHECK(report.data == packet + 5 + 9 && report.data_length == sizeof(data));
+	CHECK(memcmp(report.data, data, sizeof(data)) == 0);
+	CHECK(report.timestamp.tv_sec == 12 && report.timestamp.tv_nsec == 345);
+	CHECK(hci_report_iterator_next(&it, &report) == 1);
+	CHECK(report.mac.b[0] == 2 && report.rssi == -80 && !report.data && !report.data_length);
+	CHECK(hci_report_iterator_next(&it, &report) == 0);
+
+	// A truncated report ends the event, and anything else isn't a report event :
+	CHECK(hci_report_iterator_init(&it, packet, length - 1, NULL) < 0);
+	packet[2]--;
+	CHECK(hci_report_iterator_init(&it, packet, length - 1, NULL) == 2);
+	CHECK(hci_report_iterator_next(&it, &report) == 1);
+	CHECK(hci_report_iterator_next(&it, &report) == 0);
+	packet[2]++;
+	packet[3] = 0x01; // LE Connection Complete
+	CHECK(hci_report_iterator_init(&it, packet, length, NULL) < 0);
+	packet[3] = EVT_LE_ADVERTISING_REPORT;
+
+	// Inquiry results with RSSI :
+	uint8_t inquiry[1 + HCI_EVENT_HDR_SIZE + 1 + INQUIRY_INFO_WITH_RSSI_SIZE];
+	memset(inquiry, 0, sizeof(inquiry));
+	inquiry[0] = HCI_EVENT_PKT;
+	inquiry[1] = EVT_INQUIRY_RESULT_WITH_RSSI;
+	inquiry[2] = 1 + INQUIRY_INFO_WITH_RSSI_SIZE;
+	inquiry[3] = 1;
+	inquiry_info_with_rssi *info = (inquiry_info_with_rssi *)(inquiry + 4);
+	info->bdaddr.b[0] = 7;
+	info->rssi = -65;
+	CHECK(hci_report_iterator_init(&it, inquiry, sizeof(inquiry), NULL) == 1);
+	CHECK(hci_report_iterator_next(&it, &report) == 1);
+	CHECK(report.evt_type == HCI_REPORT_CLASSIC_EVT_TYPE && report.mac.b[0] == 7 && report.rssi == -65);
+
+	// A full batch keeps the rest of the event pending for the next collection :
+	hci_report_batch_t batch;
+	CHECK(hci_report_batch_init(&batch, 1) == 0);
+	uint8_t *buffer = hci_report_batch_next_buffer(&batch);
+	CHECK(buffer != NULL);
+	memcpy(buffer, packet, length);
+	CHECK(hci_report_batch_commit(&batch, length, &timestamp, NULL) == 1);
+	CHECK(batch.length == 1 && batch.reports[0].rssi == -42 && batch.pending);
+	CHECK(hci_report_batch_next_buffer(&batch) == NULL);
+	char *rssi = hci_report_batch_to_string(&batch);
+	CHECK(rssi && strcmp(rssi, "-42;") == 0);
+	free(rssi);
+	hci_report_batch_clear(&batch);
+	CHECK(hci_report_batch_resume(&batch, NULL) == 1);
+	CHECK(batch.length == 1 && batch.reports[0].rssi == -80 && batch.reports[0].timestamp.tv_sec == 12);
+	CHECK(!batch.overflowed);
+	hci_report_batch_destroy(&batch);
+
+	// The reports of the other devices are filtered out :
+	CHECK(hci_report_batch_init(&batch, 8) == 0);
+	bt_address_t mac;
+	memset(&mac, 0, sizeof(mac));
+	mac.b[0] = 2;
+	mac.b[5] = 0xC0;
+	buffer = hci_report_batch_next_buffer(&batch);
+	memcpy(buffer, packet, length);
+	CHECK(hci_report_batch_commit(&batch, length, NULL, &mac) == 1);
+	CHECK(batch.length == 1 && batch.reports[0].mac.b[0] == 2 && batch.filtered == 1);
+	// ... and an added report has its data copied in the batch :
+	report.data = data;
+	report.data_length = sizeof(data);
+	report.mac = mac;
+	CHECK(hci_report_batch_add(&batch, &report) == 1);
+	CHECK(batch.length == 2 && batch.reports[1].data != data);
+	CHECK(memcmp(batch.reports[1].data, data, sizeof(data)) == 0);
+	rssi = hci_report_batch_to_string(&batch);
+	CHECK(rssi && strcmp(rssi, "-80;-65;") == 0);
+	free(rssi);
+	hci_report_batch_destroy(&batch);
+
+	return CHECK_RESULT("test_report");
+}
@@ -0,0 +1,177 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the RSSI rings of the devices : wraparound, consumption of each sample once,
+   concurrent lock-free reads, and their feeding by a scan session on a simulated adapter.
+   Usage : ./test_rssi_ring
+*/
+
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "bt_rssi_ring.h"
+#include "test_check.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WRITTEN_SAMPLES 500000
+
+/* The samples written by the concurrent test carry their index in their timestamp, and
+   an RSSI derived from it, so that a torn sample can be detected.
+*/
+static bt_rssi_sample_t make_sample(uint64_t index) {
+	bt_rssi_sample_t sample;
+	memset(&sample, 0, sizeof(sample));
+	sample.timestamp.tv_sec = index / 1000000000L;
+	sample.timestamp.tv_nsec = index % 1000000000L;
+	sample.rssi = -(int8_t)(index % 100);
+	return sample;
+}
+
+static uint64_t sample_index(const bt_rssi_sample_t *sample) {
+	return sample->timestamp.tv_sec * 1000000000ULL + sample->timestamp.tv_nsec;
+}
+
+static void *writer_routine(void *data) {
+	bt_rssi_ring_t *ring = (bt_rssi_ring_t *)data;
+	for (uint64_t i = 0; i < WRITTEN_SAMPLES; i++) {
+		bt_rssi_sample_t sample = make_sample(i);
+		bt_rssi_ring_push(ring, &sample);
+	}
+	return NULL;
+}
+
+static void *reader_routine(void *data) {
+	bt_rssi_ring_t *ring = (bt_rssi_ring_t *)data;
+	bt_rssi_sample_t samples[BT_RSSI_RING_SIZE];
+	uint64_t position = 0;
+	uint64_t last = 0;
+	long errors = 0;
+	char first = 1;
+
+	while (bt_rssi_ring_position(ring) < WRITTEN_SAMPLES || position < WRITTEN_SAMPLES) {
+		uint16_t n = bt_rssi_ring_read_since(ring, &position, samples, BT_RSSI_RING_SIZE);
+		for (uint16_t i = 0; i < n; i++) {
+			uint64_t index = sample_index(&(samples[i]));
+			if (samples[i].rssi != -(int8_t)(index % 100) || (!first && index <= last)) {
+				errors++;
+			}
+			last = index;
+			first = 0;
+		}
+		if (!n && bt_rssi_ring_position(ring) >= WRITTEN_SAMPLES && position >= WRITTEN_SAMPLES) {
+			break;
+		}
+	}
+	return (void *)errors;
+}
+
+int main(void) {
+	bt_rssi_sample_t samples[BT_RSSI_RING_SIZE];
+
+	// Once full, the ring keeps the latest samples, from the oldest to the newest :
+	bt_rssi_ring_t *ring = bt_rssi_ring_create();
+	CHECK(ring != NULL);
+	CHECK(bt_rssi_ring_read_latest(ring, samples, BT_RSSI_RING_SIZE) == 0);
+	for (uint64_t i = 0; i < 100; i++) {
+		bt_rssi_sample_t sample = make_sample(i);
+		bt_rssi_ring_push(ring, &sample);
+	}
+	CHECK(bt_rssi_ring_position(ring) == 100);
+	CHECK(bt_rssi_ring_read_latest(ring, samples, BT_RSSI_RING_SIZE) == BT_RSSI_RING_SIZE);
+	CHECK(sample_index(&(samples[0])) == 100 - BT_RSSI_RING_SIZE);
+	CHECK(sample_index(&(samples[BT_RSSI_RING_SIZE - 1])) == 99 && samples[BT_RSSI_RING_SIZE - 1].rssi == -99);
+	CHECK(bt_rssi_ring_read_latest(ring, samples, 10) == 10);
+	CHECK(sample_index(&(samples[0])) == 90 && sample_index(&(samples[9])) == 99);
+
+	// A reader which fell behind skips the overwritten samples, then reads each one once :
+	uint64_t position = 0;
+	CHECK(bt_rssi_ring_read_since(ring, &position, samples, BT_RSSI_RING_SIZE) == BT_RSSI_RING_SIZE);
+	CHECK(position == 100 && sample_index(&(samples[0])) == 100 - BT_RSSI_RING_SIZE);
+	CHECK(bt_rssi_ring_read_since(ring, &position, samples, BT_RSSI_RING_SIZE) == 0);
+	for (uint64_t i = 100; i < 105; i++) {
+		bt_rssi_sample_t sample = make_sample(i);
+		bt_rssi_ring_push(ring, &sample);
+	}
+	CHECK(bt_rssi_ring_read_since(ring, &position, samples, 3) == 3);
+	CHECK(sample_index(&(samples[0])) == 100 && position == 103);
+	CHECK(bt_rssi_ring_read_since(ring, &position, samples, BT_RSSI_RING_SIZE) == 2);
+	CHECK(sample_index(&(samples[1])) == 104 && position == 105);
+	bt_rssi_ring_destroy(ring);
+
+	// Readers running along the writer never see a torn or out-of-order sample :
+	ring = bt_rssi_ring_create();
+	pthread_t writer, readers[2];
+	for (int i = 0; i < 2; i++) {
+		pthread_create(&readers[i], NULL, reader_routine, ring);
+	}
+	pthread_create(&writer, NULL, writer_routine, ring);
+	pthread_join(writer, NULL);
+	for (int i = 0; i < 2; i++) {
+		void *errors = NULL;
+		pthread_join(readers[i], &errors);
+		CHECK(errors == NULL);
+	}
+	bt_rssi_ring_destroy(ring);
+
+	// The scan sessions feed the rings of the registered devices :
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = 2;
+	config.reports_per_second = 1000;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	bt_device_t device = bt_device_create(hci_sim_device_address(sim, 1), PUBLIC_DEVICE_ADDRESS, NULL, "SIM_DEVICE");
+	hci_scan_session_t session;
+	hci_report_batch_t batch;
+	CHECK(hci_report_batch_init(&batch, HCI_REPORT_DEFAULT_CAPACITY) == 0);
+	CHECK(hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00, 0x00) == 0);
+	uint16_t received = 0;
+	while (received < 2 * BT_RSSI_RING_SIZE) {
+		int16_t n = hci_LE_scan_session_read(&session, &batch, &(device.mac), 1000);
+		if (n <= 0) {
+			break;
+		}
+		received += n;
+	}
+	CHECK(received >= 2 * BT_RSSI_RING_SIZE);
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+	CHECK(bt_device_get_RSSI_samples(device.mac, samples, BT_RSSI_RING_SIZE) == BT_RSSI_RING_SIZE);
+	CHECK(samples[BT_RSSI_RING_SIZE - 1].rssi == batch.reports[batch.length - 1].rssi);
+	for (uint16_t i = 0; i < BT_RSSI_RING_SIZE; i++) {
+		CHECK(samples[i].rssi >= config.rssi_min && samples[i].rssi <= config.rssi_max);
+	}
+	hci_report_batch_destroy(&batch);
+
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_rssi_ring");
+}
@@ -0,0 +1,117 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the long-lived LE scan sessions against a simulated adapter : the scan is
+   enabled once, read batch after batch and disabled when the session is stopped.
+   Usage : ./test_scan_session
+*/
+
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char sim_scanning(hci_sim_t *sim) {
+	pthread_mutex_lock(&(sim->mutex));
+	char scanning = sim->scan_enabled;
+	pthread_mutex_unlock(&(sim->mutex));
+	return scanning;
+}
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = 4;
+	config.reports_per_second = 2000;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	hci_report_batch_t batch;
+	CHECK(hci_report_batch_init(&batch, HCI_REPORT_DEFAULT_CAPACITY) == 0);
+
+	// The session keeps the controller, which can't be used for anything else :
+	hci_scan_session_t session, other;
+	CHECK(hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00, 0x00) == 0);
+	CHECK(session.active && hci_controller.scan_session == &session);
+	CHECK(hci_controller.state == HCI_STATE_SCANNING);
+	CHECK(sim_scanning(sim));
+	CHECK(hci_LE_start_scan_session(&other, &hci_controller, 0x00, 0x10, 0x10, 0x00, 0x00) < 0);
+	CHECK(hci_LE_clear_white_list(NULL, &hci_controller) < 0);
+
+	// Consecutive reads don't enable the scan again :
+	hci_sim_stats_t stats;
+	hci_sim_get_stats(sim, &stats);
+	uint64_t commands = stats.commands;
+	uint32_t received = 0;
+	for (int i = 0; i < 5; i++) {
+		int16_t n = hci_LE_scan_session_read(&session, &batch, NULL, 1000);
+		CHECK(n > 0 && n == batch.length);
+		received += (n > 0) ? n : 0;
+	}
+	CHECK(received >= 5);
+	for (uint16_t i = 0; i < batch.length; i++) {
+		CHECK(batch.reports[i].rssi >= config.rssi_min && batch.reports[i].rssi <= config.rssi_max);
+		CHECK(batch.reports[i].data_length == config.data_length && batch.reports[i].data);
+	}
+
+	// Only the reports of the given device are kept :
+	bt_address_t mac = hci_sim_device_address(sim, 2);
+	CHECK(hci_LE_scan_session_read(&session, &batch, &mac, 1000) > 0);
+	for (uint16_t i = 0; i < batch.length; i++) {
+		CHECK(bt_compare_addresses(&(batch.reports[i].mac), &mac));
+	}
+	char *rssi = hci_LE_scan_session_get_RSSI(&session, NULL, &mac, 3, 1000);
+	CHECK(rssi && strlen(rssi) > 0);
+	free(rssi);
+	hci_sim_get_stats(sim, &stats);
+	CHECK(stats.commands == commands);
+
+	// The scan is disabled by the stop only :
+	CHECK(sim_scanning(sim));
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+	CHECK(!sim_scanning(sim));
+	CHECK(hci_controller.state == HCI_STATE_OPEN && !hci_controller.scan_session);
+	CHECK(hci_LE_scan_session_read(&session, &batch, NULL, 100) < 0);
+
+	// The controller is free again, for a one-shot scan as well as for a new session :
+	rssi = hci_LE_get_RSSI(NULL, &hci_controller, NULL, NULL, 10, 0x00, 0x10, 0x10, 0x00, 0x00);
+	CHECK(rssi != NULL);
+	free(rssi);
+	CHECK(!sim_scanning(sim));
+	CHECK(hci_LE_start_scan_session(&other, &hci_controller, 0x01, 0x20, 0x10, 0x00, 0x00) == 0);
+	CHECK(hci_LE_scan_session_read(&other, &batch, NULL, 1000) > 0);
+	CHECK(hci_LE_stop_scan_session(&other) == 0);
+
+	hci_report_batch_destroy(&batch);
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_scan_session");
+}
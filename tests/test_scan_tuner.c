@@ -0,0 +1,143 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks that a scan tuner adapts the scan parameters of a session to the report rates
+   of a simulated adapter, whose rates follow the duty cycle of the scan.
+   Usage : ./test_scan_tuner
+*/
+
+#include "hci_controller.h"
+#include "hci_scan_tuner.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEVICES 20
+#define TARGET_RATE 10.0
+#define SLOT_DURATION 100
+
+/* Feeds a tuner with the batches of its session until its scan interval is moved in the
+   given direction (or its scan type changes if direction is 0), or for at most the given
+   duration (in s). Returns 1 if the scan was re-programmed that way.
+*/
+static char tune(hci_scan_tuner_t *tuner, hci_report_batch_t *batch, int8_t direction, time_t duration) {
+	hci_scan_session_t *session = tuner->session;
+	uint16_t interval = session->scan_interval;
+	uint8_t type = session->scan_type;
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		hci_LE_scan_session_drain(session, batch, 50);
+		if (hci_scan_tuner_feed(tuner, batch) < 0) {
+			return 0;
+		}
+		if ((direction < 0 && session->scan_interval < interval) ||
+		    (direction > 0 && session->scan_interval > interval) ||
+		    (!direction && session->scan_type != type)) {
+			return 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (now.tv_sec - start.tv_sec < duration);
+	return 0;
+}
+
+/* Checks that the simulator runs the scan the session is supposed to run.
+*/
+static char sim_follows(hci_sim_t *sim, const hci_scan_session_t *session) {
+	pthread_mutex_lock(&(sim->mutex));
+	char follows = sim->scan_enabled && sim->scan_type == session->scan_type &&
+		sim->scan_interval == session->scan_interval && sim->scan_window == session->scan_window;
+	pthread_mutex_unlock(&(sim->mutex));
+	return follows;
+}
+
+/* Runs a tuned session on a new simulator, starting with the given parameters.
+*/
+static void run(uint32_t reports_per_second, uint16_t interval, uint16_t window,
+		int8_t direction, uint8_t expected_type) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = DEVICES;
+	config.reports_per_second = reports_per_second;
+	config.duty_cycle = 1;
+	hci_sim_t *sim = hci_sim_create(&config);
+	CHECK(sim);
+	if (!sim) {
+		return;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		CHECK(0);
+		hci_sim_destroy(sim);
+		return;
+	}
+	hci_scan_session_t session;
+	hci_scan_tuner_t tuner;
+	hci_report_batch_t batch;
+	CHECK(hci_report_batch_init(&batch, 256) == 0);
+	CHECK(hci_LE_start_scan_session(&session, &hci_controller, 0x00, interval, window, 0x00, 0x00) == 0);
+	CHECK(hci_scan_tuner_init(&tuner, &session, 0.0, SLOT_DURATION) < 0);
+	CHECK(hci_scan_tuner_init(&tuner, &session, TARGET_RATE, SLOT_DURATION) == 0);
+	for (uint32_t i = 0; i < DEVICES; i++) {
+		bt_address_t mac = hci_sim_device_address(sim, i);
+		CHECK(hci_scan_tuner_track(&tuner, &mac) == 0);
+	}
+	CHECK(hci_scan_tuner_track(&tuner, &(tuner.devices[0].mac)) == 0); // Already tracked
+	CHECK(tuner.nb_devices == DEVICES);
+
+	CHECK(tune(&tuner, &batch, direction, 10));
+	CHECK(tuner.stats.reconfigurations >= 1);
+	CHECK(tuner.stats.in_range == DEVICES);
+	CHECK(session.scan_type == expected_type);
+	CHECK(session.scan_window == window); // Only the interval changes
+	CHECK(session.scan_interval >= HCI_SCAN_TUNER_MIN_INTERVAL &&
+	      session.scan_interval <= HCI_SCAN_TUNER_MAX_INTERVAL);
+	CHECK(sim_follows(sim, &session));
+	CHECK(hci_controller.state == HCI_STATE_SCANNING);
+
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+	hci_report_batch_destroy(&batch);
+	hci_close_controller(&hci_controller);
+	hci_sim_destroy(sim);
+}
+
+int main(void) {
+	// A tuner needs an active session :
+	hci_scan_tuner_t tuner;
+	hci_scan_session_t session = {0};
+	CHECK(hci_scan_tuner_init(&tuner, &session, TARGET_RATE, SLOT_DURATION) < 0);
+
+	// Devices heard too rarely with a low duty cycle : the scan interval is shortened :
+	run(2000, 0x0400, 0x0010, -1, 0x00);
+
+	// Devices heard far more than needed : the scan interval is lengthened :
+	run(2000, 0x0010, 0x0010, 1, 0x00);
+
+	// Devices heard too rarely with a continuous scan : the tuner switches to active scanning :
+	run(40, 0x0010, 0x0010, 0, 0x01);
+
+	bt_destroy_device_table();
+	return CHECK_RESULT("test_scan_tuner");
+}
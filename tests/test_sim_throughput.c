@@ -0,0 +1,128 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Measures the advertising reports throughput of the library by scanning with
+   a simulated adapter (no physical adapter needed), and checks that every generated
+   report was received.
+   Usage : ./test_sim_throughput [reports/s] [devices] [duration (s)] [reports/event]
+*/
+
+#include "hci_controller.h"
+#include "hci_socket.h"
+#include "hci_sim.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define QUEUE_SIZE (4 * 1024 * 1024)
+
+int main(int argc, char **argv) {
+	hci_sim_config_t config = hci_sim_default_config();
+	uint32_t duration = 5;
+
+	config.reports_per_second = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100000;
+	config.num_devices = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000;
+	duration = (argc > 3) ? strtoul(argv[3], NULL, 10) : duration;
+	config.reports_per_event = (argc > 4) ? strtoul(argv[4], NULL, 10) : 4;
+
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+
+	// Commands answered by the simulator :
+	uint8_t size = 0;
+	uint64_t states = 0;
+	bt_device_t device = bt_device_create(hci_sim_device_address(sim, 0), PUBLIC_DEVICE_ADDRESS, NULL, "SIM_DEVICE");
+	if (hci_LE_clear_white_list(NULL, &hci_controller) < 0 ||
+	    hci_LE_add_white_list(NULL, &hci_controller, device) < 0 ||
+	    hci_LE_get_white_list_size(NULL, &hci_controller, &size) < 0 ||
+	    hci_LE_read_supported_states(NULL, &hci_controller, &states) < 0 ||
+	    hci_compute_device_name(NULL, &hci_controller, &device) < 0) {
+		fprintf(stderr, "Simulated command failed.\n");
+		return EXIT_FAILURE;
+	}
+	fprintf(stderr, "White list size : %u, states : 0x%llX, name of %s : %s\n", size,
+		(unsigned long long)states, device.custom_name, device.real_name);
+
+	hci_scan_session_t session;
+	if (hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00, 0x00) < 0) {
+		fprintf(stderr, "Unable to start the scan.\n");
+		return EXIT_FAILURE;
+	}
+	// A large reception queue absorbs the bursts the reader can't keep up with :
+	if (set_hci_socket_receive_buffer(&(session.hci_socket), QUEUE_SIZE) < QUEUE_SIZE) {
+		fprintf(stderr, "Unable to size the reception queue.\n");
+	}
+
+	hci_report_batch_t batch;
+	hci_report_batch_init(&batch, HCI_REPORT_DEFAULT_CAPACITY);
+	uint64_t received = 0;
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		int16_t n = hci_LE_scan_session_read(&session, &batch, NULL, 1000);
+		if (n < 0) {
+			fprintf(stderr, "Read error.\n");
+			break;
+		}
+		received += n;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((uint32_t)(now.tv_sec - start.tv_sec) < duration);
+	double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+	/* The adapter stops generating reports (the fault is cleared when the scan is
+	   disabled), and the reports still queued on the socket are read :
+	*/
+	hci_sim_set_fault(sim, HCI_SIM_FAULT_SCAN_STALLED);
+	int16_t n;
+	while ((n = hci_LE_scan_session_drain(&session, &batch, 100)) > 0) {
+		received += n;
+	}
+
+	hci_LE_stop_scan_session(&session);
+	hci_report_batch_destroy(&batch);
+
+	hci_sim_stats_t stats;
+	hci_sim_get_stats(sim, &stats);
+	fprintf(stderr, "Generated : %llu reports | received : %llu reports (%.0f reports/s) | dropped events : %llu\n",
+		(unsigned long long)stats.reports, (unsigned long long)received, received / elapsed,
+		(unsigned long long)stats.dropped_events);
+
+	hci_close_controller(&hci_controller);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	if (received == 0 || received != stats.reports) {
+		fprintf(stderr, "test_sim_throughput : %llu report(s) lost.\n",
+			(unsigned long long)(stats.reports - received));
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
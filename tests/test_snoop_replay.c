@@ -0,0 +1,133 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Records a scan on a simulated adapter into a btsnoop capture, then replays the
+   capture and checks that the same reports are received again, in the same order.
+   Usage : ./test_snoop_replay
+*/
+
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "hci_snoop.h"
+#include "hci_replay.h"
+#include "test_check.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SCANNED_REPORTS 300
+
+typedef struct scanned_report_t {
+	bt_address_t mac;
+	int8_t rssi;
+} scanned_report_t;
+
+/* Scans with the given transport until SCANNED_REPORTS reports are received. */
+static uint16_t scan(const hci_transport_t *transport, void *transport_data, scanned_report_t *reports) {
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, transport, transport_data, NULL, "SIM_TEST") < 0) {
+		return 0;
+	}
+	hci_scan_session_t session;
+	hci_report_batch_t batch;
+	uint16_t received = 0;
+	hci_report_batch_init(&batch, 32);
+	if (hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00, 0x00) == 0) {
+		while (received < SCANNED_REPORTS && hci_LE_scan_session_read(&session, &batch, NULL, 1000) > 0) {
+			for (uint16_t i = 0; i < batch.length && received < SCANNED_REPORTS; i++) {
+				reports[received].mac = batch.reports[i].mac;
+				reports[received].rssi = batch.reports[i].rssi;
+				received++;
+			}
+		}
+		hci_LE_stop_scan_session(&session);
+	}
+	hci_report_batch_destroy(&batch);
+	hci_close_controller(&hci_controller);
+	return received;
+}
+
+int main(void) {
+	char path[] = "/tmp/test_snoop_replay_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	// Recording :
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = 50;
+	config.reports_per_second = 5000;
+	hci_sim_t *sim = hci_sim_create(&config);
+	hci_snoop_t *snoop = hci_snoop_open(path, &hci_sim_transport, sim);
+	CHECK(sim && snoop);
+	if (!sim || !snoop) {
+		return EXIT_FAILURE;
+	}
+	static scanned_report_t recorded[SCANNED_REPORTS], replayed[SCANNED_REPORTS];
+	CHECK(scan(&hci_snoop_transport, snoop, recorded) == SCANNED_REPORTS);
+	CHECK(snoop->records > SCANNED_REPORTS / config.reports_per_event && !snoop->drops);
+	hci_snoop_close(snoop);
+	hci_sim_destroy(sim);
+
+	// The capture is a btsnoop file of the H4 datalink :
+	uint8_t header[16];
+	fd = open(path, O_RDONLY);
+	CHECK(fd >= 0 && read(fd, header, sizeof(header)) == sizeof(header));
+	close(fd);
+	CHECK(memcmp(header, HCI_SNOOP_ID, sizeof(HCI_SNOOP_ID)) == 0);
+	CHECK(header[11] == HCI_SNOOP_VERSION);
+	CHECK(((header[14] << 8) | header[15]) == HCI_SNOOP_DATALINK_H4);
+
+	// Replaying, at the original pace and as fast as possible :
+	double speeds[] = {1.0, HCI_REPLAY_AS_FAST_AS_POSSIBLE};
+	for (int k = 0; k < 2; k++) {
+		hci_replay_t *replay = hci_replay_open(path, speeds[k]);
+		CHECK(replay != NULL);
+		if (!replay) {
+			continue;
+		}
+		memset(replayed, 0, sizeof(replayed));
+		CHECK(scan(&hci_replay_transport, replay, replayed) == SCANNED_REPORTS);
+		uint16_t differences = 0;
+		for (uint16_t i = 0; i < SCANNED_REPORTS; i++) {
+			if (!bt_compare_addresses(&(recorded[i].mac), &(replayed[i].mac)) ||
+			    recorded[i].rssi != replayed[i].rssi) {
+				differences++;
+			}
+		}
+		CHECK(differences == 0);
+		hci_replay_stats_t stats;
+		hci_replay_get_stats(replay, &stats);
+		CHECK(stats.commands > 0 && stats.unmatched_commands == 0);
+		CHECK(stats.events >= SCANNED_REPORTS / config.reports_per_event);
+		hci_replay_close(replay);
+	}
+
+	unlink(path);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_snoop_replay");
+}
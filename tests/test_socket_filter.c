@@ -0,0 +1,97 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the filters recorded in the sockets against a simulated adapter : the filters
+   are only installed when they change, and a used socket can still be closed.
+   Usage : ./test_socket_filter
+*/
+
+#include "hci_controller.h"
+#include "hci_socket.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static hci_transport_t counting_transport;
+static int installed_filters = 0;
+
+static int counting_set_filter(hci_socket_t *hci_socket, const struct hci_filter *flt) {
+	installed_filters++;
+	return hci_sim_transport.set_filter(hci_socket, flt);
+}
+
+int main(void) {
+	hci_sim_t *sim = hci_sim_create(NULL);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	counting_transport = hci_sim_transport;
+	counting_transport.set_filter = counting_set_filter;
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &counting_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+
+	hci_socket_t hci_socket = hci_open_socket_controller(&hci_controller);
+	CHECK(hci_socket.sock >= 0);
+	struct hci_filter flt, installed;
+	const struct hci_filter *inquiry = hci_filter_profile(HCI_FILTER_PROFILE_INQUIRY);
+	const struct hci_filter *le_scan = hci_filter_profile(HCI_FILTER_PROFILE_LE_SCAN);
+	CHECK(inquiry && le_scan);
+
+	// A filter is only installed once :
+	installed_filters = 0;
+	CHECK(apply_hci_socket_filter(&hci_socket, inquiry) == 0);
+	CHECK(apply_hci_socket_filter(&hci_socket, inquiry) == 0);
+	CHECK(apply_hci_socket_filter_profile(&hci_socket, HCI_FILTER_PROFILE_INQUIRY) == 0);
+	CHECK(installed_filters == 1);
+	CHECK(get_hci_socket_cached_filter(&hci_socket, &flt) == 0);
+	CHECK(memcmp(&flt, inquiry, sizeof(flt)) == 0);
+
+	// A filter set without the cache is recorded, so the next one is really installed :
+	flt = *le_scan;
+	CHECK(set_hci_socket_filter(&hci_socket, &flt) == 0);
+	CHECK(installed_filters == 2);
+	CHECK(apply_hci_socket_filter(&hci_socket, inquiry) == 0);
+	CHECK(installed_filters == 3);
+	CHECK(hci_sim_transport.get_filter(&hci_socket, &installed) == 0);
+	CHECK(memcmp(&installed, inquiry, sizeof(installed)) == 0);
+
+	// A forgotten filter is installed again :
+	forget_hci_socket_filter(&hci_socket);
+	CHECK(apply_hci_socket_filter(&hci_socket, inquiry) == 0);
+	CHECK(installed_filters == 4);
+
+	// The socket, whose filter, timestamp and statistics changed, can still be closed :
+	CHECK(hci_LE_clear_white_list(&hci_socket, &hci_controller) == 0);
+	CHECK(hci_close_socket_controller(&hci_controller, &hci_socket) == 0);
+	CHECK(hci_close_socket_controller(&hci_controller, &hci_socket) < 0);
+
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_socket_filter");
+}
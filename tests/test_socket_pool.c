@@ -0,0 +1,128 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the socket pools against a simulated adapter : exhaustion, exclusive use of
+   the sockets by concurrent threads, and the fallback of the controllers whose pool
+   is exhausted.
+   Usage : ./test_socket_pool
+*/
+
+#include "hci_controller.h"
+#include "hci_socket_pool.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 8
+#define ROUNDS 100000
+
+static hci_socket_pool_t pool;
+static int users[HCI_SOCKET_POOL_MAX_SIZE]; // Threads using each socket of the pool
+
+static void *pool_routine(void *data) {
+	long conflicts = 0;
+	(void)data;
+	for (int i = 0; i < ROUNDS; i++) {
+		hci_socket_t *hci_socket = hci_socket_pool_acquire(&pool);
+		if (!hci_socket) {
+			continue; // Every socket is taken by the other threads.
+		}
+		int index = hci_socket - pool.sockets;
+		if (__atomic_add_fetch(&users[index], 1, __ATOMIC_ACQ_REL) != 1) {
+			conflicts++;
+		}
+		__atomic_sub_fetch(&users[index], 1, __ATOMIC_ACQ_REL);
+		hci_socket_pool_release(&pool, hci_socket);
+	}
+	return (void *)conflicts;
+}
+
+int main(void) {
+	hci_sim_t *sim = hci_sim_create(NULL);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	bt_address_t mac = sim->config.address; // Address of the adapter
+
+	// Every socket is handed out once, until it is released :
+	CHECK(hci_socket_pool_init(&pool, &hci_sim_transport, sim, &mac, 4) == 4);
+	hci_socket_t *taken[4];
+	for (int i = 0; i < 4; i++) {
+		taken[i] = hci_socket_pool_acquire(&pool);
+		CHECK(taken[i] && taken[i]->sock >= 0 && hci_socket_pool_owns(&pool, taken[i]));
+		for (int j = 0; j < i; j++) {
+			CHECK(taken[i] != taken[j]);
+		}
+	}
+	CHECK(hci_socket_pool_acquire(&pool) == NULL);
+	hci_socket_pool_release(&pool, taken[2]);
+	CHECK(hci_socket_pool_acquire(&pool) == taken[2]);
+	CHECK(hci_socket_pool_acquire(&pool) == NULL);
+	hci_socket_t other;
+	CHECK(!hci_socket_pool_owns(&pool, &other));
+	for (int i = 0; i < 4; i++) {
+		hci_socket_pool_release(&pool, taken[i]);
+	}
+
+	// Concurrent threads never get the same socket :
+	pthread_t threads[THREADS];
+	for (int i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, pool_routine, NULL);
+	}
+	for (int i = 0; i < THREADS; i++) {
+		void *conflicts = NULL;
+		pthread_join(threads[i], &conflicts);
+		CHECK(conflicts == NULL);
+	}
+	for (int i = 0; i < 4; i++) {
+		CHECK(hci_socket_pool_acquire(&pool) != NULL);
+	}
+	CHECK(hci_socket_pool_acquire(&pool) == NULL);
+	hci_socket_pool_close(&pool);
+
+	// A controller whose pool is exhausted opens a socket for the call :
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	hci_socket_t *pooled[HCI_CONTROLLER_SOCKET_POOL_SIZE];
+	for (int i = 0; i < HCI_CONTROLLER_SOCKET_POOL_SIZE; i++) {
+		pooled[i] = hci_socket_pool_acquire(&(hci_controller.socket_pool));
+		CHECK(pooled[i] != NULL);
+	}
+	CHECK(hci_socket_pool_acquire(&(hci_controller.socket_pool)) == NULL);
+	CHECK(hci_LE_clear_white_list(NULL, &hci_controller) == 0);
+	for (int i = 0; i < HCI_CONTROLLER_SOCKET_POOL_SIZE; i++) {
+		hci_socket_pool_release(&(hci_controller.socket_pool), pooled[i]);
+	}
+	CHECK(hci_LE_clear_white_list(NULL, &hci_controller) == 0);
+
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_socket_pool");
+}
@@ -0,0 +1,97 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the counters of a scan session's socket against a simulated adapter : the
+   size of its reception queue is set through the transport, and the events the adapter
+   couldn't deliver are counted as dropped.
+   Usage : ./test_socket_stats
+*/
+
+#include "hci_controller.h"
+#include "hci_socket.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define QUEUE_SIZE 8192
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.reports_per_second = 200000;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+
+	hci_scan_session_t session;
+	hci_report_batch_t batch;
+	hci_socket_stats_t stats;
+	hci_sim_stats_t sim_stats;
+	CHECK(hci_report_batch_init(&batch, 1000) == 0);
+	CHECK(hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00, 0x00) == 0);
+
+	// The queue is sized by the simulator, at least to the given size :
+	int32_t size = set_hci_socket_receive_buffer(&(session.hci_socket), QUEUE_SIZE);
+	CHECK(size >= QUEUE_SIZE);
+	CHECK(set_hci_socket_receive_buffer(&(session.hci_socket), 0) == size);
+
+	// The reports aren't read meanwhile, so that the queue overflows :
+	usleep(200000);
+	hci_sim_set_fault(sim, HCI_SIM_FAULT_SCAN_STALLED);
+	CHECK(get_hci_socket_stats(&(session.hci_socket), &stats) == 0);
+	hci_sim_get_stats(sim, &sim_stats);
+	CHECK(stats.dropped > 0);
+	CHECK(stats.dropped == sim_stats.dropped_events);
+
+	// The queued reports are delivered, none is lost :
+	uint64_t received = 0;
+	int16_t n;
+	while ((n = hci_LE_scan_session_drain(&session, &batch, 100)) > 0) {
+		received += n;
+	}
+	CHECK(n == 0);
+	CHECK(get_hci_socket_stats(&(session.hci_socket), &stats) == 0);
+	CHECK(received > 0);
+	CHECK(stats.delivered == received);
+	CHECK(stats.events > 0 && stats.events <= sim_stats.events);
+	CHECK(stats.overflowed == 0 && stats.truncated == 0);
+
+	// The counters start again from 0 :
+	reset_hci_socket_stats(&(session.hci_socket));
+	CHECK(get_hci_socket_stats(&(session.hci_socket), &stats) == 0);
+	CHECK(stats.events == 0 && stats.dropped == 0 && stats.delivered == 0);
+
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+	hci_report_batch_destroy(&batch);
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_socket_stats");
+}
@@ -0,0 +1,112 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the reception times of the events read from a simulated adapter : they are
+   given by the kernel when the events are queued, not when they are read.
+   Usage : ./test_timestamps
+*/
+
+#include "hci_controller.h"
+#include "hci_socket.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DELAY 200 // Time (in ms) the events wait before being read
+
+static double to_ms(const struct timespec *t) {
+	return t->tv_sec * 1e3 + t->tv_nsec / 1e6;
+}
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = 30;
+	config.reports_per_second = 1000;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	struct timespec sent, before_read, after_read;
+
+	// The completion of a command is stamped when the adapter sends it :
+	hci_socket_t hci_socket = open_hci_socket_transport(&hci_sim_transport, sim, &(config.address));
+	CHECK(hci_socket.sock >= 0);
+	struct hci_filter filter;
+	hci_filter_clear(&filter);
+	hci_filter_set_ptype(HCI_EVENT_PKT, &filter);
+	hci_filter_set_event(EVT_CMD_COMPLETE, &filter);
+	CHECK(set_hci_socket_filter(&hci_socket, &filter) == 0);
+	clock_gettime(CLOCK_REALTIME, &sent);
+	CHECK(send_hci_socket_cmd(&hci_socket, OGF_INFO_PARAM, OCF_READ_LOCAL_VERSION, 0, NULL) == 0);
+	usleep(DELAY * 1000);
+	clock_gettime(CLOCK_REALTIME, &before_read);
+	uint8_t buf[HCI_MAX_EVENT_SIZE];
+	CHECK(read_hci_socket(&hci_socket, buf, sizeof(buf)) > 0);
+	CHECK(buf[0] == HCI_EVENT_PKT && buf[1] == EVT_CMD_COMPLETE);
+	CHECK(to_ms(&(hci_socket.timestamp)) >= to_ms(&sent));
+	CHECK(to_ms(&(hci_socket.timestamp)) < to_ms(&before_read) - DELAY / 2);
+	close_hci_socket(&hci_socket);
+
+	// The reports of a scan session keep the reception times of their events :
+	hci_scan_session_t session;
+	hci_report_batch_t batch;
+	CHECK(hci_report_batch_init(&batch, 1024) == 0);
+	CHECK(hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00, 0x00) == 0);
+	hci_LE_scan_session_drain(&session, &batch, 0);
+	clock_gettime(CLOCK_REALTIME, &sent);
+	usleep(DELAY * 1000);
+	clock_gettime(CLOCK_REALTIME, &before_read);
+	int16_t n = hci_LE_scan_session_drain(&session, &batch, 0);
+	clock_gettime(CLOCK_REALTIME, &after_read);
+	CHECK(n > 10);
+	if (n > 10) {
+		// Spread over the delay, in order, and all before the reading :
+		double first = to_ms(&(batch.reports[0].timestamp));
+		double last = to_ms(&(batch.reports[n - 1].timestamp));
+		CHECK(first >= to_ms(&sent) - DELAY / 2);
+		CHECK(last <= to_ms(&after_read));
+		CHECK(last - first > DELAY / 2);
+		CHECK(first < to_ms(&before_read) - DELAY / 2);
+		char ordered = 1;
+		for (int16_t i = 1; i < n; i++) {
+			if (to_ms(&(batch.reports[i].timestamp)) < to_ms(&(batch.reports[i - 1].timestamp))) {
+				ordered = 0;
+			}
+		}
+		CHECK(ordered);
+	}
+
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+	hci_report_batch_destroy(&batch);
+	hci_close_controller(&hci_controller);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+	return CHECK_RESULT("test_timestamps");
+}
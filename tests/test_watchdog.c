@@ -0,0 +1,217 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks that a watchdog recovers a simulated adapter from each of its faults, escalating
+   from disabling the scan to an HCI reset and to a restart, and programs the white list
+   and the scan of the session again. The interruptions and the stuck states are checked
+   too.
+   Usage : ./test_watchdog
+*/
+
+#include "hci_controller.h"
+#include "hci_sim.h"
+#include "hci_watchdog.h"
+#include "hci_white_list.h"
+#include "test_check.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LISTED 3
+
+/* Waits (at most timeout ms) for the given condition to hold.
+*/
+#define WAIT_FOR(condition, timeout)							\
+	for (uint32_t _waited = 0; !(condition) && _waited < (timeout); _waited += 20)	\
+		usleep(20000)
+
+static hci_scan_session_t session;
+static volatile char reading = 1;
+static uint64_t reports = 0;
+
+static void *read_routine(void *arg) {
+	(void)arg;
+	hci_report_batch_t batch;
+	if (hci_report_batch_init(&batch, 64) < 0) {
+		return NULL;
+	}
+	while (reading) {
+		int16_t n = hci_LE_scan_session_read(&session, &batch, NULL, 50);
+		if (n > 0) {
+			__atomic_add_fetch(&reports, n, __ATOMIC_RELAXED);
+		}
+	}
+	hci_report_batch_destroy(&batch);
+	return NULL;
+}
+
+/* Checks that the reports of the session arrive.
+*/
+static char reports_arrive(void) {
+	uint64_t before = __atomic_load_n(&reports, __ATOMIC_RELAXED);
+	WAIT_FOR(__atomic_load_n(&reports, __ATOMIC_RELAXED) > before + 10, 1000);
+	return __atomic_load_n(&reports, __ATOMIC_RELAXED) > before + 10;
+}
+
+/* Checks that the simulator scans with the white list of the session.
+*/
+static char sim_restored(hci_sim_t *sim) {
+	pthread_mutex_lock(&(sim->mutex));
+	char restored = sim->scan_enabled && sim->white_list_length == LISTED;
+	pthread_mutex_unlock(&(sim->mutex));
+	return restored;
+}
+
+static void *resolve_routine(void *arg) {
+	return (void *)(intptr_t)hci_resolve_interruption(NULL, arg);
+}
+
+static hci_watchdog_stats_t get_stats(hci_watchdog_t *watchdog) {
+	hci_watchdog_stats_t stats;
+	hci_watchdog_get_stats(watchdog, &stats);
+	return stats;
+}
+
+static hci_sim_stats_t get_sim_stats(hci_sim_t *sim) {
+	hci_sim_stats_t stats;
+	hci_sim_get_stats(sim, &stats);
+	return stats;
+}
+
+int main(void) {
+	hci_sim_t *sim = hci_sim_create(NULL);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+	hci_white_list_t white_list;
+	CHECK(hci_white_list_init(&white_list, &hci_controller) == 0);
+	bt_device_t devices[LISTED];
+	for (uint32_t i = 0; i < LISTED; i++) {
+		devices[i] = bt_device_create(hci_sim_device_address(sim, i * 7), PUBLIC_DEVICE_ADDRESS,
+					      "SIM", "SIM");
+	}
+	CHECK(hci_white_list_sync(&white_list, devices, LISTED) >= 0);
+
+	// One watchdog per controller :
+	hci_watchdog_t watchdog, other;
+	hci_watchdog_config_t config = hci_watchdog_default_config();
+	config.period = 50;
+	config.probe_timeout = 30;
+	config.stall_time = 250;
+	config.stuck_time = 300;
+	CHECK(hci_watchdog_start(&watchdog, &hci_controller, &config) == 0);
+	CHECK(hci_controller.watchdog == &watchdog);
+	CHECK(hci_watchdog_start(&other, &hci_controller, &config) < 0);
+
+	CHECK(hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x0010, 0x0010, 0x00,
+					hci_white_list_scan_filter_policy(&white_list)) == 0);
+	pthread_t reader;
+	pthread_create(&reader, NULL, read_routine, NULL);
+	CHECK(reports_arrive());
+	CHECK(get_stats(&watchdog).checks > 0);
+	CHECK(get_stats(&watchdog).missed_probes == 0);
+
+	// A stalled scan is disabled and enabled again :
+	hci_sim_set_fault(sim, HCI_SIM_FAULT_SCAN_STALLED);
+	WAIT_FOR(get_stats(&watchdog).recoveries[HCI_WATCHDOG_LEVEL_SCAN_DISABLE] == 1, 2000);
+	CHECK(get_stats(&watchdog).recoveries[HCI_WATCHDOG_LEVEL_SCAN_DISABLE] == 1);
+	CHECK(reports_arrive());
+	CHECK(sim_restored(sim));
+	CHECK(get_sim_stats(sim).resets == 0);
+
+	// An adapter which stops answering is reset, and its white list programmed again :
+	hci_sim_set_fault(sim, HCI_SIM_FAULT_UNRESPONSIVE);
+	WAIT_FOR(get_stats(&watchdog).recoveries[HCI_WATCHDOG_LEVEL_RESET] == 1, 3000);
+	CHECK(get_stats(&watchdog).recoveries[HCI_WATCHDOG_LEVEL_RESET] == 1);
+	CHECK(get_stats(&watchdog).missed_probes >= config.max_missed);
+	CHECK(get_sim_stats(sim).resets == 1);
+	CHECK(reports_arrive());
+	CHECK(sim_restored(sim));
+
+	// An adapter which doesn't even answer a reset is restarted :
+	hci_sim_set_fault(sim, HCI_SIM_FAULT_HUNG);
+	WAIT_FOR(get_stats(&watchdog).recoveries[HCI_WATCHDOG_LEVEL_RESTART] == 1, 4000);
+	CHECK(get_stats(&watchdog).recoveries[HCI_WATCHDOG_LEVEL_RESTART] == 1);
+	CHECK(get_sim_stats(sim).restarts == 1);
+	CHECK(reports_arrive());
+	CHECK(sim_restored(sim));
+	CHECK(get_stats(&watchdog).failures == 0);
+	CHECK(hci_controller.state == HCI_STATE_SCANNING);
+
+	// A session which couldn't be stopped leaves an interruption, resolved by the watchdog :
+	reading = 0;
+	pthread_join(reader, NULL);
+	hci_sim_set_fault(sim, HCI_SIM_FAULT_UNRESPONSIVE);
+	CHECK(hci_LE_stop_scan_session(&session) < 0);
+	WAIT_FOR(!__atomic_load_n(&(hci_controller.interrupted), __ATOMIC_ACQUIRE) &&
+		 hci_controller.state == HCI_STATE_OPEN, 4000);
+	CHECK(!__atomic_load_n(&(hci_controller.interrupted), __ATOMIC_ACQUIRE) &&
+	      hci_controller.state == HCI_STATE_OPEN);
+	pthread_mutex_lock(&(sim->mutex));
+	CHECK(!sim->scan_enabled);
+	pthread_mutex_unlock(&(sim->mutex));
+
+	// A stuck state is reported but left to its owner until it gives up :
+	uint64_t resolved = get_stats(&watchdog).recoveries[HCI_WATCHDOG_LEVEL_NONE];
+	__atomic_store_n(&(hci_controller.state), HCI_STATE_WRITING, __ATOMIC_RELEASE);
+	WAIT_FOR(get_stats(&watchdog).stuck_states > 0, 2000);
+	CHECK(get_stats(&watchdog).stuck_states > 0);
+	CHECK(hci_controller.state == HCI_STATE_WRITING);
+	__atomic_store_n(&(hci_controller.interrupted), 1, __ATOMIC_RELEASE);
+	WAIT_FOR(hci_controller.state == HCI_STATE_OPEN, 2000);
+	CHECK(hci_controller.state == HCI_STATE_OPEN);
+	WAIT_FOR(get_stats(&watchdog).recoveries[HCI_WATCHDOG_LEVEL_NONE] > resolved, 1000);
+	CHECK(get_stats(&watchdog).recoveries[HCI_WATCHDOG_LEVEL_NONE] > resolved);
+	CHECK(!__atomic_load_n(&(hci_controller.interrupted), __ATOMIC_ACQUIRE));
+	CHECK(get_stats(&watchdog).failures == 0);
+
+	// Concurrent resolutions (the watchdog's included) wait for each other and all succeed :
+	pthread_t resolvers[4];
+	__atomic_store_n(&(hci_controller.state), HCI_STATE_READING, __ATOMIC_RELEASE);
+	__atomic_store_n(&(hci_controller.interrupted), 1, __ATOMIC_RELEASE);
+	for (uint8_t i = 0; i < 4; i++) {
+		pthread_create(&resolvers[i], NULL, resolve_routine, &hci_controller);
+	}
+	for (uint8_t i = 0; i < 4; i++) {
+		void *res;
+		pthread_join(resolvers[i], &res);
+		CHECK((intptr_t)res == 0);
+	}
+	CHECK(hci_controller.state == HCI_STATE_OPEN);
+	CHECK(!hci_controller.interrupted && !hci_controller.restoring);
+
+	// Closing the controller stops its watchdog :
+	hci_white_list_destroy(&white_list);
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	CHECK(hci_controller.watchdog == NULL);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+	return CHECK_RESULT("test_watchdog");
+}
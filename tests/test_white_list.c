@@ -0,0 +1,114 @@
+/* The MIT License (MIT)
+ * Copyright (c) 2016 Thomas Bertauld <thomas.bertauld@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Checks the white list manager against a simulated adapter : incremental updates,
+   host filtering of the lists which don't fit, refusal while scanning and restoration
+   after a reset.
+   Usage : ./test_white_list
+*/
+
+#include "hci_controller.h"
+#include "hci_white_list.h"
+#include "hci_sim.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_DEVICES 20
+
+int main(void) {
+	hci_sim_config_t config = hci_sim_default_config();
+	config.num_devices = NB_DEVICES;
+	config.white_list_size = 8;
+	hci_sim_t *sim = hci_sim_create(&config);
+	if (!sim) {
+		return EXIT_FAILURE;
+	}
+	hci_controller_t hci_controller;
+	if (hci_controller_init(&hci_controller, &hci_sim_transport, sim, NULL, "SIM_TEST") < 0) {
+		fprintf(stderr, "Unable to open the simulated controller.\n");
+		return EXIT_FAILURE;
+	}
+
+	bt_device_t devices[NB_DEVICES];
+	memset(devices, 0, sizeof(devices));
+	for (int i = 0; i < NB_DEVICES; i++) {
+		devices[i].mac = hci_sim_device_address(sim, i);
+		devices[i].add_type = PUBLIC_DEVICE_ADDRESS;
+	}
+	bt_address_t outsider = hci_sim_device_address(sim, NB_DEVICES - 1);
+
+	hci_white_list_t white_list;
+	CHECK(hci_white_list_init(&white_list, &hci_controller) == 0);
+	CHECK(white_list.capacity == 8);
+	CHECK(sim->white_list_length == 0);
+
+	CHECK(hci_white_list_sync(&white_list, devices, 4) == 4);
+	CHECK(sim->white_list_length == 4);
+	CHECK(hci_white_list_scan_filter_policy(&white_list) == 0x01);
+	CHECK(hci_white_list_accept(&white_list, &(devices[0].mac)));
+	CHECK(!hci_white_list_accept(&white_list, &outsider));
+
+	// Only the differences are sent : 2 devices removed, 2 added.
+	CHECK(hci_white_list_sync(&white_list, devices + 2, 4) == 4);
+	CHECK(sim->white_list_length == 4 && white_list.shadow_length == 4);
+	CHECK(!hci_white_list_accept(&white_list, &(devices[0].mac)));
+	CHECK(hci_white_list_accept(&white_list, &(devices[5].mac)));
+	CHECK(hci_white_list_sync(&white_list, devices + 2, 4) == 0);
+
+	// Refused while scanning, the manager being left as it is :
+	hci_scan_session_t session;
+	CHECK(hci_LE_start_scan_session(&session, &hci_controller, 0x00, 0x10, 0x10, 0x00,
+					hci_white_list_scan_filter_policy(&white_list)) == 0);
+	CHECK(hci_white_list_sync(&white_list, devices, 2) < 0);
+	CHECK(white_list.length == 4 && hci_white_list_accept(&white_list, &(devices[5].mac)));
+	CHECK(hci_LE_stop_scan_session(&session) == 0);
+
+	// Too many devices : the controller's list is left as it is and the host filters.
+	CHECK(hci_white_list_sync(&white_list, devices, NB_DEVICES - 1) >= 0);
+	CHECK(white_list.host_filtering);
+	CHECK(hci_white_list_scan_filter_policy(&white_list) == 0x00);
+	CHECK(hci_white_list_accept(&white_list, &(devices[10].mac)));
+	CHECK(!hci_white_list_accept(&white_list, &outsider));
+	CHECK(sim->white_list_length == 4);
+
+	// The adapter loses its list on a reset, the shadow copy writes it back :
+	CHECK(hci_white_list_sync(&white_list, devices, 3) >= 0);
+	CHECK(!white_list.host_filtering && sim->white_list_length == 3);
+	CHECK(hci_reset_adapter(NULL, &hci_controller, 1000) == 0);
+	CHECK(sim->white_list_length == 0);
+	CHECK(hci_white_list_restore(&white_list) == 3);
+	CHECK(sim->white_list_length == 3);
+
+	// Every device is accepted without any device :
+	CHECK(hci_white_list_sync(&white_list, NULL, 0) >= 0);
+	CHECK(sim->white_list_length == 0);
+	CHECK(hci_white_list_accept(&white_list, &outsider));
+
+	hci_white_list_destroy(&white_list);
+	CHECK(hci_close_controller(&hci_controller) == 0);
+	hci_sim_destroy(sim);
+	bt_destroy_device_table();
+
+	return CHECK_RESULT("test_white_list");
+}